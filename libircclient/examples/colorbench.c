@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This example is free, and not covered by LGPL license. There is no
+ * restriction applied to their modification, redistribution, using and so on.
+ * You can study them, modify them, use them in your own program - either
+ * completely or partially. By using it you may give me some credits in your
+ * program, but you don't have to.
+ *
+ *
+ * This program measures the speed of the color conversion functions over a
+ * channel log, one message per line, as written by most IRC clients and
+ * loggers with the format codes kept. Run it as:
+ *
+ *   colorbench channel.log [rounds]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined (_WIN32)
+	#include <windows.h>
+#else
+	#include <sys/time.h>
+#endif
+
+#include "libircclient.h"
+
+
+static double now (void)
+{
+#if defined (_WIN32)
+	return GetTickCount() / 1000.0;
+#else
+	struct timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+#endif
+}
+
+
+static void report (const char * name, double elapsed, unsigned int lines, size_t bytes)
+{
+	printf ("%-36s %8.3f s %8.1f ns/line %8.1f MB/s\n", name, elapsed,
+		elapsed * 1e9 / lines, bytes / elapsed / 1e6);
+}
+
+
+int main (int argc, char ** argv)
+{
+	char ** lines = 0, * copy, * out, buf[4096];
+	size_t * lengths = 0, bytes = 0, maxlen = 0;
+	unsigned int count = 0, alloc = 0, colored = 0, rounds, i, r;
+	double start;
+	long check = 0;
+	FILE * fp;
+
+	if ( argc < 2 )
+	{
+		printf ("Usage: %s <channel log> [rounds]\n", argv[0]);
+		return 1;
+	}
+
+	if ( (fp = fopen (argv[1], "rb")) == 0 )
+	{
+		printf ("Could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	rounds = argc > 2 ? atoi (argv[2]) : 20;
+
+	// Load the whole log, so the disk is not measured
+	while ( fgets (buf, sizeof(buf), fp) )
+	{
+		size_t len = strcspn (buf, "\r\n");
+
+		if ( count == alloc )
+		{
+			alloc = alloc ? alloc * 2 : 4096;
+			lines = realloc (lines, alloc * sizeof(char *));
+			lengths = realloc (lengths, alloc * sizeof(size_t));
+
+			if ( !lines || !lengths )
+			{
+				printf ("Out of memory\n");
+				return 1;
+			}
+		}
+
+		buf[len] = '\0';
+		lines[count] = strdup (buf);
+		lengths[count] = len;
+		bytes += len;
+
+		if ( len > maxlen )
+			maxlen = len;
+
+		if ( strpbrk (buf, "\x02\x03\x04\x0F\x11\x16\x1D\x1E\x1F") )
+			colored++;
+
+		count++;
+	}
+
+	fclose (fp);
+
+	if ( count == 0 )
+	{
+		printf ("The log is empty\n");
+		return 1;
+	}
+
+	printf ("%u lines, %lu bytes, %u (%.1f%%) with format codes, %u rounds\n\n",
+		count, (unsigned long) bytes, colored, colored * 100.0 / count, rounds);
+
+	copy = malloc (maxlen + 1);
+	out = malloc (LIBIRC_COLOR_HTML_BOUND(maxlen));
+
+	if ( !copy || !out )
+	{
+		printf ("Out of memory\n");
+		return 1;
+	}
+
+	start = now();
+
+	for ( r = 0; r < rounds; r++ )
+		for ( i = 0; i < count; i++ )
+		{
+			char * stripped = irc_color_strip_from_mirc (lines[i]);
+			check += stripped[0];
+			free (stripped);
+		}
+
+	report ("irc_color_strip_from_mirc", now() - start, count * rounds, bytes * rounds);
+	start = now();
+
+	for ( r = 0; r < rounds; r++ )
+		for ( i = 0; i < count; i++ )
+			check += irc_color_strip_from_mirc_into (out, maxlen + 1, lines[i], lengths[i]);
+
+	report ("irc_color_strip_from_mirc_into", now() - start, count * rounds, bytes * rounds);
+	start = now();
+
+	// The copy is included, as the in-place strip changes the line
+	for ( r = 0; r < rounds; r++ )
+		for ( i = 0; i < count; i++ )
+		{
+			memcpy (copy, lines[i], lengths[i] + 1);
+			check += irc_color_strip_from_mirc_inplace (copy, lengths[i]);
+		}
+
+	report ("irc_color_strip_from_mirc_inplace", now() - start, count * rounds, bytes * rounds);
+	start = now();
+
+	for ( r = 0; r < rounds; r++ )
+		for ( i = 0; i < count; i++ )
+			check += irc_color_convert_from_mirc_into (out, LIBIRC_COLOR_BOUND(maxlen), lines[i], lengths[i]);
+
+	report ("irc_color_convert_from_mirc_into", now() - start, count * rounds, bytes * rounds);
+	start = now();
+
+	for ( r = 0; r < rounds; r++ )
+		for ( i = 0; i < count; i++ )
+			check += irc_color_render_into (LIBIRC_COLOR_TO_ANSI, out, LIBIRC_COLOR_BOUND(maxlen), lines[i], lengths[i]);
+
+	report ("irc_color_render_into (ANSI)", now() - start, count * rounds, bytes * rounds);
+	start = now();
+
+	for ( r = 0; r < rounds; r++ )
+		for ( i = 0; i < count; i++ )
+			check += irc_color_render_into (LIBIRC_COLOR_TO_HTML, out, LIBIRC_COLOR_HTML_BOUND(maxlen), lines[i], lengths[i]);
+
+	report ("irc_color_render_into (HTML)", now() - start, count * rounds, bytes * rounds);
+
+	// Prevents the compiler from dropping the calls
+	if ( check == 0x7FFFFFFF )
+		printf ("\n");
+
+	for ( i = 0; i < count; i++ )
+		free (lines[i]);
+
+	free (lines);
+	free (lengths);
+	free (copy);
+	free (out);
+	return 0;
+}
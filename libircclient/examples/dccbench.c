@@ -0,0 +1,238 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This example is free, and not covered by LGPL license. There is no
+ * restriction applied to their modification, redistribution, using and so on.
+ * You can study them, modify them, use them in your own program - either
+ * completely or partially. By using it you may give me some credits in your
+ * program, but you don't have to.
+ *
+ *
+ * This program measures the DCC SEND throughput over a link with a delay.
+ * It starts a tiny IRC server (see ircrelay.h) which passes the DCC
+ * connections through a proxy delaying them, connects a sender and a
+ * receiver to it, and sends a file with the different send windows: the
+ * smallest one is the classic DCC SEND waiting for every block to be
+ * acknowledged, the largest ones keep the link busy. The last run is DCC
+ * TSEND, where nothing is acknowledged. Run it as:
+ *
+ *   dccbench [megabytes] [delay ms] [seconds per run]
+ *
+ * The runs slower than the time limit are stopped, and their throughput is
+ * measured over the data received so far.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "libircclient.h"
+#include "ircrelay.h"
+
+
+typedef struct
+{
+	irc_session_t * sender;
+	irc_session_t * receiver;
+	int				connected;
+	int				done;			/* 1 when received, -1 on error */
+	irc_dcc_t		send_id;
+	irc_dcc_t		recv_id;		/* 0 until the offer arrives */
+	irc_dcc_size_t	received;
+	double			start;
+} bench_t;
+
+static bench_t bench;
+
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void event_connect (irc_session_t * session, const char * event, const char * origin, const char ** params, unsigned int count)
+{
+	bench.connected++;
+}
+
+
+static void recv_callback (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length)
+{
+	if ( status )
+		bench.done = -1;
+	else if ( !data )
+		bench.done = 1;
+	else
+		bench.received += length;
+}
+
+
+static void send_callback (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length)
+{
+}
+
+
+static void event_dcc_send_req (irc_session_t * session, const char * nick, const char * addr, const char * filename, irc_dcc_size_t size, irc_dcc_t dccid)
+{
+	bench.recv_id = dccid;
+	bench.start = now();
+
+	if ( irc_dcc_accept (session, dccid, 0, recv_callback) )
+		bench.done = -1;
+}
+
+
+/*
+ * Runs the event loops of both sessions until the condition is met or the
+ * time is over.
+ */
+static void pump (int * condition, int value, double until)
+{
+	while ( *condition != value && now() < until )
+	{
+		struct timeval tv = { 0, 10000 };
+		fd_set in, out;
+		int maxfd = 0;
+
+		FD_ZERO (&in);
+		FD_ZERO (&out);
+		irc_add_select_descriptors (bench.sender, &in, &out, &maxfd);
+		irc_add_select_descriptors (bench.receiver, &in, &out, &maxfd);
+
+		if ( select (maxfd + 1, &in, &out, 0, &tv) < 0 )
+			continue;
+
+		if ( irc_process_select_descriptors (bench.sender, &in, &out)
+		|| irc_process_select_descriptors (bench.receiver, &in, &out) )
+		{
+			printf ("Connection lost\n");
+			exit (1);
+		}
+	}
+}
+
+
+static void run (const char * name, const char * path, unsigned int window, int turbo, double limit)
+{
+	double elapsed;
+
+	irc_dcc_set_send_window (bench.sender, window);
+
+	if ( turbo )
+		irc_option_set (bench.sender, LIBIRC_OPTION_DCC_TSEND);
+	else
+		irc_option_reset (bench.sender, LIBIRC_OPTION_DCC_TSEND);
+
+	bench.done = 0;
+	bench.recv_id = 0;
+	bench.received = 0;
+	bench.start = now();
+
+	if ( irc_dcc_sendfile (bench.sender, 0, "receiver", path, send_callback, &bench.send_id) )
+	{
+		printf ("%-24s could not send: %s\n", name, irc_strerror (irc_errno (bench.sender)));
+		return;
+	}
+
+	pump (&bench.done, 1, now() + limit);
+	elapsed = now() - bench.start;
+
+	if ( bench.done == 0 )
+	{
+		irc_dcc_destroy (bench.sender, bench.send_id);
+
+		if ( bench.recv_id )
+			irc_dcc_destroy (bench.receiver, bench.recv_id);
+	}
+
+	printf ("%-24s %8.3f s %10.1f KB/s %s\n", name, elapsed, bench.received / elapsed / 1024,
+		bench.done == 1 ? "" : (bench.done == 0 ? "(stopped)" : "(failed)"));
+
+	// Let the sender see the end of the transfer before the next one
+	pump (&bench.done, 2, now() + 0.2);
+}
+
+
+int main (int argc, char ** argv)
+{
+	static const struct { const char * name; unsigned int window; int turbo; } runs[] =
+	{
+		{ "SEND, no window",	0,				0 },
+		{ "SEND, 16K window",	16 * 1024,		0 },
+		{ "SEND, 64K window",	64 * 1024,		0 },
+		{ "SEND, 256K window",	256 * 1024,		0 },
+		{ "SEND, 1M window",	1024 * 1024,	0 },
+		{ "TSEND",				0,				1 },
+	};
+
+	irc_callbacks_t callbacks;
+	ircrelay_config_t config;
+	irc_dcc_size_t size = (irc_dcc_size_t) (argc > 1 ? atoi (argv[1]) : 8) * 1024 * 1024;
+	double limit = argc > 3 ? atof (argv[3]) : 10;
+	char path[] = "/tmp/dccbenchXXXXXX", buf[65536];
+	unsigned short port;
+	irc_dcc_size_t written;
+	unsigned int i;
+	int fd;
+
+	config.delay_ms = argc > 2 ? atoi (argv[2]) : 50;
+	config.ping_ms = 0;
+
+	if ( (fd = mkstemp (path)) < 0 )
+	{
+		printf ("Could not create the file\n");
+		return 1;
+	}
+
+	for ( i = 0; i < sizeof(buf); i++ )
+		buf[i] = (char) rand();
+
+	for ( written = 0; written < size; written += sizeof(buf) )
+		if ( write (fd, buf, sizeof(buf)) != sizeof(buf) )
+			break;
+
+	close (fd);
+
+	if ( ircrelay_start (&config, &port) )
+	{
+		printf ("Could not start the server\n");
+		unlink (path);
+		return 1;
+	}
+
+	memset (&callbacks, 0, sizeof(callbacks));
+	callbacks.event_connect = event_connect;
+	callbacks.event_dcc_send_req = event_dcc_send_req;
+
+	bench.sender = irc_create_session (&callbacks);
+	bench.receiver = irc_create_session (&callbacks);
+
+	if ( !bench.sender || !bench.receiver
+	|| irc_connect (bench.sender, "127.0.0.1", port, 0, "sender", 0, 0)
+	|| irc_connect (bench.receiver, "127.0.0.1", port, 0, "receiver", 0, 0) )
+	{
+		printf ("Could not connect to the server\n");
+		unlink (path);
+		return 1;
+	}
+
+	pump (&bench.connected, 2, now() + 5);
+	printf ("%u MB over a link with %u ms delay each way:\n", (unsigned int) (written / 1024 / 1024), config.delay_ms);
+
+	for ( i = 0; i < sizeof(runs) / sizeof(runs[0]); i++ )
+		run (runs[i].name, path, runs[i].window, runs[i].turbo, limit);
+
+	irc_disconnect (bench.sender);
+	irc_disconnect (bench.receiver);
+	irc_destroy_session (bench.sender);
+	irc_destroy_session (bench.receiver);
+	ircrelay_stop ();
+	unlink (path);
+	return 0;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This example is free, and not covered by LGPL license. There is no
+ * restriction applied to their modification, redistribution, using and so on.
+ * You can study them, modify them, use them in your own program - either
+ * completely or partially. By using it you may give me some credits in your
+ * program, but you don't have to.
+ *
+ *
+ * This program checks the DCC SEND of a file larger than 4Gb. It creates a
+ * sparse file with a few marked bytes around the 4Gb boundary, starts a
+ * tiny IRC server (see ircrelay.h), and sends the file from one session to
+ * another over the loopback. The receiver checks the offered size, that
+ * every byte arrives where it belongs, and the total. The file takes no
+ * disk space but the marks. Run it as:
+ *
+ *   dcclarge [gigabytes]
+ *
+ * The default is 6Gb. Prints OK and exits with 0 if the file arrived intact.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/select.h>
+
+#include "libircclient.h"
+#include "ircrelay.h"
+
+
+#define FOUR_GB		(4ULL * 1024 * 1024 * 1024)
+
+
+typedef struct
+{
+	irc_session_t * sender;
+	irc_session_t * receiver;
+	int				connected;
+	int				done;			/* 1 when received, -1 on error */
+	irc_dcc_size_t	size;
+	irc_dcc_size_t	offered;
+	irc_dcc_size_t	received;
+	irc_dcc_size_t	marks[4];
+	unsigned int	errors;
+} check_t;
+
+static check_t check;
+
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/*
+ * The byte expected at the offset: the marks carry their number, the rest
+ * of the file is a hole and reads as zeros.
+ */
+static unsigned char expected (irc_dcc_size_t offset)
+{
+	unsigned int i;
+
+	for ( i = 0; i < 4; i++ )
+		if ( check.marks[i] == offset )
+			return 0xA0 + i;
+
+	return 0;
+}
+
+
+static void event_connect (irc_session_t * session, const char * event, const char * origin, const char ** params, unsigned int count)
+{
+	check.connected++;
+}
+
+
+static void recv_callback (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length)
+{
+	unsigned int i;
+
+	if ( status )
+	{
+		printf ("Receive failed at %llu: %s\n", check.received, irc_strerror (status));
+		check.done = -1;
+		return;
+	}
+
+	if ( !data )
+	{
+		check.done = 1;
+		return;
+	}
+
+	// The holes must read as zeros, only the nonzero bytes need a closer look
+	for ( i = 0; i < length; i++ )
+	{
+		if ( data[i] && (unsigned char) data[i] != expected (check.received + i) && check.errors++ < 10 )
+			printf ("Wrong byte %02X at %llu\n", (unsigned char) data[i], check.received + i);
+	}
+
+	for ( i = 0; i < 4; i++ )
+	{
+		irc_dcc_size_t offset = check.marks[i];
+
+		if ( offset >= check.received && offset < check.received + length
+		&& (unsigned char) data[offset - check.received] != 0xA0 + i && check.errors++ < 10 )
+			printf ("Mark %u missing at %llu\n", i, offset);
+	}
+
+	check.received += length;
+}
+
+
+static void send_callback (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length)
+{
+	if ( status )
+		printf ("Send failed: %s\n", irc_strerror (status));
+}
+
+
+static void event_dcc_send_req (irc_session_t * session, const char * nick, const char * addr, const char * filename, irc_dcc_size_t size, irc_dcc_t dccid)
+{
+	check.offered = size;
+
+	if ( irc_dcc_accept (session, dccid, 0, recv_callback) )
+		check.done = -1;
+}
+
+
+static void pump (int * condition, int value)
+{
+	irc_dcc_size_t last = 0;
+	double progress = now();
+
+	// Gives up if nothing arrives for half a minute
+	while ( *condition != value && now() < progress + 30 )
+	{
+		struct timeval tv = { 0, 10000 };
+		fd_set in, out;
+		int maxfd = 0;
+
+		FD_ZERO (&in);
+		FD_ZERO (&out);
+		irc_add_select_descriptors (check.sender, &in, &out, &maxfd);
+		irc_add_select_descriptors (check.receiver, &in, &out, &maxfd);
+
+		if ( select (maxfd + 1, &in, &out, 0, &tv) < 0 )
+			continue;
+
+		if ( irc_process_select_descriptors (check.sender, &in, &out)
+		|| irc_process_select_descriptors (check.receiver, &in, &out) )
+		{
+			printf ("Connection lost\n");
+			exit (1);
+		}
+
+		if ( check.received != last )
+		{
+			last = check.received;
+			progress = now();
+		}
+	}
+}
+
+
+int main (int argc, char ** argv)
+{
+	irc_callbacks_t callbacks;
+	ircrelay_config_t config;
+	char path[] = "/tmp/dcclargeXXXXXX";
+	unsigned short port;
+	irc_dcc_t dccid;
+	double start;
+	unsigned int i;
+	int fd, ok;
+
+	check.size = (irc_dcc_size_t) (argc > 1 ? atoi (argv[1]) : 6) * 1024 * 1024 * 1024;
+	check.marks[0] = 0;
+	check.marks[1] = FOUR_GB - 1;
+	check.marks[2] = FOUR_GB;
+	check.marks[3] = check.size - 1;
+
+	if ( check.size <= FOUR_GB )
+	{
+		printf ("The file must be larger than 4Gb\n");
+		return 1;
+	}
+
+	if ( (fd = mkstemp (path)) < 0 || ftruncate (fd, (off_t) check.size) )
+	{
+		printf ("Could not create the file\n");
+		return 1;
+	}
+
+	for ( i = 0; i < 4; i++ )
+	{
+		unsigned char mark = 0xA0 + i;
+
+		if ( pwrite (fd, &mark, 1, (off_t) check.marks[i]) != 1 )
+		{
+			printf ("Could not write the file\n");
+			unlink (path);
+			return 1;
+		}
+	}
+
+	close (fd);
+
+	config.delay_ms = 0;
+	config.ping_ms = 0;
+
+	if ( ircrelay_start (&config, &port) )
+	{
+		printf ("Could not start the server\n");
+		unlink (path);
+		return 1;
+	}
+
+	memset (&callbacks, 0, sizeof(callbacks));
+	callbacks.event_connect = event_connect;
+	callbacks.event_dcc_send_req = event_dcc_send_req;
+
+	check.sender = irc_create_session (&callbacks);
+	check.receiver = irc_create_session (&callbacks);
+
+	if ( !check.sender || !check.receiver
+	|| irc_connect (check.sender, "127.0.0.1", port, 0, "sender", 0, 0)
+	|| irc_connect (check.receiver, "127.0.0.1", port, 0, "receiver", 0, 0) )
+	{
+		printf ("Could not connect to the server\n");
+		unlink (path);
+		return 1;
+	}
+
+	pump (&check.connected, 2);
+
+	// A large file moves faster in larger blocks and with more in flight
+	irc_dcc_set_buffer_size (check.sender, 512 * 1024);
+	irc_dcc_set_buffer_size (check.receiver, 512 * 1024);
+	irc_dcc_set_send_window (check.sender, 1024 * 1024);
+	start = now();
+
+	if ( irc_dcc_sendfile (check.sender, 0, "receiver", path, send_callback, &dccid) )
+	{
+		printf ("Could not send: %s\n", irc_strerror (irc_errno (check.sender)));
+		unlink (path);
+		return 1;
+	}
+
+	pump (&check.done, 1);
+
+	printf ("Offered %llu, received %llu of %llu bytes in %.1f s, %u wrong\n",
+		check.offered, check.received, check.size, now() - start, check.errors);
+
+	ok = check.done == 1 && check.offered == check.size
+		&& check.received == check.size && check.errors == 0;
+
+	printf ("%s\n", ok ? "OK" : "FAILED");
+
+	irc_disconnect (check.sender);
+	irc_disconnect (check.receiver);
+	irc_destroy_session (check.sender);
+	irc_destroy_session (check.receiver);
+	ircrelay_stop ();
+	unlink (path);
+	return ok ? 0 : 1;
+}
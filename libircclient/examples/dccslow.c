@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This example is free, and not covered by LGPL license. There is no
+ * restriction applied to their modification, redistribution, using and so on.
+ * You can study them, modify them, use them in your own program - either
+ * completely or partially. By using it you may give me some credits in your
+ * program, but you don't have to.
+ *
+ *
+ * This program checks that a slow disk does not stall the IRC event loop
+ * with LIBIRC_OPTION_DCC_ASYNC_IO. It makes every file read sleep, as a
+ * busy network file system would, starts a tiny IRC server (see ircrelay.h)
+ * which pings the clients often, and sends a file from one session to
+ * another, first reading the file in the event loop, then in the I/O
+ * thread. For each run it prints the transfer time and the slowest PONG.
+ * Run it as:
+ *
+ *   dccslow [megabytes] [ms per read]
+ *
+ * The reads are slowed down by replacing pread(), so this only works where
+ * the program symbols take over the C library ones, as on Linux. The DCC
+ * files are read with pread() when their CRC32 is computed, so the option
+ * is set to keep the library from using sendfile().
+ *
+ * Prints OK and exits with 0 if no PONG waited for a read in the I/O thread.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+#include "libircclient.h"
+#include "ircrelay.h"
+
+
+typedef struct
+{
+	irc_session_t * sender;
+	irc_session_t * receiver;
+	int				connected;
+	int				done;			/* 1 when received, -1 on error */
+	irc_dcc_size_t	received;
+} slow_t;
+
+static slow_t slow;
+static unsigned int read_delay_ms;
+
+
+/*
+ * The slow file source. The library is built either with the 64-bit file
+ * offsets or without, so both names are taken over.
+ */
+ssize_t pread64 (int fd, void * buf, size_t count, off64_t offset)
+{
+	static ssize_t (*next) (int, void *, size_t, off64_t);
+
+	if ( !next )
+		next = (ssize_t (*) (int, void *, size_t, off64_t)) dlsym (RTLD_NEXT, "pread64");
+
+	usleep (read_delay_ms * 1000);
+	return next (fd, buf, count, offset);
+}
+
+
+ssize_t pread (int fd, void * buf, size_t count, off_t offset)
+{
+	return pread64 (fd, buf, count, offset);
+}
+
+
+static double now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void event_connect (irc_session_t * session, const char * event, const char * origin, const char ** params, unsigned int count)
+{
+	slow.connected++;
+}
+
+
+static void recv_callback (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length)
+{
+	if ( status )
+		slow.done = -1;
+	else if ( !data )
+		slow.done = 1;
+	else
+		slow.received += length;
+}
+
+
+static void send_callback (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length)
+{
+	if ( status )
+		printf ("Send failed: %s\n", irc_strerror (status));
+}
+
+
+static void event_dcc_send_req (irc_session_t * session, const char * nick, const char * addr, const char * filename, irc_dcc_size_t size, irc_dcc_t dccid)
+{
+	if ( irc_dcc_accept (session, dccid, 0, recv_callback) )
+		slow.done = -1;
+}
+
+
+static void pump (int * condition, int value, double until)
+{
+	while ( *condition != value && now() < until )
+	{
+		struct timeval tv = { 0, 10000 };
+		fd_set in, out;
+		int maxfd = 0;
+
+		FD_ZERO (&in);
+		FD_ZERO (&out);
+		irc_add_select_descriptors (slow.sender, &in, &out, &maxfd);
+		irc_add_select_descriptors (slow.receiver, &in, &out, &maxfd);
+
+		if ( select (maxfd + 1, &in, &out, 0, &tv) < 0 )
+			continue;
+
+		if ( irc_process_select_descriptors (slow.sender, &in, &out)
+		|| irc_process_select_descriptors (slow.receiver, &in, &out) )
+		{
+			printf ("Connection lost\n");
+			exit (1);
+		}
+	}
+}
+
+
+/*
+ * Sends the file, and returns the slowest PONG during the transfer, or
+ * a negative value if the transfer failed.
+ */
+static int run (const char * name, const char * path, int async)
+{
+	unsigned int pong_max, pongs;
+	irc_dcc_t dccid;
+	double start;
+
+	if ( async )
+		irc_option_set (slow.sender, LIBIRC_OPTION_DCC_ASYNC_IO);
+	else
+		irc_option_reset (slow.sender, LIBIRC_OPTION_DCC_ASYNC_IO);
+
+	// Let the PINGs sent during the previous run be answered first
+	slow.done = 0;
+	pump (&slow.done, 1, now() + read_delay_ms / 1000.0 + 0.1);
+	ircrelay_pong_max (&pongs);
+
+	slow.received = 0;
+	start = now();
+
+	if ( irc_dcc_sendfile (slow.sender, 0, "receiver", path, send_callback, &dccid) )
+	{
+		printf ("%-28s could not send: %s\n", name, irc_strerror (irc_errno (slow.sender)));
+		return -1;
+	}
+
+	pump (&slow.done, 1, now() + 120);
+	pong_max = ircrelay_pong_max (&pongs);
+
+	printf ("%-28s %7.3f s, %u PONGs, the slowest in %u ms%s\n", name, now() - start,
+		pongs, pong_max, slow.done == 1 ? "" : " (failed)");
+
+	return slow.done == 1 ? (int) pong_max : -1;
+}
+
+
+int main (int argc, char ** argv)
+{
+	irc_callbacks_t callbacks;
+	ircrelay_config_t config;
+	irc_dcc_size_t size = (irc_dcc_size_t) (argc > 1 ? atoi (argv[1]) : 4) * 1024 * 1024, written;
+	char path[] = "/tmp/dccslowXXXXXX", buf[65536];
+	unsigned short port;
+	int fd, sync_pong, async_pong;
+
+	read_delay_ms = argc > 2 ? atoi (argv[2]) : 100;
+	config.delay_ms = 0;
+	config.ping_ms = 20;
+
+	if ( (fd = mkstemp (path)) < 0 )
+	{
+		printf ("Could not create the file\n");
+		return 1;
+	}
+
+	memset (buf, 'x', sizeof(buf));
+
+	for ( written = 0; written < size; written += sizeof(buf) )
+		if ( write (fd, buf, sizeof(buf)) != sizeof(buf) )
+			break;
+
+	close (fd);
+
+	if ( ircrelay_start (&config, &port) )
+	{
+		printf ("Could not start the server\n");
+		unlink (path);
+		return 1;
+	}
+
+	memset (&callbacks, 0, sizeof(callbacks));
+	callbacks.event_connect = event_connect;
+	callbacks.event_dcc_send_req = event_dcc_send_req;
+
+	slow.sender = irc_create_session (&callbacks);
+	slow.receiver = irc_create_session (&callbacks);
+
+	if ( !slow.sender || !slow.receiver
+	|| irc_connect (slow.sender, "127.0.0.1", port, 0, "sender", 0, 0)
+	|| irc_connect (slow.receiver, "127.0.0.1", port, 0, "receiver", 0, 0) )
+	{
+		printf ("Could not connect to the server\n");
+		unlink (path);
+		return 1;
+	}
+
+	pump (&slow.connected, 2, now() + 5);
+	irc_option_set (slow.sender, LIBIRC_OPTION_DCC_CRC32);
+	printf ("%u MB, %u ms per read, pinged every %u ms:\n", (unsigned int) (written / 1024 / 1024), read_delay_ms, config.ping_ms);
+
+	sync_pong = run ("Read in the event loop", path, 0);
+	async_pong = run ("Read in the I/O thread", path, 1);
+
+	irc_disconnect (slow.sender);
+	irc_disconnect (slow.receiver);
+	irc_destroy_session (slow.sender);
+	irc_destroy_session (slow.receiver);
+	ircrelay_stop ();
+	unlink (path);
+
+	if ( sync_pong < 0 || async_pong < 0 || async_pong >= (int) read_delay_ms )
+	{
+		printf ("FAILED\n");
+		return 1;
+	}
+
+	printf ("OK\n");
+	return 0;
+}
@@ -0,0 +1,611 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This example is free, and not covered by LGPL license. There is no
+ * restriction applied to their modification, redistribution, using and so on.
+ * You can study them, modify them, use them in your own program - either
+ * completely or partially. By using it you may give me some credits in your
+ * program, but you don't have to.
+ *
+ *
+ * The tiny IRC server of the DCC examples, see ircrelay.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ircrelay.h"
+
+#define RELAY_CLIENTS		8
+#define RELAY_PROXIES		16
+#define RELAY_CHUNK			65536
+
+
+/*
+ * The data read from one side of a proxied connection, which waits for
+ * its time to be written to the other side.
+ */
+typedef struct relay_chunk_s
+{
+	struct relay_chunk_s * next;
+	unsigned long long	due;
+	unsigned int		length;
+	unsigned int		offset;
+	char				data[RELAY_CHUNK];
+} relay_chunk_t;
+
+
+typedef struct
+{
+	int					from;
+	int					to;
+	int					eof;
+	relay_chunk_t	  *	head;
+	relay_chunk_t	  *	tail;
+} relay_pipe_t;
+
+
+/*
+ * A DCC connection through the proxy: the offer is changed to the port
+ * the proxy listens on, and the proxy connects to the offered port once
+ * the receiver connects.
+ */
+typedef struct
+{
+	int					listen;		/* -1 if not used */
+	struct sockaddr_in	target;
+	relay_pipe_t		pipes[2];
+} relay_proxy_t;
+
+
+typedef struct
+{
+	int					sock;		/* -1 if not used */
+	char				nick[64];
+	char				buf[4096];
+	unsigned int		used;
+	unsigned long long	ping_sent;	/* 0 if not waiting for a PONG */
+} relay_client_t;
+
+
+static ircrelay_config_t	relay_config;
+static int					relay_sock = -1;
+static volatile int			relay_stopping;
+static pthread_t			relay_thread;
+static relay_client_t		relay_clients[RELAY_CLIENTS];
+static relay_proxy_t		relay_proxies[RELAY_PROXIES];
+static pthread_mutex_t		relay_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int			relay_pong_max, relay_pong_count;
+static unsigned long long	relay_last_ping;
+
+
+static unsigned long long relay_now (void)
+{
+	struct timeval tv;
+	gettimeofday (&tv, 0);
+	return tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+}
+
+
+static void relay_add (int fd, fd_set * set, int * maxfd)
+{
+	FD_SET (fd, set);
+
+	if ( fd > *maxfd )
+		*maxfd = fd;
+}
+
+
+static void relay_send (relay_client_t * client, const char * fmt, ...)
+{
+	char line[1024];
+	va_list va;
+	int length, sent = 0, rc;
+
+	va_start (va, fmt);
+	length = vsnprintf (line, sizeof(line) - 2, fmt, va);
+	va_end (va);
+
+	if ( length < 0 || length > (int) sizeof(line) - 3 )
+		return;
+
+	strcpy (line + length, "\r\n");
+	length += 2;
+
+	while ( sent < length && (rc = write (client->sock, line + sent, length - sent)) > 0 )
+		sent += rc;
+}
+
+
+static void relay_proxy_close (relay_proxy_t * proxy)
+{
+	int i;
+
+	if ( proxy->listen >= 0 )
+		close (proxy->listen);
+
+	for ( i = 0; i < 2; i++ )
+	{
+		relay_pipe_t * pipe = proxy->pipes + i;
+
+		if ( pipe->from >= 0 )
+			close (pipe->from);
+
+		while ( pipe->head )
+		{
+			relay_chunk_t * chunk = pipe->head;
+			pipe->head = chunk->next;
+			free (chunk);
+		}
+	}
+
+	memset (proxy, 0, sizeof(relay_proxy_t));
+	proxy->listen = proxy->pipes[0].from = proxy->pipes[1].from = -1;
+}
+
+
+/*
+ * Starts a proxy to the offered address, and returns its port, or 0.
+ */
+static unsigned short relay_proxy_start (unsigned long addr, unsigned short port)
+{
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	relay_proxy_t * proxy = 0;
+	int i;
+
+	for ( i = 0; i < RELAY_PROXIES && !proxy; i++ )
+		if ( relay_proxies[i].listen < 0 && relay_proxies[i].pipes[0].from < 0 )
+			proxy = relay_proxies + i;
+
+	if ( !proxy || (proxy->listen = socket (AF_INET, SOCK_STREAM, 0)) < 0 )
+		return 0;
+
+	memset (&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	if ( bind (proxy->listen, (struct sockaddr *) &sa, sizeof(sa))
+	|| listen (proxy->listen, 1)
+	|| getsockname (proxy->listen, (struct sockaddr *) &sa, &salen) )
+	{
+		relay_proxy_close (proxy);
+		return 0;
+	}
+
+	memset (&proxy->target, 0, sizeof(proxy->target));
+	proxy->target.sin_family = AF_INET;
+	proxy->target.sin_addr.s_addr = htonl (addr);
+	proxy->target.sin_port = htons (port);
+	return ntohs (sa.sin_port);
+}
+
+
+static void relay_proxy_accept (relay_proxy_t * proxy)
+{
+	int a = accept (proxy->listen, 0, 0), b;
+
+	close (proxy->listen);
+	proxy->listen = -1;
+
+	if ( a < 0 )
+		return;
+
+	if ( (b = socket (AF_INET, SOCK_STREAM, 0)) < 0
+	|| connect (b, (struct sockaddr *) &proxy->target, sizeof(proxy->target)) )
+	{
+		close (a);
+
+		if ( b >= 0 )
+			close (b);
+
+		return;
+	}
+
+	fcntl (a, F_SETFL, fcntl (a, F_GETFL) | O_NONBLOCK);
+	fcntl (b, F_SETFL, fcntl (b, F_GETFL) | O_NONBLOCK);
+
+	proxy->pipes[0].from = proxy->pipes[1].to = a;
+	proxy->pipes[1].from = proxy->pipes[0].to = b;
+}
+
+
+/*
+ * Moves the data of a direction of the proxy: reads what arrived, and
+ * writes what is due. Returns nonzero once the connection is over.
+ */
+static int relay_pipe_process (relay_pipe_t * pipe, fd_set * in, fd_set * out, unsigned long long now)
+{
+	if ( !pipe->eof && FD_ISSET (pipe->from, in) )
+	{
+		relay_chunk_t * chunk = malloc (sizeof(relay_chunk_t));
+		int length;
+
+		if ( !chunk )
+			return 1;
+
+		if ( (length = read (pipe->from, chunk->data, sizeof(chunk->data))) <= 0 )
+		{
+			free (chunk);
+
+			if ( length < 0 && errno != EAGAIN )
+				return 1;
+
+			pipe->eof = length == 0;
+		}
+		else
+		{
+			chunk->next = 0;
+			chunk->due = now + relay_config.delay_ms;
+			chunk->length = length;
+			chunk->offset = 0;
+
+			if ( pipe->tail )
+				pipe->tail->next = chunk;
+			else
+				pipe->head = chunk;
+
+			pipe->tail = chunk;
+		}
+	}
+
+	while ( pipe->head && pipe->head->due <= now && FD_ISSET (pipe->to, out) )
+	{
+		relay_chunk_t * chunk = pipe->head;
+		int length = write (pipe->to, chunk->data + chunk->offset, chunk->length - chunk->offset);
+
+		if ( length < 0 )
+			return errno != EAGAIN;
+
+		if ( (chunk->offset += length) < chunk->length )
+			break;
+
+		if ( (pipe->head = chunk->next) == 0 )
+			pipe->tail = 0;
+
+		free (chunk);
+	}
+
+	// Passes the end of the data once it is all written
+	if ( pipe->eof == 1 && !pipe->head )
+	{
+		shutdown (pipe->to, SHUT_WR);
+		pipe->eof = 2;
+	}
+
+	return 0;
+}
+
+
+static relay_client_t * relay_find (const char * nick)
+{
+	int i;
+
+	for ( i = 0; i < RELAY_CLIENTS; i++ )
+		if ( relay_clients[i].sock >= 0 && !strcasecmp (relay_clients[i].nick, nick) )
+			return relay_clients + i;
+
+	return 0;
+}
+
+
+/*
+ * Passes the DCC SEND or TSEND offer through the proxy: "DCC SEND file ip port size",
+ * the file name could be quoted and have spaces, so it is parsed from the
+ * end. The passive offers, with port 0 and a token after the size, are
+ * passed as is.
+ */
+static void relay_proxy_offer (char * text)
+{
+	char * end = strrchr (text, '\x01'), * p, * fields[3], rest[512];
+	unsigned short port;
+	int i;
+
+	if ( !end || end == text )
+		return;
+
+	for ( p = end, i = 2; i >= 0; i-- )
+	{
+		while ( p > text && p[-1] != ' ' )
+			p--;
+
+		fields[i] = p;
+
+		if ( p == text )
+			return;
+
+		p--;
+	}
+
+	if ( atoi (fields[1]) == 0 || !strcmp (fields[0], "0") || strchr (fields[0], ':')
+	|| (port = relay_proxy_start (strtoul (fields[0], 0, 10), atoi (fields[1]))) == 0 )
+		return;
+
+	snprintf (rest, sizeof(rest), "%lu %u %.*s", (unsigned long) INADDR_LOOPBACK, port, (int) (end - fields[2] + 1), fields[2]);
+	strcpy (fields[0], rest);
+}
+
+
+static void relay_line (relay_client_t * client, char * line)
+{
+	char * cmd = line, * arg = strchr (line, ' ');
+
+	if ( arg )
+		*arg++ = '\0';
+	else
+		arg = "";
+
+	if ( !strcmp (cmd, "NICK") )
+		snprintf (client->nick, sizeof(client->nick), "%s", arg);
+	else if ( !strcmp (cmd, "USER") )
+	{
+		relay_send (client, ":relay 001 %s :Welcome to the relay", client->nick);
+		relay_send (client, ":relay 376 %s :End of MOTD", client->nick);
+	}
+	else if ( !strcmp (cmd, "PING") )
+		relay_send (client, ":relay PONG relay %s", arg);
+	else if ( !strcmp (cmd, "PONG") && client->ping_sent )
+	{
+		unsigned int elapsed = (unsigned int) (relay_now () - client->ping_sent);
+
+		pthread_mutex_lock (&relay_stats_mutex);
+
+		if ( elapsed > relay_pong_max )
+			relay_pong_max = elapsed;
+
+		relay_pong_count++;
+		pthread_mutex_unlock (&relay_stats_mutex);
+		client->ping_sent = 0;
+	}
+	else if ( !strcmp (cmd, "PRIVMSG") || !strcmp (cmd, "NOTICE") )
+	{
+		char * text = strchr (arg, ' ');
+		relay_client_t * to;
+
+		if ( !text )
+			return;
+
+		*text++ = '\0';
+
+		if ( *text == ':' )
+			text++;
+
+		if ( relay_config.delay_ms
+		&& (!strncmp (text, "\x01" "DCC SEND ", 10) || !strncmp (text, "\x01" "DCC TSEND ", 11)) )
+			relay_proxy_offer (text);
+
+		if ( (to = relay_find (arg)) != 0 )
+			relay_send (to, ":%s!relay@127.0.0.1 %s %s :%s", client->nick, cmd, arg, text);
+	}
+	else if ( !strcmp (cmd, "QUIT") )
+	{
+		close (client->sock);
+		client->sock = -1;
+	}
+}
+
+
+static void relay_client_read (relay_client_t * client)
+{
+	int length = read (client->sock, client->buf + client->used, sizeof(client->buf) - client->used - 1);
+	char * line, * eol;
+
+	if ( length <= 0 )
+	{
+		close (client->sock);
+		client->sock = -1;
+		return;
+	}
+
+	client->used += length;
+	client->buf[client->used] = '\0';
+
+	for ( line = client->buf; client->sock >= 0 && (eol = strchr (line, '\n')) != 0; line = eol + 1 )
+	{
+		*eol = '\0';
+
+		if ( eol > line && eol[-1] == '\r' )
+			eol[-1] = '\0';
+
+		relay_line (client, line);
+	}
+
+	if ( client->sock >= 0 )
+	{
+		client->used -= line - client->buf;
+		memmove (client->buf, line, client->used);
+	}
+}
+
+
+static void * relay_run (void * unused)
+{
+	(void) unused;
+
+	while ( !relay_stopping )
+	{
+		struct timeval tv = { 0, 10000 };
+		unsigned long long now = relay_now ();
+		fd_set in, out;
+		int maxfd = relay_sock, i, j;
+
+		FD_ZERO (&in);
+		FD_ZERO (&out);
+		relay_add (relay_sock, &in, &maxfd);
+
+		for ( i = 0; i < RELAY_CLIENTS; i++ )
+		{
+			relay_client_t * client = relay_clients + i;
+
+			if ( client->sock < 0 )
+				continue;
+
+			relay_add (client->sock, &in, &maxfd);
+
+			if ( relay_config.ping_ms && client->nick[0] && !client->ping_sent
+			&& now >= relay_last_ping + relay_config.ping_ms )
+			{
+				client->ping_sent = now;
+				relay_send (client, "PING :%llu", now);
+			}
+		}
+
+		if ( relay_config.ping_ms && now >= relay_last_ping + relay_config.ping_ms )
+			relay_last_ping = now;
+
+		for ( i = 0; i < RELAY_PROXIES; i++ )
+		{
+			relay_proxy_t * proxy = relay_proxies + i;
+
+			if ( proxy->listen >= 0 )
+				relay_add (proxy->listen, &in, &maxfd);
+
+			for ( j = 0; j < 2 && proxy->pipes[0].from >= 0; j++ )
+			{
+				relay_pipe_t * pipe = proxy->pipes + j;
+
+				if ( !pipe->eof )
+					relay_add (pipe->from, &in, &maxfd);
+
+				if ( pipe->head && pipe->head->due <= now )
+					relay_add (pipe->to, &out, &maxfd);
+
+				// Wake up when the next data is due
+				if ( pipe->head && pipe->head->due > now && pipe->head->due - now < 10 )
+					tv.tv_usec = (pipe->head->due - now) * 1000;
+			}
+		}
+
+		if ( select (maxfd + 1, &in, &out, 0, &tv) < 0 )
+			continue;
+
+		now = relay_now ();
+
+		if ( FD_ISSET (relay_sock, &in) )
+		{
+			int sock = accept (relay_sock, 0, 0);
+
+			for ( i = 0; sock >= 0 && i < RELAY_CLIENTS && relay_clients[i].sock >= 0; i++ )
+				;
+
+			if ( sock >= 0 && i < RELAY_CLIENTS )
+			{
+				memset (relay_clients + i, 0, sizeof(relay_client_t));
+				relay_clients[i].sock = sock;
+			}
+			else if ( sock >= 0 )
+				close (sock);
+		}
+
+		for ( i = 0; i < RELAY_CLIENTS; i++ )
+			if ( relay_clients[i].sock >= 0 && FD_ISSET (relay_clients[i].sock, &in) )
+				relay_client_read (relay_clients + i);
+
+		for ( i = 0; i < RELAY_PROXIES; i++ )
+		{
+			relay_proxy_t * proxy = relay_proxies + i;
+
+			if ( proxy->listen >= 0 && FD_ISSET (proxy->listen, &in) )
+				relay_proxy_accept (proxy);
+			else if ( proxy->pipes[0].from >= 0 )
+			{
+				if ( relay_pipe_process (proxy->pipes, &in, &out, now)
+				|| relay_pipe_process (proxy->pipes + 1, &in, &out, now)
+				|| (proxy->pipes[0].eof == 2 && proxy->pipes[1].eof == 2) )
+					relay_proxy_close (proxy);
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+int ircrelay_start (const ircrelay_config_t * config, unsigned short * port)
+{
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	int i, on = 1;
+
+	// The writes to the closed DCC connections must not kill the example
+	signal (SIGPIPE, SIG_IGN);
+
+	relay_config = *config;
+	relay_stopping = 0;
+	relay_last_ping = 0;
+
+	for ( i = 0; i < RELAY_CLIENTS; i++ )
+		relay_clients[i].sock = -1;
+
+	for ( i = 0; i < RELAY_PROXIES; i++ )
+	{
+		relay_proxies[i].listen = -1;
+		relay_proxies[i].pipes[0].from = relay_proxies[i].pipes[1].from = -1;
+	}
+
+	if ( (relay_sock = socket (AF_INET, SOCK_STREAM, 0)) < 0 )
+		return 1;
+
+	setsockopt (relay_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset (&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	if ( bind (relay_sock, (struct sockaddr *) &sa, sizeof(sa))
+	|| listen (relay_sock, RELAY_CLIENTS)
+	|| getsockname (relay_sock, (struct sockaddr *) &sa, &salen)
+	|| pthread_create (&relay_thread, 0, relay_run, 0) )
+	{
+		close (relay_sock);
+		return 1;
+	}
+
+	*port = ntohs (sa.sin_port);
+	return 0;
+}
+
+
+void ircrelay_stop (void)
+{
+	int i;
+
+	relay_stopping = 1;
+	pthread_join (relay_thread, 0);
+
+	for ( i = 0; i < RELAY_CLIENTS; i++ )
+		if ( relay_clients[i].sock >= 0 )
+			close (relay_clients[i].sock);
+
+	for ( i = 0; i < RELAY_PROXIES; i++ )
+		relay_proxy_close (relay_proxies + i);
+
+	close (relay_sock);
+}
+
+
+unsigned int ircrelay_pong_max (unsigned int * count)
+{
+	unsigned int max;
+
+	pthread_mutex_lock (&relay_stats_mutex);
+	max = relay_pong_max;
+	*count = relay_pong_count;
+	relay_pong_max = relay_pong_count = 0;
+	pthread_mutex_unlock (&relay_stats_mutex);
+
+	return max;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This example is free, and not covered by LGPL license. There is no
+ * restriction applied to their modification, redistribution, using and so on.
+ * You can study them, modify them, use them in your own program - either
+ * completely or partially. By using it you may give me some credits in your
+ * program, but you don't have to.
+ *
+ *
+ * A tiny IRC server for the DCC examples, run in a thread of the example
+ * itself. It registers the clients, relays PRIVMSG and NOTICE between them
+ * (so they can offer each other DCC), may pass the DCC connections through
+ * a proxy which delays them, and may ping the clients to measure how fast
+ * their event loops answer. POSIX only.
+ */
+
+#ifndef INCLUDE_IRCRELAY_H
+#define INCLUDE_IRCRELAY_H
+
+typedef struct
+{
+	unsigned int	delay_ms;		/* one-way delay of the DCC connections, 0 for direct */
+	unsigned int	ping_ms;		/* how often the clients are pinged, 0 for never */
+} ircrelay_config_t;
+
+
+/*
+ * Starts the server on a free port of 127.0.0.1, and stores the port.
+ * Returns 0 on success.
+ */
+int ircrelay_start (const ircrelay_config_t * config, unsigned short * port);
+
+void ircrelay_stop (void);
+
+/*
+ * The slowest PONG since the last call, in milliseconds, and the number of
+ * the PONGs.
+ */
+unsigned int ircrelay_pong_max (unsigned int * count);
+
+#endif /* INCLUDE_IRCRELAY_H */
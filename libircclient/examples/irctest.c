@@ -242,10 +242,10 @@ void irc_event_dcc_chat (irc_session_t * session, const char * nick, const char
 }
 
 
-void irc_event_dcc_send (irc_session_t * session, const char * nick, const char * addr, const char * filename, unsigned long size, irc_dcc_t dccid)
+void irc_event_dcc_send (irc_session_t * session, const char * nick, const char * addr, const char * filename, irc_dcc_size_t size, irc_dcc_t dccid)
 {
 	FILE * fp;
-	printf ("DCC send [%d] requested from '%s' (%s): %s (%lu bytes)\n", dccid, nick, addr, filename, size);
+	printf ("DCC send [%d] requested from '%s' (%s): %s (%llu bytes)\n", dccid, nick, addr, filename, size);
 
 	if ( (fp = fopen ("file", "wb")) == 0 )
 		abort();
@@ -0,0 +1,630 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This example is free, and not covered by LGPL license. There is no
+ * restriction applied to their modification, redistribution, using and so on.
+ * You can study them, modify them, use them in your own program - either
+ * completely or partially. By using it you may give me some credits in your
+ * program, but you don't have to.
+ *
+ *
+ * This program checks the SASL authentication against a mock server, run
+ * in a thread of the program itself. The server negotiates the capabilities,
+ * checks PLAIN and SCRAM-SHA-256 logins of the account "bot" with the
+ * password "secret", and only registers the client after CAP END. Each case
+ * connects, and compares irc_errno() in event_connect with the expected
+ * result. EXTERNAL needs an SSL server, and is not checked. Run it as:
+ *
+ *   saslcheck
+ *
+ * Prints OK and exits with 0 if every case passed. POSIX only.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "libircclient.h"
+
+
+#define ACCOUNT		"bot"
+#define PASSWORD	"secret"
+#define ITERATIONS	4096
+
+
+typedef struct
+{
+	const char	  *	name;
+	int				mechanism;
+	const char	  *	password;		/* the one the client uses */
+	const char	  *	caps;			/* the server CAP LS reply */
+	int				impostor;		/* the server does not know the password */
+	int				expected;		/* irc_errno() in event_connect */
+} sasl_case_t;
+
+
+/*
+ * The state of the mock server for a connection.
+ */
+typedef struct
+{
+	const sasl_case_t * test;
+	int				sock;
+	char			nick[64];
+	int				user;
+	int				cap_started;
+	int				cap_ended;
+	int				registered;
+	char			mechanism[32];	/* empty if not authenticating */
+	int				step;
+	char			client_first[256];
+	char			server_first[256];
+	const char	  *	error;			/* the protocol errors the client made */
+} mock_t;
+
+
+static int connected;
+static int connect_errno;
+
+
+/*
+ * A compact SHA-256, HMAC-SHA-256 and PBKDF2, enough for the server side
+ * of SCRAM-SHA-256.
+ */
+typedef struct
+{
+	unsigned int		h[8];
+	unsigned char		block[64];
+	unsigned long long	length;
+} sha256_t;
+
+static const unsigned int sha256_k[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROR(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+
+
+static void sha256_block (sha256_t * sha)
+{
+	unsigned int w[64], v[8], t1, t2;
+	int i;
+
+	for ( i = 0; i < 16; i++ )
+		w[i] = sha->block[i*4] << 24 | sha->block[i*4+1] << 16 | sha->block[i*4+2] << 8 | sha->block[i*4+3];
+
+	for ( i = 16; i < 64; i++ )
+		w[i] = w[i-16] + (ROR (w[i-15], 7) ^ ROR (w[i-15], 18) ^ (w[i-15] >> 3))
+			+ w[i-7] + (ROR (w[i-2], 17) ^ ROR (w[i-2], 19) ^ (w[i-2] >> 10));
+
+	memcpy (v, sha->h, sizeof(v));
+
+	for ( i = 0; i < 64; i++ )
+	{
+		t1 = v[7] + (ROR (v[4], 6) ^ ROR (v[4], 11) ^ ROR (v[4], 25))
+			+ ((v[4] & v[5]) ^ (~v[4] & v[6])) + sha256_k[i] + w[i];
+		t2 = (ROR (v[0], 2) ^ ROR (v[0], 13) ^ ROR (v[0], 22))
+			+ ((v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]));
+
+		memmove (v + 1, v, sizeof(v) - sizeof(v[0]));
+		v[4] += t1;
+		v[0] = t1 + t2;
+	}
+
+	for ( i = 0; i < 8; i++ )
+		sha->h[i] += v[i];
+}
+
+
+static void sha256_init (sha256_t * sha)
+{
+	static const unsigned int h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+	memcpy (sha->h, h, sizeof(h));
+	sha->length = 0;
+}
+
+
+static void sha256_update (sha256_t * sha, const void * data, size_t length)
+{
+	const unsigned char * p = (const unsigned char *) data;
+
+	while ( length-- )
+	{
+		sha->block[sha->length++ % 64] = *p++;
+
+		if ( sha->length % 64 == 0 )
+			sha256_block (sha);
+	}
+}
+
+
+static void sha256_result (sha256_t * sha, unsigned char * digest)
+{
+	unsigned long long bits = sha->length * 8;
+	unsigned char pad = 0x80;
+	int i;
+
+	sha256_update (sha, &pad, 1);
+	pad = 0;
+
+	while ( sha->length % 64 != 56 )
+		sha256_update (sha, &pad, 1);
+
+	for ( i = 7; i >= 0; i-- )
+	{
+		pad = (unsigned char) (bits >> (i * 8));
+		sha256_update (sha, &pad, 1);
+	}
+
+	for ( i = 0; i < 32; i++ )
+		digest[i] = (unsigned char) (sha->h[i / 4] >> (24 - (i % 4) * 8));
+}
+
+
+static void sha256 (const void * data, size_t length, unsigned char * digest)
+{
+	sha256_t sha;
+
+	sha256_init (&sha);
+	sha256_update (&sha, data, length);
+	sha256_result (&sha, digest);
+}
+
+
+static void hmac_sha256 (const void * key, size_t keylen, const void * data, size_t length, unsigned char * digest)
+{
+	unsigned char pad[64], inner[32];
+	sha256_t sha;
+	int i;
+
+	// The keys here are never longer than a block
+	memset (pad, 0, sizeof(pad));
+	memcpy (pad, key, keylen);
+
+	for ( i = 0; i < 64; i++ )
+		pad[i] ^= 0x36;
+
+	sha256_init (&sha);
+	sha256_update (&sha, pad, sizeof(pad));
+	sha256_update (&sha, data, length);
+	sha256_result (&sha, inner);
+
+	for ( i = 0; i < 64; i++ )
+		pad[i] ^= 0x36 ^ 0x5c;
+
+	sha256_init (&sha);
+	sha256_update (&sha, pad, sizeof(pad));
+	sha256_update (&sha, inner, sizeof(inner));
+	sha256_result (&sha, digest);
+}
+
+
+/*
+ * PBKDF2 with HMAC-SHA-256, the Hi() of SCRAM; one block is enough.
+ */
+static void pbkdf2_sha256 (const char * password, const unsigned char * salt, size_t saltlen, unsigned int iterations, unsigned char * result)
+{
+	unsigned char buf[128], u[32];
+	unsigned int i, j;
+
+	memcpy (buf, salt, saltlen);
+	memcpy (buf + saltlen, "\0\0\0\1", 4);
+	hmac_sha256 (password, strlen (password), buf, saltlen + 4, u);
+	memcpy (result, u, sizeof(u));
+
+	for ( i = 1; i < iterations; i++ )
+	{
+		hmac_sha256 (password, strlen (password), u, sizeof(u), u);
+
+		for ( j = 0; j < sizeof(u); j++ )
+			result[j] ^= u[j];
+	}
+}
+
+
+static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+static void base64_encode (char * out, const unsigned char * data, size_t length)
+{
+	size_t i;
+
+	for ( i = 0; i < length; i += 3 )
+	{
+		unsigned int v = data[i] << 16 | (i + 1 < length ? data[i+1] << 8 : 0) | (i + 2 < length ? data[i+2] : 0);
+
+		*out++ = base64_chars[v >> 18];
+		*out++ = base64_chars[(v >> 12) & 63];
+		*out++ = i + 1 < length ? base64_chars[(v >> 6) & 63] : '=';
+		*out++ = i + 2 < length ? base64_chars[v & 63] : '=';
+	}
+
+	*out = '\0';
+}
+
+
+/*
+ * Decodes into a zero-terminated buffer; returns the length.
+ */
+static size_t base64_decode (unsigned char * out, const char * text)
+{
+	unsigned int v = 0, bits = 0;
+	size_t length = 0;
+	const char * p;
+
+	for ( ; *text && *text != '='; text++ )
+	{
+		if ( (p = strchr (base64_chars, *text)) == 0 )
+			break;
+
+		v = v << 6 | (unsigned int) (p - base64_chars);
+
+		if ( (bits += 6) >= 8 )
+		{
+			bits -= 8;
+			out[length++] = (unsigned char) (v >> bits);
+		}
+	}
+
+	out[length] = '\0';
+	return length;
+}
+
+
+static void mock_send (mock_t * mock, const char * fmt, ...)
+{
+	char line[1024];
+	va_list va;
+	int length;
+
+	va_start (va, fmt);
+	length = vsnprintf (line, sizeof(line) - 2, fmt, va);
+	va_end (va);
+
+	strcpy (line + length, "\r\n");
+
+	if ( send (mock->sock, line, length + 2, 0) < 0 )
+		mock->error = "send failed";
+}
+
+
+static void mock_sasl_done (mock_t * mock, int success)
+{
+	if ( success )
+	{
+		mock_send (mock, ":mock 900 %s %s!u@h %s :You are now logged in as %s", mock->nick, mock->nick, ACCOUNT, ACCOUNT);
+		mock_send (mock, ":mock 903 %s :SASL authentication successful", mock->nick);
+	}
+	else
+		mock_send (mock, ":mock 904 %s :SASL authentication failed", mock->nick);
+
+	mock->mechanism[0] = '\0';
+}
+
+
+/*
+ * SCRAM-SHA-256, the server side: answers the client-first-message, then
+ * checks the client proof and answers with the server signature. The
+ * impostor does not know the password, so it takes any proof and signs
+ * with a wrong one; the client must refuse it.
+ */
+static void mock_scram (mock_t * mock, const char * data)
+{
+	static const char first[] = "n,,n=" ACCOUNT ",r=";
+	static const unsigned char salt[] = "mock salt";
+	unsigned char salted[32], client_key[32], stored_key[32], server_key[32];
+	unsigned char signature[32], proof[64], check[32];
+	char auth[1024], encoded[128], message[256];
+	const char * p;
+	int i;
+
+	if ( mock->step == 0 )
+	{
+		// n,,n=bot,r=nonce
+		if ( strncmp (data, first, sizeof(first) - 1) || strlen (data) > 100 )
+		{
+			mock_sasl_done (mock, 0);
+			return;
+		}
+
+		strcpy (mock->client_first, data + 3);
+		base64_encode (encoded, salt, sizeof(salt) - 1);
+		snprintf (mock->server_first, sizeof(mock->server_first), "r=%.100sMOCKNONCE,s=%s,i=%d", data + sizeof(first) - 1, encoded, ITERATIONS);
+		base64_encode (message, (const unsigned char *) mock->server_first, strlen (mock->server_first));
+		mock_send (mock, "AUTHENTICATE %s", message);
+		mock->step++;
+		return;
+	}
+
+	if ( mock->step == 1 )
+	{
+		// c=biws,r=nonce,p=proof
+		if ( (p = strstr (data, ",p=")) == 0 || base64_decode (proof, p + 3) != 32 )
+		{
+			mock_sasl_done (mock, 0);
+			return;
+		}
+
+		pbkdf2_sha256 (mock->test->impostor ? "not" PASSWORD : PASSWORD, salt, sizeof(salt) - 1, ITERATIONS, salted);
+		hmac_sha256 (salted, sizeof(salted), "Client Key", 10, client_key);
+		hmac_sha256 (salted, sizeof(salted), "Server Key", 10, server_key);
+		sha256 (client_key, sizeof(client_key), stored_key);
+
+		snprintf (auth, sizeof(auth), "%s,%s,%.*s", mock->client_first, mock->server_first, (int) (p - data), data);
+		hmac_sha256 (stored_key, sizeof(stored_key), auth, strlen (auth), signature);
+
+		// The proof is ClientKey XOR ClientSignature
+		for ( i = 0; i < 32; i++ )
+			proof[i] ^= signature[i];
+
+		sha256 (proof, 32, check);
+
+		if ( !mock->test->impostor && memcmp (check, stored_key, sizeof(check)) )
+		{
+			mock_sasl_done (mock, 0);
+			return;
+		}
+
+		hmac_sha256 (server_key, sizeof(server_key), auth, strlen (auth), signature);
+		strcpy (message, "v=");
+		base64_encode (message + 2, signature, sizeof(signature));
+		base64_encode (encoded, (const unsigned char *) message, strlen (message));
+		mock_send (mock, "AUTHENTICATE %s", encoded);
+		mock->step++;
+		return;
+	}
+
+	// The client accepted the server signature
+	mock_sasl_done (mock, data[0] == '\0');
+}
+
+
+static void mock_authenticate (mock_t * mock, const char * arg)
+{
+	unsigned char data[512];
+
+	if ( !strcmp (arg, "*") )
+	{
+		mock_send (mock, ":mock 906 %s :SASL authentication aborted", mock->nick);
+		mock->mechanism[0] = '\0';
+		return;
+	}
+
+	if ( !mock->mechanism[0] )
+	{
+		if ( strcmp (arg, "PLAIN") && strcmp (arg, "SCRAM-SHA-256") )
+		{
+			mock_send (mock, ":mock 908 %s PLAIN,SCRAM-SHA-256 :are available SASL mechanisms", mock->nick);
+			mock_send (mock, ":mock 904 %s :SASL authentication failed", mock->nick);
+			return;
+		}
+
+		snprintf (mock->mechanism, sizeof(mock->mechanism), "%s", arg);
+		mock->step = 0;
+		mock_send (mock, "AUTHENTICATE +");
+		return;
+	}
+
+	if ( strlen (arg) >= 400 )
+	{
+		mock->error = "the messages are short, and fit a line";
+		return;
+	}
+
+	if ( strcmp (arg, "+") )
+		base64_decode (data, arg);
+	else
+		data[0] = '\0';
+
+	if ( !strcmp (mock->mechanism, "PLAIN") )
+	{
+		// authzid NUL authcid NUL password
+		const char * authcid = (const char *) data + strlen ((const char *) data) + 1;
+		const char * password = authcid + strlen (authcid) + 1;
+
+		mock_sasl_done (mock, !strcmp (authcid, ACCOUNT) && !strcmp (password, PASSWORD));
+	}
+	else
+		mock_scram (mock, (const char *) data);
+}
+
+
+static void mock_line (mock_t * mock, char * line)
+{
+	char * cmd = line, * arg = strchr (line, ' ');
+
+	if ( arg )
+		*arg++ = '\0';
+	else
+		arg = "";
+
+	if ( !strcmp (cmd, "CAP") && !strncmp (arg, "LS", 2) )
+	{
+		mock->cap_started = 1;
+		mock_send (mock, ":mock CAP * LS :%s", mock->test->caps);
+	}
+	else if ( !strcmp (cmd, "CAP") && !strncmp (arg, "REQ ", 4) )
+	{
+		arg += 4 + (arg[4] == ':');
+
+		if ( !strcmp (arg, "sasl") && strstr (mock->test->caps, "sasl") )
+			mock_send (mock, ":mock CAP * ACK :sasl");
+		else
+			mock_send (mock, ":mock CAP * NAK :%s", arg);
+	}
+	else if ( !strcmp (cmd, "CAP") && !strcmp (arg, "END") )
+	{
+		if ( mock->mechanism[0] )
+			mock->error = "CAP END before the authentication is over";
+
+		mock->cap_ended = 1;
+	}
+	else if ( !strcmp (cmd, "NICK") )
+		snprintf (mock->nick, sizeof(mock->nick), "%s", arg);
+	else if ( !strcmp (cmd, "USER") )
+		mock->user = 1;
+	else if ( !strcmp (cmd, "AUTHENTICATE") )
+		mock_authenticate (mock, arg);
+	else if ( !strcmp (cmd, "QUIT") )
+	{
+		mock_send (mock, "ERROR :Closing link");
+		shutdown (mock->sock, SHUT_RDWR);
+	}
+
+	if ( !mock->registered && mock->nick[0] && mock->user && (mock->cap_ended || !mock->cap_started) )
+	{
+		mock->registered = 1;
+		mock_send (mock, ":mock 001 %s :Welcome to the mock network", mock->nick);
+		mock_send (mock, ":mock 376 %s :End of MOTD", mock->nick);
+	}
+}
+
+
+/*
+ * Serves a single connection, until it is closed.
+ */
+static void * mock_run (void * arg)
+{
+	mock_t * mock = (mock_t *) arg;
+	char buf[4096], * line, * eol;
+	unsigned int used = 0;
+	int length;
+
+	while ( (length = recv (mock->sock, buf + used, sizeof(buf) - used - 1, 0)) > 0 )
+	{
+		used += length;
+		buf[used] = '\0';
+
+		for ( line = buf; (eol = strchr (line, '\n')) != 0; line = eol + 1 )
+		{
+			*eol = '\0';
+
+			if ( eol > line && eol[-1] == '\r' )
+				eol[-1] = '\0';
+
+			mock_line (mock, line);
+		}
+
+		used -= line - buf;
+		memmove (buf, line, used);
+	}
+
+	close (mock->sock);
+	return 0;
+}
+
+
+static void event_connect (irc_session_t * session, const char * event, const char * origin, const char ** params, unsigned int count)
+{
+	connected = 1;
+	connect_errno = irc_errno (session);
+	irc_cmd_quit (session, 0);
+}
+
+
+static int check (const sasl_case_t * test, int listener, unsigned short port)
+{
+	struct timeval timeout = { 5, 0 };
+	irc_callbacks_t callbacks;
+	irc_session_t * session;
+	pthread_t thread;
+	mock_t mock;
+	int ok;
+
+	memset (&callbacks, 0, sizeof(callbacks));
+	callbacks.event_connect = event_connect;
+	connected = 0;
+	connect_errno = -1;
+
+	memset (&mock, 0, sizeof(mock));
+	mock.test = test;
+
+	if ( (session = irc_create_session (&callbacks)) == 0
+	|| irc_sasl_set (session, test->mechanism, ACCOUNT, test->password)
+	|| irc_connect (session, "127.0.0.1", port, 0, "bot", 0, 0)
+	|| (mock.sock = accept (listener, 0, 0)) < 0 )
+	{
+		printf ("%-36s could not connect\n", test->name);
+		return 0;
+	}
+
+	// A client which never finishes would hang the check otherwise
+	setsockopt (mock.sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	pthread_create (&thread, 0, mock_run, &mock);
+
+	irc_run (session);
+	pthread_join (thread, 0);
+	irc_destroy_session (session);
+
+	ok = connected && connect_errno == test->expected && !mock.error;
+
+	printf ("%-36s %s", test->name, ok ? "passed" : "FAILED");
+
+	if ( !connected )
+		printf (", not connected");
+	else if ( connect_errno != test->expected )
+		printf (", irc_errno() %d, expected %d", connect_errno, test->expected);
+
+	if ( mock.error )
+		printf (", %s", mock.error);
+
+	printf ("\n");
+	return ok;
+}
+
+
+int main (int argc, char ** argv)
+{
+	static const sasl_case_t tests[] =
+	{
+		{ "PLAIN",								LIBIRC_SASL_PLAIN,			PASSWORD,	"sasl=PLAIN,SCRAM-SHA-256",	0, 0 },
+		{ "PLAIN, wrong password",				LIBIRC_SASL_PLAIN,			"wrong",	"sasl=PLAIN,SCRAM-SHA-256",	0, LIBIRC_ERR_AUTH },
+		{ "PLAIN, server without SASL",			LIBIRC_SASL_PLAIN,			PASSWORD,	"multi-prefix",				0, LIBIRC_ERR_AUTH },
+		{ "PLAIN, mechanism not offered",		LIBIRC_SASL_PLAIN,			PASSWORD,	"sasl=SCRAM-SHA-256",		0, LIBIRC_ERR_AUTH },
+		{ "SCRAM-SHA-256",						LIBIRC_SASL_SCRAM_SHA_256,	PASSWORD,	"sasl=PLAIN,SCRAM-SHA-256",	0, 0 },
+		{ "SCRAM-SHA-256, wrong password",		LIBIRC_SASL_SCRAM_SHA_256,	"wrong",	"sasl=PLAIN,SCRAM-SHA-256",	0, LIBIRC_ERR_AUTH },
+		{ "SCRAM-SHA-256, server impostor",		LIBIRC_SASL_SCRAM_SHA_256,	PASSWORD,	"sasl",						1, LIBIRC_ERR_AUTH },
+	};
+
+	struct sockaddr_in sa;
+	socklen_t salen = sizeof(sa);
+	unsigned int i, passed = 0;
+	int listener;
+
+	memset (&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+
+	if ( (listener = socket (AF_INET, SOCK_STREAM, 0)) < 0
+	|| bind (listener, (struct sockaddr *) &sa, sizeof(sa))
+	|| listen (listener, 1)
+	|| getsockname (listener, (struct sockaddr *) &sa, &salen) )
+	{
+		printf ("Could not start the server\n");
+		return 1;
+	}
+
+	for ( i = 0; i < sizeof(tests) / sizeof(tests[0]); i++ )
+		passed += check (tests + i, listener, ntohs (sa.sin_port));
+
+	close (listener);
+	printf ("%s\n", passed == i ? "OK" : "FAILED");
+	return passed == i ? 0 : 1;
+}
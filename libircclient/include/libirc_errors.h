@@ -228,8 +228,18 @@
 #define LIBIRC_ERR_SSL_CERT_VERIFY_FAILED	20
 
 
+/*! \brief SASL authentication failed
+ * 
+ * The SASL authentication set by irc_sasl_set() did not succeed: the server does not support it
+ * or the mechanism, or rejected the credentials. The connection is registered anyway, without
+ * the account. irc_errno() returns this error in the event_connect callback.
+ * \ingroup errorcodes
+ */
+#define LIBIRC_ERR_AUTH						21
+
+
 // Internal max error value count.
 // If you added more errors, add them to errors.c too!
-#define LIBIRC_ERR_MAX			21
+#define LIBIRC_ERR_MAX			22
 
 #endif /* INCLUDE_IRC_ERRORS_H */
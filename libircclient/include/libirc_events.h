@@ -108,7 +108,7 @@ typedef void (*irc_event_dcc_chat_t) (irc_session_t * session, const char * nick
 
 
 /*!
- * \fn typedef void (*irc_event_dcc_send_t) (irc_session_t * session, const char * nick, const char * addr, const char * filename, unsigned long size, irc_dcc_t dccid)
+ * \fn typedef void (*irc_event_dcc_send_t) (irc_session_t * session, const char * nick, const char * addr, const char * filename, irc_dcc_size_t size, irc_dcc_t dccid)
  * \brief A remote DCC CHAT request callback
  *
  * \param session the session, which generates an event
@@ -127,7 +127,180 @@ typedef void (*irc_event_dcc_chat_t) (irc_session_t * session, const char * nick
  * \sa irc_dcc_accept or irc_dcc_decline
  * \ingroup events
  */
-typedef void (*irc_event_dcc_send_t) (irc_session_t * session, const char * nick, const char * addr, const char * filename, unsigned long size, irc_dcc_t dccid);
+typedef void (*irc_event_dcc_send_t) (irc_session_t * session, const char * nick, const char * addr, const char * filename, irc_dcc_size_t size, irc_dcc_t dccid);
+
+
+/*!
+ * \fn typedef void (*irc_event_dcc_resume_t) (irc_session_t * session, const char * nick, irc_dcc_t dccid, irc_dcc_size_t * position)
+ * \brief A remote DCC RESUME request callback
+ *
+ * \param session  the session, which generates an event
+ * \param nick     the person who wants to resume the file transfer.
+ * \param dccid    the id of the file transfer, as returned by irc_dcc_sendfile().
+ * \param position the position the receiver wants to resume from. You may
+ *                 change it, for example set it to 0 to send the whole file.
+ *
+ * This callback is called when the receiver of a file you offered with 
+ * irc_dcc_sendfile() asks to resume the transfer from the specified 
+ * position. After the callback returns, the position is confirmed with 
+ * DCC ACCEPT, and the file is sent starting from it. Positions beyond the
+ * end of file are ignored.
+ *
+ * \sa irc_dcc_sendfile irc_dcc_resume
+ * \ingroup events
+ */
+typedef void (*irc_event_dcc_resume_t) (irc_session_t * session, const char * nick, irc_dcc_t dccid, irc_dcc_size_t * position);
+
+
+/*!
+ * \fn typedef void (*irc_event_dcc_queue_t) (irc_session_t * session, irc_dcc_t dccid, unsigned int position)
+ * \brief A DCC SEND queue position callback
+ *
+ * \param session  the session, which generates an event
+ * \param dccid    the id of the file transfer, as returned by irc_dcc_sendfile().
+ * \param position the new position in the queue, starting from 1, or 0 if
+ *                 the file has just been offered.
+ *
+ * This callback is called when a DCC SEND, queued because of the limits set
+ * by irc_dcc_set_send_slots(), moves in the queue or leaves it. It is only
+ * called when the position changes.
+ *
+ * \sa irc_dcc_set_send_slots irc_dcc_set_priority
+ * \ingroup events
+ */
+typedef void (*irc_event_dcc_queue_t) (irc_session_t * session, irc_dcc_t dccid, unsigned int position);
+
+
+/*!
+ * \brief A line of an aggregated reply.
+ *
+ * The numeric and its params, without the nick it is sent to.
+ * \ingroup events
+ */
+typedef struct
+{
+	unsigned int	code;
+	const char	**	params;
+	unsigned int	count;
+
+} irc_reply_line_t;
+
+
+/*!
+ * \fn typedef void (*irc_event_reply_t) (irc_session_t * session, unsigned int event, const char * key, const irc_reply_line_t * lines, unsigned int count)
+ * \brief An aggregated reply callback
+ *
+ * \param session the session, which generates an event
+ * \param event   the numeric of the lines: 353 for NAMES, 352 or 354 for WHO,
+ *                322 for LIST, 367 for the ban list, 348 for the exception
+ *                list or 346 for the invite list.
+ * \param key     the channel, or the WHO mask; empty for LIST.
+ * \param lines   the lines of the reply, in the order they came.
+ * \param count   the number of the lines, which could be 0.
+ *
+ * This callback is called with LIBIRC_OPTION_AGGREGATE_REPLIES set, once
+ * the numeric which ends the reply arrives. The lines and their params are
+ * only valid until the callback returns.
+ *
+ * \ingroup events
+ */
+typedef void (*irc_event_reply_t) (irc_session_t * session, unsigned int event, const char * key, const irc_reply_line_t * lines, unsigned int count);
+
+
+/*!
+ * \fn typedef void (*irc_query_callback_t) (irc_session_t * session, irc_query_t query, int status, void * ctx, const irc_reply_line_t * lines, unsigned int count)
+ * \brief A query completion callback
+ *
+ * \param session the session, which generates an event
+ * \param query   the query id.
+ * \param status  0 if the server replied, LIBIRC_ERR_TIMEOUT if it did not
+ *                reply in a minute, or LIBIRC_ERR_CLOSED if the session 
+ *                reconnected or is being destroyed.
+ * \param ctx     the context passed to the query function.
+ * \param lines   the lines of the reply, in the order they came. An error
+ *                numeric, such as ERR_NOSUCHNICK, is a line too.
+ * \param count   the number of the lines.
+ *
+ * The lines and their params are only valid until the callback returns.
+ *
+ * \sa irc_query_whois irc_query_who irc_query_mode
+ * \ingroup events
+ */
+typedef void (*irc_query_callback_t) (irc_session_t * session, irc_query_t query, int status, void * ctx, const irc_reply_line_t * lines, unsigned int count);
+
+
+/*!
+ * \brief A message of a batch.
+ *
+ * The message as it was received, with the server-time tag parsed.
+ * \ingroup events
+ */
+typedef struct
+{
+	const char		  *	tags;		/*!< The message tags, see irc_batch_message_tag() */
+	unsigned long long	time;		/*!< The server-time, milliseconds since the epoch, or 0 */
+	const char		  *	origin;		/*!< The origin, or 0 */
+	const char		  *	command;	/*!< The command, or the three digits of a numeric */
+	const char		 **	params;
+	unsigned int		count;
+
+} irc_batch_message_t;
+
+
+/*!
+ * \fn typedef void (*irc_event_batch_t) (irc_session_t * session, const char * type, const char ** params, unsigned int count, const irc_batch_message_t * messages, unsigned int mcount)
+ * \brief A batch callback
+ *
+ * \param session  the session, which generates an event
+ * \param type     the batch type: "chathistory", "netsplit" or "netjoin".
+ * \param params   the params of the batch after the type, such as the 
+ *                 chathistory target or the netsplit servers.
+ * \param count    the number of the params.
+ * \param messages the messages of the batch, in the order they came.
+ * \param mcount   the number of the messages.
+ *
+ * This callback is called with LIBIRC_OPTION_COLLECT_BATCHES set, when the
+ * batch ends. The messages are only valid until the callback returns.
+ *
+ * \ingroup events
+ */
+typedef void (*irc_event_batch_t) (irc_session_t * session, const char * type, const char ** params, unsigned int count, const irc_batch_message_t * messages, unsigned int mcount);
+
+
+/*!
+ * \brief A user of a netsplit.
+ *
+ * A user who quit in a netsplit, or joined a channel coming back.
+ * \ingroup events
+ */
+typedef struct
+{
+	const char	*	origin;		/*!< The user, as in the QUIT or JOIN */
+	const char	*	channel;	/*!< The channel joined, or 0 for NETSPLIT */
+
+} irc_netsplit_user_t;
+
+
+/*!
+ * \fn typedef void (*irc_event_netsplit_t) (irc_session_t * session, const char * event, const char * servers, const irc_netsplit_user_t * users, unsigned int count)
+ * \brief A netsplit callback
+ *
+ * \param session the session, which generates an event
+ * \param event   "NETSPLIT" when the users quit, or "NETJOIN" when they
+ *                come back.
+ * \param servers the two servers which split, as in the QUIT reason.
+ * \param users   the users who quit, or the channels they joined.
+ * \param count   the number of the users.
+ *
+ * This callback is called with LIBIRC_OPTION_DETECT_NETSPLITS set, instead
+ * of the event_quit and event_join of the users. NETSPLIT is called once
+ * the QUITs stop, before the state tracker drops the users. A user who
+ * joins several channels is listed once for each. The users are only
+ * valid until the callback returns.
+ *
+ * \ingroup events
+ */
+typedef void (*irc_event_netsplit_t) (irc_session_t * session, const char * event, const char * servers, const irc_netsplit_user_t * users, unsigned int count);
 
 
 /*! \brief Event callbacks structure.
@@ -154,6 +327,8 @@ typedef struct
 	 * The "on_connect" event is triggered when the client successfully 
 	 * connects to the server, and could send commands to the server.
      * No extra params supplied; \a params is 0.
+	 * If the SASL authentication set by irc_sasl_set() failed, irc_errno()
+	 * returns LIBIRC_ERR_AUTH within this event.
 	 */
 	irc_event_callback_t	event_connect;
 
@@ -382,6 +557,57 @@ typedef struct
 	 */
 	irc_event_dcc_send_t		event_dcc_send_req;
 
+	/*!
+	 * The "dcc resume" event is triggered when the receiver of a file you 
+	 * offered via DCC SEND asks to resume the transfer.
+     *
+     * See the params in ::irc_event_dcc_resume_t specification.
+	 */
+	irc_event_dcc_resume_t		event_dcc_resume_req;
+
+	/*!
+	 * The "dcc queue" event is triggered when a queued DCC SEND changes its
+	 * position in the queue, or is offered to the receiver.
+     *
+     * See the params in ::irc_event_dcc_queue_t specification.
+	 */
+	irc_event_dcc_queue_t		event_dcc_queue;
+
+	/*!
+	 * The "presence" event is triggered when a nick added by irc_monitor_add()
+	 * comes online or goes offline, and when its presence is first known
+	 * after the connection.
+	 *
+	 * \param event "ONLINE" or "OFFLINE".
+	 * \param origin the nick, with the user@host if the server tells it.
+	 * No extra params supplied; \a params is 0.
+	 */
+	irc_event_callback_t		event_presence;
+
+	/*!
+	 * The "reply" event is triggered with LIBIRC_OPTION_AGGREGATE_REPLIES
+	 * set, when a NAMES, WHO, LIST or channel list reply is complete.
+     *
+     * See the params in ::irc_event_reply_t specification.
+	 */
+	irc_event_reply_t			event_reply;
+
+	/*!
+	 * The "batch" event is triggered with LIBIRC_OPTION_COLLECT_BATCHES
+	 * set, when a chathistory, netsplit or netjoin batch ends.
+     *
+     * See the params in ::irc_event_batch_t specification.
+	 */
+	irc_event_batch_t			event_batch;
+
+	/*!
+	 * The "netsplit" event is triggered with LIBIRC_OPTION_DETECT_NETSPLITS
+	 * set, when the QUITs of a netsplit stop, and when the JOINs of the
+	 * users coming back stop.
+     *
+     * See the params in ::irc_event_netsplit_t specification.
+	 */
+	irc_event_netsplit_t		event_netsplit;
 
 } irc_callbacks_t;
 
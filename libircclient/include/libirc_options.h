@@ -53,4 +53,292 @@
 #define LIBIRC_OPTION_SSL_NO_VERIFY (1 << 3)
 
 
+/*! \brief Offers the files using DCC TSEND instead of DCC SEND.
+ *
+ * In TSEND ("turbo send") mode the receiver does not acknowledge the 
+ * received data, so the file is streamed without waiting for the peer.
+ * Only set this option if you know the receiving client supports TSEND.
+ * Incoming TSEND offers are always accepted regardless of this option.
+ * \ingroup options
+ */
+#define LIBIRC_OPTION_DCC_TSEND		(1 << 4)
+
+
+/*! \brief Reads and writes the DCC files in a separate thread.
+ *
+ * The files sent by irc_dcc_sendfile() and received by irc_dcc_accept_to_file()
+ * are read and written by a separate I/O thread, with the next file block
+ * read ahead while the current one is being sent. So a slow disk or network
+ * file system does not delay the IRC traffic, and the connection does not 
+ * time out during the large transfers. The files are not sent with
+ * sendfile() in this mode. 
+ *
+ * Requires the thread support; otherwise the files are accessed in place.
+ * This option only affects the DCC sessions created after it is set.
+ * \ingroup options
+ */
+#define LIBIRC_OPTION_DCC_ASYNC_IO	(1 << 5)
+
+
+/*! \brief Makes passive (reverse) DCC offers.
+ *
+ * The offers made by irc_dcc_chat() and irc_dcc_sendfile() carry port 0 and
+ * a token instead of a listening port. The receiver listens and replies with
+ * its own address, and libircclient connects to it. Set this option when 
+ * the peers cannot connect to you, for example behind a NAT. The receiving
+ * client must support the passive DCC. Incoming passive offers are always 
+ * handled regardless of this option.
+ * \ingroup options
+ */
+#define LIBIRC_OPTION_DCC_PASSIVE	(1 << 6)
+
+
+/*! \brief Computes the CRC32 of the DCC file transfers.
+ *
+ * The CRC32 (the one used by zip and gzip) of the file data is computed as
+ * it is sent or received, and obtained with irc_dcc_get_digest(), usually
+ * from the completion callback. So the received files do not need to be 
+ * read again to verify them. The files are not sent with sendfile() when
+ * a digest is computed. This option only affects the DCC sessions created
+ * after it is set.
+ * \ingroup options
+ */
+#define LIBIRC_OPTION_DCC_CRC32		(1 << 7)
+
+
+/*! \brief Computes the SHA-256 of the DCC file transfers.
+ *
+ * Same as LIBIRC_OPTION_DCC_CRC32, but computes the SHA-256 digest. Both
+ * options could be set together. When the library is built with OpenSSL,
+ * its implementation is used, which takes advantage of the CPU SHA 
+ * extensions.
+ * \ingroup options
+ */
+#define LIBIRC_OPTION_DCC_SHA256	(1 << 8)
+
+
+/*! \brief Tracks the channels we are in, their members and the user hosts.
+ *
+ * The library follows JOIN, PART, KICK, QUIT, NICK, MODE, the NAMES and WHO
+ * replies and CHGHOST to keep the members of every channel we are in with 
+ * their modes, and the user@host of the members. The state is queried with
+ * the irc_state_* functions instead of tracking it in the event callbacks. 
+ * It is updated before the JOIN, NICK and MODE events and after the PART, 
+ * KICK and QUIT events, so the events see the members involved. Set it 
+ * before joining the channels; the state is cleared on every connection.
+ * \ingroup state
+ */
+#define LIBIRC_OPTION_TRACK_STATE	(1 << 9)
+
+
+/*! \brief Delivers the multi-line replies as a single event.
+ *
+ * The lines of the NAMES, WHO, LIST, ban list, exception list and invite
+ * list replies are collected instead of being passed to event_numeric one
+ * by one. The whole reply is passed to event_reply when its end numeric
+ * arrives, which is not passed to event_numeric either. The state tracker
+ * still follows the lines as they come. Has no effect unless event_reply
+ * is set.
+ * \ingroup events
+ */
+#define LIBIRC_OPTION_AGGREGATE_REPLIES	(1 << 10)
+
+
+/*! \brief Delivers the IRCv3 batches as a single event.
+ *
+ * With the batch capability enabled, the messages of the chathistory, 
+ * netsplit and netjoin batches are collected instead of being dispatched
+ * one by one. The whole batch is passed to event_batch when it ends. The
+ * QUITs of a netsplit and the JOINs of a netjoin still update the state 
+ * tracker as they come. The other batches, such as the labeled replies, 
+ * are dispatched as usual. Has no effect unless event_batch is set.
+ * \ingroup events
+ */
+#define LIBIRC_OPTION_COLLECT_BATCHES	(1 << 11)
+
+
+/*! \brief Delivers the netsplits as single events.
+ *
+ * The QUITs with two server names as the reason are held until they stop
+ * for two seconds, and delivered to event_netsplit as one NETSPLIT event.
+ * The state tracker then drops all the split users at once. The JOINs of
+ * the split users coming back are delivered as NETJOIN events the same
+ * way, but the tracker follows them as they come. Has no effect unless
+ * event_netsplit is set.
+ * \ingroup events
+ */
+#define LIBIRC_OPTION_DETECT_NETSPLITS	(1 << 12)
+
+
+/*! \brief Preallocates the whole file in irc_dcc_accept_to_file().
+ *
+ * The disk space for the whole file is reserved before the transfer
+ * starts, which keeps the file unfragmented and reports the lack of 
+ * disk space immediately. Only supported on Linux; ignored elsewhere.
+ * \ingroup dccstuff
+ */
+#define LIBIRC_DCC_FILE_PREALLOCATE	(1 << 0)
+
+
+/*! \brief Resumes the transfer in irc_dcc_accept_to_file().
+ *
+ * If the file already exists, it is not truncated. Instead the sender is
+ * asked to send only the remaining part with DCC RESUME, as irc_dcc_resume()
+ * does.
+ * \ingroup dccstuff
+ */
+#define LIBIRC_DCC_FILE_RESUME		(1 << 1)
+
+
+/*! \brief Strips the color codes in irc_color_stream_init().
+ * \ingroup colors
+ */
+#define LIBIRC_COLOR_STRIP			1
+
+
+/*! \brief Converts the mIRC color codes to libircclient colors in irc_color_stream_init().
+ * \ingroup colors
+ */
+#define LIBIRC_COLOR_FROM_MIRC		2
+
+
+/*! \brief Converts the libircclient colors to mIRC color codes in irc_color_stream_init().
+ * \ingroup colors
+ */
+#define LIBIRC_COLOR_TO_MIRC		3
+
+
+/*! \brief Renders the mIRC color codes as ANSI escape sequences in irc_color_stream_init().
+ * \ingroup colors
+ */
+#define LIBIRC_COLOR_TO_ANSI		4
+
+
+/*! \brief Renders the mIRC color codes as HTML in irc_color_stream_init().
+ * \ingroup colors
+ */
+#define LIBIRC_COLOR_TO_HTML		5
+
+
+/*! \brief The output buffer size enough to convert the colors of len bytes.
+ *
+ * A single color code could expand to a long libircclient tag, so the output
+ * could be up to 18 times longer than the input. This size is enough for 
+ * any conversion of len bytes into a caller buffer, including a part of a
+ * streaming conversion, and the 0 terminator.
+ * \ingroup colors
+ */
+#define LIBIRC_COLOR_BOUND(len)		((len) * 18 + 128)
+
+
+/*! \brief The output buffer size enough to render len bytes as HTML.
+ *
+ * Every format code could close an HTML span and open another one with a 
+ * long inline style. This size is enough for LIBIRC_COLOR_TO_HTML the same
+ * way as LIBIRC_COLOR_BOUND() is for the other conversions.
+ * \ingroup colors
+ */
+#define LIBIRC_COLOR_HTML_BOUND(len)	((len) * 160 + 192)
+
+
+/*! \brief The channel member has voice (+v).
+ * \ingroup state
+ */
+#define LIBIRC_MEMBER_VOICE			(1 << 0)
+
+
+/*! \brief The channel member is a half-operator (+h).
+ * \ingroup state
+ */
+#define LIBIRC_MEMBER_HALFOP		(1 << 1)
+
+
+/*! \brief The channel member is an operator (+o).
+ * \ingroup state
+ */
+#define LIBIRC_MEMBER_OP			(1 << 2)
+
+
+/*! \brief The channel member is an administrator (+a).
+ * \ingroup state
+ */
+#define LIBIRC_MEMBER_ADMIN			(1 << 3)
+
+
+/*! \brief The channel member is the owner (+q).
+ * \ingroup state
+ */
+#define LIBIRC_MEMBER_OWNER			(1 << 4)
+
+
+/*! \brief The longest line the server accepts, with the CR LF.
+ *
+ * The LINELEN of RPL_ISUPPORT, or 512 as RFC 1459 defines.
+ * \ingroup isupport
+ */
+#define LIBIRC_LIMIT_LINELEN		0
+
+
+/*! \brief The longest nick the server accepts.
+ *
+ * The NICKLEN of RPL_ISUPPORT, or 9 as RFC 1459 defines.
+ * \ingroup isupport
+ */
+#define LIBIRC_LIMIT_NICKLEN		1
+
+
+/*! \brief The number of the channel modes with a parameter in a single MODE.
+ *
+ * The MODES of RPL_ISUPPORT, or 3 if not sent; 0 means no limit.
+ * \ingroup isupport
+ */
+#define LIBIRC_LIMIT_MODES			2
+
+
+/*! \brief The number of the targets of a single PRIVMSG or NOTICE.
+ *
+ * The MAXTARGETS of RPL_ISUPPORT, or 1 if not sent; 0 means no limit. The
+ * TARGMAX limits are obtained with irc_server_targmax().
+ * \ingroup isupport
+ */
+#define LIBIRC_LIMIT_MAXTARGETS		3
+
+
+/*! \brief The number of the nicks the MONITOR list could hold.
+ *
+ * The MONITOR of RPL_ISUPPORT; 0 means no limit, and -1 means the server
+ * does not support MONITOR.
+ * \ingroup isupport
+ */
+#define LIBIRC_LIMIT_MONITOR		4
+
+
+/*! \brief The number of the limits, not a limit itself.
+ * \ingroup isupport
+ */
+#define LIBIRC_LIMIT_MAX			5
+
+
+/*! \brief The SASL PLAIN mechanism of irc_sasl_set(): the password as is.
+ *
+ * Use it only over SSL connections, as the password is merely encoded.
+ * \ingroup caps
+ */
+#define LIBIRC_SASL_PLAIN			1
+
+
+/*! \brief The SASL EXTERNAL mechanism of irc_sasl_set(): the client certificate.
+ * \ingroup caps
+ */
+#define LIBIRC_SASL_EXTERNAL		2
+
+
+/*! \brief The SASL SCRAM-SHA-256 mechanism of irc_sasl_set(): a password proof.
+ *
+ * The password is not sent, and the server proves it knows the password too.
+ * \ingroup caps
+ */
+#define LIBIRC_SASL_SCRAM_SHA_256	3
+
+
 #endif /* INCLUDE_IRC_OPTIONS_H */
@@ -84,6 +84,71 @@ typedef struct irc_dcc_session_s	irc_dcc_session_t;
 typedef unsigned int				irc_dcc_t;
 
 
+/*! \brief A query identifier.
+ *
+ * The irc_query_t type identifies a query sent by irc_query_whois() and
+ * the other query functions, until its callback is called.
+ */
+typedef unsigned int				irc_query_t;
+
+
+/*! \brief A DCC file size or offset.
+ *
+ * The irc_dcc_size_t type is used for DCC file sizes and offsets. It is 
+ * 64-bit wide, so files larger than 4GB could be transferred.
+ */
+typedef unsigned long long			irc_dcc_size_t;
+
+
+/*! \brief The DCC file transfer statistics.
+ *
+ * The irc_dcc_stats_t structure is filled by irc_dcc_get_stats().
+ */
+typedef struct
+{
+	irc_dcc_size_t	size;			/*!< The file size */
+	irc_dcc_size_t	transferred;	/*!< The amount received, or sent and acknowledged */
+	unsigned int	rate;			/*!< The average transfer rate, bytes per second */
+	unsigned int	eta;			/*!< The estimated time left, seconds, or 0 if unknown */
+	unsigned int	queue_position;	/*!< The DCC SEND queue position, or 0 if not queued */
+
+} irc_dcc_stats_t;
+
+
+/*! \brief The digests of a DCC file transfer.
+ *
+ * The irc_dcc_digest_t structure is filled by irc_dcc_get_digest().
+ */
+typedef struct
+{
+	irc_dcc_size_t	offset;			/*!< The file offset the digests start from: 0, or the resume position */
+	irc_dcc_size_t	length;			/*!< The amount of the file data covered by the digests */
+	unsigned int	flags;			/*!< LIBIRC_OPTION_DCC_CRC32 and LIBIRC_OPTION_DCC_SHA256 bits of the computed digests */
+	unsigned int	crc32;			/*!< The CRC32 */
+	unsigned char	sha256[32];		/*!< The SHA-256 */
+
+} irc_dcc_digest_t;
+
+
+/*! \brief The state of a streaming color conversion.
+ *
+ * The irc_color_stream_t structure keeps the conversion state between the
+ * irc_color_stream_convert() calls: the open format modes, and a color 
+ * code split between the input parts. Its members are internal to 
+ * libircclient, and should not be used directly.
+ */
+typedef struct
+{
+	unsigned int	mode;
+	unsigned int	mask;
+	int				fgcolor;
+	int				bgcolor;
+	unsigned int	pending_length;
+	char			pending[32];
+
+} irc_color_stream_t;
+
+
 /*!
  * \fn typedef void (*irc_dcc_callback_t) (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length)
  * \brief A common DCC callback, used to inform you about the current DCC state or event.
@@ -129,6 +194,38 @@ typedef unsigned int				irc_dcc_t;
 typedef void (*irc_dcc_callback_t) (irc_session_t * session, irc_dcc_t id, int status, void * ctx, const char * data, unsigned int length);
 
 
+/*!
+ * \fn typedef void (*irc_state_member_callback_t) (irc_session_t * session, const char * channel, const char * nick, const char * host, unsigned int modes, void * ctx)
+ * \brief A callback to list the members of a tracked channel.
+ *
+ * \param session An IRC session.
+ * \param channel The channel name, as we joined it.
+ * \param nick    The member nick.
+ * \param host    The member user@host, or 0 if not known yet.
+ * \param modes   The member modes, the LIBIRC_MEMBER_* bits.
+ * \param ctx     The context passed to irc_state_members().
+ *
+ * \sa irc_state_members
+ * \ingroup state
+ */
+typedef void (*irc_state_member_callback_t) (irc_session_t * session, const char * channel, const char * nick, const char * host, unsigned int modes, void * ctx);
+
+
+/*!
+ * \fn typedef void (*irc_state_channel_callback_t) (irc_session_t * session, const char * channel, unsigned int members, void * ctx)
+ * \brief A callback to list the tracked channels.
+ *
+ * \param session An IRC session.
+ * \param channel The channel name, as we joined it.
+ * \param members The number of the channel members, including us.
+ * \param ctx     The context passed to irc_state_channels().
+ *
+ * \sa irc_state_channels
+ * \ingroup state
+ */
+typedef void (*irc_state_channel_callback_t) (irc_session_t * session, const char * channel, unsigned int members, void * ctx);
+
+
 #define IN_INCLUDE_LIBIRC_H
 #include "libirc_errors.h"
 #include "libirc_events.h"
@@ -1175,13 +1272,79 @@ int irc_dcc_msg	(irc_session_t * session, irc_dcc_t dccid, const char * text);
  * callback function - you may just return, and call it later. However, to
  * prevent memory leaks, you must call either irc_dcc_decline or 
  * irc_dcc_accept for any incoming DCC request.
+ *
+ * The offers may come with an IPv4 or IPv6 address. A passive offer (with 
+ * port 0 and a token) is accepted by listening on the local address of the
+ * IRC connection and sending it to the peer, which then connects to us.
  * 
- * \sa irc_dcc_decline event_dcc_chat_req event_dcc_send_req
+ * \sa irc_dcc_decline event_dcc_chat_req event_dcc_send_req LIBIRC_OPTION_DCC_PASSIVE
  * \ingroup dccstuff
  */
 int	irc_dcc_accept (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback);
 
 
+/*!
+ * \fn int irc_dcc_resume (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback, irc_dcc_size_t position)
+ * \brief Accepts a remote DCC RECVFILE request, resuming from the specified position.
+ *
+ * \param session An initiated and connected session.
+ * \param dccid   A DCC session ID, returned by appropriate callback.
+ * \param ctx     A user-supplied DCC session context, which will be passed 
+ *                to the DCC callback function. May be NULL.
+ * \param callback A DCC callback function, which will be called when 
+ *                the file data is received. Must not be NULL.
+ * \param position The amount of the file you already have, usually the
+ *                size of the partially received file.
+ *
+ * \return Return code 0 means success. Other value means error, the error 
+ *  code may be obtained through irc_errno().
+ *
+ * This function works like irc_dcc_accept(), but asks the sender to start
+ * from the specified position using the DCC RESUME request. The connection
+ * is established after the sender confirms it with DCC ACCEPT, and only
+ * the remaining part of the file is passed to the callback. It is up to 
+ * you to append it to the existing file. If the sender does not confirm
+ * the position, the callback is called with LIBIRC_ERR_TIMEOUT.
+ *
+ * The position 0 is the same as calling irc_dcc_accept().
+ *
+ * \sa irc_dcc_accept event_dcc_send_req
+ * \ingroup dccstuff
+ */
+int	irc_dcc_resume (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback, irc_dcc_size_t position);
+
+
+/*!
+ * \fn int irc_dcc_accept_to_file (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback, const char * path, unsigned int flags)
+ * \brief Accepts a remote DCC RECVFILE request, and stores the file on disk.
+ *
+ * \param session An initiated and connected session.
+ * \param dccid   A DCC session ID, returned by appropriate callback.
+ * \param ctx     A user-supplied DCC session context, which will be passed 
+ *                to the DCC callback function. May be NULL.
+ * \param callback A DCC callback function, which will be called to report
+ *                the progress and the result. Must not be NULL.
+ * \param path    The file to store the received data into.
+ * \param flags   A combination of LIBIRC_DCC_FILE_PREALLOCATE and 
+ *                LIBIRC_DCC_FILE_RESUME, or 0.
+ *
+ * \return Return code 0 means success. Other value means error, the error 
+ *  code may be obtained through irc_errno().
+ *
+ * This function works like irc_dcc_accept(), but the library writes the 
+ * received file itself, in large batches. The callback is not called with
+ * the data. Instead, each time a batch is written, it is called with 
+ * \a data set to 0 and \a length set to the amount written. When the whole
+ * file is written and closed, the callback is called with both set to 0.
+ * If the transfer fails, the data received so far is still written, so
+ * the transfer could be resumed later with LIBIRC_DCC_FILE_RESUME.
+ *
+ * \sa irc_dcc_accept irc_dcc_resume event_dcc_send_req
+ * \ingroup dccstuff
+ */
+int	irc_dcc_accept_to_file (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback, const char * path, unsigned int flags);
+
+
 /*!
  * \fn int irc_dcc_decline (irc_session_t * session, irc_dcc_t dccid)
  * \brief Declines a remote DCC CHAT or DCC RECVFILE request.
@@ -1270,6 +1433,642 @@ int irc_dcc_sendfile (irc_session_t * session, void * ctx, const char * nick, co
 int irc_dcc_destroy (irc_session_t * session, irc_dcc_t dccid);
 
 
+/*!
+ * \fn void irc_dcc_set_send_window (irc_session_t * session, unsigned int window)
+ * \brief Sets the amount of unacknowledged data a DCC SEND keeps in flight.
+ *
+ * \param session An initiated session.
+ * \param window  A window size in bytes.
+ *
+ * The DCC SEND receiver acknowledges every received block by sending back the
+ * total amount of data received so far. Instead of waiting for every block 
+ * to be acknowledged, libircclient keeps sending until the amount of 
+ * unacknowledged data reaches the window size, so the transfer speed is not
+ * limited by the round trip time. The default window is 64Kb; larger windows
+ * are useful on the links with a high latency. 
+ *
+ * The new value only affects the DCC sessions created after this call. It
+ * does not matter for DCC TSEND, where nothing is acknowledged.
+ *
+ * \sa irc_dcc_sendfile LIBIRC_OPTION_DCC_TSEND
+ * \ingroup dccstuff
+ */
+void irc_dcc_set_send_window (irc_session_t * session, unsigned int window);
+
+
+/*!
+ * \fn void irc_dcc_set_buffer_size (irc_session_t * session, unsigned int size)
+ * \brief Sets the size of the DCC file transfer buffers.
+ *
+ * \param session An initiated session.
+ * \param size    A buffer size in bytes.
+ *
+ * The DCC file transfers send and receive the file data through a buffer of
+ * this size, so larger buffers mean fewer system calls per transferred
+ * megabyte. The default size is 256Kb; it cannot be less than 1Kb. The 
+ * buffers are allocated when the transfer starts, and the freed ones are
+ * reused by the next transfers. 
+ *
+ * The DCC chats are not affected: their buffers start small and grow with
+ * the line length, up to 64Kb per line.
+ *
+ * The new value only affects the DCC sessions created after this call.
+ *
+ * \sa irc_dcc_sendfile irc_dcc_accept
+ * \ingroup dccstuff
+ */
+void irc_dcc_set_buffer_size (irc_session_t * session, unsigned int size);
+
+
+/*!
+ * \fn void irc_dcc_set_send_slots (irc_session_t * session, unsigned int total, unsigned int per_nick)
+ * \brief Limits the number of DCC SENDs running at once.
+ *
+ * \param session  An initiated session.
+ * \param total    Max number of running DCC SENDs, or 0 if unlimited.
+ * \param per_nick Max number of running DCC SENDs to the same nick, or 0 if unlimited.
+ *
+ * With the limits set, irc_dcc_sendfile() does not offer the file right 
+ * away, but puts the transfer into a queue. The queued transfers are offered
+ * when a slot frees up, the higher priority first (see irc_dcc_set_priority),
+ * and then in the order they were queued. A DCC SEND takes a slot from the 
+ * offer until it is finished, failed or destroyed. The queue positions are
+ * reported through the event_dcc_queue callback.
+ *
+ * The queued transfers do not time out; only the offered ones do.
+ *
+ * \sa irc_dcc_sendfile irc_dcc_set_priority irc_dcc_get_stats
+ * \ingroup dccstuff
+ */
+void irc_dcc_set_send_slots (irc_session_t * session, unsigned int total, unsigned int per_nick);
+
+
+/*!
+ * \fn int irc_dcc_set_priority (irc_session_t * session, irc_dcc_t dccid, int priority)
+ * \brief Sets the queue priority of a DCC SEND.
+ *
+ * \param session  An initiated session.
+ * \param dccid    A DCC SEND session id.
+ * \param priority A priority; the default is 0, the higher ones go first.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The priority only matters while the transfer waits in the queue.
+ *
+ * \sa irc_dcc_set_send_slots
+ * \ingroup dccstuff
+ */
+int irc_dcc_set_priority (irc_session_t * session, irc_dcc_t dccid, int priority);
+
+
+/*!
+ * \fn int irc_dcc_set_rate_limit (irc_session_t * session, irc_dcc_t dccid, unsigned int rate)
+ * \brief Limits the DCC SEND speed.
+ *
+ * \param session An initiated session.
+ * \param dccid   A DCC SEND session id, or 0 to limit all the DCC SENDs together.
+ * \param rate    The max speed in bytes per second, or 0 if unlimited.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * Both the transfer and the total limits apply at the same time. The speed
+ * is averaged over a second, so the data may go out in bursts; the sending
+ * is only resumed when the event loop runs, so the select() timeout should 
+ * be short enough. The received files are not limited.
+ *
+ * \sa irc_dcc_sendfile irc_dcc_get_stats
+ * \ingroup dccstuff
+ */
+int irc_dcc_set_rate_limit (irc_session_t * session, irc_dcc_t dccid, unsigned int rate);
+
+
+/*!
+ * \fn int irc_dcc_get_stats (irc_session_t * session, irc_dcc_t dccid, irc_dcc_stats_t * stats)
+ * \brief Obtains the DCC file transfer progress.
+ *
+ * \param session An initiated session.
+ * \param dccid   A DCC session id.
+ * \param stats   A structure to receive the statistics.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The transfer rate is sampled about once a second, and smoothed, so it is 0
+ * during the first second of the transfer. For a DCC chat all the values 
+ * are 0. This function can be called from any thread.
+ *
+ * \sa irc_dcc_set_rate_limit irc_dcc_set_send_slots
+ * \ingroup dccstuff
+ */
+int irc_dcc_get_stats (irc_session_t * session, irc_dcc_t dccid, irc_dcc_stats_t * stats);
+
+
+/*!
+ * \fn int irc_dcc_get_digest (irc_session_t * session, irc_dcc_t dccid, irc_dcc_digest_t * digest)
+ * \brief Obtains the digests of the DCC file transfer.
+ *
+ * \param session An initiated session.
+ * \param dccid   A DCC session id.
+ * \param digest  A structure to receive the digests.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * Returns the CRC32 and SHA-256 of the file data sent or received so far,
+ * if the session was created with LIBIRC_OPTION_DCC_CRC32 or 
+ * LIBIRC_OPTION_DCC_SHA256 set. Call it from the completion callback (the
+ * one with zero status and no data) to get the digests of the whole 
+ * transfer; the session is gone after the callback returns. A resumed 
+ * transfer only covers the data from the resume position, which is 
+ * reported in the offset.
+ *
+ * \sa LIBIRC_OPTION_DCC_CRC32 LIBIRC_OPTION_DCC_SHA256
+ * \ingroup dccstuff
+ */
+int irc_dcc_get_digest (irc_session_t * session, irc_dcc_t dccid, irc_dcc_digest_t * digest);
+
+
+/*!
+ * \fn int irc_state_is_member (irc_session_t * session, const char * channel, const char * nick, unsigned int * modes)
+ * \brief Checks whether the nick is in the tracked channel.
+ *
+ * \param session An initiated session.
+ * \param channel A channel name.
+ * \param nick    A nick.
+ * \param modes   If not 0, receives the member modes, the LIBIRC_MEMBER_* bits.
+ *
+ * \return Returns 1 if the nick is in the channel, and 0 if not, or if the
+ *   channel is not tracked.
+ *
+ * The channel and the nick are compared ignoring the case, as the server
+ * does. Works only with LIBIRC_OPTION_TRACK_STATE set, and takes constant
+ * time however big the channel is. This function can be called from any 
+ * thread.
+ *
+ * \sa LIBIRC_OPTION_TRACK_STATE irc_state_members
+ * \ingroup state
+ */
+int irc_state_is_member (irc_session_t * session, const char * channel, const char * nick, unsigned int * modes);
+
+
+/*!
+ * \fn int irc_state_member_count (irc_session_t * session, const char * channel)
+ * \brief Returns the number of the members of the tracked channel.
+ *
+ * \param session An initiated session.
+ * \param channel A channel name.
+ *
+ * \return Returns the number of the members, including us, or -1 if the 
+ *   channel is not tracked.
+ *
+ * \sa LIBIRC_OPTION_TRACK_STATE
+ * \ingroup state
+ */
+int irc_state_member_count (irc_session_t * session, const char * channel);
+
+
+/*!
+ * \fn int irc_state_get_host (irc_session_t * session, const char * nick, char * host, size_t size)
+ * \brief Obtains the user@host of the user in the tracked channels.
+ *
+ * \param session An initiated session.
+ * \param nick    A nick.
+ * \param host    The buffer to receive the user@host.
+ * \param size    The buffer size; a longer host is truncated.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The host is learned from the JOIN of the user, the WHO replies, and the
+ * NAMES replies or CHGHOST if the server has the userhost-in-names or 
+ * chghost capabilities. The users which are in no tracked channel are not
+ * known; LIBIRC_ERR_INVAL is returned for them and for the users whose host
+ * is not learned yet.
+ *
+ * \sa LIBIRC_OPTION_TRACK_STATE
+ * \ingroup state
+ */
+int irc_state_get_host (irc_session_t * session, const char * nick, char * host, size_t size);
+
+
+/*!
+ * \fn int irc_state_members (irc_session_t * session, const char * channel, irc_state_member_callback_t callback, void * ctx)
+ * \brief Lists the members of the tracked channel.
+ *
+ * \param session  An initiated session.
+ * \param channel  A channel name.
+ * \param callback The callback called for each member.
+ * \param ctx      The context passed to the callback.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The members are listed in no particular order. The callback is called 
+ * with the tracker locked, so it must not call the libircclient functions
+ * of this session; the strings are only valid within the callback. 
+ * LIBIRC_ERR_INVAL is returned if the channel is not tracked.
+ *
+ * \sa LIBIRC_OPTION_TRACK_STATE irc_state_channels
+ * \ingroup state
+ */
+int irc_state_members (irc_session_t * session, const char * channel, irc_state_member_callback_t callback, void * ctx);
+
+
+/*!
+ * \fn int irc_state_channels (irc_session_t * session, irc_state_channel_callback_t callback, void * ctx)
+ * \brief Lists the tracked channels.
+ *
+ * \param session  An initiated session.
+ * \param callback The callback called for each channel.
+ * \param ctx      The context passed to the callback.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The channels are listed in no particular order, with the same limits on
+ * the callback as irc_state_members() has.
+ *
+ * \sa LIBIRC_OPTION_TRACK_STATE irc_state_members
+ * \ingroup state
+ */
+int irc_state_channels (irc_session_t * session, irc_state_channel_callback_t callback, void * ctx);
+
+
+/*!
+ * \fn int irc_monitor_add (irc_session_t * session, const char * nicks)
+ * \brief Follows the presence of the nicks.
+ *
+ * \param session An initiated session.
+ * \param nicks   The nicks, separated by commas or spaces.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The event_presence callback is called when a nick comes online or goes
+ * offline. Once the registration is complete, the library asks the server
+ * to follow the nicks with MONITOR, or WATCH if the server has no MONITOR,
+ * in as few lines as its limits allow. The nicks the server list has no
+ * place for, and all of them if the server has neither, are polled with
+ * ISON, less often while nothing changes. Do not send ISON yourself then.
+ *
+ * The nicks stay for the next connections, and their presence is reported
+ * again after every connection.
+ *
+ * \sa irc_monitor_remove irc_monitor_is_online
+ * \ingroup state
+ */
+int irc_monitor_add (irc_session_t * session, const char * nicks);
+
+
+/*!
+ * \fn int irc_monitor_remove (irc_session_t * session, const char * nicks)
+ * \brief Stops following the presence of the nicks.
+ *
+ * \param session An initiated session.
+ * \param nicks   The nicks, separated by commas or spaces.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The nicks not followed are ignored.
+ *
+ * \sa irc_monitor_add
+ * \ingroup state
+ */
+int irc_monitor_remove (irc_session_t * session, const char * nicks);
+
+
+/*!
+ * \fn int irc_monitor_is_online (irc_session_t * session, const char * nick)
+ * \brief Checks whether the followed nick is online.
+ *
+ * \param session An initiated session.
+ * \param nick    A nick added by irc_monitor_add().
+ *
+ * \return Returns 1 if the nick is online, 0 if it is offline, or -1 if 
+ *   its presence is not known yet or the nick is not followed.
+ *
+ * \sa irc_monitor_add
+ * \ingroup state
+ */
+int irc_monitor_is_online (irc_session_t * session, const char * nick);
+
+
+/*!
+ * \fn int irc_query_whois (irc_session_t * session, const char * nick, irc_query_callback_t callback, void * ctx, irc_query_t * query)
+ * \brief Queries the information about the nick, and gets the whole reply.
+ *
+ * \param session  An initiated and connected session.
+ * \param nick     A single nick. Must not be NULL.
+ * \param callback The callback which gets the reply. Must not be NULL.
+ * \param ctx      The context passed to the callback.
+ * \param query    Where to store the query id, or 0.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * Sends WHOIS like irc_cmd_whois(), but the reply lines are passed to the
+ * callback at once instead of event_numeric, including ERR_NOSUCHNICK. 
+ * Any number of queries could be sent without waiting for the replies.
+ *
+ * If the labeled-response and batch capabilities are enabled, see 
+ * irc_cap_request(), the query is labeled and its reply is found by the
+ * label. Otherwise the reply is found by the numerics and the nick, as the
+ * server answers the queries in order. Do not send the same commands with
+ * irc_cmd_whois() or irc_send_raw() while the queries wait then, or their
+ * lines could be taken for the replies.
+ *
+ * \sa irc_query_callback_t irc_query_cancel
+ * \ingroup ircmd_oth
+ */
+int irc_query_whois (irc_session_t * session, const char * nick, irc_query_callback_t callback, void * ctx, irc_query_t * query);
+
+
+/*!
+ * \fn int irc_query_who (irc_session_t * session, const char * mask, irc_query_callback_t callback, void * ctx, irc_query_t * query)
+ * \brief Sends WHO, and gets the whole reply.
+ *
+ * \param session  An initiated and connected session.
+ * \param mask     A channel or a mask. Must not be NULL.
+ * \param callback The callback which gets the reply. Must not be NULL.
+ * \param ctx      The context passed to the callback.
+ * \param query    Where to store the query id, or 0.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * Same as irc_query_whois(), for the RPL_WHOREPLY lines.
+ *
+ * \sa irc_query_callback_t irc_query_cancel
+ * \ingroup ircmd_oth
+ */
+int irc_query_who (irc_session_t * session, const char * mask, irc_query_callback_t callback, void * ctx, irc_query_t * query);
+
+
+/*!
+ * \fn int irc_query_mode (irc_session_t * session, const char * target, irc_query_callback_t callback, void * ctx, irc_query_t * query)
+ * \brief Queries the channel modes or our user modes, and gets the reply.
+ *
+ * \param session  An initiated and connected session.
+ * \param target   A channel, or our nick. Must not be NULL.
+ * \param callback The callback which gets the reply. Must not be NULL.
+ * \param ctx      The context passed to the callback.
+ * \param query    Where to store the query id, or 0.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * Same as irc_query_whois(), for RPL_CHANNELMODEIS or RPL_UMODEIS, or the 
+ * error. With labeled-response the RPL_CREATIONTIME which some servers 
+ * send after RPL_CHANNELMODEIS is a part of the reply. Without it the 
+ * reply ends with RPL_CHANNELMODEIS, and the RPL_CREATIONTIME right after
+ * it is dropped, not passed to event_numeric.
+ *
+ * \sa irc_query_callback_t irc_query_cancel
+ * \ingroup ircmd_oth
+ */
+int irc_query_mode (irc_session_t * session, const char * target, irc_query_callback_t callback, void * ctx, irc_query_t * query);
+
+
+/*!
+ * \fn int irc_query_cancel (irc_session_t * session, irc_query_t query)
+ * \brief Cancels the query.
+ *
+ * \param session An initiated session.
+ * \param query   The query id.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The callback of the query is not called. The reply is still awaited, so
+ * it is not taken for the reply of another query.
+ *
+ * \ingroup ircmd_oth
+ */
+int irc_query_cancel (irc_session_t * session, irc_query_t query);
+
+
+/*!
+ * \fn int irc_server_limit (irc_session_t * session, unsigned int limit)
+ * \brief Returns the server limit, as the server told in RPL_ISUPPORT.
+ *
+ * \param session An initiated session.
+ * \param limit   One of the LIBIRC_LIMIT_* constants.
+ *
+ * \return Returns the limit; see the constants for the meaning of 0 and -1.
+ *   -1 is also returned if the limit is not known.
+ *
+ * The limits have the RFC 1459 defaults until the server sends them, which
+ * most servers do right after the connection is registered, before the
+ * event_connect. Use them to size the lines and the batches of targets 
+ * instead of guessing low. This function can be called from any thread.
+ *
+ * \sa irc_server_targmax irc_server_feature
+ * \ingroup isupport
+ */
+int irc_server_limit (irc_session_t * session, unsigned int limit);
+
+
+/*!
+ * \fn int irc_server_targmax (irc_session_t * session, const char * command)
+ * \brief Returns the number of the targets the command accepts.
+ *
+ * \param session An initiated session.
+ * \param command A command name, such as "PRIVMSG" or "WHOIS".
+ *
+ * \return Returns the number of the targets, or 0 if there is no limit.
+ *
+ * The limits come from the TARGMAX of RPL_ISUPPORT. A PRIVMSG or NOTICE 
+ * not listed there takes LIBIRC_LIMIT_MAXTARGETS targets, MONITOR is only
+ * limited by LIBIRC_LIMIT_MONITOR, and the other commands take a single one.
+ *
+ * \sa irc_server_limit
+ * \ingroup isupport
+ */
+int irc_server_targmax (irc_session_t * session, const char * command);
+
+
+/*!
+ * \fn int irc_server_feature (irc_session_t * session, const char * name, char * value, size_t size)
+ * \brief Obtains the RPL_ISUPPORT token as the server sent it.
+ *
+ * \param session An initiated session.
+ * \param name    A token name, such as "WHOX" or "CHANMODES".
+ * \param value   The buffer to receive the token value, or 0.
+ * \param size    The buffer size; a longer value is truncated.
+ *
+ * \return Returns 0 if the server sent the token, or 1 if it did not.
+ *
+ * The value is unescaped, and is empty if the token has no value, such as
+ * WHOX. This gives the features the library does not parse, and the flags
+ * like WHOX which are only present or not.
+ *
+ * \sa irc_server_limit
+ * \ingroup isupport
+ */
+int irc_server_feature (irc_session_t * session, const char * name, char * value, size_t size);
+
+
+/*!
+ * \fn int irc_cap_request (irc_session_t * session, const char * caps)
+ * \brief Asks for the IRCv3 capabilities.
+ *
+ * \param session An initiated session.
+ * \param caps    The space-separated capability names, such as 
+ *                 "multi-prefix userhost-in-names away-notify".
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The capabilities are added to the wanted ones of the session. If any are
+ * wanted when the connection is established, the library negotiates them
+ * with CAP LS 302, CAP REQ and CAP END before the registration completes,
+ * and requests those the server has. The ones the server adds later are 
+ * requested as it announces them, and the ones asked after the negotiation
+ * are requested right away. The wanted capabilities stay for the next 
+ * connections.
+ *
+ * The library follows the capabilities it knows itself; the application
+ * must handle what the others change, such as the extra JOIN parameters of
+ * extended-join. The tags of message-tags and server-time are obtained with
+ * irc_message_tag().
+ *
+ * \sa irc_cap_enabled
+ * \ingroup caps
+ */
+int irc_cap_request (irc_session_t * session, const char * caps);
+
+
+/*!
+ * \fn int irc_cap_enabled (irc_session_t * session, const char * cap)
+ * \brief Checks whether the capability is enabled.
+ *
+ * \param session An initiated session.
+ * \param cap     A capability name.
+ *
+ * \return Returns 1 if the server acknowledged the capability, or 0 if not.
+ *
+ * \sa irc_cap_request irc_cap_get_enabled
+ * \ingroup caps
+ */
+int irc_cap_enabled (irc_session_t * session, const char * cap);
+
+
+/*!
+ * \fn int irc_cap_get_enabled (irc_session_t * session, char * caps, size_t size)
+ * \brief Obtains the enabled capabilities.
+ *
+ * \param session An initiated session.
+ * \param caps    The buffer to receive the space-separated capability names.
+ * \param size    The buffer size; a longer list is truncated.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * \sa irc_cap_enabled
+ * \ingroup caps
+ */
+int irc_cap_get_enabled (irc_session_t * session, char * caps, size_t size);
+
+
+/*!
+ * \fn int irc_message_tag (irc_session_t * session, const char * key, char * value, size_t size)
+ * \brief Obtains the tag of the message being processed.
+ *
+ * \param session An initiated session.
+ * \param key     A tag key, such as "time" or "+example.com/tag".
+ * \param value   The buffer to receive the unescaped tag value, or 0.
+ * \param size    The buffer size; a longer value is truncated.
+ *
+ * \return Returns 0 if the message has the tag, or 1 if it does not.
+ *
+ * The IRCv3 servers tag the messages with the message-tags, server-time 
+ * and other capabilities enabled. This function is only valid within an 
+ * event callback, and returns the tags of the message the event came from.
+ * A tag without a value gives an empty value.
+ *
+ * \sa irc_cap_request
+ * \ingroup caps
+ */
+int irc_message_tag (irc_session_t * session, const char * key, char * value, size_t size);
+
+
+/*!
+ * \fn int irc_batch_message_tag (const irc_batch_message_t * message, const char * key, char * value, size_t size)
+ * \brief Obtains the tag of a batch message.
+ *
+ * \param message A message passed to event_batch.
+ * \param key     A tag key, such as "msgid".
+ * \param value   The buffer to receive the unescaped tag value, or 0.
+ * \param size    The buffer size; a longer value is truncated.
+ *
+ * \return Returns 0 if the message has the tag, or 1 if it does not.
+ *
+ * Same as irc_message_tag(), for the messages of a batch.
+ *
+ * \sa LIBIRC_OPTION_COLLECT_BATCHES
+ * \ingroup caps
+ */
+int irc_batch_message_tag (const irc_batch_message_t * message, const char * key, char * value, size_t size);
+
+
+/*!
+ * \fn int irc_sasl_set (irc_session_t * session, int mechanism, const char * user, const char * password)
+ * \brief Authenticates with SASL during the registration.
+ *
+ * \param session   An initiated session.
+ * \param mechanism LIBIRC_SASL_PLAIN, LIBIRC_SASL_EXTERNAL or 
+ *                   LIBIRC_SASL_SCRAM_SHA_256, or 0 to stop using SASL.
+ * \param user      The account name. With LIBIRC_SASL_EXTERNAL it is the
+ *                   optional identity to act as, and could be 0.
+ * \param password  The account password; not used with LIBIRC_SASL_EXTERNAL.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno().
+ *
+ * The library asks for the "sasl" capability and, once the server has
+ * acknowledged it, authenticates before it ends the capability negotiation,
+ * so the connection is registered already logged in. EXTERNAL uses the 
+ * client certificate set by irc_ssl_set_client_cert(). SCRAM-SHA-256 does
+ * not send the password and checks the server knows it too.
+ *
+ * The result is reported in the event_connect callback: irc_errno() returns
+ * LIBIRC_ERR_AUTH there if the authentication failed, or the server does
+ * not support it or the mechanism. The credentials stay for the next 
+ * connections; set them before irc_connect().
+ *
+ * \sa irc_cap_request irc_ssl_set_client_cert
+ * \ingroup caps
+ */
+int irc_sasl_set (irc_session_t * session, int mechanism, const char * user, const char * password);
+
+
+/*!
+ * \fn int irc_ssl_set_client_cert (irc_session_t * session, const char * certfile, const char * keyfile)
+ * \brief Sets the client certificate of the SSL connections.
+ *
+ * \param session  An initiated session.
+ * \param certfile The PEM file with the certificate, or 0 to use none.
+ * \param keyfile  The PEM file with the private key, or 0 if it is in the
+ *                  certificate file.
+ *
+ * \return Return code 0 means success. Any other value means error; the 
+ *   error code may be obtained through irc_errno(). LIBIRC_ERR_SSL_NOT_SUPPORTED
+ *   is returned if the library is built without SSL.
+ *
+ * The certificate is presented to the server by the next irc_connect() to 
+ * an SSL server, which fails with LIBIRC_ERR_SSL_INIT_FAILED if the files 
+ * could not be loaded. The servers use it to identify the user, with SASL
+ * EXTERNAL or by its fingerprint.
+ *
+ * \sa irc_sasl_set
+ * \ingroup conndisc
+ */
+int irc_ssl_set_client_cert (irc_session_t * session, const char * certfile, const char * keyfile);
+
+
 /*!
  * \fn void irc_get_version (unsigned int * high, unsigned int * low)
  * \brief Obtains a libircclient version.
@@ -1492,6 +2291,195 @@ char * irc_color_convert_from_mirc (const char * message);
  */
 char * irc_color_convert_to_mirc (const char * message);
 
+
+/*!
+ * \fn int irc_color_strip_from_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len)
+ * \brief Removes all the color codes and format options into a caller buffer.
+ *
+ * \param dst     A buffer to receive the plain text.
+ * \param dst_cap The buffer size.
+ * \param src     A message from IRC; it does not need to be 0-terminated.
+ * \param src_len The message length.
+ *
+ * \return Returns the length of the result, which is 0-terminated, or -1
+ * if it does not fit into the buffer.
+ *
+ * Same as irc_color_strip_from_mirc(), but converts the message in a single
+ * pass without allocating memory. The result is never longer than the 
+ * message, so a buffer of src_len + 1 bytes is always enough.
+ *
+ * \sa irc_color_strip_from_mirc irc_color_stream_init
+ * \ingroup colors
+ */
+int irc_color_strip_from_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len);
+
+
+/*!
+ * \fn int irc_color_strip_from_mirc_inplace (char * message, size_t length)
+ * \brief Removes all the color codes and format options in place.
+ *
+ * \param message A message from IRC, which is modified.
+ * \param length  The message length.
+ *
+ * \return Returns the length of the stripped message. If it is shorter than
+ * the original, the message is 0-terminated at the new length.
+ *
+ * Same as irc_color_strip_from_mirc(), but strips the message in its own
+ * buffer. A message without codes is only scanned, and not modified.
+ *
+ * \sa irc_color_strip_from_mirc irc_color_strip_from_mirc_into
+ * \ingroup colors
+ */
+int irc_color_strip_from_mirc_inplace (char * message, size_t length);
+
+
+/*!
+ * \fn int irc_color_convert_from_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len)
+ * \brief Converts all the color codes and format options to libircclient colors into a caller buffer.
+ *
+ * \param dst     A buffer to receive the converted message.
+ * \param dst_cap The buffer size.
+ * \param src     A message from IRC; it does not need to be 0-terminated.
+ * \param src_len The message length.
+ *
+ * \return Returns the length of the result, which is 0-terminated, or -1
+ * if it does not fit into the buffer.
+ *
+ * Same as irc_color_convert_from_mirc(), but converts the message in a 
+ * single pass without allocating memory. A buffer of 
+ * LIBIRC_COLOR_BOUND(src_len) bytes is always enough.
+ *
+ * \sa irc_color_convert_from_mirc irc_color_stream_init
+ * \ingroup colors
+ */
+int irc_color_convert_from_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len);
+
+
+/*!
+ * \fn int irc_color_convert_to_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len)
+ * \brief Converts all the color codes from libircclient format to mIRC into a caller buffer.
+ *
+ * \param dst     A buffer to receive the converted message.
+ * \param dst_cap The buffer size.
+ * \param src     A message with color codes; it does not need to be 0-terminated.
+ * \param src_len The message length.
+ *
+ * \return Returns the length of the result, which is 0-terminated, or -1
+ * if it does not fit into the buffer.
+ *
+ * Same as irc_color_convert_to_mirc(), but converts the message in a single
+ * pass without allocating memory. The result is never longer than the 
+ * message, so a buffer of src_len + 1 bytes is always enough.
+ *
+ * \sa irc_color_convert_to_mirc irc_color_stream_init
+ * \ingroup colors
+ */
+int irc_color_convert_to_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len);
+
+
+/*!
+ * \fn int irc_color_render_into (unsigned int mode, char * dst, size_t dst_cap, const char * src, size_t src_len)
+ * \brief Renders the mIRC color codes and format options into a caller buffer.
+ *
+ * \param mode    The output format: LIBIRC_COLOR_TO_ANSI, LIBIRC_COLOR_TO_HTML,
+ *                LIBIRC_COLOR_STRIP or LIBIRC_COLOR_FROM_MIRC.
+ * \param dst     A buffer to receive the rendered message.
+ * \param dst_cap The buffer size.
+ * \param src     A message from IRC; it does not need to be 0-terminated.
+ * \param src_len The message length.
+ *
+ * \return Returns the length of the result, which is 0-terminated, or -1
+ * if it does not fit into the buffer.
+ *
+ * The message is tokenized once, and every format code is written in the 
+ * output format directly, in a single pass without allocating memory. All
+ * the codes are recognized: bold, italic, underline, strikethrough, 
+ * monospace, reverse, reset, the 99 colors of 0x03 and the hex colors of 
+ * 0x04. The output format renders what it can, and drops the rest:
+ * - LIBIRC_COLOR_TO_ANSI writes the ANSI SGR escape sequences for a 
+ *   terminal, with the colors in the 256-color or the 24-bit form; the 
+ *   escape characters of the message itself are dropped.
+ * - LIBIRC_COLOR_TO_HTML writes the text escaped for HTML, with the 
+ *   formatted parts in the spans with an inline style.
+ * - LIBIRC_COLOR_STRIP writes the plain text, as irc_color_strip_from_mirc_into().
+ * - LIBIRC_COLOR_FROM_MIRC writes the libircclient colors, as 
+ *   irc_color_convert_from_mirc_into().
+ *
+ * A buffer of LIBIRC_COLOR_BOUND(src_len) bytes is always enough, or 
+ * LIBIRC_COLOR_HTML_BOUND(src_len) bytes for LIBIRC_COLOR_TO_HTML.
+ *
+ * \sa irc_color_stream_init
+ * \ingroup colors
+ */
+int irc_color_render_into (unsigned int mode, char * dst, size_t dst_cap, const char * src, size_t src_len);
+
+
+/*!
+ * \fn void irc_color_stream_init (irc_color_stream_t * stream, unsigned int mode)
+ * \brief Starts a streaming color conversion.
+ *
+ * \param stream The conversion state to initialize.
+ * \param mode   LIBIRC_COLOR_STRIP, LIBIRC_COLOR_FROM_MIRC, LIBIRC_COLOR_TO_MIRC,
+ *               LIBIRC_COLOR_TO_ANSI or LIBIRC_COLOR_TO_HTML.
+ *
+ * The streaming conversion converts the input of any length, passed in 
+ * parts to irc_color_stream_convert(), and finished with 
+ * irc_color_stream_finish(). The parts could be split anywhere, even in 
+ * the middle of a color code. The stream does not allocate memory, and 
+ * needs no cleanup.
+ *
+ * \sa irc_color_stream_convert irc_color_stream_finish
+ * \ingroup colors
+ */
+void irc_color_stream_init (irc_color_stream_t * stream, unsigned int mode);
+
+
+/*!
+ * \fn int irc_color_stream_convert (irc_color_stream_t * stream, char * dst, size_t dst_cap, const char * src, size_t src_len)
+ * \brief Converts the next part of the streaming input.
+ *
+ * \param stream  The conversion state.
+ * \param dst     A buffer to receive the converted part.
+ * \param dst_cap The buffer size.
+ * \param src     The next part of the input.
+ * \param src_len The part length.
+ *
+ * \return Returns the length of the converted part, or -1 if it does not
+ * fit into the buffer; the stream could not be used after that.
+ *
+ * The converted part is not 0-terminated, so the results of the calls could
+ * be just concatenated. A color code at the end of the part, which could 
+ * continue in the next one, is kept in the stream and converted with the 
+ * next part. A buffer of LIBIRC_COLOR_BOUND(src_len) bytes is always enough,
+ * or LIBIRC_COLOR_HTML_BOUND(src_len) bytes for LIBIRC_COLOR_TO_HTML.
+ *
+ * \sa irc_color_stream_init irc_color_stream_finish
+ * \ingroup colors
+ */
+int irc_color_stream_convert (irc_color_stream_t * stream, char * dst, size_t dst_cap, const char * src, size_t src_len);
+
+
+/*!
+ * \fn int irc_color_stream_finish (irc_color_stream_t * stream, char * dst, size_t dst_cap)
+ * \brief Finishes the streaming conversion.
+ *
+ * \param stream  The conversion state.
+ * \param dst     A buffer to receive the rest of the output.
+ * \param dst_cap The buffer size.
+ *
+ * \return Returns the length of the output, which is not 0-terminated, or 
+ * -1 if it does not fit into the buffer.
+ *
+ * Converts the color code kept at the end of the input, and closes all 
+ * the open format modes. A buffer of LIBIRC_COLOR_BOUND(0) bytes is always
+ * enough, or LIBIRC_COLOR_HTML_BOUND(0) bytes for LIBIRC_COLOR_TO_HTML. The 
+ * stream could be initialized again for the next input.
+ *
+ * \sa irc_color_stream_init irc_color_stream_convert
+ * \ingroup colors
+ */
+int irc_color_stream_finish (irc_color_stream_t * stream, char * dst, size_t dst_cap);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,243 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * The IRCv3 batches, collected with LIBIRC_OPTION_COLLECT_BATCHES and
+ * delivered as one event when they end. The messages of a batch are not
+ * dispatched one by one, but the QUITs of a netsplit and the JOINs of a
+ * netjoin still update the tracker as they come. Only the types below are
+ * collected: the messages of the others, such as the labeled replies, are
+ * needed by the state tracker, the queries and the rest as usual.
+ */
+
+static const char * libirc_batch_types[] = { "chathistory", "netsplit", "netjoin", 0 };
+
+
+static const char * libirc_batch_strdup (irc_session_t * session, irc_batch_t * batch, const char * str)
+{
+	size_t length = strlen (str) + 1;
+	char * copy = libirc_reply_alloc (session, &batch->store, length);
+
+	if ( copy )
+		memcpy (copy, str, length);
+
+	return copy;
+}
+
+
+static const char ** libirc_batch_params (irc_session_t * session, irc_batch_t * batch, const char ** params, unsigned int count)
+{
+	const char ** copy = libirc_reply_alloc (session, &batch->store, (count + 1) * sizeof(char*));
+	unsigned int i;
+
+	if ( !copy )
+		return 0;
+
+	for ( i = 0; i < count; i++ )
+		if ( (copy[i] = libirc_batch_strdup (session, batch, params[i])) == 0 )
+			return 0;
+
+	copy[count] = 0;
+	return copy;
+}
+
+
+static void libirc_batch_free (irc_session_t * session, irc_batch_t * batch)
+{
+	libirc_reply_release (session, &batch->store);
+	free (batch->messages);
+	free (batch);
+}
+
+
+static void libirc_batch_clear (irc_session_t * session)
+{
+	while ( session->batches )
+	{
+		irc_batch_t * batch = session->batches;
+
+		session->batches = batch->next;
+		libirc_batch_free (session, batch);
+	}
+}
+
+
+static irc_batch_t * libirc_batch_find (irc_session_t * session, const char * ref)
+{
+	irc_batch_t * batch;
+
+	for ( batch = session->batches; batch; batch = batch->next )
+		if ( !strcmp (batch->ref, ref) )
+			return batch;
+
+	return 0;
+}
+
+
+/*
+ * Converts the server-time tag, 2011-10-19T16:40:51.620Z, to milliseconds
+ * since the epoch; 0 if it could not be parsed.
+ */
+static unsigned long long libirc_batch_time (const char * value)
+{
+	int year, month, day, hour, min, sec, n = 0;
+	unsigned int msec = 0, scale = 100;
+	long long days, era, yoe, doy;
+
+	if ( sscanf (value, "%4d-%2d-%2dT%2d:%2d:%2d%n", &year, &month, &day, &hour, &min, &sec, &n) != 6
+	|| month < 1 || month > 12 || year < 1970 )
+		return 0;
+
+	for ( value += n; *value == '.' || (isdigit (*value) && scale > 0); value++ )
+	{
+		if ( *value != '.' )
+		{
+			msec += (*value - '0') * scale;
+			scale /= 10;
+		}
+	}
+
+	// The days since the epoch of the civil date, with the years starting in March
+	year -= month <= 2;
+	era = year / 400;
+	yoe = year - era * 400;
+	doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	days = era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+
+	return ((unsigned long long) (days * 86400 + hour * 3600 + min * 60 + sec)) * 1000 + msec;
+}
+
+
+/*
+ * Collects the message if it belongs to a batch being collected. Returns
+ * nonzero if so, and the message is not dispatched.
+ */
+static int libirc_batch_message (irc_session_t * session, unsigned int code, const char * command, const char * prefix, const char * userhost, const char ** params, unsigned int count)
+{
+	irc_batch_message_t * message;
+	irc_batch_t * batch;
+	char value[64], numeric[4];
+
+	// A nested batch is collected on its own
+	if ( !session->batches || (command && !strcmp (command, "BATCH"))
+	|| libirc_message_tag (session->message_tags, "batch", value, sizeof(value))
+	|| (batch = libirc_batch_find (session, value)) == 0 )
+		return 0;
+
+	if ( batch->mcount == batch->msize )
+	{
+		unsigned int size = batch->msize ? batch->msize * 2 : 64;
+		irc_batch_message_t * messages = realloc (batch->messages, size * sizeof(irc_batch_message_t));
+
+		// Out of memory, the message is dispatched as usual
+		if ( !messages )
+			return 0;
+
+		batch->messages = messages;
+		batch->msize = size;
+	}
+
+	if ( code )
+	{
+		sprintf (numeric, "%03u", code % 1000);
+		command = numeric;
+	}
+
+	message = batch->messages + batch->mcount;
+	memset (message, 0, sizeof(irc_batch_message_t));
+
+	if ( libirc_message_tag (session->message_tags, "time", value, sizeof(value)) == 0 )
+		message->time = libirc_batch_time (value);
+
+	if ( (message->tags = libirc_batch_strdup (session, batch, session->message_tags)) == 0
+	|| (prefix && (message->origin = libirc_batch_strdup (session, batch, prefix)) == 0)
+	|| (message->command = libirc_batch_strdup (session, batch, command)) == 0
+	|| (message->params = libirc_batch_params (session, batch, params, count)) == 0 )
+		return 0;
+
+	message->count = count;
+	batch->mcount++;
+
+	if ( !strcmp (batch->type, "netsplit") && !strcmp (command, "QUIT") )
+		libirc_state_quit (session, prefix);
+	else if ( !strcmp (batch->type, "netjoin") && !strcmp (command, "JOIN") )
+		libirc_state_join (session, prefix, userhost, params, count);
+
+	return 1;
+}
+
+
+/*
+ * BATCH: +ref, the type and its params, or -ref. Returns nonzero if the
+ * batch is collected, and so is not passed to event_unknown.
+ */
+static int libirc_batch_command (irc_session_t * session, const char * command, const char ** params, unsigned int count)
+{
+	irc_batch_t * batch, ** link;
+	unsigned int i;
+
+	if ( strcmp (command, "BATCH") || count < 1 || params[0][0] == '\0' || params[0][1] == '\0' )
+		return 0;
+
+	if ( params[0][0] == '-' )
+	{
+		for ( link = &session->batches; *link; link = &(*link)->next )
+			if ( !strcmp ((*link)->ref, params[0] + 1) )
+				break;
+
+		if ( (batch = *link) == 0 )
+			return 0;
+
+		*link = batch->next;
+
+		(*session->callbacks.event_batch) (session, batch->type, batch->params, batch->count, batch->messages, batch->mcount);
+		libirc_batch_free (session, batch);
+		return 1;
+	}
+
+	if ( params[0][0] != '+' || count < 2 || !(session->options & LIBIRC_OPTION_COLLECT_BATCHES)
+	|| !session->callbacks.event_batch || libirc_batch_find (session, params[0] + 1) )
+		return 0;
+
+	for ( i = 0; libirc_batch_types[i] && strcmp (libirc_batch_types[i], params[1]); i++ )
+		;
+
+	if ( !libirc_batch_types[i] )
+		return 0;
+
+	if ( (batch = calloc (1, sizeof(irc_batch_t))) == 0 )
+		return 0;
+
+	if ( (batch->ref = libirc_batch_strdup (session, batch, params[0] + 1)) == 0
+	|| (batch->type = libirc_batch_strdup (session, batch, params[1])) == 0
+	|| (batch->params = libirc_batch_params (session, batch, params + 2, count - 2)) == 0 )
+	{
+		libirc_batch_free (session, batch);
+		return 0;
+	}
+
+	batch->count = count - 2;
+	batch->next = session->batches;
+	session->batches = batch;
+	return 1;
+}
+
+
+int irc_batch_message_tag (const irc_batch_message_t * message, const char * key, char * value, size_t size)
+{
+	if ( !message || !key )
+		return 1;
+
+	return libirc_message_tag (message->tags, key, value, size);
+}
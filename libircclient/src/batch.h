@@ -0,0 +1,37 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_BATCH_H
+#define INCLUDE_IRC_BATCH_H
+
+
+/*
+ * A batch being collected, until its BATCH -ref arrives. The strings are
+ * kept in the arena of the store, like the lines of a reply.
+ */
+typedef struct irc_batch_s
+{
+	struct irc_batch_s	  *	next;
+	const char			  *	ref;
+	const char			  *	type;
+	const char			 **	params;		/* the params after the type */
+	unsigned int			count;
+	irc_batch_message_t	  *	messages;
+	unsigned int			mcount;
+	unsigned int			msize;
+	irc_reply_t				store;
+} irc_batch_t;
+
+
+#endif /* INCLUDE_IRC_BATCH_H */
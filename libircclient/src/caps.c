@@ -0,0 +1,376 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * The capability lists are kept as space-separated strings, as the server
+ * sends them; the available ones keep their values, like "sasl=PLAIN".
+ */
+static const char * libirc_cap_find (const char * list, const char * name, size_t length)
+{
+	while ( list && *list )
+	{
+		if ( strcspn (list, "= ") == length && !strncmp (list, name, length) )
+			return list;
+
+		list += strcspn (list, " ");
+
+		while ( *list == ' ' )
+			list++;
+	}
+
+	return 0;
+}
+
+
+static int libirc_cap_add (char ** list, const char * entry, size_t length)
+{
+	size_t used = *list ? strlen (*list) : 0;
+	char * grown = realloc (*list, used + length + 2);
+
+	if ( !grown )
+		return 1;
+
+	if ( used )
+		grown[used++] = ' ';
+
+	memcpy (grown + used, entry, length);
+	grown[used + length] = '\0';
+	*list = grown;
+	return 0;
+}
+
+
+static void libirc_cap_remove (char * list, const char * name, size_t length)
+{
+	char * entry = (char *) libirc_cap_find (list, name, length), * next;
+
+	if ( !entry )
+		return;
+
+	next = entry + strcspn (entry, " ");
+
+	while ( *next == ' ' )
+		next++;
+
+	// The last entry takes the space before it
+	if ( *next == '\0' && entry > list )
+		entry--;
+
+	memmove (entry, next, strlen (next) + 1);
+}
+
+
+/*
+ * Ends the negotiation, which lets the server complete the registration.
+ * The SASL authentication, if started, must be over first.
+ */
+static void libirc_cap_end (irc_session_t * session)
+{
+	if ( (session->flags & SESSIONFL_CAP_NEGOTIATING) && session->cap_pending == 0
+	&& session->sasl.state != SASL_IN_PROGRESS )
+	{
+		session->flags &= ~SESSIONFL_CAP_NEGOTIATING;
+		irc_send_raw (session, "CAP END");
+	}
+}
+
+
+/*
+ * Requests the wanted capabilities the server has and we do not have yet,
+ * as few CAP REQ lines as fit. Called with mutex_isupport locked.
+ */
+static void libirc_cap_request_available (irc_session_t * session)
+{
+	const char * wanted = session->cap_wanted;
+	char req[400];
+	size_t used = 0;
+
+	while ( wanted && *wanted )
+	{
+		size_t length = strcspn (wanted, " ");
+
+		if ( libirc_cap_find (session->cap_available, wanted, length)
+		&& !libirc_cap_find (session->cap_enabled, wanted, length)
+		&& length < sizeof(req) - 1 )
+		{
+			if ( used + length + 1 > sizeof(req) - 1 )
+			{
+				req[used] = '\0';
+
+				if ( irc_send_raw (session, "CAP REQ :%s", req) == 0 )
+					session->cap_pending++;
+
+				used = 0;
+			}
+
+			if ( used )
+				req[used++] = ' ';
+
+			memcpy (req + used, wanted, length);
+			used += length;
+		}
+
+		wanted += length;
+
+		while ( *wanted == ' ' )
+			wanted++;
+	}
+
+	if ( used )
+	{
+		req[used] = '\0';
+
+		if ( irc_send_raw (session, "CAP REQ :%s", req) == 0 )
+			session->cap_pending++;
+	}
+}
+
+
+/*
+ * Starts the negotiation when the connection is established, before the
+ * registration, if the application wants any capabilities.
+ */
+static void libirc_cap_start (irc_session_t * session)
+{
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	if ( session->cap_wanted && irc_send_raw (session, "CAP LS 302") == 0 )
+		session->flags |= SESSIONFL_CAP_NEGOTIATING;
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+}
+
+
+/*
+ * Forgets the capabilities of the previous connection; the wanted ones
+ * stay for the next.
+ */
+static void libirc_cap_reset (irc_session_t * session)
+{
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	free (session->cap_available);
+	free (session->cap_enabled);
+	session->cap_available = 0;
+	session->cap_enabled = 0;
+	session->cap_pending = 0;
+	libirc_sasl_reset (&session->sasl);
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+}
+
+
+/*
+ * CAP: our nick, the subcommand, "*" if more lines follow, and the list.
+ */
+static void libirc_cap_process (irc_session_t * session, const char ** params, unsigned int count)
+{
+	const char * cmd, * list;
+	int more;
+
+	if ( count < 3 )
+		return;
+
+	cmd = params[1];
+	list = params[count - 1];
+	more = count > 3 && !strcmp (params[2], "*");
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	if ( !strcmp (cmd, "LS") || !strcmp (cmd, "NEW") )
+	{
+		const char * p;
+
+		for ( p = list; *p; )
+		{
+			size_t length = strcspn (p, " ");
+
+			if ( length && !libirc_cap_find (session->cap_available, p, strcspn (p, "= ")) )
+				libirc_cap_add (&session->cap_available, p, length);
+
+			p += length;
+
+			while ( *p == ' ' )
+				p++;
+		}
+
+		if ( !more )
+		{
+			session->flags |= SESSIONFL_CAP_LISTED;
+			libirc_cap_request_available (session);
+		}
+	}
+	else if ( !strcmp (cmd, "ACK") )
+	{
+		const char * p;
+		int sasl = 0;
+
+		for ( p = list; *p; )
+		{
+			size_t length = strcspn (p, " ");
+
+			// A capability could also be disabled by the request
+			if ( *p == '-' )
+			{
+				if ( session->cap_enabled )
+					libirc_cap_remove (session->cap_enabled, p + 1, length - 1);
+			}
+			else if ( length && !libirc_cap_find (session->cap_enabled, p, length) )
+			{
+				libirc_cap_add (&session->cap_enabled, p, length);
+				sasl |= length == 4 && !strncmp (p, "sasl", 4);
+			}
+
+			p += length;
+
+			while ( *p == ' ' )
+				p++;
+		}
+
+		// The authentication is done before the registration only
+		if ( sasl && (session->flags & SESSIONFL_CAP_NEGOTIATING) )
+		{
+			const char * cap = libirc_cap_find (session->cap_available, "sasl", 4);
+
+			libirc_sasl_start (session, cap && cap[4] == '=' ? cap + 5 : 0);
+		}
+
+		if ( !more && session->cap_pending > 0 )
+			session->cap_pending--;
+	}
+	else if ( !strcmp (cmd, "NAK") )
+	{
+		if ( !more && session->cap_pending > 0 )
+			session->cap_pending--;
+	}
+	else if ( !strcmp (cmd, "DEL") )
+	{
+		const char * p;
+
+		for ( p = list; *p; )
+		{
+			size_t length = strcspn (p, " ");
+
+			if ( session->cap_available )
+				libirc_cap_remove (session->cap_available, p, length);
+
+			if ( session->cap_enabled )
+				libirc_cap_remove (session->cap_enabled, p, length);
+
+			p += length;
+
+			while ( *p == ' ' )
+				p++;
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+
+	if ( !more )
+		libirc_cap_end (session);
+}
+
+
+int irc_cap_request (irc_session_t * session, const char * caps)
+{
+	const char * p;
+	int rc = 0;
+
+	if ( !caps )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	for ( p = caps; *p && rc == 0; )
+	{
+		size_t length = strcspn (p, " ");
+
+		if ( length && !libirc_cap_find (session->cap_wanted, p, length) )
+			rc = libirc_cap_add (&session->cap_wanted, p, length);
+
+		p += length;
+
+		while ( *p == ' ' )
+			p++;
+	}
+
+	// Once the server listed its capabilities, the new ones are requested
+	// right away
+	if ( rc == 0 && (session->flags & SESSIONFL_CAP_LISTED) )
+		libirc_cap_request_available (session);
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+
+	if ( rc )
+		session->lasterror = LIBIRC_ERR_NOMEM;
+
+	return rc;
+}
+
+
+int irc_cap_enabled (irc_session_t * session, const char * cap)
+{
+	int enabled;
+
+	if ( !cap )
+		return 0;
+
+	libirc_mutex_lock (&session->mutex_isupport);
+	enabled = libirc_cap_find (session->cap_enabled, cap, strlen (cap)) != 0;
+	libirc_mutex_unlock (&session->mutex_isupport);
+
+	return enabled;
+}
+
+
+int irc_cap_get_enabled (irc_session_t * session, char * caps, size_t size)
+{
+	size_t length;
+
+	if ( !caps || size == 0 )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	length = session->cap_enabled ? strlen (session->cap_enabled) : 0;
+
+	if ( length > size - 1 )
+		length = size - 1;
+
+	if ( length )
+		memcpy (caps, session->cap_enabled, length);
+
+	caps[length] = '\0';
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+	return 0;
+}
+
+
+int irc_message_tag (irc_session_t * session, const char * key, char * value, size_t size)
+{
+	if ( !key || libirc_message_tag (session->message_tags, key, value, size) )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	return 0;
+}
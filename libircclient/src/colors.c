@@ -12,231 +12,841 @@
  * License for more details.
  */
 
-#include <ctype.h>
-
 #define LIBIRC_COLORPARSER_BOLD			(1<<1)
 #define LIBIRC_COLORPARSER_UNDERLINE	(1<<2)
 #define LIBIRC_COLORPARSER_REVERSE		(1<<3)
 #define LIBIRC_COLORPARSER_COLOR		(1<<4)
+#define LIBIRC_COLORPARSER_ITALIC		(1<<5)
+#define LIBIRC_COLORPARSER_STRIKE		(1<<6)
+#define LIBIRC_COLORPARSER_MONOSPACE	(1<<7)
+#define LIBIRC_COLORPARSER_SPAN			(1<<8)	// an HTML span is open
+
+#define LIBIRC_COLORPARSER_FORMAT		(LIBIRC_COLORPARSER_BOLD | LIBIRC_COLORPARSER_UNDERLINE \
+										| LIBIRC_COLORPARSER_REVERSE | LIBIRC_COLORPARSER_ITALIC \
+										| LIBIRC_COLORPARSER_STRIKE | LIBIRC_COLORPARSER_MONOSPACE)
+
+// The colors of the ANSI and HTML output; 0 is the default color
+#define LIBIRC_COLORPARSER_PALETTE		(1<<24)	// a color index of 0x03
+#define LIBIRC_COLORPARSER_RGB			(1<<25)	// a 0xRRGGBB value of 0x04
 
 #define LIBIRC_COLORPARSER_MAXCOLORS	15
+#define LIBIRC_COLORPARSER_DEFAULT		99
+
+// The longest sequence which has to be seen whole: a [code] tag
+#define LIBIRC_COLORPARSER_MAXTAG		31
+
+
+typedef struct
+{
+	const char *	name;
+	unsigned int	length;
+} irc_color_name_t;
+
+
+static const irc_color_name_t color_replacement_table[] =
+{
+	{ "WHITE", 5 },
+	{ "BLACK", 5 },
+	{ "DARKBLUE", 8 },
+	{ "DARKGREEN", 9 },
+	{ "RED", 3 },
+	{ "BROWN", 5 },
+	{ "PURPLE", 6 },
+	{ "OLIVE", 5 },
+	{ "YELLOW", 6 },
+	{ "GREEN", 5 },
+	{ "TEAL", 4 },
+	{ "CYAN", 4 },
+	{ "BLUE", 4 },
+	{ "MAGENTA", 7 },
+	{ "DARKGRAY", 8 },
+	{ "LIGHTGRAY", 9 },
+	{ 0, 0 }
+};
+
+
+// The RGB values of the 99 mIRC colors, for HTML
+static const unsigned int libirc_colorparser_rgb[LIBIRC_COLORPARSER_DEFAULT] =
+{
+	0xFFFFFF, 0x000000, 0x00007F, 0x009300, 0xFF0000, 0x7F0000, 0x9C009C, 0xFC7F00,
+	0xFFFF00, 0x00FC00, 0x009393, 0x00FFFF, 0x0000FC, 0xFF00FF, 0x7F7F7F, 0xD2D2D2,
+	0x470000, 0x472100, 0x474700, 0x324700, 0x004700, 0x00472C, 0x004747, 0x002747,
+	0x000047, 0x2E0047, 0x470047, 0x47002A, 0x740000, 0x743A00, 0x747400, 0x517400,
+	0x007400, 0x007449, 0x007474, 0x004074, 0x000074, 0x4B0074, 0x740074, 0x740045,
+	0xB50000, 0xB56300, 0xB5B500, 0x7DB500, 0x00B500, 0x00B571, 0x00B5B5, 0x0063B5,
+	0x0000B5, 0x7500B5, 0xB500B5, 0xB5006B, 0xFF0000, 0xFF8C00, 0xFFFF00, 0xB2FF00,
+	0x00FF00, 0x00FFA0, 0x00FFFF, 0x008CFF, 0x0000FF, 0xA500FF, 0xFF00FF, 0xFF0098,
+	0xFF5959, 0xFFB459, 0xFFFF71, 0xCFFF60, 0x6FFF6F, 0x65FFC9, 0x6DFFFF, 0x59B4FF,
+	0x5959FF, 0xC459FF, 0xFF66FF, 0xFF59BC, 0xFF9C9C, 0xFFD39C, 0xFFFF9C, 0xE2FF9C,
+	0x9CFF9C, 0x9CFFDB, 0x9CFFFF, 0x9CD3FF, 0x9C9CFF, 0xDC9CFF, 0xFF9CFF, 0xFF94D3,
+	0x000000, 0x131313, 0x282828, 0x363636, 0x4D4D4D, 0x656565, 0x818181, 0x9F9F9F,
+	0xBCBCBC, 0xE2E2E2, 0xFFFFFF
+};
 
 
-static const char * color_replacement_table[] =
-{
-	"WHITE",
-	"BLACK",
-	"DARKBLUE",
-	"DARKGREEN",
-	"RED",
-	"BROWN",
-	"PURPLE",
-	"OLIVE",
-	"YELLOW",
-	"GREEN",
-	"TEAL",
-	"CYAN",
-	"BLUE",
-	"MAGENTA",
-	"DARKGRAY",
-	"LIGHTGRAY",
-	0
+// The nearest xterm 256-color palette entries of the 99 mIRC colors, for ANSI
+static const unsigned char libirc_colorparser_xterm[LIBIRC_COLORPARSER_DEFAULT] =
+{
+	 15,   0,   4,   2,   9,   1,   5, 202,  11,  10,   6,  14,  12,  13,   8,   7,
+	 52,  94, 100,  58,  22,  29,  23,  24,  17,  54,  53,  89,  88, 130, 142,  64,
+	 28,  35,  30,  25,  18,  91,  90, 125, 124, 166, 184, 106,  34,  49,  37,  33,
+	 19, 129, 127, 161, 196, 208, 226, 154,  46,  86,  51,  75,  21, 171, 201, 198,
+	203, 215, 227, 191,  83, 122,  87, 111,  63, 177, 207, 205, 217, 223, 229, 193,
+	157, 158, 159, 153, 147, 183, 219, 212,  16, 233, 235, 237, 239, 241, 244, 247,
+	250, 254, 231
 };
 
 
-static inline void libirc_colorparser_addorcat (char ** destline, unsigned int * destlen, const char * str)
+// The bytes which start the mIRC format codes
+static const unsigned char libirc_colorparser_special[256] =
 {
-	unsigned int len = strlen(str);
+	0, 0, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1,
+	0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 1, 1, 1
+};
 
-	if ( *destline )
+
+/*
+ * Finds the next mIRC format code, or returns pend if there is none. Most
+ * of the messages have no codes at all, so the text is checked 16 bytes at
+ * a time where the vector instructions are available: first whether any 
+ * byte is a control character at all, and only then for the exact codes,
+ * which are 0x02-0x04, 0x0F, 0x11, 0x16 and 0x1D-0x1F.
+ */
+static const char * libirc_colorparser_findcode (const char * p, const char * pend)
+{
+#if defined (LIBIRC_HAVE_SSE2)
+	const __m128i controls = _mm_set1_epi8 (0x1F), two = _mm_set1_epi8 (2);
+
+	for ( ; pend - p >= 16; p += 16 )
 	{
-		strcpy (*destline, str);
-		*destline += len;
+		__m128i v = _mm_loadu_si128 ((const __m128i *) p);
+		__m128i low, high, codes;
+
+		if ( !_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_min_epu8 (v, controls), v)) )
+			continue;
+
+		// The ranges are checked as (v - first) <= 2, unsigned
+		low = _mm_sub_epi8 (v, _mm_set1_epi8 (0x02));
+		high = _mm_sub_epi8 (v, _mm_set1_epi8 (0x1D));
+
+		codes = _mm_or_si128 (
+			_mm_or_si128 (
+				_mm_cmpeq_epi8 (_mm_min_epu8 (low, two), low),
+				_mm_cmpeq_epi8 (_mm_min_epu8 (high, two), high)),
+			_mm_or_si128 (
+				_mm_or_si128 (_mm_cmpeq_epi8 (v, _mm_set1_epi8 (0x0F)), _mm_cmpeq_epi8 (v, _mm_set1_epi8 (0x11))),
+				_mm_cmpeq_epi8 (v, _mm_set1_epi8 (0x16))));
+
+		if ( _mm_movemask_epi8 (codes) )
+			break;
 	}
-	else
-		*destlen += len;
+#elif defined (LIBIRC_HAVE_NEON)
+	const uint8x16_t controls = vdupq_n_u8 (0x1F), two = vdupq_n_u8 (2);
+
+	for ( ; pend - p >= 16; p += 16 )
+	{
+		uint8x16_t v = vld1q_u8 ((const uint8_t *) p);
+		uint8x16_t codes;
+
+		if ( vmaxvq_u8 (vcleq_u8 (v, controls)) == 0 )
+			continue;
+
+		codes = vorrq_u8 (
+			vorrq_u8 (
+				vcleq_u8 (vsubq_u8 (v, vdupq_n_u8 (0x02)), two),
+				vcleq_u8 (vsubq_u8 (v, vdupq_n_u8 (0x1D)), two)),
+			vorrq_u8 (
+				vorrq_u8 (vceqq_u8 (v, vdupq_n_u8 (0x0F)), vceqq_u8 (v, vdupq_n_u8 (0x11))),
+				vceqq_u8 (v, vdupq_n_u8 (0x16))));
+
+		if ( vmaxvq_u8 (codes) )
+			break;
+	}
+#endif
+
+	// The code is located within the block found above, or in the tail
+	while ( p < pend && !libirc_colorparser_special[(unsigned char) *p] )
+		p++;
+
+	return p;
 }
 
 
-static void libirc_colorparser_applymask (unsigned int * mask, 
-		char ** destline, unsigned int * destlen,
-		unsigned int bitmask, const char * start, const char * end)
+static inline int libirc_colorparser_isdigit (char c)
 {
-	if ( (*mask & bitmask) != 0 )
+	return c >= '0' && c <= '9';
+}
+
+
+static inline int libirc_colorparser_hexdigit (char c)
+{
+	if ( c >= '0' && c <= '9' )
+		return c - '0';
+
+	if ( c >= 'a' && c <= 'f' )
+		return c - 'a' + 10;
+
+	if ( c >= 'A' && c <= 'F' )
+		return c - 'A' + 10;
+
+	return -1;
+}
+
+
+/*
+ * Appends the string to the output, if it fits. All the output goes 
+ * through here, so the caller buffer is never overrun.
+ */
+static inline int libirc_colorparser_put (char ** d, char * end, const char * str, size_t length)
+{
+	if ( length > (size_t) (end - *d) )
+		return 1;
+
+	memcpy (*d, str, length);
+	*d += length;
+	return 0;
+}
+
+
+/*
+ * Parses the mIRC color code: 0x03, then optionally the foreground color
+ * of one or two digits, and a comma with the background color. Returns
+ * the code length, or 0 if the input ends before it is known; at the final
+ * end of the input the code is just cut there.
+ */
+static unsigned int libirc_colorparser_parsecolor (const char * p, size_t avail, int final, int * color, int * bgcolor)
+{
+	unsigned int i = 1;
+
+	*color = *bgcolor = -1;
+
+	if ( i >= avail )
+		return final ? i : 0;
+
+	if ( !libirc_colorparser_isdigit (p[i]) )
+		return i;
+
+	*color = p[i++] - '0';
+
+	if ( i >= avail )
+		return final ? i : 0;
+
+	if ( libirc_colorparser_isdigit (p[i]) )
 	{
-		*mask &= ~bitmask;
-		libirc_colorparser_addorcat (destline, destlen, end);
+		*color = *color * 10 + (p[i++] - '0');
+
+		if ( i >= avail )
+			return final ? i : 0;
 	}
-	else
+
+	// The comma only belongs to the code if the background color follows
+	if ( p[i] != ',' )
+		return i;
+
+	if ( i + 1 >= avail )
+		return final ? i : 0;
+
+	if ( !libirc_colorparser_isdigit (p[i+1]) )
+		return i;
+
+	*bgcolor = p[i+1] - '0';
+	i += 2;
+
+	if ( i >= avail )
+		return final ? i : 0;
+
+	if ( libirc_colorparser_isdigit (p[i]) )
+		*bgcolor = *bgcolor * 10 + (p[i++] - '0');
+
+	return i;
+}
+
+
+/*
+ * Parses the six hex digits of RRGGBB. Returns 1 if parsed, 0 if these are
+ * not hex digits, or -1 if the input ends before it is known.
+ */
+static int libirc_colorparser_parsergb (const char * p, size_t avail, int final, int * rgb)
+{
+	unsigned int i, value = 0;
+
+	for ( i = 0; i < 6; i++ )
+	{
+		int digit;
+
+		if ( i >= avail )
+			return final ? 0 : -1;
+
+		if ( (digit = libirc_colorparser_hexdigit (p[i])) < 0 )
+			return 0;
+
+		value = (value << 4) | digit;
+	}
+
+	*rgb = value;
+	return 1;
+}
+
+
+/*
+ * Parses the hex color code: 0x04, then optionally the foreground color
+ * as RRGGBB, and a comma with the background color. Returns the same as
+ * libirc_colorparser_parsecolor().
+ */
+static unsigned int libirc_colorparser_parsehexcolor (const char * p, size_t avail, int final, int * color, int * bgcolor)
+{
+	unsigned int i = 7;
+	int result;
+
+	*color = *bgcolor = -1;
+
+	if ( (result = libirc_colorparser_parsergb (p + 1, avail - 1, final, color)) <= 0 )
+		return result < 0 ? 0 : 1;
+
+	if ( i >= avail )
+		return final ? i : 0;
+
+	if ( p[i] != ',' )
+		return i;
+
+	if ( (result = libirc_colorparser_parsergb (p + i + 1, avail - i - 1, final, bgcolor)) <= 0 )
+		return result < 0 ? 0 : i;
+
+	return i + 7;
+}
+
+
+/*
+ * Parses the format code at p. Only the color codes have parameters, and
+ * are longer than a byte.
+ */
+static unsigned int libirc_colorparser_parsecode (const char * p, size_t avail, int final, int * color, int * bgcolor)
+{
+	if ( *p == 0x03 )
+		return libirc_colorparser_parsecolor (p, avail, final, color, bgcolor);
+
+	if ( *p == 0x04 )
+		return libirc_colorparser_parsehexcolor (p, avail, final, color, bgcolor);
+
+	*color = *bgcolor = -1;
+	return 1;
+}
+
+
+/*
+ * An output target of the IRC format conversion. The text between the
+ * codes goes to text(), every format code to code(), and finish() closes
+ * whatever is left open at the end of the input. The functions return
+ * nonzero if the output does not fit.
+ */
+typedef struct
+{
+	int (*text) (irc_color_stream_t * stream, char ** d, char * end, const char * text, size_t length);
+	int (*code) (irc_color_stream_t * stream, char ** d, char * end, char code, int color, int bgcolor);
+	int (*finish) (irc_color_stream_t * stream, char ** d, char * end);
+} irc_color_target_t;
+
+
+static int libirc_colorparser_text (irc_color_stream_t * stream, char ** d, char * end, const char * text, size_t length)
+{
+	return libirc_colorparser_put (d, end, text, length);
+}
+
+
+static int libirc_colorparser_strip (irc_color_stream_t * stream, char ** d, char * end, char code, int color, int bgcolor)
+{
+	return 0;
+}
+
+
+/*
+ * Toggles the format mode, writing its [X] or [/X] tag.
+ */
+static int libirc_colorparser_applymask (irc_color_stream_t * stream, char ** d, char * end, unsigned int bitmask, char letter)
+{
+	char tag[4] = { '[', '/', letter, ']' };
+
+	stream->mask ^= bitmask;
+
+	if ( stream->mask & bitmask )
 	{
-		*mask |= bitmask;
-		libirc_colorparser_addorcat (destline, destlen, start);
+		tag[1] = letter;
+		tag[2] = ']';
+		return libirc_colorparser_put (d, end, tag, 3);
 	}
+
+	return libirc_colorparser_put (d, end, tag, 4);
 }
 
 
-static void libirc_colorparser_applycolor (unsigned int * mask, 
-		char ** destline, unsigned int * destlen,
-		unsigned int colorid, unsigned int bgcolorid)
+static int libirc_colorparser_applycolor (irc_color_stream_t * stream, char ** d, char * end, unsigned int colorid, unsigned int bgcolorid)
 {
-	const char * end = "[/COLOR]";
-	char startbuf[64];
+	const irc_color_name_t * fg = color_replacement_table + colorid;
+	const irc_color_name_t * bg = color_replacement_table + bgcolorid;
+	char tag[64], *t = tag;
+
+	if ( (stream->mask & LIBIRC_COLORPARSER_COLOR) != 0 
+	&& libirc_colorparser_put (d, end, "[/COLOR]", 8) )
+		return 1;
+
+	stream->mask |= LIBIRC_COLORPARSER_COLOR;
+
+	memcpy (t, "[COLOR=", 7);
+	t += 7;
+	memcpy (t, fg->name, fg->length);
+	t += fg->length;
 
 	if ( bgcolorid != 0 )
-		sprintf (startbuf, "[COLOR=%s/%s]", color_replacement_table[colorid], color_replacement_table[bgcolorid]);
+	{
+		*t++ = '/';
+		memcpy (t, bg->name, bg->length);
+		t += bg->length;
+	}
+
+	*t++ = ']';
+	return libirc_colorparser_put (d, end, tag, t - tag);
+}
+
+
+static int libirc_colorparser_closetags (irc_color_stream_t * stream, char ** d, char * end)
+{
+	if ( (stream->mask & LIBIRC_COLORPARSER_BOLD) 
+	&& libirc_colorparser_put (d, end, "[/B]", 4) )
+		return 1;
+
+	if ( (stream->mask & LIBIRC_COLORPARSER_UNDERLINE)
+	&& libirc_colorparser_put (d, end, "[/U]", 4) )
+		return 1;
+
+	if ( (stream->mask & LIBIRC_COLORPARSER_REVERSE)
+	&& libirc_colorparser_put (d, end, "[/I]", 4) )
+		return 1;
+
+	if ( (stream->mask & LIBIRC_COLORPARSER_COLOR)
+	&& libirc_colorparser_put (d, end, "[/COLOR]", 8) )
+		return 1;
+
+	stream->mask = 0;
+	return 0;
+}
+
+
+/*
+ * IRC to [code] conversion. The codes without a tag (italic, strikethrough,
+ * monospace, hex colors and the colors out of range) are dropped.
+ */
+static int libirc_colorparser_code_tags (irc_color_stream_t * stream, char ** d, char * end, char code, int color, int bgcolor)
+{
+	switch (code)
+	{
+	case 0x02:	// bold
+		return libirc_colorparser_applymask (stream, d, end, LIBIRC_COLORPARSER_BOLD, 'B');
+
+	case 0x1F:	// underline
+		return libirc_colorparser_applymask (stream, d, end, LIBIRC_COLORPARSER_UNDERLINE, 'U');
+
+	case 0x16:	// reverse
+		return libirc_colorparser_applymask (stream, d, end, LIBIRC_COLORPARSER_REVERSE, 'I');
+
+	case 0x0F:	// reset colors
+		return libirc_colorparser_closetags (stream, d, end);
+
+	case 0x03:	// set color
+		if ( color == -1
+		|| color > LIBIRC_COLORPARSER_MAXCOLORS
+		|| bgcolor > LIBIRC_COLORPARSER_MAXCOLORS )
+			return 0;
+
+		if ( bgcolor != -1 )
+			stream->bgcolor = bgcolor;
+
+		return libirc_colorparser_applycolor (stream, d, end, color, stream->bgcolor);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Applies the color code to the stream colors of the ANSI and HTML output.
+ * A code without colors resets both, and the color 99 is the default one.
+ */
+static void libirc_colorparser_setcolors (irc_color_stream_t * stream, char code, int color, int bgcolor)
+{
+	if ( color == -1 )
+	{
+		stream->fgcolor = stream->bgcolor = 0;
+		return;
+	}
+
+	if ( code == 0x04 )
+	{
+		stream->fgcolor = LIBIRC_COLORPARSER_RGB | color;
+
+		if ( bgcolor != -1 )
+			stream->bgcolor = LIBIRC_COLORPARSER_RGB | bgcolor;
+	}
 	else
-		sprintf (startbuf, "[COLOR=%s]", color_replacement_table[colorid]);
+	{
+		stream->fgcolor = color == LIBIRC_COLORPARSER_DEFAULT ? 0 : LIBIRC_COLORPARSER_PALETTE | color;
+
+		if ( bgcolor != -1 )
+			stream->bgcolor = bgcolor == LIBIRC_COLORPARSER_DEFAULT ? 0 : LIBIRC_COLORPARSER_PALETTE | bgcolor;
+	}
+}
+
+
+static char * libirc_colorparser_number (char * t, unsigned int value)
+{
+	if ( value >= 100 )
+		*t++ = '0' + value / 100;
+
+	if ( value >= 10 )
+		*t++ = '0' + value / 10 % 10;
+
+	*t++ = '0' + value % 10;
+	return t;
+}
+
+
+/*
+ * Writes the SGR parameters of the color: "39" for the default one,
+ * "38;5;N" for the palette ones, and "38;2;R;G;B" for the hex ones. The
+ * background ones start with 4 instead of 3.
+ */
+static char * libirc_colorparser_ansicolor (char * t, int color, char base)
+{
+	*t++ = base;
+
+	if ( color == 0 )
+	{
+		*t++ = '9';
+		return t;
+	}
+
+	*t++ = '8';
+	*t++ = ';';
 
-	if ( (*mask & LIBIRC_COLORPARSER_COLOR) != 0 )
-		libirc_colorparser_addorcat (destline, destlen, end);
+	if ( color & LIBIRC_COLORPARSER_PALETTE )
+	{
+		*t++ = '5';
+		*t++ = ';';
+		return libirc_colorparser_number (t, libirc_colorparser_xterm[color & 0xFF]);
+	}
 
-	*mask |= LIBIRC_COLORPARSER_COLOR;
-	libirc_colorparser_addorcat (destline, destlen, startbuf);
+	*t++ = '2';
+	*t++ = ';';
+	t = libirc_colorparser_number (t, (color >> 16) & 0xFF);
+	*t++ = ';';
+	t = libirc_colorparser_number (t, (color >> 8) & 0xFF);
+	*t++ = ';';
+	return libirc_colorparser_number (t, color & 0xFF);
 }
 
 
-static void libirc_colorparser_closetags (unsigned int * mask, 
-		char ** destline, unsigned int * destlen)
+/*
+ * The escape characters of the text are dropped, so the message could not
+ * send its own control sequences to the terminal.
+ */
+static int libirc_colorparser_text_ansi (irc_color_stream_t * stream, char ** d, char * end, const char * text, size_t length)
 {
-	if ( *mask & LIBIRC_COLORPARSER_BOLD )
-		libirc_colorparser_applymask (mask, destline, destlen, LIBIRC_COLORPARSER_BOLD, 0, "[/B]");
+	const char * pend = text + length, * esc;
 
-	if ( *mask & LIBIRC_COLORPARSER_UNDERLINE )
-		libirc_colorparser_applymask (mask, destline, destlen, LIBIRC_COLORPARSER_UNDERLINE, 0, "[/U]");
+	while ( (esc = memchr (text, 0x1B, pend - text)) != 0 )
+	{
+		if ( libirc_colorparser_put (d, end, text, esc - text) )
+			return 1;
 
-	if ( *mask & LIBIRC_COLORPARSER_REVERSE )
-		libirc_colorparser_applymask (mask, destline, destlen, LIBIRC_COLORPARSER_REVERSE, 0, "[/I]");
+		text = esc + 1;
+	}
 
-	if ( *mask & LIBIRC_COLORPARSER_COLOR )
-		libirc_colorparser_applymask (mask, destline, destlen, LIBIRC_COLORPARSER_COLOR, 0, "[/COLOR]");
+	return libirc_colorparser_put (d, end, text, pend - text);
 }
 
 
+static int libirc_colorparser_ansimode (irc_color_stream_t * stream, char ** d, char * end, unsigned int bitmask, const char * on, const char * off)
+{
+	const char * sgr;
+
+	stream->mask ^= bitmask;
+	sgr = stream->mask & bitmask ? on : off;
+	return libirc_colorparser_put (d, end, sgr, strlen (sgr));
+}
+
+
+static int libirc_colorparser_finish_ansi (irc_color_stream_t * stream, char ** d, char * end)
+{
+	if ( ((stream->mask & LIBIRC_COLORPARSER_FORMAT & ~LIBIRC_COLORPARSER_MONOSPACE) != 0
+		|| stream->fgcolor != 0 || stream->bgcolor != 0)
+	&& libirc_colorparser_put (d, end, "\x1B[0m", 4) )
+		return 1;
+
+	stream->mask = 0;
+	stream->fgcolor = stream->bgcolor = 0;
+	return 0;
+}
+
 
 /*
- * IRC to [code] color conversion. Or strip.
+ * IRC to ANSI SGR conversion. The monospace has no SGR, as the terminal
+ * text is monospace anyway.
  */
-static char * libirc_colorparser_irc2code (const char * source, int strip)
-{
-	unsigned int mask = 0, destlen = 0;
-	char * destline = 0, *d = 0;
-	const char *p;
-	int current_bg = 0;
-
-    /*
-     * There will be two passes. First pass calculates the total length of
-     * the destination string. The second pass allocates memory for the string,
-     * and fills it.
-     */
-	while ( destline == 0 ) // destline will be set after the 2nd pass
+static int libirc_colorparser_code_ansi (irc_color_stream_t * stream, char ** d, char * end, char code, int color, int bgcolor)
+{
+	char sgr[48], *t = sgr;
+
+	switch (code)
+	{
+	case 0x02:
+		return libirc_colorparser_ansimode (stream, d, end, LIBIRC_COLORPARSER_BOLD, "\x1B[1m", "\x1B[22m");
+
+	case 0x1D:
+		return libirc_colorparser_ansimode (stream, d, end, LIBIRC_COLORPARSER_ITALIC, "\x1B[3m", "\x1B[23m");
+
+	case 0x1F:
+		return libirc_colorparser_ansimode (stream, d, end, LIBIRC_COLORPARSER_UNDERLINE, "\x1B[4m", "\x1B[24m");
+
+	case 0x1E:
+		return libirc_colorparser_ansimode (stream, d, end, LIBIRC_COLORPARSER_STRIKE, "\x1B[9m", "\x1B[29m");
+
+	case 0x16:
+		return libirc_colorparser_ansimode (stream, d, end, LIBIRC_COLORPARSER_REVERSE, "\x1B[7m", "\x1B[27m");
+
+	case 0x11:
+		stream->mask ^= LIBIRC_COLORPARSER_MONOSPACE;
+		return 0;
+
+	case 0x0F:
+		return libirc_colorparser_finish_ansi (stream, d, end);
+	}
+
+	// Both colors are written, as a single sequence
+	libirc_colorparser_setcolors (stream, code, color, bgcolor);
+
+	*t++ = 0x1B;
+	*t++ = '[';
+	t = libirc_colorparser_ansicolor (t, stream->fgcolor, '3');
+	*t++ = ';';
+	t = libirc_colorparser_ansicolor (t, stream->bgcolor, '4');
+	*t++ = 'm';
+
+	return libirc_colorparser_put (d, end, sgr, t - sgr);
+}
+
+
+static int libirc_colorparser_text_html (irc_color_stream_t * stream, char ** d, char * end, const char * text, size_t length)
+{
+	const char * pend = text + length, * p;
+
+	for ( p = text; p < pend; p++ )
 	{
-		if ( destlen > 0 )
+		const char * entity;
+
+		switch (*p)
 		{
-			// This is the 2nd pass; allocate memory.
-			if ( (destline = malloc (destlen)) == 0 )
-				return 0;
+		case '&':	entity = "&amp;"; break;
+		case '<':	entity = "&lt;"; break;
+		case '>':	entity = "&gt;"; break;
+		case '"':	entity = "&quot;"; break;
+		case '\'':	entity = "&#39;"; break;
+		default:	continue;
+		}
+
+		if ( libirc_colorparser_put (d, end, text, p - text)
+		|| libirc_colorparser_put (d, end, entity, strlen (entity)) )
+			return 1;
+
+		text = p + 1;
+	}
+
+	return libirc_colorparser_put (d, end, text, pend - text);
+}
+
+
+static char * libirc_colorparser_htmlcolor (char * t, const char * property, int color)
+{
+	static const char hex[] = "0123456789abcdef";
+	unsigned int rgb = color & LIBIRC_COLORPARSER_RGB ? color & 0xFFFFFF : libirc_colorparser_rgb[color & 0xFF];
+	int shift;
+
+	memcpy (t, property, strlen (property));
+	t += strlen (property);
+	*t++ = '#';
+
+	for ( shift = 20; shift >= 0; shift -= 4 )
+		*t++ = hex[(rgb >> shift) & 0x0F];
+
+	*t++ = ';';
+	return t;
+}
+
+
+static int libirc_colorparser_finish_html (irc_color_stream_t * stream, char ** d, char * end)
+{
+	if ( (stream->mask & LIBIRC_COLORPARSER_SPAN)
+	&& libirc_colorparser_put (d, end, "</span>", 7) )
+		return 1;
+
+	stream->mask = 0;
+	stream->fgcolor = stream->bgcolor = 0;
+	return 0;
+}
+
+
+/*
+ * IRC to HTML conversion. Every code closes the current span and opens a
+ * new one with the whole format state as its inline style, so the spans
+ * are never nested. The reverse mode swaps the colors, black on white by
+ * default.
+ */
+static int libirc_colorparser_code_html (irc_color_stream_t * stream, char ** d, char * end, char code, int color, int bgcolor)
+{
+	char span[192], *t = span;
+	int fg, bg;
+
+	switch (code)
+	{
+	case 0x02:	stream->mask ^= LIBIRC_COLORPARSER_BOLD; break;
+	case 0x1D:	stream->mask ^= LIBIRC_COLORPARSER_ITALIC; break;
+	case 0x1F:	stream->mask ^= LIBIRC_COLORPARSER_UNDERLINE; break;
+	case 0x1E:	stream->mask ^= LIBIRC_COLORPARSER_STRIKE; break;
+	case 0x16:	stream->mask ^= LIBIRC_COLORPARSER_REVERSE; break;
+	case 0x11:	stream->mask ^= LIBIRC_COLORPARSER_MONOSPACE; break;
+	case 0x0F:	return libirc_colorparser_finish_html (stream, d, end);
+	default:	libirc_colorparser_setcolors (stream, code, color, bgcolor); break;
+	}
+
+	if ( (stream->mask & LIBIRC_COLORPARSER_SPAN)
+	&& libirc_colorparser_put (d, end, "</span>", 7) )
+		return 1;
+
+	stream->mask &= ~LIBIRC_COLORPARSER_SPAN;
+
+	if ( (stream->mask & LIBIRC_COLORPARSER_FORMAT) == 0 && stream->fgcolor == 0 && stream->bgcolor == 0 )
+		return 0;
+
+	fg = stream->fgcolor;
+	bg = stream->bgcolor;
+
+	if ( stream->mask & LIBIRC_COLORPARSER_REVERSE )
+	{
+		fg = stream->bgcolor ? stream->bgcolor : LIBIRC_COLORPARSER_PALETTE | 0;
+		bg = stream->fgcolor ? stream->fgcolor : LIBIRC_COLORPARSER_PALETTE | 1;
+	}
+
+	memcpy (t, "<span style=\"", 13);
+	t += 13;
+
+	if ( stream->mask & LIBIRC_COLORPARSER_BOLD )
+	{
+		memcpy (t, "font-weight:bold;", 17);
+		t += 17;
+	}
+
+	if ( stream->mask & LIBIRC_COLORPARSER_ITALIC )
+	{
+		memcpy (t, "font-style:italic;", 18);
+		t += 18;
+	}
 
-			d = destline;
+	if ( stream->mask & (LIBIRC_COLORPARSER_UNDERLINE | LIBIRC_COLORPARSER_STRIKE) )
+	{
+		memcpy (t, "text-decoration:", 16);
+		t += 16;
+
+		if ( stream->mask & LIBIRC_COLORPARSER_UNDERLINE )
+		{
+			memcpy (t, "underline ", 10);
+			t += 10;
 		}
 
-		for ( p = source; *p; p++ )
+		if ( stream->mask & LIBIRC_COLORPARSER_STRIKE )
 		{
-			switch (*p)
-			{
-			case 0x02:	// bold
-				if ( strip )
-					continue;
-
-				libirc_colorparser_applymask (&mask, &d, &destlen, LIBIRC_COLORPARSER_BOLD, "[B]", "[/B]");
-				break;
-				
-			case 0x1F:	// underline
-				if ( strip )
-					continue;
-
-				libirc_colorparser_applymask (&mask, &d, &destlen, LIBIRC_COLORPARSER_UNDERLINE, "[U]", "[/U]");
-				break;
-
-			case 0x16:	// reverse
-				if ( strip )
-					continue;
-
-				libirc_colorparser_applymask (&mask, &d, &destlen, LIBIRC_COLORPARSER_REVERSE, "[I]", "[/I]");
-				break;
-
-			case 0x0F:	// reset colors
-				if ( strip )
-					continue;
-
-				libirc_colorparser_closetags (&mask, &d, &destlen);
-				break;
-
-			case 0x03:	// set color
-				if ( isdigit (p[1]) )
-				{
-					// Parse 
-					int bgcolor = -1, color = p[1] - 0x30;
-					p++;
-
-					if ( isdigit (p[1]) )
-					{
-						color = color * 10 + (p[1] - 0x30);
-						p++;
-					}
-
-					// If there is a comma, search for the following 
-					// background color
-					if ( p[1] == ',' && isdigit (p[2]) )
-					{
-						bgcolor = p[2] - 0x30;
-						p += 2;
-
-						if ( isdigit (p[1]) )
-						{
-							bgcolor = bgcolor * 10 + (p[1] - 0x30);
-							p++;
-						}
-					}
-
-					// Check for range
-					if ( color <= LIBIRC_COLORPARSER_MAXCOLORS 
-					&& bgcolor <= LIBIRC_COLORPARSER_MAXCOLORS )
-					{
-						if ( strip )
-							continue;
-
-						if ( bgcolor != -1 )
-							current_bg = bgcolor;
-
-						libirc_colorparser_applycolor (&mask, &d, &destlen, color, current_bg);
-					}
-				}
-				break;
-
-			default:
-				if ( destline )
-					*d++ = *p;
-				else
-					destlen++;
-				break;
-			}
+			memcpy (t, "line-through ", 13);
+			t += 13;
 		}
 
-		// Close all the opened tags
-		libirc_colorparser_closetags (&mask, &d, &destlen);
-		destlen++; // for 0-terminator
+		t[-1] = ';';
 	}
 
-	*d = '\0';
-	return destline;
+	if ( stream->mask & LIBIRC_COLORPARSER_MONOSPACE )
+	{
+		memcpy (t, "font-family:monospace;", 22);
+		t += 22;
+	}
+
+	if ( fg )
+		t = libirc_colorparser_htmlcolor (t, "color:", fg);
+
+	if ( bg )
+		t = libirc_colorparser_htmlcolor (t, "background-color:", bg);
+
+	*t++ = '"';
+	*t++ = '>';
+
+	stream->mask |= LIBIRC_COLORPARSER_SPAN;
+	return libirc_colorparser_put (d, end, span, t - span);
+}
+
+
+// The targets of the IRC format conversion, by the conversion mode
+static const irc_color_target_t libirc_colorparser_targets[] =
+{
+	{ 0, 0, 0 },
+	{ libirc_colorparser_text, libirc_colorparser_strip, 0 },								// LIBIRC_COLOR_STRIP
+	{ libirc_colorparser_text, libirc_colorparser_code_tags, libirc_colorparser_closetags },	// LIBIRC_COLOR_FROM_MIRC
+	{ 0, 0, 0 },																			// LIBIRC_COLOR_TO_MIRC
+	{ libirc_colorparser_text_ansi, libirc_colorparser_code_ansi, libirc_colorparser_finish_ansi },	// LIBIRC_COLOR_TO_ANSI
+	{ libirc_colorparser_text_html, libirc_colorparser_code_html, libirc_colorparser_finish_html }	// LIBIRC_COLOR_TO_HTML
+};
+
+
+/*
+ * IRC format conversion. Tokenizes the input into the text and the format
+ * codes, and passes them to the target of the stream mode. Converts the
+ * input until its end, or until a color code which could continue in the
+ * next input. Returns the position it stopped at, or 0 if the output does
+ * not fit.
+ */
+static const char * libirc_colorparser_render (irc_color_stream_t * stream, char ** d, char * end, const char * p, const char * pend, int final)
+{
+	const irc_color_target_t * target = libirc_colorparser_targets + stream->mode;
+
+	while ( p < pend )
+	{
+		const char * text = p;
+		int color, bgcolor;
+		unsigned int length;
+
+		// The plain text is passed as a whole
+		p = libirc_colorparser_findcode (p, pend);
+
+		if ( p > text && target->text (stream, d, end, text, p - text) )
+			return 0;
+
+		if ( p == pend )
+			break;
+
+		if ( (length = libirc_colorparser_parsecode (p, pend - p, final, &color, &bgcolor)) == 0 )
+			return p;
+
+		if ( target->code (stream, d, end, *p, color, bgcolor) )
+			return 0;
+
+		p += length;
+	}
+
+	return p;
 }
 
 
-static int libirc_colorparser_colorlookup (const char * color)
+static int libirc_colorparser_colorlookup (const char * color, size_t length)
 {
 	int i;
-	for ( i = 0; color_replacement_table[i]; i++ )
-		if ( !strcmp (color, color_replacement_table[i]) )
+
+	for ( i = 0; color_replacement_table[i].name; i++ )
+		if ( color_replacement_table[i].length == length 
+		&& !memcmp (color, color_replacement_table[i].name, length) )
 			return i;
 
 	return -1;
@@ -244,145 +854,320 @@ static int libirc_colorparser_colorlookup (const char * color)
 
 
 /*
- * [code] to IRC color conversion.
+ * Translates the [code] tag (without the brackets) into the mIRC code.
+ * Returns the code length, or 0 if the tag is not known.
  */
-char * irc_color_convert_to_mirc (const char * source)
-{
-	unsigned int destlen = 0;
-	char * destline = 0, *d = 0;
-	const char *p1, *p2, *cur;
-
-    /*
-     * There will be two passes. First pass calculates the total length of
-     * the destination string. The second pass allocates memory for the string,
-     * and fills it.
-     */
-	while ( destline == 0 ) // destline will be set after the 2nd pass
+static unsigned int libirc_colorparser_tag2irc (const char * tag, size_t length, char * code)
+{
+	if ( length == 6 && !memcmp (tag, "/COLOR", 6) )
+		code[0] = 0x0F;
+	else if ( length > 6 && !memcmp (tag, "COLOR=", 6) )
 	{
-		if ( destlen > 0 )
+		const char * fg = tag + 6, * bg = memchr (fg, '/', length - 6);
+		int color, bgcolor = -2;
+
+		if ( bg )
+		{
+			bgcolor = libirc_colorparser_colorlookup (bg + 1, tag + length - bg - 1);
+			color = libirc_colorparser_colorlookup (fg, bg - fg);
+		}
+		else
+			color = libirc_colorparser_colorlookup (fg, tag + length - fg);
+
+		if ( color == -1 || bgcolor == -1 )
+			return 0;
+
+		code[0] = 0x03;
+		code[1] = '0' + color / 10;
+		code[2] = '0' + color % 10;
+
+		if ( bgcolor < 0 )
+			return 3;
+
+		code[3] = ',';
+		code[4] = '0' + bgcolor / 10;
+		code[5] = '0' + bgcolor % 10;
+		return 6;
+	}
+	else if ( (length == 1 && tag[0] == 'B') || (length == 2 && !memcmp (tag, "/B", 2)) )
+		code[0] = 0x02;
+	else if ( (length == 1 && tag[0] == 'U') || (length == 2 && !memcmp (tag, "/U", 2)) )
+		code[0] = 0x1F;
+	else if ( (length == 1 && tag[0] == 'I') || (length == 2 && !memcmp (tag, "/I", 2)) )
+		code[0] = 0x16;
+	else
+		return 0;
+
+	return 1;
+}
+
+
+/*
+ * [code] to IRC color conversion. Converts the input until its end, or 
+ * until a '[' which could start a tag continued in the next input. Returns 
+ * the position it stopped at, or 0 if the output does not fit.
+ */
+static const char * libirc_colorparser_code2irc (irc_color_stream_t * stream, char ** d, char * end, const char * p, const char * pend, int final)
+{
+	while ( p < pend )
+	{
+		const char * text = p, * limit, * close;
+		char code[8];
+		unsigned int length;
+
+		if ( (p = memchr (p, '[', pend - p)) == 0 )
+			p = pend;
+
+		if ( p > text && libirc_colorparser_put (d, end, text, p - text) )
+			return 0;
+
+		if ( p == pend )
+			break;
+
+		// The tag is at most LIBIRC_COLORPARSER_MAXTAG long with the brackets
+		limit = pend - p > LIBIRC_COLORPARSER_MAXTAG ? p + LIBIRC_COLORPARSER_MAXTAG : pend;
+		close = memchr (p + 1, ']', limit - p - 1);
+
+		if ( !close && limit == pend && !final )
+			return p;
+
+		if ( close && (length = libirc_colorparser_tag2irc (p + 1, close - p - 1, code)) > 0 )
 		{
-			// This is the 2nd pass; allocate memory.
-			if ( (destline = malloc (destlen)) == 0 )
+			if ( libirc_colorparser_put (d, end, code, length) )
 				return 0;
 
-			d = destline;
+			p = close + 1;
 		}
+		else
+		{
+			// Not a tag, so the bracket is just the text
+			if ( libirc_colorparser_put (d, end, p, 1) )
+				return 0;
+
+			p++;
+		}
+	}
+
+	return p;
+}
+
+
+static const char * libirc_colorparser_process (irc_color_stream_t * stream, char ** d, char * end, const char * p, const char * pend, int final)
+{
+	if ( stream->mode == LIBIRC_COLOR_TO_MIRC )
+		return libirc_colorparser_code2irc (stream, d, end, p, pend, final);
+	else
+		return libirc_colorparser_render (stream, d, end, p, pend, final);
+}
+
+
+/*
+ * Converts the next part of the input. A code which could continue in the
+ * next part is kept in the stream; it is completed by the beginning of the
+ * next part, which is converted together with it in a local buffer. The 
+ * buffer is large enough to decide on any code kept, so either the kept 
+ * code is finished there and the rest of the input is converted in place,
+ * or the whole input is short enough to be kept. Returns the output length,
+ * or -1 if the output does not fit.
+ */
+static int libirc_colorparser_run (irc_color_stream_t * stream, char * dst, size_t dst_cap, const char * src, size_t src_len, int final)
+{
+	char * d = dst, * end = dst + dst_cap;
+	const char * stop;
+
+	if ( stream->pending_length > 0 )
+	{
+		char buf[2 * LIBIRC_COLORPARSER_MAXTAG + 2];
+		unsigned int kept = stream->pending_length;
+		size_t added = sizeof(buf) - kept;
+
+		if ( added > src_len )
+			added = src_len;
+
+		memcpy (buf, stream->pending, kept);
+		memcpy (buf + kept, src, added);
+		stream->pending_length = 0;
 
-		cur = source;
-		while ( (p1 = strchr (cur, '[')) != 0 )
+		if ( (stop = libirc_colorparser_process (stream, &d, end, buf, buf + kept + added, final && added == src_len)) == 0 )
+			return -1;
+
+		if ( stop < buf + kept + added && added == src_len )
 		{
-			const char * replacedval = 0;
-			p2 = 0;
-
-			// Check if the closing bracket is available after p1
-			// and the tag length is suitable
-			if ( p1[1] != '\0' 
-			&& (p2 = strchr (p1, ']')) != 0
-			&& (p2 - p1) > 1
-			&& (p2 - p1) < 31 )
-			{
-				// Get the tag
-				char tagbuf[32];
-				int taglen = p2 - p1 - 1;
-
-				memcpy (tagbuf, p1 + 1, taglen);
-				tagbuf[taglen] = '\0';
-
-				if ( !strcmp (tagbuf, "/COLOR") )
-					replacedval = "\x0F";
-				else if ( strstr (tagbuf, "COLOR=") == tagbuf )
-				{
-					int color, bgcolor = -2;
-					char * bcol;
-
-					bcol = strchr (tagbuf + 6, '/');
-
-					if ( bcol )
-					{
-						*bcol++ = '\0';
-						bgcolor = libirc_colorparser_colorlookup (bcol);
-					}
-
-					color = libirc_colorparser_colorlookup (tagbuf + 6);
-
-					if ( color != -1 && bgcolor == -2 )
-					{
-						sprintf (tagbuf, "\x03%02d", color);
-						replacedval = tagbuf;
-					}
-					else if ( color != -1 && bgcolor >= 0 )
-					{
-						sprintf (tagbuf, "\x03%02d,%02d", color, bgcolor);
-						replacedval = tagbuf;
-					}
-				}
-				else if ( !strcmp (tagbuf, "B") || !strcmp (tagbuf, "/B") )
-					replacedval = "\x02";
-				else if ( !strcmp (tagbuf, "U") || !strcmp (tagbuf, "/U") )
-					replacedval = "\x1F";
-				else if ( !strcmp (tagbuf, "I") || !strcmp (tagbuf, "/I") )
-					replacedval = "\x16";
-			}
-
-			if ( replacedval )
-			{
-				// add a part before the tag
-				int partlen = p1 - cur;
-
-				if ( destline )
-				{
-					memcpy (d, cur, partlen);
-					d += partlen;
-				}
-				else
-					destlen += partlen;
-
-				// Add the replacement
-				libirc_colorparser_addorcat (&d, &destlen, replacedval);
-
-				// And move the pointer
-				cur = p2 + 1;
-			}
-			else
-			{
-				// add a whole part before the end tag
-				int partlen;
-
-				if ( !p2 )
-					p2 = cur + strlen(cur);
-
-				partlen = p2 - cur + 1;
-
-				if ( destline )
-				{
-					memcpy (d, cur, partlen);
-					d += partlen;
-				}
-				else
-					destlen += partlen;
-
-				// And move the pointer
-				cur = p2 + 1;
-			}
+			stream->pending_length = buf + kept + added - stop;
+			memcpy (stream->pending, stop, stream->pending_length);
+			return d - dst;
 		}
 
-		// Add the rest of string
-		libirc_colorparser_addorcat (&d, &destlen, cur);
-		destlen++; // for 0-terminator
+		src += stop - buf - kept;
+		src_len -= stop - buf - kept;
 	}
 
-	*d = '\0';
+	if ( (stop = libirc_colorparser_process (stream, &d, end, src, src + src_len, final)) == 0 )
+		return -1;
+
+	stream->pending_length = src + src_len - stop;
+	memcpy (stream->pending, stop, stream->pending_length);
+	return d - dst;
+}
+
+
+void irc_color_stream_init (irc_color_stream_t * stream, unsigned int mode)
+{
+	memset (stream, 0, sizeof(irc_color_stream_t));
+
+	// An unknown mode just strips the codes
+	if ( mode >= sizeof(libirc_colorparser_targets) / sizeof(libirc_colorparser_targets[0]) || mode == 0 )
+		mode = LIBIRC_COLOR_STRIP;
+
+	stream->mode = mode;
+}
+
+
+int irc_color_stream_convert (irc_color_stream_t * stream, char * dst, size_t dst_cap, const char * src, size_t src_len)
+{
+	return libirc_colorparser_run (stream, dst, dst_cap, src, src_len, 0);
+}
+
+
+int irc_color_stream_finish (irc_color_stream_t * stream, char * dst, size_t dst_cap)
+{
+	int length = libirc_colorparser_run (stream, dst, dst_cap, "", 0, 1);
+	char * d;
+
+	if ( length < 0 )
+		return -1;
+
+	// Close all the opened tags
+	d = dst + length;
+
+	if ( libirc_colorparser_targets[stream->mode].finish
+	&& libirc_colorparser_targets[stream->mode].finish (stream, &d, dst + dst_cap) )
+		return -1;
+
+	return d - dst;
+}
+
+
+/*
+ * Converts the whole input into the caller buffer in a single pass, and 
+ * terminates the output with 0.
+ */
+static int libirc_colorparser_convert_into (unsigned int mode, char * dst, size_t dst_cap, const char * src, size_t src_len)
+{
+	irc_color_stream_t stream;
+	int length, rest;
+
+	if ( dst_cap == 0 )
+		return -1;
+
+	irc_color_stream_init (&stream, mode);
+
+	// Keep the space for the terminator
+	if ( (length = libirc_colorparser_run (&stream, dst, dst_cap - 1, src, src_len, 1)) < 0
+	|| (rest = irc_color_stream_finish (&stream, dst + length, dst_cap - 1 - length)) < 0 )
+		return -1;
+
+	length += rest;
+	dst[length] = '\0';
+	return length;
+}
+
+
+int irc_color_strip_from_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len)
+{
+	return libirc_colorparser_convert_into (LIBIRC_COLOR_STRIP, dst, dst_cap, src, src_len);
+}
+
+
+int irc_color_convert_from_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len)
+{
+	return libirc_colorparser_convert_into (LIBIRC_COLOR_FROM_MIRC, dst, dst_cap, src, src_len);
+}
+
+
+int irc_color_convert_to_mirc_into (char * dst, size_t dst_cap, const char * src, size_t src_len)
+{
+	return libirc_colorparser_convert_into (LIBIRC_COLOR_TO_MIRC, dst, dst_cap, src, src_len);
+}
+
+
+int irc_color_render_into (unsigned int mode, char * dst, size_t dst_cap, const char * src, size_t src_len)
+{
+	return libirc_colorparser_convert_into (mode, dst, dst_cap, src, src_len);
+}
+
+
+int irc_color_strip_from_mirc_inplace (char * message, size_t length)
+{
+	const char * p = message, * pend = message + length;
+	char * d = message;
+
+	while ( p < pend )
+	{
+		const char * code = libirc_colorparser_findcode (p, pend);
+		int color, bgcolor;
+
+		// Nothing is moved until the first code
+		if ( code > p && d != p )
+			memmove (d, p, code - p);
+
+		d += code - p;
+		p = code;
+
+		if ( p == pend )
+			break;
+
+		p += libirc_colorparser_parsecode (p, pend - p, 1, &color, &bgcolor);
+	}
+
+	if ( d < pend )
+		*d = '\0';
+
+	return d - message;
+}
+
+
+/*
+ * The allocating conversions. Stripping and the conversion to mIRC never
+ * make the text longer, so the buffer is allocated for the worst case only
+ * when converting from mIRC, and shrunk afterwards.
+ */
+static char * libirc_colorparser_convert (unsigned int mode, const char * source)
+{
+	size_t length = strlen (source);
+	size_t size = mode == LIBIRC_COLOR_FROM_MIRC ? LIBIRC_COLOR_BOUND(length) : length + 1;
+	char * destline = malloc (size), * shrunk;
+	int result;
+
+	if ( !destline )
+		return 0;
+
+	if ( (result = libirc_colorparser_convert_into (mode, destline, size, source, length)) < 0 )
+	{
+		free (destline);
+		return 0;
+	}
+
+	if ( (size_t) result + 1 < size && (shrunk = realloc (destline, result + 1)) != 0 )
+		destline = shrunk;
+
 	return destline;
 }
 
 
 char * irc_color_strip_from_mirc (const char * message)
 {
-	return libirc_colorparser_irc2code (message, 1);
+	return libirc_colorparser_convert (LIBIRC_COLOR_STRIP, message);
 }
 
 
 char * irc_color_convert_from_mirc (const char * message)
 {
-	return libirc_colorparser_irc2code (message, 0);
+	return libirc_colorparser_convert (LIBIRC_COLOR_FROM_MIRC, message);
+}
+
+
+char * irc_color_convert_to_mirc (const char * message)
+{
+	return libirc_colorparser_convert (LIBIRC_COLOR_TO_MIRC, message);
 }
@@ -17,148 +17,1410 @@
 #define LIBIRC_DCC_RECVFILE		3
 
 
-static irc_dcc_session_t * libirc_find_dcc_session (irc_session_t * session, irc_dcc_t dccid, int lock_list)
+/*
+ * Looks up the DCC session by its id in O(1): the low bits of the id are
+ * the slot index, and the high bits are the slot generation. If found, the
+ * session is returned locked. The table lock is held while taking the DCC
+ * lock, so the processing loop cannot free the session meanwhile.
+ */
+static irc_dcc_session_t * libirc_find_dcc_session (irc_session_t * session, irc_dcc_t dccid)
+{
+	unsigned int slot = dccid & LIBIRC_DCC_SLOT_MASK;
+	irc_dcc_session_t * dcc = 0;
+
+	libirc_mutex_lock (&session->mutex_dcc);
+
+	if ( slot < session->dcc_slots_count
+	&& session->dcc_slots[slot].dcc
+	&& session->dcc_slots[slot].dcc->id == dccid )
+	{
+		dcc = session->dcc_slots[slot].dcc;
+		libirc_mutex_lock (&dcc->mutex);
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc);
+	return dcc;
+}
+
+
+/*
+ * Returns the DCC session from the specified slot locked, or 0 if the 
+ * slot is empty.
+ */
+static irc_dcc_session_t * libirc_lock_dcc_slot (irc_session_t * session, unsigned int slot)
+{
+	irc_dcc_session_t * dcc;
+
+	libirc_mutex_lock (&session->mutex_dcc);
+
+	if ( (dcc = session->dcc_slots[slot].dcc) != 0 )
+		libirc_mutex_lock (&dcc->mutex);
+
+	libirc_mutex_unlock (&session->mutex_dcc);
+	return dcc;
+}
+
+
+static unsigned int libirc_dcc_slots_count (irc_session_t * session)
+{
+	unsigned int count;
+
+	libirc_mutex_lock (&session->mutex_dcc);
+	count = session->dcc_slots_count;
+	libirc_mutex_unlock (&session->mutex_dcc);
+
+	return count;
+}
+
+
+/*
+ * Stores the DCC session in a free slot of the table, growing the table 
+ * if needed, and assigns its id. Must be called with the table locked.
+ */
+static int libirc_dcc_add_slot (irc_session_t * session, irc_dcc_session_t * dcc)
+{
+	irc_dcc_slot_t * slot;
+
+	if ( session->dcc_free_slot == 0 )
+	{
+		unsigned int i, count = session->dcc_slots_count ? session->dcc_slots_count * 2 : LIBIRC_DCC_INITIAL_SLOTS;
+		irc_dcc_slot_t * slots;
+
+		if ( count > LIBIRC_DCC_SLOT_MASK + 1 )
+			count = LIBIRC_DCC_SLOT_MASK + 1;
+
+		if ( count <= session->dcc_slots_count
+		|| (slots = realloc (session->dcc_slots, count * sizeof(irc_dcc_slot_t))) == 0 )
+			return LIBIRC_ERR_NOMEM;
+
+		// Chain the new slots into the free list
+		for ( i = session->dcc_slots_count; i < count; i++ )
+		{
+			slots[i].dcc = 0;
+			slots[i].generation = 1;
+			slots[i].next_free = i + 1 < count ? i + 2 : 0;
+		}
+
+		session->dcc_free_slot = session->dcc_slots_count + 1;
+		session->dcc_slots = slots;
+		session->dcc_slots_count = count;
+	}
+
+	slot = session->dcc_slots + session->dcc_free_slot - 1;
+	dcc->id = (slot->generation << LIBIRC_DCC_SLOT_BITS) | (session->dcc_free_slot - 1);
+
+	session->dcc_free_slot = slot->next_free;
+	slot->dcc = dcc;
+
+	// The queued DCC SENDs with the same priority start in this order
+	dcc->queue_seq = session->dcc_queue_seq++;
+	return 0;
+}
+
+
+/*
+ * The file transfer buffers are large, so the freed ones are kept in a 
+ * small per-session pool and reused by the next transfers. The pool has 
+ * its own lock, which may be taken while holding a DCC session lock.
+ */
+static char * libirc_dcc_buffer_get (irc_session_t * session, unsigned int size)
+{
+	char * buf = 0;
+
+	libirc_mutex_lock (&session->mutex_dcc_pool);
+
+	if ( session->dcc_buffer_pool && size == session->dcc_buffer_size )
+	{
+		buf = session->dcc_buffer_pool;
+		memcpy (&session->dcc_buffer_pool, buf, sizeof(char *));
+		session->dcc_buffer_pool_count--;
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc_pool);
+
+	return buf ? buf : malloc (size);
+}
+
+
+static void libirc_dcc_buffer_put (irc_session_t * session, char * buf, unsigned int size)
+{
+	libirc_mutex_lock (&session->mutex_dcc_pool);
+
+	if ( size == session->dcc_buffer_size 
+	&& session->dcc_buffer_pool_count < LIBIRC_DCC_BUFFER_POOL_MAX )
+	{
+		memcpy (buf, &session->dcc_buffer_pool, sizeof(char *));
+		session->dcc_buffer_pool = buf;
+		session->dcc_buffer_pool_count++;
+		buf = 0;
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc_pool);
+
+	if ( buf )
+		free (buf);
+}
+
+
+/*
+ * Frees the pooled buffers. Called with mutex_dcc_pool locked.
+ */
+static void libirc_dcc_buffer_pool_free_nolock (irc_session_t * session)
+{
+	while ( session->dcc_buffer_pool )
+	{
+		char * buf = session->dcc_buffer_pool;
+		memcpy (&session->dcc_buffer_pool, buf, sizeof(char *));
+		free (buf);
+	}
+
+	session->dcc_buffer_pool_count = 0;
+}
+
+
+static void libirc_dcc_buffer_pool_free (irc_session_t * session)
+{
+	libirc_mutex_lock (&session->mutex_dcc_pool);
+	libirc_dcc_buffer_pool_free_nolock (session);
+	libirc_mutex_unlock (&session->mutex_dcc_pool);
+}
+
+
+/*
+ * Asks the kernel to read ahead of the transfer. The read-ahead of a shared
+ * descriptor is confused by the interleaved reads of several transfers, so
+ * every transfer asks for its own range, once per half of it.
+ */
+static void libirc_dcc_prefetch (irc_dcc_session_t * dcc, irc_dcc_size_t offset)
+{
+	irc_dcc_size_t start = offset > dcc->file_prefetch_offset ? offset : dcc->file_prefetch_offset;
+
+	if ( offset + LIBIRC_DCC_PREFETCH_SIZE / 2 < dcc->file_prefetch_offset
+	|| start >= dcc->file_size )
+		return;
+
+	dcc->file_prefetch_offset = offset + LIBIRC_DCC_PREFETCH_SIZE;
+	libirc_file_prefetch (dcc->file_fd, start, dcc->file_prefetch_offset - start);
+}
+
+
+/*
+ * Takes a file data buffer from the pool, unless it is already allocated.
+ */
+static int libirc_dcc_alloc_file_buffer (irc_session_t * session, irc_dcc_session_t * dcc, char ** buf, unsigned int * size)
+{
+	if ( *buf )
+		return 0;
+
+	if ( (*buf = libirc_dcc_buffer_get (session, dcc->buffer_size)) == 0 )
+		return LIBIRC_ERR_NOMEM;
+
+	*size = dcc->buffer_size;
+	return 0;
+}
+
+
+/*
+ * Grows the chat or acknowledge buffer to hold at least the needed amount,
+ * doubling its size but never above the limit. The chat buffers start 
+ * small, so the idle chats do not waste memory.
+ */
+static int libirc_dcc_grow_buffer (char ** buf, unsigned int * size, unsigned int needed, unsigned int limit)
+{
+	unsigned int newsize = *size ? *size : LIBIRC_DCC_BUFFER_SIZE;
+	char * newbuf;
+
+	if ( *buf && *size >= needed )
+		return 0;
+
+	while ( newsize < needed && newsize < limit )
+		newsize *= 2;
+
+	if ( newsize > limit )
+		newsize = limit;
+
+	if ( newsize < needed || (newbuf = realloc (*buf, newsize)) == 0 )
+		return LIBIRC_ERR_NOMEM;
+
+	*buf = newbuf;
+	*size = newsize;
+	return 0;
+}
+
+
+/*
+ * Returns the empty buffer to the pool, or frees it.
+ */
+static void libirc_dcc_release_buffer (irc_session_t * session, char ** buf, unsigned int * size)
+{
+	if ( *buf )
+		libirc_dcc_buffer_put (session, *buf, *size);
+
+	*buf = 0;
+	*size = 0;
+}
+
+
+static void libirc_dcc_destroy_nolock (irc_dcc_session_t * dcc)
+{
+	if ( dcc->sock >= 0 )
+		socket_close (&dcc->sock);
+
+	dcc->state = LIBIRC_STATE_REMOVED;
+}
+
+
+/*
+ * Frees the DCC session. Must be called without holding its lock; the 
+ * session is taken out of the table first, and then its lock is taken to
+ * wait for anyone who found it before.
+ */
+static void libirc_remove_dcc_session (irc_session_t * session, irc_dcc_session_t * dcc)
+{
+	unsigned int index = dcc->id & LIBIRC_DCC_SLOT_MASK;
+	irc_dcc_slot_t * slot;
+
+	libirc_mutex_lock (&session->mutex_dcc);
+
+	slot = session->dcc_slots + index;
+	slot->dcc = 0;
+	slot->generation = (slot->generation + 1) & (0xFFFFFFFFU >> LIBIRC_DCC_SLOT_BITS);
+
+	// Generation 0 is never used, so no DCC id is ever 0
+	if ( slot->generation == 0 )
+		slot->generation = 1;
+
+	slot->next_free = session->dcc_free_slot;
+	session->dcc_free_slot = index + 1;
+
+	libirc_mutex_lock (&dcc->mutex);
+	libirc_mutex_unlock (&dcc->mutex);
+	libirc_mutex_unlock (&session->mutex_dcc);
+
+	if ( dcc->sock >= 0 )
+		socket_close (&dcc->sock);
+
+	// The job in flight is finished and freed by the I/O thread, which then
+	// closes the file, so its descriptor stays valid while it runs
+	if ( dcc->io )
+	{
+		if ( libirc_dcc_io_orphan (session, dcc->io, dcc->file) )
+		{
+			dcc->file = 0;
+			dcc->file_fd = -1;
+		}
+		else
+		{
+			libirc_dcc_release_buffer (session, &dcc->io->buf, &dcc->io->size);
+			free (dcc->io);
+		}
+	}
+
+	// A shared file stays open for the other transfers
+	if ( dcc->file )
+		libirc_dcc_close_file (session, dcc->file);
+	else if ( dcc->file_fd >= 0 )
+		close (dcc->file_fd);
+
+	dcc->file = 0;
+	dcc->file_fd = -1;
+
+	libirc_dcc_release_buffer (session, &dcc->incoming_buf, &dcc->incoming_size);
+	libirc_dcc_release_buffer (session, &dcc->outgoing_buf, &dcc->outgoing_size);
+
+	if ( dcc->flags & DCCFL_SHA256 )
+		libirc_sha256_free (&dcc->sha256);
+
+	libirc_mutex_destroy (&dcc->mutex);
+	free (dcc);
+}
+
+
+/*
+ * Stores the current received amount as a big-endian 32-bit acknowledge in
+ * the output buffer. For files over 4GB the amount wraps around, as all the
+ * other clients expect. If the buffer is still busy with the previous ack, the
+ * new one is postponed until it is drained; acks are cumulative, so only the
+ * latest value matters. The same happens if there is no memory for the
+ * buffer.
+ */
+static void libirc_dcc_queue_ack (irc_dcc_session_t * dcc)
+{
+	if ( dcc->outgoing_offset > 0
+	|| libirc_dcc_grow_buffer (&dcc->outgoing_buf, &dcc->outgoing_size, 4, LIBIRC_DCC_BUFFER_SIZE) )
+	{
+		dcc->flags |= DCCFL_ACK_PENDING;
+		return;
+	}
+
+	dcc->outgoing_buf[0] = (char) (dcc->file_confirm_offset >> 24);
+	dcc->outgoing_buf[1] = (char) (dcc->file_confirm_offset >> 16);
+	dcc->outgoing_buf[2] = (char) (dcc->file_confirm_offset >> 8);
+	dcc->outgoing_buf[3] = (char) dcc->file_confirm_offset;
+	dcc->outgoing_offset = 4;
+	dcc->flags &= ~DCCFL_ACK_PENDING;
+}
+
+
+/*
+ * Returns the amount of file data which could be sent now without 
+ * overflowing the send window, but no more than max.
+ */
+static unsigned int libirc_dcc_window_room (irc_dcc_session_t * dcc, unsigned int max)
+{
+	irc_dcc_size_t inflight, amount;
+
+	if ( dcc->flags & DCCFL_TURBO )
+		return max;
+
+	inflight = dcc->file_sent_offset - dcc->file_confirm_offset;
+	amount = inflight < dcc->send_window ? dcc->send_window - inflight : 0;
+
+	return amount < max ? (unsigned int) amount : max;
+}
+
+
+/*
+ * Refills the token bucket, and returns how much it allows to send now,
+ * but no more than max.
+ */
+static unsigned int libirc_dcc_bucket_room (irc_dcc_bucket_t * bucket, unsigned long long now, unsigned int max)
+{
+	unsigned long long tokens;
+
+	if ( !bucket->rate )
+		return max;
+
+	// Keep the time stamp until at least one token is earned, otherwise
+	// the frequent calls would never refill a slow bucket
+	tokens = (now - bucket->stamp) * bucket->rate / 1000;
+
+	if ( tokens > 0 )
+	{
+		tokens += bucket->tokens;
+		bucket->tokens = tokens > bucket->rate ? bucket->rate : (unsigned int) tokens;
+		bucket->stamp = now;
+	}
+
+	return bucket->tokens < max ? bucket->tokens : max;
+}
+
+
+static void libirc_dcc_bucket_take (irc_dcc_bucket_t * bucket, unsigned int amount)
+{
+	if ( bucket->rate )
+		bucket->tokens = amount < bucket->tokens ? bucket->tokens - amount : 0;
+}
+
+
+static void libirc_dcc_bucket_set (irc_dcc_bucket_t * bucket, unsigned int rate)
+{
+	// The bucket starts full, so the cap does not delay the start
+	bucket->rate = rate;
+	bucket->tokens = rate;
+	bucket->stamp = libirc_time_ms ();
+}
+
+
+/*
+ * Returns the amount of file data the transfer and the total rate caps 
+ * allow to send now, but no more than max. Called with the DCC session
+ * locked; the total cap has its own lock.
+ */
+static unsigned int libirc_dcc_rate_room (irc_session_t * session, irc_dcc_session_t * dcc, unsigned int max)
+{
+	unsigned long long now = libirc_time_ms ();
+
+	max = libirc_dcc_bucket_room (&dcc->rate_limit, now, max);
+
+	libirc_mutex_lock (&session->mutex_dcc_limits);
+	max = libirc_dcc_bucket_room (&session->dcc_rate_limit, now, max);
+	libirc_mutex_unlock (&session->mutex_dcc_limits);
+
+	return max;
+}
+
+
+static void libirc_dcc_rate_take (irc_session_t * session, irc_dcc_session_t * dcc, unsigned int amount)
+{
+	libirc_dcc_bucket_take (&dcc->rate_limit, amount);
+
+	libirc_mutex_lock (&session->mutex_dcc_limits);
+	libirc_dcc_bucket_take (&session->dcc_rate_limit, amount);
+	libirc_mutex_unlock (&session->mutex_dcc_limits);
+}
+
+
+/*
+ * Returns the amount of the file which is done: received, or sent and 
+ * acknowledged by the receiver.
+ */
+static irc_dcc_size_t libirc_dcc_transferred (irc_dcc_session_t * dcc)
+{
+	if ( dcc->dccmode == LIBIRC_DCC_SENDFILE && (dcc->flags & DCCFL_TURBO) )
+		return dcc->file_sent_offset;
+
+	return dcc->dccmode == LIBIRC_DCC_CHAT ? 0 : dcc->file_confirm_offset;
+}
+
+
+/*
+ * Samples the transfer rate about once a second, and smooths it.
+ */
+static void libirc_dcc_update_stats (irc_dcc_session_t * dcc, unsigned long long now)
+{
+	irc_dcc_size_t done = libirc_dcc_transferred (dcc);
+
+	if ( dcc->stats_time == 0 )
+	{
+		dcc->stats_time = now;
+		dcc->stats_bytes = done;
+	}
+	else if ( now - dcc->stats_time >= 1000 )
+	{
+		unsigned int rate = (unsigned int) ((done - dcc->stats_bytes) * 1000 / (now - dcc->stats_time));
+
+		dcc->stats_rate = dcc->stats_rate ? (dcc->stats_rate * 3 + rate) / 4 : rate;
+		dcc->stats_time = now;
+		dcc->stats_bytes = done;
+	}
+}
+
+
+/*
+ * Adds the file data at the specified offset to the digests. The data is
+ * hashed in the file order as it is sent or received, so the digests cover
+ * the file from the first transferred byte, which is not 0 if resumed.
+ */
+static void libirc_dcc_digest_update (irc_dcc_session_t * dcc, irc_dcc_size_t offset, const char * data, unsigned int length)
+{
+	if ( (dcc->flags & (DCCFL_CRC32 | DCCFL_SHA256)) == 0 || length == 0 )
+		return;
+
+	if ( dcc->digest_length == 0 )
+		dcc->digest_offset = offset;
+
+	if ( dcc->flags & DCCFL_CRC32 )
+		libirc_crc32_update (&dcc->crc32, data, length);
+
+	if ( dcc->flags & DCCFL_SHA256 )
+		libirc_sha256_update (&dcc->sha256, data, length);
+
+	dcc->digest_length += length;
+}
+
+
+/*
+ * Same as libirc_dcc_window_room(), but returns 0 once the whole file has
+ * been read.
+ */
+static unsigned int libirc_dcc_send_amount (irc_dcc_session_t * dcc, unsigned int max)
+{
+	if ( dcc->flags & DCCFL_SEND_EOF )
+		return 0;
+
+	return libirc_dcc_window_room (dcc, max);
+}
+
+
+/*
+ * Parses the acknowledges received from the DCC SEND peer. The acks are 
+ * cumulative, so only the latest complete one is used; an incomplete
+ * tail is kept in the buffer until the rest arrives.
+ *
+ * The classic acks are 32-bit and wrap around for files over 4GB, so the 
+ * full offset is restored from the last confirmed one. Some clients send 
+ * 64-bit acks for such files instead; the first word of their first ack 
+ * is the high word of the starting offset (zero unless resumed past 4GB),
+ * which a 32-bit ack practically never is, so it tells which kind is used.
+ */
+static int libirc_dcc_process_acks (irc_dcc_session_t * dcc)
+{
+	const unsigned char * bptr;
+	irc_dcc_size_t received_size;
+	unsigned int acksize, complete;
+
+	if ( (dcc->flags & DCCFL_ACK_DETECTED) == 0 )
+	{
+		if ( dcc->incoming_offset < 4 )
+			return 0;
+
+		bptr = (const unsigned char *) dcc->incoming_buf;
+
+		if ( dcc->file_size > 0xFFFFFFFFULL
+		&& ((bptr[0] << 24) | (bptr[1] << 16) | (bptr[2] << 8) | bptr[3]) == (unsigned int) (dcc->file_confirm_offset >> 32) )
+			dcc->flags |= DCCFL_ACK64;
+
+		dcc->flags |= DCCFL_ACK_DETECTED;
+	}
+
+	acksize = (dcc->flags & DCCFL_ACK64) ? 8 : 4;
+	complete = dcc->incoming_offset - (dcc->incoming_offset % acksize);
+
+	if ( complete == 0 )
+		return 0;
+
+	// The order is big-endian
+	bptr = (const unsigned char *) dcc->incoming_buf + complete - acksize;
+	received_size = 0;
+
+	for ( ; acksize > 0; acksize--, bptr++ )
+		received_size = (received_size << 8) | *bptr;
+
+	if ( dcc->incoming_offset - complete > 0 )
+		memmove (dcc->incoming_buf, dcc->incoming_buf + complete, dcc->incoming_offset - complete);
+
+	dcc->incoming_offset -= complete;
+
+	if ( (dcc->flags & DCCFL_ACK64) == 0 )
+	{
+		received_size |= dcc->file_confirm_offset & ~0xFFFFFFFFULL;
+
+		if ( received_size < dcc->file_confirm_offset )
+			received_size += 0x100000000ULL;
+	}
+
+	// The receiver cannot confirm more than we sent, and acks never go back
+	if ( received_size > dcc->file_sent_offset || received_size < dcc->file_confirm_offset )
+		return LIBIRC_ERR_WRITE;
+
+	dcc->file_confirm_offset = received_size;
+	return 0;
+}
+
+
+/*
+ * Writes the received data collected in the file buffer to the file, and
+ * reports the progress to the application. Must be called with the DCC 
+ * session locked; the lock is released while writing.
+ */
+static int libirc_dcc_flush_file (irc_session_t * ircsession, irc_dcc_session_t * dcc)
+{
+	unsigned int length = dcc->incoming_offset;
+	int err = 0;
+
+	if ( length == 0 )
+		return 0;
+
+	libirc_mutex_unlock (&dcc->mutex);
+
+	if ( libirc_file_write_at (dcc->file_fd, dcc->incoming_buf, length, dcc->file_write_offset) )
+		err = LIBIRC_ERR_WRITE;
+	else
+		(*dcc->cb)(ircsession, dcc->id, 0, dcc->ctx, 0, length);
+
+	libirc_mutex_lock (&dcc->mutex);
+
+	dcc->incoming_offset = 0;
+	dcc->file_write_offset += length;
+	return err;
+}
+
+
+static socklen_t libirc_sockaddr_len (const struct sockaddr_storage * addr)
+{
+	return addr->ss_family == AF_INET6 ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+}
+
+
+static unsigned short libirc_sockaddr_port (const struct sockaddr_storage * addr)
+{
+	if ( addr->ss_family == AF_INET6 )
+		return ntohs (((const struct sockaddr_in6 *) addr)->sin6_port);
+
+	return ntohs (((const struct sockaddr_in *) addr)->sin_port);
+}
+
+
+/*
+ * Parses the address of a DCC offer: IPv4 is sent as a decimal number in 
+ * the host byte order, and IPv6 as text. Returns 0 on success.
+ */
+static int libirc_dcc_parse_addr (const char * text, unsigned short port, struct sockaddr_storage * addr)
+{
+	memset (addr, 0, sizeof(struct sockaddr_storage));
+
+	if ( text[strspn (text, "0123456789")] == '\0' )
+	{
+		struct sockaddr_in * saddr = (struct sockaddr_in *) addr;
+
+		saddr->sin_family = AF_INET;
+		saddr->sin_addr.s_addr = htonl (strtoul (text, 0, 10)); // what idiot came up with idea to send IP address in host-byteorder?
+		saddr->sin_port = htons (port);
+	}
+	else
+	{
+		struct addrinfo hints, * ainfo;
+
+		memset (&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_flags = AI_NUMERICHOST;
+
+		if ( getaddrinfo (text, 0, &hints, &ainfo) )
+			return 1;
+
+		memcpy (addr, ainfo->ai_addr, ainfo->ai_addrlen);
+		freeaddrinfo (ainfo);
+
+		if ( addr->ss_family == AF_INET6 )
+			((struct sockaddr_in6 *) addr)->sin6_port = htons (port);
+		else
+			((struct sockaddr_in *) addr)->sin_port = htons (port);
+	}
+
+	return 0;
+}
+
+
+/*
+ * Formats the address as text, for the callbacks and the notices.
+ */
+static void libirc_dcc_addr_text (const struct sockaddr_storage * addr, char * buf, size_t size)
+{
+	if ( getnameinfo ((const struct sockaddr *) addr, libirc_sockaddr_len (addr), buf, size, 0, 0, NI_NUMERICHOST) )
+		snprintf (buf, size, "unknown");
+}
+
+
+/*
+ * Formats the address for a DCC offer, as the other clients expect it.
+ */
+static void libirc_dcc_offer_addr (const struct sockaddr_storage * addr, char * buf, size_t size)
+{
+	if ( addr->ss_family == AF_INET )
+		snprintf (buf, size, "%lu", (unsigned long) ntohl (((const struct sockaddr_in *) addr)->sin_addr.s_addr));
+	else
+		libirc_dcc_addr_text (addr, buf, size);
+}
+
+
+/*
+ * Returns the local address of the IRC connection, which is the one the
+ * DCC offers are made for.
+ */
+static void libirc_dcc_local_addr (irc_session_t * session, struct sockaddr_storage * addr)
+{
+	memset (addr, 0, sizeof(struct sockaddr_storage));
+
+#if defined (ENABLE_IPV6)
+	if ( session->flags & SESSIONFL_USES_IPV6 )
+	{
+		addr->ss_family = AF_INET6;
+		memcpy (&((struct sockaddr_in6 *) addr)->sin6_addr, &session->local_addr6, sizeof(session->local_addr6));
+		return;
+	}
+#endif
+
+	addr->ss_family = AF_INET;
+	memcpy (&((struct sockaddr_in *) addr)->sin_addr, &session->local_addr, sizeof(session->local_addr));
+}
+
+
+/*
+ * Creates the socket for the peer to connect to, on the local address of
+ * the IRC connection, and remembers its port for the offer.
+ */
+static int libirc_dcc_listen (irc_session_t * session, irc_dcc_session_t * dcc)
+{
+	struct sockaddr_storage saddr;
+	socklen_t len = sizeof(saddr);
+	unsigned long arg = 1;
+
+	libirc_dcc_local_addr (session, &saddr);
+
+	if ( socket_create (saddr.ss_family, SOCK_STREAM, &dcc->sock) )
+		return LIBIRC_ERR_SOCKET;
+
+	setsockopt (dcc->sock, SOL_SOCKET, SO_REUSEADDR, (char*)&arg, sizeof(arg));
+
+	if ( bind (dcc->sock, (struct sockaddr *) &saddr, libirc_sockaddr_len (&saddr)) < 0
+	|| listen (dcc->sock, 5) < 0
+	|| getsockname (dcc->sock, (struct sockaddr *) &saddr, &len) < 0 )
+	{
+		socket_close (&dcc->sock);
+		return LIBIRC_ERR_SOCKET;
+	}
+
+	dcc->port = libirc_sockaddr_port (&saddr);
+	dcc->state = LIBIRC_STATE_LISTENING;
+	return 0;
+}
+
+
+/*
+ * Starts connecting to the peer address from the offer.
+ */
+static int libirc_dcc_connect (irc_dcc_session_t * dcc)
+{
+	if ( socket_create (dcc->remote_addr.ss_family, SOCK_STREAM, &dcc->sock) )
+		return LIBIRC_ERR_SOCKET;
+
+	// make socket non-blocking, so connect() call won't block
+	if ( socket_make_nonblocking (&dcc->sock)
+	|| socket_connect (&dcc->sock, (struct sockaddr *) &dcc->remote_addr, libirc_sockaddr_len (&dcc->remote_addr)) )
+	{
+		socket_close (&dcc->sock);
+		return LIBIRC_ERR_CONNECT;
+	}
+
+	dcc->state = LIBIRC_STATE_CONNECTING;
+	return 0;
+}
+
+
+/*
+ * Sends the DCC CHAT or SEND offer with our address and the port we listen
+ * on. A passive offer has port 0 and a token, and the peer replies with its
+ * own address and the token; the reply to a passive offer is sent the same
+ * way, with the peer's token and without the notice.
+ */
+static int libirc_dcc_send_offer (irc_session_t * session, irc_dcc_t dccid)
+{
+	struct sockaddr_storage saddr;
+	char cmdbuf[384], notbuf[384], nick[128], addrbuf[64], addrtext[64], tokenbuf[32];
+	irc_dcc_session_t * dcc;
+	int reply;
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return 1;
+
+	libirc_dcc_local_addr (session, &saddr);
+	libirc_dcc_offer_addr (&saddr, addrbuf, sizeof(addrbuf));
+	libirc_dcc_addr_text (&saddr, addrtext, sizeof(addrtext));
+
+	tokenbuf[0] = '\0';
+	reply = (dcc->flags & DCCFL_PASSIVE) && dcc->state == LIBIRC_STATE_LISTENING;
+
+	if ( dcc->flags & DCCFL_PASSIVE )
+		snprintf (tokenbuf, sizeof(tokenbuf), " %lu", dcc->token);
+
+	if ( dcc->dccmode == LIBIRC_DCC_CHAT )
+	{
+		snprintf (notbuf, sizeof(notbuf), "DCC Chat (%s)", addrtext);
+		snprintf (cmdbuf, sizeof(cmdbuf), "DCC CHAT chat %s %u%s", addrbuf, dcc->port, tokenbuf);
+	}
+	else
+	{
+		snprintf (notbuf, sizeof(notbuf), "DCC Send %s (%s)", dcc->filename, addrtext);
+		snprintf (cmdbuf, sizeof(cmdbuf), "DCC %s %s %s %u %llu%s", (dcc->flags & DCCFL_TURBO) ? "TSEND" : "SEND", dcc->filename, addrbuf, dcc->port, dcc->file_size, tokenbuf);
+	}
+
+	strcpy (nick, dcc->nick);
+	libirc_mutex_unlock (&dcc->mutex);
+
+	return (!reply && irc_cmd_notice (session, nick, notbuf))
+		|| irc_cmd_ctcp_request (session, nick, cmdbuf);
+}
+
+
+/*
+ * Starts the queued DCC SEND: offers the file, and waits for the receiver
+ * from now on. Returns 0 if started.
+ */
+static int libirc_dcc_start_queued (irc_session_t * session, irc_dcc_t dccid)
+{
+	irc_dcc_session_t * dcc;
+	int err;
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return 1;
+
+	if ( dcc->state != LIBIRC_STATE_QUEUED )
+	{
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	dcc->state = (dcc->flags & DCCFL_PASSIVE) ? LIBIRC_STATE_PASSIVE : LIBIRC_STATE_LISTENING;
+	dcc->queue_position = 0;
+	time (&dcc->timeout);
+	libirc_mutex_unlock (&dcc->mutex);
+
+	if ( session->callbacks.event_dcc_queue )
+		(*session->callbacks.event_dcc_queue) (session, dccid, 0);
+
+	if ( libirc_dcc_send_offer (session, dccid) == 0 )
+		return 0;
+
+	// The offer cannot be sent; the error is reported as a failed transfer
+	err = session->lasterror ? session->lasterror : LIBIRC_ERR_STATE;
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) != 0 )
+	{
+		libirc_mutex_unlock (&dcc->mutex);
+		(*dcc->cb)(session, dccid, err, dcc->ctx, 0, 0);
+		libirc_remove_dcc_session (session, dcc);
+	}
+
+	return 0;
+}
+
+
+static void libirc_dcc_report_position (irc_session_t * session, irc_dcc_t dccid, unsigned int position)
+{
+	irc_dcc_session_t * dcc;
+	int changed;
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return;
+
+	changed = dcc->queue_position != position;
+	dcc->queue_position = position;
+	libirc_mutex_unlock (&dcc->mutex);
+
+	if ( changed && session->callbacks.event_dcc_queue )
+		(*session->callbacks.event_dcc_queue) (session, dccid, position);
+}
+
+
+static int libirc_dcc_queue_compare (const void * a, const void * b)
+{
+	const irc_dcc_queue_entry_t * qa = (const irc_dcc_queue_entry_t *) a;
+	const irc_dcc_queue_entry_t * qb = (const irc_dcc_queue_entry_t *) b;
+
+	if ( qa->priority != qb->priority )
+		return qa->priority > qb->priority ? -1 : 1;
+
+	return qa->seq < qb->seq ? -1 : (qa->seq > qb->seq);
+}
+
+
+/*
+ * Wakes up the scheduler after the queue or the limits changed. Must be
+ * called with mutex_dcc_limits locked.
+ */
+static void libirc_dcc_queue_changed (irc_session_t * session)
+{
+	if ( ++session->dcc_queue_changes == 0 )
+		session->dcc_queue_changes = 1;
+}
+
+
+/*
+ * Grows the scheduler arrays with the slot table. Only the event loop uses
+ * them, with the table locked.
+ */
+static int libirc_dcc_schedule_grow (irc_session_t * session, unsigned int count)
+{
+	irc_dcc_queue_entry_t * entries;
+
+	if ( count <= session->dcc_schedule_size )
+		return 0;
+
+	if ( (entries = realloc (session->dcc_schedule_queue, count * sizeof(irc_dcc_queue_entry_t))) == 0 )
+		return 1;
+
+	session->dcc_schedule_queue = entries;
+
+	if ( (entries = realloc (session->dcc_schedule_active, count * sizeof(irc_dcc_queue_entry_t))) == 0 )
+		return 1;
+
+	session->dcc_schedule_active = entries;
+	session->dcc_schedule_size = count;
+	return 0;
+}
+
+
+/*
+ * Starts the queued DCC SENDs, in the order of priority and then of the 
+ * irc_dcc_sendfile() calls, while the total and per-nick slot limits 
+ * allow. A DCC SEND takes a slot from the offer until it is finished. The
+ * transfers left waiting get their new queue positions. Once nothing is
+ * queued, the scheduler sleeps until the next queued send or limit change.
+ */
+static void libirc_dcc_schedule (irc_session_t * session)
 {
-	irc_dcc_session_t * s, *found = 0;
+	irc_dcc_queue_entry_t * queue, * active;
+	unsigned int slot, count, i, j, queued = 0, running = 0, position = 0;
+	unsigned int changes, max_sends, max_sends_per_nick;
+	irc_dcc_session_t * dcc;
+
+	libirc_mutex_lock (&session->mutex_dcc_limits);
+	changes = session->dcc_queue_changes;
+	max_sends = session->dcc_max_sends;
+	max_sends_per_nick = session->dcc_max_sends_per_nick;
+	libirc_mutex_unlock (&session->mutex_dcc_limits);
+
+	if ( !changes )
+		return;
+
+	libirc_mutex_lock (&session->mutex_dcc);
+
+	count = session->dcc_slots_count;
+
+	if ( libirc_dcc_schedule_grow (session, count) )
+	{
+		libirc_mutex_unlock (&session->mutex_dcc);
+		return;
+	}
 
-	if ( lock_list )
-		libirc_mutex_lock (&session->mutex_dcc);
+	queue = session->dcc_schedule_queue;
+	active = session->dcc_schedule_active;
 
-	for ( s = session->dcc_sessions; s; s = s->next )
+	for ( slot = 0; slot < count; slot++ )
 	{
-		if ( s->id == dccid )
+		if ( (dcc = session->dcc_slots[slot].dcc) == 0 )
+			continue;
+
+		libirc_mutex_lock (&dcc->mutex);
+
+		if ( dcc->dccmode == LIBIRC_DCC_SENDFILE && dcc->state == LIBIRC_STATE_QUEUED )
 		{
-			found = s;
-			break;
+			queue[queued].id = dcc->id;
+			queue[queued].priority = dcc->priority;
+			queue[queued].seq = dcc->queue_seq;
+			strcpy (queue[queued++].nick, dcc->nick);
 		}
+		else if ( dcc->dccmode == LIBIRC_DCC_SENDFILE && dcc->state != LIBIRC_STATE_REMOVED )
+			strcpy (active[running++].nick, dcc->nick);
+
+		libirc_mutex_unlock (&dcc->mutex);
 	}
 
-	if ( found == 0 && lock_list )
-		libirc_mutex_unlock (&session->mutex_dcc);
+	libirc_mutex_unlock (&session->mutex_dcc);
+
+	// A send queued during the scan changed the counter, and is seen on the
+	// next pass
+	if ( queued == 0 )
+	{
+		libirc_mutex_lock (&session->mutex_dcc_limits);
+
+		if ( session->dcc_queue_changes == changes )
+			session->dcc_queue_changes = 0;
+
+		libirc_mutex_unlock (&session->mutex_dcc_limits);
+		return;
+	}
+
+	qsort (queue, queued, sizeof(irc_dcc_queue_entry_t), libirc_dcc_queue_compare);
+
+	for ( i = 0; i < queued; i++ )
+	{
+		unsigned int same_nick = 0;
+
+		for ( j = 0; j < running; j++ )
+		{
+			if ( strncasecmp (active[j].nick, queue[i].nick, sizeof(queue[i].nick)) == 0 )
+				same_nick++;
+		}
 
-	return found;
+		if ( (!max_sends || running < max_sends)
+		&& (!max_sends_per_nick || same_nick < max_sends_per_nick) )
+		{
+			if ( libirc_dcc_start_queued (session, queue[i].id) == 0 )
+				strcpy (active[running++].nick, queue[i].nick);
+		}
+		else
+			libirc_dcc_report_position (session, queue[i].id, ++position);
+	}
 }
 
 
-static void libirc_dcc_destroy_nolock (irc_session_t * session, irc_dcc_t dccid)
+/*
+ * Returns nonzero if there is (or could be allocated) space to receive.
+ * The received file data and the acks are consumed right away, and the
+ * chat input always keeps a byte for the line terminator.
+ */
+static int libirc_dcc_can_receive (irc_dcc_session_t * dcc)
 {
-	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid, 0);
+	// Nothing else is expected once the whole file is received, so the 
+	// sender closing the connection does not matter while it is written
+	if ( dcc->dccmode == LIBIRC_DCC_RECVFILE && dcc->file_confirm_offset >= dcc->file_size )
+		return 0;
+
+	if ( !dcc->incoming_buf )
+		return 1;
+
+	if ( dcc->dccmode == LIBIRC_DCC_CHAT )
+		return dcc->incoming_offset + 1 < dcc->incoming_size || dcc->incoming_size < LIBIRC_DCC_CHAT_MAX_LINE;
+
+	return dcc->incoming_offset < dcc->incoming_size;
+}
 
-	if ( dcc )
+
+/*
+ * Makes sure the input buffer has some space before receiving: the file
+ * data goes into the large buffer, the acks into a small one, and the chat
+ * buffer grows with the line length.
+ */
+static int libirc_dcc_prepare_recv (irc_session_t * ircsession, irc_dcc_session_t * dcc)
+{
+	switch ( dcc->dccmode )
 	{
-		if ( dcc->sock >= 0 )
-			socket_close (&dcc->sock);
+	case LIBIRC_DCC_RECVFILE:
+		return libirc_dcc_alloc_file_buffer (ircsession, dcc, &dcc->incoming_buf, &dcc->incoming_size);
 
-		dcc->state = LIBIRC_STATE_REMOVED;
+	case LIBIRC_DCC_CHAT:
+		return libirc_dcc_grow_buffer (&dcc->incoming_buf, &dcc->incoming_size, dcc->incoming_offset + 2, LIBIRC_DCC_CHAT_MAX_LINE);
+
+	default:
+		return libirc_dcc_grow_buffer (&dcc->incoming_buf, &dcc->incoming_size, LIBIRC_DCC_BUFFER_SIZE, LIBIRC_DCC_BUFFER_SIZE);
 	}
 }
 
 
-static void libirc_remove_dcc_session (irc_session_t * session, irc_dcc_session_t * dcc, int lock_list)
+/*
+ * Passes the complete DCC chat lines to the callback, 0-terminated and 
+ * without the CRLF, CR or LF terminator. A line which does not fit into 
+ * the largest chat buffer is passed as is. The callback could destroy 
+ * the session, so the state is checked after every line.
+ */
+static void libirc_dcc_process_chat (irc_session_t * ircsession, irc_dcc_session_t * dcc)
 {
-	if ( dcc->sock >= 0 )
-		socket_close (&dcc->sock);
+	unsigned int start = 0;
+
+	while ( dcc->state == LIBIRC_STATE_CONNECTED && start < dcc->incoming_offset )
+	{
+		char * line = dcc->incoming_buf + start;
+		unsigned int avail = dcc->incoming_offset - start;
+		unsigned int length, skip;
+
+		// The LF of a CRLF which was split between two reads
+		if ( (dcc->flags & DCCFL_CHAT_CR) && line[0] == 0x0A )
+		{
+			dcc->flags &= ~DCCFL_CHAT_CR;
+			start++;
+			continue;
+		}
+
+		dcc->flags &= ~DCCFL_CHAT_CR;
+		length = libirc_find_eol (line, avail);
+
+		if ( length < avail )
+		{
+			skip = length + 1;
+
+			if ( line[length] == 0x0D )
+			{
+				if ( skip < avail && line[skip] == 0x0A )
+					skip++;
+				else if ( skip == avail )
+					dcc->flags |= DCCFL_CHAT_CR;
+			}
+		}
+		else if ( start == 0 
+		&& dcc->incoming_offset + 1 >= dcc->incoming_size 
+		&& dcc->incoming_size >= LIBIRC_DCC_CHAT_MAX_LINE )
+			skip = length;
+		else
+			break;
+
+		line[length] = '\0';
+		start += skip;
+
+		libirc_mutex_unlock (&dcc->mutex);
+		(*dcc->cb)(ircsession, dcc->id, 0, dcc->ctx, line, length);
+		libirc_mutex_lock (&dcc->mutex);
+	}
+
+	if ( dcc->incoming_offset - start > 0 )
+		memmove (dcc->incoming_buf, dcc->incoming_buf + start, dcc->incoming_offset - start);
+
+	dcc->incoming_offset -= start;
+}
+
+
+/*
+ * Returns nonzero while the I/O thread has not written all the received
+ * file data yet.
+ */
+static int libirc_dcc_write_pending (irc_session_t * ircsession, irc_dcc_session_t * dcc)
+{
+	if ( (dcc->flags & DCCFL_ASYNC_IO) == 0 )
+		return 0;
+
+	return dcc->incoming_offset > 0
+		|| (dcc->io && libirc_dcc_io_state (ircsession, dcc->io) != LIBIRC_DCC_IO_IDLE);
+}
+
+
+/*
+ * Passes the received file data to the I/O thread to be written. The 
+ * buffer goes with the job, and the next data is received into another one.
+ */
+static int libirc_dcc_queue_write (irc_session_t * ircsession, irc_dcc_session_t * dcc)
+{
+	irc_dcc_io_t * io = dcc->io;
+	char * buf = io->buf;
+	unsigned int size = io->size;
+	int err;
+
+	io->buf = dcc->incoming_buf;
+	io->size = dcc->incoming_size;
+	io->write = 1;
+	io->fd = dcc->file_fd;
+	io->offset = dcc->file_write_offset;
+	io->length = dcc->incoming_offset;
+
+	if ( (err = libirc_dcc_io_submit (ircsession, io)) != 0 )
+	{
+		io->buf = buf;
+		io->size = size;
+		return err;
+	}
+
+	dcc->incoming_buf = buf;
+	dcc->incoming_size = size;
+	dcc->incoming_offset = 0;
+	dcc->file_write_offset += io->length;
+	return 0;
+}
+
+
+/*
+ * Runs the asynchronous file I/O of the DCC session: takes the result of 
+ * the finished job, and starts the next one. The sender reads ahead into
+ * the job buffer while the output buffer is being sent, and swaps the two
+ * when the output buffer is empty. The receiver writes the full input 
+ * buffers, and the rest of the file when everything is received.
+ */
+static void libirc_dcc_process_io (irc_session_t * ircsession, irc_dcc_session_t * dcc)
+{
+	irc_dcc_io_t * io = dcc->io;
+	int state, err = 0;
+
+	if ( !io )
+	{
+		if ( (io = calloc (1, sizeof(irc_dcc_io_t))) == 0 )
+			err = LIBIRC_ERR_NOMEM;
 
-	if ( dcc->dccsend_file_fp )
-		fclose (dcc->dccsend_file_fp);
+		dcc->io = io;
+	}
+
+	if ( !err && (state = libirc_dcc_io_state (ircsession, io)) == LIBIRC_DCC_IO_DONE )
+	{
+		if ( io->result < 0 )
+			err = io->write ? LIBIRC_ERR_WRITE : LIBIRC_ERR_READ;
+		else if ( io->write )
+		{
+			state = io->state = LIBIRC_DCC_IO_IDLE;
+
+			libirc_mutex_unlock (&dcc->mutex);
+			(*dcc->cb)(ircsession, dcc->id, 0, dcc->ctx, 0, io->length);
+			libirc_mutex_lock (&dcc->mutex);
+		}
+		else if ( io->result == 0 )
+		{
+			state = io->state = LIBIRC_DCC_IO_IDLE;
+			dcc->flags |= DCCFL_SEND_EOF;
+		}
+		else if ( dcc->outgoing_offset == 0 )
+		{
+			char * buf = dcc->outgoing_buf;
+			unsigned int size = dcc->outgoing_size;
 
-	dcc->dccsend_file_fp = 0;
+			dcc->outgoing_buf = io->buf;
+			dcc->outgoing_size = io->size;
+			dcc->outgoing_offset = io->result;
+			dcc->file_read_offset += io->result;
 
-	libirc_mutex_destroy (&dcc->mutex_outbuf);
+			io->buf = buf;
+			io->size = size;
+			state = io->state = LIBIRC_DCC_IO_IDLE;
 
-	if ( lock_list )
-		libirc_mutex_lock (&session->mutex_dcc);
+			// Do not wait for another read to find out the file end
+			if ( dcc->file_read_offset >= dcc->file_size )
+				dcc->flags |= DCCFL_SEND_EOF;
+		}
+	}
 
-	if ( session->dcc_sessions != dcc )
+	if ( !err
+	&& state == LIBIRC_DCC_IO_IDLE
+	&& dcc->state == LIBIRC_STATE_CONNECTED )
 	{
-		irc_dcc_session_t * s;
-		for ( s = session->dcc_sessions; s; s = s->next )
+		if ( dcc->dccmode == LIBIRC_DCC_SENDFILE && (dcc->flags & DCCFL_SEND_EOF) == 0 )
 		{
-			if ( s->next == dcc )
+			if ( (err = libirc_dcc_alloc_file_buffer (ircsession, dcc, &io->buf, &io->size)) == 0 )
 			{
-				s->next = dcc->next;
-				break;
+				io->write = 0;
+				io->fd = dcc->file_fd;
+				io->offset = dcc->file_read_offset;
+				io->length = io->size;
+
+				libirc_dcc_prefetch (dcc, io->offset + io->length);
+
+				err = libirc_dcc_io_submit (ircsession, io);
 			}
 		}
+		else if ( dcc->dccmode == LIBIRC_DCC_RECVFILE 
+		&& dcc->incoming_offset > 0
+		&& (dcc->incoming_offset == dcc->incoming_size || dcc->file_confirm_offset >= dcc->file_size) )
+			err = libirc_dcc_queue_write (ircsession, dcc);
 	}
-	else
-		session->dcc_sessions = dcc->next;
-
-	if ( lock_list )
-		libirc_mutex_unlock (&session->mutex_dcc);
 
-	free (dcc);
+	if ( err && dcc->state != LIBIRC_STATE_REMOVED )
+	{
+		libirc_mutex_unlock (&dcc->mutex);
+		(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
+		libirc_mutex_lock (&dcc->mutex);
+		libirc_dcc_destroy_nolock (dcc);
+	}
 }
 
 
 static void libirc_dcc_add_descriptors (irc_session_t * ircsession, fd_set *in_set, fd_set *out_set, int * maxfd)
 {
-	irc_dcc_session_t * dcc, *dcc_next;
+	irc_dcc_session_t * dcc;
+	unsigned int slot, count;
+	unsigned long long now_ms = libirc_time_ms ();
 	time_t now = time (0);
 
-	libirc_mutex_lock (&ircsession->mutex_dcc);
+	// Start the queued transfers if there are free slots
+	libirc_dcc_schedule (ircsession);
+	count = libirc_dcc_slots_count (ircsession);
 
-	// Preprocessing DCC list:
+	// Preprocessing DCC sessions:
 	// - ask DCC send callbacks for data;
 	// - remove unused DCC structures
-	for ( dcc = ircsession->dcc_sessions; dcc; dcc = dcc_next )
+	//
+	// Every session is processed under its own lock, so a slow one doesn't
+	// block the others. The sessions are only freed in this thread, so the
+	// pointer stays valid while the lock is released for the callbacks.
+	for ( slot = 0; slot < count; slot++ )
 	{
-		dcc_next = dcc->next;
+		if ( (dcc = libirc_lock_dcc_slot (ircsession, slot)) == 0 )
+			continue;
 
 		// Remove timed-out sessions
 		if ( (dcc->state == LIBIRC_STATE_CONNECTING
 			|| dcc->state == LIBIRC_STATE_INIT
-			|| dcc->state == LIBIRC_STATE_LISTENING)
+			|| dcc->state == LIBIRC_STATE_LISTENING
+			|| dcc->state == LIBIRC_STATE_PASSIVE
+			|| dcc->state == LIBIRC_STATE_RESUMING)
 		&& now - dcc->timeout > ircsession->dcc_timeout )
 		{
 			// Inform the caller about DCC timeout.
 			// Do not inform when state is LIBIRC_STATE_INIT - session
 			// was initiated from someone else, and callbacks aren't set yet.
-			if ( dcc->state != LIBIRC_STATE_INIT )
-			{
-				libirc_mutex_unlock (&ircsession->mutex_dcc);
+			libirc_mutex_unlock (&dcc->mutex);
+
+			if ( dcc->state != LIBIRC_STATE_INIT && dcc->cb )
+				(*dcc->cb)(ircsession, dcc->id, LIBIRC_ERR_TIMEOUT, dcc->ctx, 0, 0);
+
+			libirc_remove_dcc_session (ircsession, dcc);
+			continue;
+		}
 
-				if ( dcc->cb )
-					(*dcc->cb)(ircsession, dcc->id, LIBIRC_ERR_TIMEOUT, dcc->ctx, 0, 0);
+		if ( dcc->state == LIBIRC_STATE_CONNECTED )
+			libirc_dcc_update_stats (dcc, now_ms);
+
+		// The asynchronous file I/O runs in the I/O thread
+		if ( dcc->state == LIBIRC_STATE_CONNECTED
+		&& (dcc->flags & DCCFL_ASYNC_IO) )
+			libirc_dcc_process_io (ircsession, dcc);
+
+		/*
+		 * If we're sending file through the buffer, the output buffer is 
+		 * empty and the receiver has not fallen behind more than the send
+		 * window, we need to provide some data. The file is read without
+		 * holding the DCC session lock, so irc_dcc_destroy() does not wait
+		 * for it; this is safe because the sessions are only freed in this
+		 * thread.
+		 */
+		if ( dcc->state == LIBIRC_STATE_CONNECTED
+		&& dcc->dccmode == LIBIRC_DCC_SENDFILE
+		&& (dcc->flags & (DCCFL_ZEROCOPY | DCCFL_ASYNC_IO)) == 0
+		&& dcc->file_fd >= 0
+		&& dcc->outgoing_offset == 0 )
+		{
+			unsigned int amount = libirc_dcc_send_amount (dcc, dcc->buffer_size);
 
-				libirc_mutex_lock (&ircsession->mutex_dcc);
+			if ( amount > 0 
+			&& libirc_dcc_alloc_file_buffer (ircsession, dcc, &dcc->outgoing_buf, &dcc->outgoing_size) )
+			{
+				libirc_mutex_unlock (&dcc->mutex);
+				(*dcc->cb)(ircsession, dcc->id, LIBIRC_ERR_NOMEM, dcc->ctx, 0, 0);
+				libirc_mutex_lock (&dcc->mutex);
+				libirc_dcc_destroy_nolock (dcc);
 			}
+			else if ( amount > 0 )
+			{
+				int len;
+
+				libirc_dcc_prefetch (dcc, dcc->file_read_offset);
+
+				libirc_mutex_unlock (&dcc->mutex);
+				len = libirc_file_read_at (dcc->file_fd, dcc->outgoing_buf, amount, dcc->file_read_offset);
+				libirc_mutex_lock (&dcc->mutex);
 
-			libirc_remove_dcc_session (ircsession, dcc, 0);
+				if ( len > 0 )
+				{
+					dcc->outgoing_offset = len;
+					dcc->file_read_offset += len;
+				}
+				else if ( len < 0 )
+				{
+					libirc_mutex_unlock (&dcc->mutex);
+					(*dcc->cb)(ircsession, dcc->id, LIBIRC_ERR_READ, dcc->ctx, 0, 0);
+					libirc_mutex_lock (&dcc->mutex);
+					libirc_dcc_destroy_nolock (dcc);
+				}
+				else
+					dcc->flags |= DCCFL_SEND_EOF;
+			}
 		}
 
 		/*
-		 * If we're sending file, and the output buffer is empty, we need
-         * to provide some data.
-         */
+		 * The file has been sent completely once everything is out of our 
+		 * buffer and the receiver confirmed it all (unless it is TSEND, 
+		 * where there are no confirmations).
+		 */
 		if ( dcc->state == LIBIRC_STATE_CONNECTED
 		&& dcc->dccmode == LIBIRC_DCC_SENDFILE
-		&& dcc->dccsend_file_fp
-		&& dcc->outgoing_offset == 0 )
+		&& (dcc->flags & DCCFL_SEND_EOF)
+		&& dcc->outgoing_offset == 0
+		&& ((dcc->flags & DCCFL_TURBO) || dcc->file_confirm_offset == dcc->file_sent_offset) )
 		{
-			int len = fread (dcc->outgoing_buf, 1, sizeof (dcc->outgoing_buf), dcc->dccsend_file_fp);
+			libirc_mutex_unlock (&dcc->mutex);
+			(*dcc->cb)(ircsession, dcc->id, 0, dcc->ctx, 0, 0);
+			libirc_mutex_lock (&dcc->mutex);
+			libirc_dcc_destroy_nolock (dcc);
+		}
 
-			if ( len <= 0 )
+		/*
+		 * When receiving the file, flush the postponed acknowledge, and
+		 * finish the session when the whole file is received and confirmed.
+		 */
+		if ( dcc->state == LIBIRC_STATE_CONNECTED
+		&& dcc->dccmode == LIBIRC_DCC_RECVFILE
+		&& dcc->outgoing_offset == 0 )
+		{
+			if ( dcc->flags & DCCFL_ACK_PENDING )
+				libirc_dcc_queue_ack (dcc);
+			else if ( dcc->file_confirm_offset >= dcc->file_size 
+			&& !libirc_dcc_write_pending (ircsession, dcc) )
 			{
-				int err = (len < 0 ? LIBIRC_ERR_READ : 0);
-			
-				libirc_mutex_unlock (&ircsession->mutex_dcc);
+				int err = 0;
 
-				(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
-				libirc_mutex_lock (&ircsession->mutex_dcc);
-				libirc_dcc_destroy_nolock (ircsession, dcc->id);
+				// Write the rest of the file and close it before reporting
+				// the completion, so the application could use the file
+				if ( dcc->flags & DCCFL_TO_FILE )
+				{
+					err = libirc_dcc_flush_file (ircsession, dcc);
+
+					close (dcc->file_fd);
+					dcc->file_fd = -1;
+				}
+
+				if ( dcc->state != LIBIRC_STATE_REMOVED )
+				{
+					libirc_mutex_unlock (&dcc->mutex);
+					(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
+					libirc_mutex_lock (&dcc->mutex);
+					libirc_dcc_destroy_nolock (dcc);
+				}
 			}
-			else
-				dcc->outgoing_offset = len;
 		}
 
 		// Clean up unused sessions
 		if ( dcc->state == LIBIRC_STATE_REMOVED )
-			libirc_remove_dcc_session (ircsession, dcc, 0);
-	}
+		{
+			libirc_mutex_unlock (&dcc->mutex);
+			libirc_remove_dcc_session (ircsession, dcc);
+			continue;
+		}
 
-	for ( dcc = ircsession->dcc_sessions; dcc; dcc = dcc->next )
-	{
 		switch (dcc->state)
 		{
 		case LIBIRC_STATE_LISTENING:
@@ -172,349 +1434,399 @@ static void libirc_dcc_add_descriptors (irc_session_t * ircsession, fd_set *in_s
 			break;
 
 		case LIBIRC_STATE_CONNECTED:
-			// Add input descriptor if there is space in input buffer
-			// and it is DCC chat (during DCC send, there is nothing to recv)
-			if ( dcc->incoming_offset < sizeof(dcc->incoming_buf) - 1 )
+			// Add input descriptor if there is space in input buffer.
+			// During DCC send the receiver acknowledges arrive here.
+			if ( libirc_dcc_can_receive (dcc) )
 				libirc_add_to_set (dcc->sock, in_set, maxfd);
 
-			// Add output descriptor if there is something in output buffer
-			libirc_mutex_lock (&dcc->mutex_outbuf);
-
-			if ( dcc->outgoing_offset > 0  )
+			// Add output descriptor if there is something in output buffer,
+			// and the send window allows sending the file data
+			if ( dcc->outgoing_offset > 0
+			&& (dcc->dccmode != LIBIRC_DCC_SENDFILE 
+				|| (libirc_dcc_window_room (dcc, 1) > 0 && libirc_dcc_rate_room (ircsession, dcc, 1) > 0)) )
 				libirc_add_to_set (dcc->sock, out_set, maxfd);
 
-			libirc_mutex_unlock (&dcc->mutex_outbuf);
+			// The zero-copy send goes directly from the file, so wait for 
+			// the socket as long as the send window allows more data
+			if ( (dcc->flags & DCCFL_ZEROCOPY)
+			&& libirc_dcc_send_amount (dcc, LIBIRC_DCC_SENDFILE_CHUNK) > 0 
+			&& libirc_dcc_rate_room (ircsession, dcc, 1) > 0 )
+				libirc_add_to_set (dcc->sock, out_set, maxfd);
 			break;
-
-		case LIBIRC_STATE_CONFIRM_SIZE:
-			/*
-			 * If we're receiving file, then WE should confirm the transferred
-             * part (so we have to sent data). But if we're sending the file, 
-             * then RECEIVER should confirm the packet, so we have to receive
-             * data.
-             *
-             * We don't need to LOCK_DCC_OUTBUF - during file transfer, buffers
-             * can't change asynchronously.
-             */
-             if ( dcc->dccmode == LIBIRC_DCC_RECVFILE && dcc->outgoing_offset > 0 )
-             	libirc_add_to_set (dcc->sock, out_set, maxfd);
-
-             if ( dcc->dccmode == LIBIRC_DCC_SENDFILE && dcc->incoming_offset < 4 )
-				libirc_add_to_set (dcc->sock, in_set, maxfd);
 		}
+
+		libirc_mutex_unlock (&dcc->mutex);
 	}
 
-	libirc_mutex_unlock (&ircsession->mutex_dcc);
+	libirc_dcc_io_add_descriptors (ircsession, in_set, maxfd);
 }
 
 
-static void libirc_dcc_process_descriptors (irc_session_t * ircsession, fd_set *in_set, fd_set *out_set)
+/*
+ * Processes the socket events of a single DCC session, which is locked by
+ * the caller. We need to use such a complex scheme here, because on every
+ * callback the session could be destroyed.
+ */
+static void libirc_dcc_process_session (irc_session_t * ircsession, irc_dcc_session_t * dcc, fd_set *in_set, fd_set *out_set)
 {
-	irc_dcc_session_t * dcc;
-
-	/*
-	 * We need to use such a complex scheme here, because on every callback
-     * a number of DCC sessions could be destroyed.
-     */
-	libirc_mutex_lock (&ircsession->mutex_dcc);
-
-	for ( dcc = ircsession->dcc_sessions; dcc; dcc = dcc->next )
+	if ( dcc->state == LIBIRC_STATE_LISTENING
+	&& FD_ISSET (dcc->sock, in_set) )
 	{
-		if ( dcc->state == LIBIRC_STATE_LISTENING
-		&& FD_ISSET (dcc->sock, in_set) )
-		{
-			socklen_t len = sizeof(dcc->remote_addr);
+		socklen_t len = sizeof(dcc->remote_addr);
 
 #if defined(_WIN32)
-			SOCKET nsock, err = 0;
+		SOCKET nsock, err = 0;
 #else
-			int nsock, err = 0;
+		int nsock, err = 0;
 #endif
 
-			// New connection is available; accept it.
-			if ( socket_accept (&dcc->sock, &nsock, (struct sockaddr *) &dcc->remote_addr, &len) )
-				err = LIBIRC_ERR_ACCEPT;
-
-			// On success, change the active socket and change the state
-			if ( err == 0 )
-			{
-				// close the listen socket, and replace it by a newly 
-				// accepted
-				socket_close (&dcc->sock);
-				dcc->sock = nsock;
-				dcc->state = LIBIRC_STATE_CONNECTED;
-			}
-
-			// If this is DCC chat, inform the caller about accept() 
-			// success or failure.
-			// Otherwise (DCC send) there is no reason.
-			if ( dcc->dccmode == LIBIRC_DCC_CHAT )
-			{
-				libirc_mutex_unlock (&ircsession->mutex_dcc);
-				(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
-				libirc_mutex_lock (&ircsession->mutex_dcc);
-			}
+		// New connection is available; accept it.
+		if ( socket_accept (&dcc->sock, &nsock, (struct sockaddr *) &dcc->remote_addr, &len) )
+			err = LIBIRC_ERR_ACCEPT;
 
-			if ( err )
-				libirc_dcc_destroy_nolock (ircsession, dcc->id);
+		// On success, change the active socket and change the state
+		if ( err == 0 )
+		{
+			// close the listen socket, and replace it by a newly 
+			// accepted. It must not block, because the file might be
+			// sent in chunks larger than the socket buffer.
+			socket_close (&dcc->sock);
+			dcc->sock = nsock;
+			dcc->state = LIBIRC_STATE_CONNECTED;
+			socket_make_nonblocking (&dcc->sock);
 		}
 
-		if ( dcc->state == LIBIRC_STATE_CONNECTING
-		&& FD_ISSET (dcc->sock, out_set) )
+		// If this is DCC chat, inform the caller about accept() 
+		// success or failure.
+		// Otherwise (DCC send) there is no reason.
+		if ( dcc->dccmode == LIBIRC_DCC_CHAT )
 		{
-			// Now we have to determine whether the socket is connected 
-			// or the connect is failed
-			struct sockaddr_in saddr;
-			socklen_t slen = sizeof(saddr);
-			int err = 0;
-
-			if ( getpeername (dcc->sock, (struct sockaddr*)&saddr, &slen) < 0 )
-				err = LIBIRC_ERR_CONNECT;
+			libirc_mutex_unlock (&dcc->mutex);
+			(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
+			libirc_mutex_lock (&dcc->mutex);
+		}
 
-			// On success, change the state
-			if ( err == 0 )
-				dcc->state = LIBIRC_STATE_CONNECTED;
+		if ( err )
+			libirc_dcc_destroy_nolock (dcc);
 
-			// If this is DCC chat, inform the caller about connect()
-			// success or failure.
-			// Otherwise (DCC send) there is no reason.
-			if ( dcc->dccmode == LIBIRC_DCC_CHAT )
-			{
-				libirc_mutex_unlock (&ircsession->mutex_dcc);
-				(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
-				libirc_mutex_lock (&ircsession->mutex_dcc);
-			}
+		// The descriptor sets were made before the accept, and the new
+		// socket may reuse the number of a socket closed meanwhile, so its
+		// events are only checked on the next round
+		return;
+	}
 
-			if ( err )
-				libirc_dcc_destroy_nolock (ircsession, dcc->id);
+	if ( dcc->state == LIBIRC_STATE_CONNECTING
+	&& FD_ISSET (dcc->sock, out_set) )
+	{
+		// Now we have to determine whether the socket is connected 
+		// or the connect is failed
+		struct sockaddr_storage saddr;
+		socklen_t slen = sizeof(saddr);
+		int err = 0;
+
+		if ( getpeername (dcc->sock, (struct sockaddr*)&saddr, &slen) < 0 )
+			err = LIBIRC_ERR_CONNECT;
+
+		// On success, change the state
+		if ( err == 0 )
+			dcc->state = LIBIRC_STATE_CONNECTED;
+
+		// If this is DCC chat, inform the caller about connect()
+		// success or failure.
+		// Otherwise (DCC send) there is no reason.
+		if ( dcc->dccmode == LIBIRC_DCC_CHAT )
+		{
+			libirc_mutex_unlock (&dcc->mutex);
+			(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
+			libirc_mutex_lock (&dcc->mutex);
 		}
 
-		if ( dcc->state == LIBIRC_STATE_CONNECTED
-		|| dcc->state == LIBIRC_STATE_CONFIRM_SIZE )
+		if ( err )
+			libirc_dcc_destroy_nolock (dcc);
+	}
+
+	if ( dcc->state == LIBIRC_STATE_CONNECTED )
+	{
+		if ( FD_ISSET (dcc->sock, in_set) )
 		{
-			if ( FD_ISSET (dcc->sock, in_set) )
+			int length = 0, offset = 0, err = 0;
+
+			if ( (err = libirc_dcc_prepare_recv (ircsession, dcc)) == 0 )
 			{
-				int length, offset = 0, err = 0;
-		
-				unsigned int amount = sizeof (dcc->incoming_buf) - dcc->incoming_offset;
+				unsigned int amount = dcc->incoming_size - dcc->incoming_offset;
+
+				// Keep a byte for the chat line terminator
+				if ( dcc->dccmode == LIBIRC_DCC_CHAT )
+					amount--;
 
 				length = socket_recv (&dcc->sock, dcc->incoming_buf + dcc->incoming_offset, amount);
 
 				if ( length < 0 )
-				{
 					err = LIBIRC_ERR_READ;
-				}	
 				else if ( length == 0 )
-				{
 					err = LIBIRC_ERR_CLOSED;
+				else if ( dcc->dccmode == LIBIRC_DCC_RECVFILE )
+					libirc_dcc_digest_update (dcc, dcc->file_confirm_offset, dcc->incoming_buf + dcc->incoming_offset, length);
+			}
 
-					if ( dcc->dccsend_file_fp )
-					{
-						fclose (dcc->dccsend_file_fp);
-						dcc->dccsend_file_fp = 0;
-					}
+			if ( !err && (dcc->flags & DCCFL_TO_FILE) )
+			{
+				/*
+				 * The file received by the library is collected in the
+				 * buffer, which is written to the disk when full.
+				 */
+				dcc->incoming_offset += length;
+				dcc->file_confirm_offset += length;
+
+				// The I/O thread gets the full buffer before the next select
+				if ( dcc->incoming_offset == dcc->incoming_size 
+				&& (dcc->flags & DCCFL_ASYNC_IO) == 0 )
+					err = libirc_dcc_flush_file (ircsession, dcc);
+
+				// A single ack covers everything received by this call
+				if ( !err 
+				&& dcc->state != LIBIRC_STATE_REMOVED 
+				&& (dcc->flags & DCCFL_TURBO) == 0 )
+					libirc_dcc_queue_ack (dcc);
+			}
+			else if ( !err )
+			{
+				dcc->incoming_offset += length;
+
+				if ( dcc->dccmode == LIBIRC_DCC_SENDFILE )
+				{
+					/*
+					 * During DCC SEND we don't call any callbacks (except 
+					 * there is an error). We just receive the acknowledges,
+					 * which move the send window forward.
+					 */
+					err = libirc_dcc_process_acks (dcc);
+				}
+				else if ( dcc->dccmode == LIBIRC_DCC_CHAT )
+				{
+					libirc_dcc_process_chat (ircsession, dcc);
+
+					// Give back the memory taken by a long line
+					if ( dcc->incoming_offset == 0 && dcc->incoming_size > LIBIRC_DCC_BUFFER_SIZE )
+						libirc_dcc_release_buffer (ircsession, &dcc->incoming_buf, &dcc->incoming_size);
 				}
 				else
 				{
-					dcc->incoming_offset += length;
+					if ( dcc->dccmode != LIBIRC_DCC_RECVFILE )
+						abort();
 
-					if ( dcc->dccmode != LIBIRC_DCC_CHAT )
-						offset = dcc->incoming_offset;
-					else
-						offset = libirc_findcrorlf (dcc->incoming_buf, dcc->incoming_offset);
+					offset = dcc->incoming_offset;
 
-					/*
-					 * In LIBIRC_STATE_CONFIRM_SIZE state we don't call any
-                     * callbacks (except there is an error). We just receive
-                     * the data, and compare it with the amount sent.
-                     */
-					if ( dcc->state == LIBIRC_STATE_CONFIRM_SIZE )
-					{
-						if ( dcc->dccmode != LIBIRC_DCC_SENDFILE )
-							abort();
-
-						if ( dcc->incoming_offset == 4 )
-						{
-							// The order is big-endian
-							const unsigned char * bptr = (const unsigned char *) dcc->incoming_buf;
-							unsigned int received_size = (bptr[0] << 24) | (bptr[1] << 16) | (bptr[2] << 8)  | bptr[3];
-
-							// Sent size confirmed
-							if ( dcc->file_confirm_offset == received_size )
-							{
-								dcc->state = LIBIRC_STATE_CONNECTED;
-								dcc->incoming_offset = 0;
-							}
-							else
-								err = LIBIRC_ERR_WRITE;
-						}
-					}
-					else
+					libirc_mutex_unlock (&dcc->mutex);
+					(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, dcc->incoming_buf, offset);
+					libirc_mutex_lock (&dcc->mutex);
+
+                        /*
+                         * If the session is not terminated in callback,
+                         * account the received data and acknowledge it.
+                         * The sender keeps sending while the ack is on 
+                         * its way, so we don't stop receiving meanwhile.
+                         */
+					if ( dcc->state != LIBIRC_STATE_REMOVED )
 					{
-						/*
-						 * If it is DCC_CHAT, we send a 0-terminated string 
-						 * (which is smaller than offset). Otherwise we send
-	                     * a full buffer. 
-	                     */
-						libirc_mutex_unlock (&ircsession->mutex_dcc);
-
-						if ( dcc->dccmode != LIBIRC_DCC_CHAT )
-						{
-							if ( dcc->dccmode != LIBIRC_DCC_RECVFILE )
-								abort();
-
-							(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, dcc->incoming_buf, offset);
-
-                            /*
-                             * If the session is not terminated in callback,
-                             * put the sent amount into the sent_packet_size_net_byteorder
-                             */
-                             if ( dcc->state != LIBIRC_STATE_REMOVED )
-                             {
-                             	dcc->state = LIBIRC_STATE_CONFIRM_SIZE;
-                             	dcc->file_confirm_offset += offset;
-								
-								// Store as big endian
-								dcc->outgoing_buf[0] = (char) dcc->file_confirm_offset >> 24;
-								dcc->outgoing_buf[1] = (char) dcc->file_confirm_offset >> 16;
-								dcc->outgoing_buf[2] = (char) dcc->file_confirm_offset >> 8;
-								dcc->outgoing_buf[3] = (char) dcc->file_confirm_offset;
-                             	dcc->outgoing_offset = 4;
-							}
-						}
-						else
-							(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, dcc->incoming_buf, strlen(dcc->incoming_buf));
-
-						libirc_mutex_lock (&ircsession->mutex_dcc);
-
-						if ( dcc->incoming_offset - offset > 0 )
-							memmove (dcc->incoming_buf, dcc->incoming_buf + offset, dcc->incoming_offset - offset);
-
-						dcc->incoming_offset -= offset;
+						dcc->file_confirm_offset += offset;
+
+						if ( (dcc->flags & DCCFL_TURBO) == 0 )
+							libirc_dcc_queue_ack (dcc);
 					}
+
+					dcc->incoming_offset = 0;
 				}
+			}
 
                 /*
                  * If error arises somewhere above, we inform the caller 
                  * of failure, and destroy this session.
                  */
-				if ( err )
-				{
-					libirc_mutex_unlock (&ircsession->mutex_dcc);
-					(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
-					libirc_mutex_lock (&ircsession->mutex_dcc);
-					libirc_dcc_destroy_nolock (ircsession, dcc->id);
-				}
+			if ( err )
+			{
+				// Keep whatever was received, so it could be resumed
+				if ( (dcc->flags & DCCFL_TO_FILE) && err != LIBIRC_ERR_WRITE )
+					libirc_dcc_flush_file (ircsession, dcc);
+
+				libirc_mutex_unlock (&dcc->mutex);
+				(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
+				libirc_mutex_lock (&dcc->mutex);
+				libirc_dcc_destroy_nolock (dcc);
 			}
+		}
 
             /*
              * Session might be closed (with sock = -1) after the in_set 
              * processing, so before out_set processing we should check
              * for this case
-			 */
-			if ( dcc->state == LIBIRC_STATE_REMOVED )
-				continue;
+		 */
+		if ( dcc->state == LIBIRC_STATE_REMOVED )
+			return;
 
-			/*
-			 * Write bit set - we can send() something, and it won't block.
-             */
-			if ( FD_ISSET (dcc->sock, out_set) )
+#if defined (LIBIRC_HAVE_SENDFILE)
+		/*
+		 * Zero-copy DCC send: the kernel moves the file data directly
+		 * into the socket, in chunks limited by the send window. The 
+		 * output buffer is only used by chats and acknowledges, so it 
+		 * is not involved here.
+		 */
+		if ( (dcc->flags & DCCFL_ZEROCOPY) && FD_ISSET (dcc->sock, out_set) )
+		{
+			unsigned int amount = libirc_dcc_rate_room (ircsession, dcc, libirc_dcc_send_amount (dcc, LIBIRC_DCC_SENDFILE_CHUNK));
+			off_t offset = dcc->file_sent_offset;
+			ssize_t length = 0;
+			int err = 0;
+
+			if ( amount > 0 )
 			{
-				int length, offset, err = 0;
+				libirc_dcc_prefetch (dcc, dcc->file_sent_offset);
+				libirc_mutex_unlock (&dcc->mutex);
 
-				/*
-				 * Because in some cases outgoing_buf could be changed 
-				 * asynchronously (by another thread), we should lock 
-				 * it.
-                 */
-				libirc_mutex_lock (&dcc->mutex_outbuf);
+				while ( (length = sendfile (dcc->sock, dcc->file_fd, &offset, amount)) < 0 
+				&& errno == EINTR )
+					;
+
+				libirc_mutex_lock (&dcc->mutex);
+
+				if ( length < 0 && errno != EAGAIN )
+					err = LIBIRC_ERR_WRITE;
+				else if ( length == 0 )
+					dcc->flags |= DCCFL_SEND_EOF;
+				else if ( length > 0 )
+				{
+					dcc->file_sent_offset += length;
+					libirc_dcc_rate_take (ircsession, dcc, length);
 
-				offset = dcc->outgoing_offset;
-		
-				if ( offset > 0 )
+					if ( dcc->file_sent_offset >= dcc->file_size )
+						dcc->flags |= DCCFL_SEND_EOF;
+
+					libirc_mutex_unlock (&dcc->mutex);
+					(*dcc->cb)(ircsession, dcc->id, 0, dcc->ctx, 0, length);
+					libirc_mutex_lock (&dcc->mutex);
+				}
+			}
+
+			if ( err )
+			{
+				libirc_mutex_unlock (&dcc->mutex);
+				(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
+				libirc_mutex_lock (&dcc->mutex);
+
+				libirc_dcc_destroy_nolock (dcc);
+			}
+
+			return;
+		}
+#endif
+
+		/*
+		 * Write bit set - we can send() something, and it won't block.
+             */
+		if ( FD_ISSET (dcc->sock, out_set) )
+		{
+			int length, offset, err = 0;
+
+			offset = dcc->outgoing_offset;
+
+			// The file data is sent no faster than the send window and 
+			// the rate caps allow
+			if ( dcc->dccmode == LIBIRC_DCC_SENDFILE )
+				offset = libirc_dcc_rate_room (ircsession, dcc, libirc_dcc_window_room (dcc, offset));
+	
+			if ( offset > 0 )
+			{
+				length = socket_send (&dcc->sock, dcc->outgoing_buf, offset);
+
+				if ( length < 0 )
+					err = LIBIRC_ERR_WRITE;
+				else if ( length == 0 )
+					err = LIBIRC_ERR_CLOSED;
+				else
 				{
-					length = socket_send (&dcc->sock, dcc->outgoing_buf, offset);
+					// The sent file data is hashed before it leaves the buffer
+					if ( dcc->dccmode == LIBIRC_DCC_SENDFILE )
+						libirc_dcc_digest_update (dcc, dcc->file_sent_offset, dcc->outgoing_buf, length);
 
-					if ( length < 0 )
-						err = LIBIRC_ERR_WRITE;
-					else if ( length == 0 )
-						err = LIBIRC_ERR_CLOSED;
-					else
+					if ( dcc->outgoing_offset - length > 0 )
+						memmove (dcc->outgoing_buf, dcc->outgoing_buf + length, dcc->outgoing_offset - length);
+
+					dcc->outgoing_offset -= length;
+
+					/*
+					 * If this was DCC_SENDFILE, account the data which
+					 * is now in flight, and report the progress. The
+					 * confirmations are processed as they arrive.
+                     */
+					if ( dcc->dccmode == LIBIRC_DCC_SENDFILE )
 					{
-						/*
-						 * If this was DCC_SENDFILE, and we just sent a packet,
-						 * change the state to wait for confirmation (and store
-						 * sent packet size)
-	                     */
-						if ( dcc->state == LIBIRC_STATE_CONNECTED
-						&& dcc->dccmode == LIBIRC_DCC_SENDFILE )
-						{
-							dcc->file_confirm_offset += offset;
-							dcc->state = LIBIRC_STATE_CONFIRM_SIZE;
-
-							libirc_mutex_unlock (&ircsession->mutex_dcc);
-							libirc_mutex_unlock (&dcc->mutex_outbuf);
-							(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, offset);
-							libirc_mutex_lock (&ircsession->mutex_dcc);
-							libirc_mutex_lock (&dcc->mutex_outbuf);
-						}
-
-						if ( dcc->outgoing_offset - length > 0 )
-							memmove (dcc->outgoing_buf, dcc->outgoing_buf + length, dcc->outgoing_offset - length);
-
-						dcc->outgoing_offset -= length;
-
-						/*
-						 * If we just sent the confirmation data, change state 
-						 * back.
-                         */
-						if ( dcc->state == LIBIRC_STATE_CONFIRM_SIZE
-						&& dcc->dccmode == LIBIRC_DCC_RECVFILE
-						&& dcc->outgoing_offset == 0 )
-						{
-							/*
-							 * If the file is already received, we should inform
-                             * the caller, and close the session.
-                             */
-							if ( dcc->received_file_size == dcc->file_confirm_offset )
-                            {
-								libirc_mutex_unlock (&ircsession->mutex_dcc);
-								libirc_mutex_unlock (&dcc->mutex_outbuf);
-								(*dcc->cb)(ircsession, dcc->id, 0, dcc->ctx, 0, 0);
-								libirc_dcc_destroy_nolock (ircsession, dcc->id);
-                            }
-                            else
-                            {
-                            	/* Continue to receive the file */
-								dcc->state = LIBIRC_STATE_CONNECTED;
-							}
-						}
+						dcc->file_sent_offset += length;
+						libirc_dcc_rate_take (ircsession, dcc, length);
+
+						libirc_mutex_unlock (&dcc->mutex);
+						(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, length);
+						libirc_mutex_lock (&dcc->mutex);
 					}
-				}
 
-				libirc_mutex_unlock (&dcc->mutex_outbuf);
+					// Give back the memory taken by a long message queue
+					if ( dcc->dccmode == LIBIRC_DCC_CHAT
+					&& dcc->outgoing_offset == 0
+					&& dcc->outgoing_size > LIBIRC_DCC_BUFFER_SIZE )
+						libirc_dcc_release_buffer (ircsession, &dcc->outgoing_buf, &dcc->outgoing_size);
+
+					/*
+					 * If we just sent the confirmation data, and a newer
+					 * one is waiting, send it too.
+                         */
+					if ( dcc->dccmode == LIBIRC_DCC_RECVFILE
+					&& dcc->outgoing_offset == 0
+					&& (dcc->flags & DCCFL_ACK_PENDING) )
+						libirc_dcc_queue_ack (dcc);
+				}
+			}
 
                 /*
                  * If error arises somewhere above, we inform the caller 
                  * of failure, and destroy this session.
                  */
-				if ( err )
-				{
-					libirc_mutex_unlock (&ircsession->mutex_dcc);
-					(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
-					libirc_mutex_lock (&ircsession->mutex_dcc);
+			if ( err )
+			{
+				libirc_mutex_unlock (&dcc->mutex);
+				(*dcc->cb)(ircsession, dcc->id, err, dcc->ctx, 0, 0);
+				libirc_mutex_lock (&dcc->mutex);
 
-					libirc_dcc_destroy_nolock (ircsession, dcc->id);
-				}
+				libirc_dcc_destroy_nolock (dcc);
 			}
 		}
 	}
+}
+
+
+static void libirc_dcc_process_descriptors (irc_session_t * ircsession, fd_set *in_set, fd_set *out_set)
+{
+	irc_dcc_session_t * dcc;
+	unsigned int slot, count = libirc_dcc_slots_count (ircsession);
+
+	for ( slot = 0; slot < count; slot++ )
+	{
+		if ( (dcc = libirc_lock_dcc_slot (ircsession, slot)) == 0 )
+			continue;
+
+		libirc_dcc_process_session (ircsession, dcc, in_set, out_set);
+		libirc_mutex_unlock (&dcc->mutex);
+	}
 
-	libirc_mutex_unlock (&ircsession->mutex_dcc);
+	libirc_dcc_io_process_descriptors (ircsession, in_set);
 }
 
 
-static int libirc_new_dcc_session (irc_session_t * session, unsigned long ip, unsigned short port, int dccmode, void * ctx, irc_dcc_session_t ** pdcc)
+/*
+ * Creates a DCC session for the offer received from the peer address, or
+ * for our own offer if the address is 0. Our offer listens for the peer, 
+ * or with LIBIRC_OPTION_DCC_PASSIVE waits for the peer to listen. The 
+ * socket for the received offer is only created when it is accepted.
+ */
+static int libirc_new_dcc_session (irc_session_t * session, const struct sockaddr_storage * remote_addr, int dccmode, void * ctx, irc_dcc_session_t ** pdcc)
 {
 	irc_dcc_session_t * dcc = malloc (sizeof(irc_dcc_session_t));
 
@@ -524,76 +1836,72 @@ static int libirc_new_dcc_session (irc_session_t * session, unsigned long ip, un
 	// setup
 	memset (dcc, 0, sizeof(irc_dcc_session_t));
 
-	dcc->dccsend_file_fp = 0;
-
-	if ( libirc_mutex_init (&dcc->mutex_outbuf) )
-		goto cleanup_exit_error;
+	dcc->sock = -1;
+	dcc->file_fd = -1;
 
-	if ( socket_create (PF_INET, SOCK_STREAM, &dcc->sock) )
+	if ( libirc_mutex_init (&dcc->mutex) )
 		goto cleanup_exit_error;
 
-	if ( !ip )
+	// The file data digests, computed as the data passes through
+	if ( dccmode != LIBIRC_DCC_CHAT && (session->options & LIBIRC_OPTION_DCC_CRC32) )
 	{
-		unsigned long arg = 1;
-
-		setsockopt (dcc->sock, SOL_SOCKET, SO_REUSEADDR, (char*)&arg, sizeof(arg));
-
-#if defined (ENABLE_IPV6)
-		if ( session->flags & SESSIONFL_USES_IPV6 )
-		{
-			struct sockaddr_in6 saddr6;
-
-			memset (&saddr6, 0, sizeof(saddr6));
-			saddr6.sin6_family = AF_INET6;
-			memcpy (&saddr6.sin6_addr, &session->local_addr6, sizeof(session->local_addr6));
-			saddr6.sin6_port = htons (0);
+		dcc->flags |= DCCFL_CRC32;
+		dcc->crc32 = 0xFFFFFFFF;
+	}
 
-			if ( bind (dcc->sock, (struct sockaddr *) &saddr6, sizeof(saddr6)) < 0 )
-				goto cleanup_exit_error;
-		}
-		else
-#endif
+	if ( dccmode != LIBIRC_DCC_CHAT && (session->options & LIBIRC_OPTION_DCC_SHA256) )
+	{
+		if ( libirc_sha256_init (&dcc->sha256) )
 		{
-			struct sockaddr_in saddr;
-			memset (&saddr, 0, sizeof(saddr));
-			saddr.sin_family = AF_INET;
-			memcpy (&saddr.sin_addr, &session->local_addr, sizeof(session->local_addr));
-			saddr.sin_port = htons (0);
-
-			if ( bind (dcc->sock, (struct sockaddr *) &saddr, sizeof(saddr)) < 0 )
-				goto cleanup_exit_error;
+			libirc_mutex_destroy (&dcc->mutex);
+			free (dcc);
+			return LIBIRC_ERR_NOMEM;
 		}
 
-		if ( listen (dcc->sock, 5) < 0 )
-			goto cleanup_exit_error;
-
-		dcc->state = LIBIRC_STATE_LISTENING;
+		dcc->flags |= DCCFL_SHA256;
 	}
-	else
-	{
-		// make socket non-blocking, so connect() call won't block
-		if ( socket_make_nonblocking (&dcc->sock) )
-			goto cleanup_exit_error;
-
-		memset (&dcc->remote_addr, 0, sizeof(dcc->remote_addr));
-		dcc->remote_addr.sin_family = AF_INET;
-		dcc->remote_addr.sin_addr.s_addr = htonl (ip); // what idiot came up with idea to send IP address in host-byteorder?
-        dcc->remote_addr.sin_port = htons(port);
 
+	if ( remote_addr )
+	{
+		memcpy (&dcc->remote_addr, remote_addr, sizeof(dcc->remote_addr));
 		dcc->state = LIBIRC_STATE_INIT;
 	}
+	else if ( session->options & LIBIRC_OPTION_DCC_PASSIVE )
+	{
+		dcc->flags |= DCCFL_PASSIVE;
+		dcc->state = LIBIRC_STATE_PASSIVE;
+	}
+	else if ( libirc_dcc_listen (session, dcc) )
+		goto cleanup_exit_error;
 
 	dcc->dccmode = dccmode;
 	dcc->ctx = ctx;
+	dcc->send_window = session->dcc_send_window;
+	dcc->buffer_size = session->dcc_buffer_size;
 	time (&dcc->timeout);
 
-	// and store it
+	// and store it. The new session is returned locked, so the caller 
+	// could finish its setup before the processing loop gets to it.
 	libirc_mutex_lock (&session->mutex_dcc);
 
-	dcc->id = session->dcc_last_id++;
-	dcc->next = session->dcc_sessions;
-	session->dcc_sessions = dcc;
+	if ( libirc_dcc_add_slot (session, dcc) )
+	{
+		libirc_mutex_unlock (&session->mutex_dcc);
+		socket_close (&dcc->sock);
+
+		if ( dcc->flags & DCCFL_SHA256 )
+			libirc_sha256_free (&dcc->sha256);
+
+		libirc_mutex_destroy (&dcc->mutex);
+		free (dcc);
+		return LIBIRC_ERR_NOMEM;
+	}
+
+	// Our passive offers are matched to the replies by the id
+	if ( !remote_addr && (dcc->flags & DCCFL_PASSIVE) )
+		dcc->token = dcc->id;
 
+	libirc_mutex_lock (&dcc->mutex);
 	libirc_mutex_unlock (&session->mutex_dcc);
 
     *pdcc = dcc;
@@ -603,6 +1911,9 @@ cleanup_exit_error:
 	if ( dcc->sock >= 0 )
 		socket_close (&dcc->sock);
 
+	if ( dcc->flags & DCCFL_SHA256 )
+		libirc_sha256_free (&dcc->sha256);
+
 	free (dcc);
 	return LIBIRC_ERR_SOCKET;
 }
@@ -613,155 +1924,396 @@ int irc_dcc_destroy (irc_session_t * session, irc_dcc_t dccid)
 	// This function doesn't actually destroy the session; it just changes
 	// its state to "removed" and closes the socket. The memory is actually
 	// freed after the processing loop.
-	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid, 1);
+	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid);
 
 	if ( !dcc )
 		return 1;
 
-	if ( dcc->sock >= 0 )
-		socket_close (&dcc->sock);
+	libirc_dcc_destroy_nolock (dcc);
+	libirc_mutex_unlock (&dcc->mutex);
+	return 0;
+}
 
-	dcc->state = LIBIRC_STATE_REMOVED;
 
-	libirc_mutex_unlock (&session->mutex_dcc);
+int	irc_dcc_chat (irc_session_t * session, void * ctx, const char * nick, irc_dcc_callback_t callback, irc_dcc_t * dccid)
+{
+	irc_dcc_session_t * dcc;
+	int err;
+
+	if ( session->state != LIBIRC_STATE_CONNECTED )
+	{
+		session->lasterror = LIBIRC_ERR_STATE;
+		return 1;
+	}
+
+	err = libirc_new_dcc_session (session, 0, LIBIRC_DCC_CHAT, ctx, &dcc);
+
+	if ( err )
+	{
+		session->lasterror = err;
+		return 1;
+	}
+
+	*dccid = dcc->id;
+	dcc->cb = callback;
+	dcc->dccmode = LIBIRC_DCC_CHAT;
+	irc_target_get_nick (nick, dcc->nick, sizeof(dcc->nick));
+	libirc_mutex_unlock (&dcc->mutex);
+
+	if ( libirc_dcc_send_offer (session, *dccid) )
+	{
+		libirc_remove_dcc_session (session, dcc);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+int irc_dcc_msg	(irc_session_t * session, irc_dcc_t dccid, const char * text)
+{
+	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid);
+
+	if ( !dcc )
+		return 1;
+
+	if ( dcc->dccmode != LIBIRC_DCC_CHAT )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	// The queue grows as needed, but is limited if the peer does not read
+	if ( libirc_dcc_grow_buffer (&dcc->outgoing_buf, &dcc->outgoing_size, dcc->outgoing_offset + strlen(text) + 2, LIBIRC_DCC_CHAT_MAX_QUEUE) )
+	{
+		session->lasterror = LIBIRC_ERR_NOMEM;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	memcpy (dcc->outgoing_buf + dcc->outgoing_offset, text, strlen (text));
+	dcc->outgoing_offset += strlen (text);
+	dcc->outgoing_buf[dcc->outgoing_offset++] = 0x0D;
+	dcc->outgoing_buf[dcc->outgoing_offset++] = 0x0A;
+
+	libirc_mutex_unlock (&dcc->mutex);
+
 	return 0;
 }
 
 
-int	irc_dcc_chat (irc_session_t * session, void * ctx, const char * nick, irc_dcc_callback_t callback, irc_dcc_t * dccid)
+/*
+ * Finds the file transfer offered to or by the nick on the port, as used 
+ * by DCC RESUME and DCC ACCEPT. The session is returned locked.
+ */
+static irc_dcc_session_t * libirc_find_dcc_offer (irc_session_t * session, int dccmode, int state, const char * nick, unsigned short port, unsigned long token)
+{
+	irc_dcc_session_t * dcc = 0;
+	unsigned int slot;
+
+	libirc_mutex_lock (&session->mutex_dcc);
+
+	for ( slot = 0; slot < session->dcc_slots_count; slot++ )
+	{
+		if ( (dcc = session->dcc_slots[slot].dcc) == 0 )
+			continue;
+
+		libirc_mutex_lock (&dcc->mutex);
+
+		if ( dcc->dccmode == dccmode
+		&& dcc->state == state
+		&& dcc->port == port
+		&& ((dcc->flags & DCCFL_PASSIVE) == 0 || dcc->token == token)
+		&& strncasecmp (dcc->nick, nick, sizeof(dcc->nick)) == 0 )
+			break;
+
+		libirc_mutex_unlock (&dcc->mutex);
+		dcc = 0;
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc);
+	return dcc;
+}
+
+
+/*
+ * Handles DCC RESUME from the receiver of our DCC SEND offer: seeks in the
+ * file, and confirms the position with DCC ACCEPT. The offer is found by 
+ * the port, because some clients send a bogus file name here; a passive 
+ * offer has port 0, and is found by the token.
+ */
+static void libirc_dcc_resume_request (irc_session_t * session, const char * origin, const char * filename, unsigned short port, irc_dcc_size_t position, unsigned long token)
+{
+	int state = port ? LIBIRC_STATE_LISTENING : LIBIRC_STATE_PASSIVE;
+	irc_dcc_session_t * dcc;
+	char nick[128], cmdbuf[384];
+	irc_dcc_t dccid;
+
+	irc_target_get_nick (origin, nick, sizeof(nick));
+
+	if ( (dcc = libirc_find_dcc_offer (session, LIBIRC_DCC_SENDFILE, state, nick, port, token)) == 0 )
+		return;
+
+	dccid = dcc->id;
+
+	// Let the application decide where to restart
+	if ( session->callbacks.event_dcc_resume_req )
+	{
+		libirc_mutex_unlock (&dcc->mutex);
+		(*session->callbacks.event_dcc_resume_req) (session, nick, dccid, &position);
+
+		// The session could be destroyed meanwhile
+		if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+			return;
+
+		if ( dcc->state != state )
+		{
+			libirc_mutex_unlock (&dcc->mutex);
+			return;
+		}
+	}
+
+	if ( position > dcc->file_size )
+	{
+		libirc_mutex_unlock (&dcc->mutex);
+		return;
+	}
+
+	// The acks from the receiver start at the resume position
+	dcc->file_sent_offset = position;
+	dcc->file_read_offset = position;
+	dcc->file_confirm_offset = position;
+
+	if ( position == dcc->file_size )
+		dcc->flags |= DCCFL_SEND_EOF;
+
+	time (&dcc->timeout);
+	libirc_mutex_unlock (&dcc->mutex);
+
+	if ( state == LIBIRC_STATE_PASSIVE )
+		snprintf (cmdbuf, sizeof(cmdbuf), "DCC ACCEPT %s 0 %llu %lu", filename, position, token);
+	else
+		snprintf (cmdbuf, sizeof(cmdbuf), "DCC ACCEPT %s %u %llu", filename, port, position);
+
+	irc_cmd_ctcp_request (session, nick, cmdbuf);
+}
+
+
+/*
+ * Starts the connection for the accepted offer: connects to the peer, or
+ * for a passive offer listens, so the peer could connect to us. The reply
+ * with our address must be sent after the session is unlocked.
+ */
+static int libirc_dcc_start_accepted (irc_session_t * session, irc_dcc_session_t * dcc)
+{
+	time (&dcc->timeout);
+
+	if ( dcc->flags & DCCFL_PASSIVE )
+		return libirc_dcc_listen (session, dcc);
+
+	return libirc_dcc_connect (dcc);
+}
+
+
+/*
+ * Handles DCC ACCEPT confirming our DCC RESUME, and connects to the sender.
+ */
+static void libirc_dcc_resume_accepted (irc_session_t * session, const char * origin, unsigned short port, irc_dcc_size_t position, unsigned long token)
 {
-	struct sockaddr_in saddr;
-	socklen_t len = sizeof(saddr);
-	char cmdbuf[128], notbuf[128];
 	irc_dcc_session_t * dcc;
-	int err;
+	irc_dcc_t dccid;
+	char nick[128];
+	int err, passive;
 
-	if ( session->state != LIBIRC_STATE_CONNECTED )
-	{
-		session->lasterror = LIBIRC_ERR_STATE;
-		return 1;
-	}
+	irc_target_get_nick (origin, nick, sizeof(nick));
 
-	err = libirc_new_dcc_session (session, 0, 0, LIBIRC_DCC_CHAT, ctx, &dcc);
+	if ( (dcc = libirc_find_dcc_offer (session, LIBIRC_DCC_RECVFILE, LIBIRC_STATE_RESUMING, nick, port, token)) == 0 )
+		return;
 
-	if ( err )
-	{
-		session->lasterror = err;
-		return 1;
-	}
+	if ( position > dcc->file_size )
+		err = LIBIRC_ERR_CONNECT;
+	else
+		err = libirc_dcc_start_accepted (session, dcc);
 
-	if ( getsockname (dcc->sock, (struct sockaddr*) &saddr, &len) < 0 )
+	if ( err )
 	{
-		session->lasterror = LIBIRC_ERR_SOCKET;
-		libirc_remove_dcc_session (session, dcc, 1);
-		return 1;
-	}
-
-	sprintf (notbuf, "DCC Chat (%s)", inet_ntoa (saddr.sin_addr));
-	sprintf (cmdbuf, "DCC CHAT chat %lu %u", (unsigned long) ntohl (saddr.sin_addr.s_addr), ntohs (saddr.sin_port));
+		libirc_mutex_unlock (&dcc->mutex);
+		(*dcc->cb)(session, dcc->id, err, dcc->ctx, 0, 0);
+		libirc_mutex_lock (&dcc->mutex);
 
-	if ( irc_cmd_notice (session, nick, notbuf)
-	|| irc_cmd_ctcp_request (session, nick, cmdbuf) )
-	{
-		libirc_remove_dcc_session (session, dcc, 1);
-		return 1;
+		libirc_dcc_destroy_nolock (dcc);
+		libirc_mutex_unlock (&dcc->mutex);
+		return;
 	}
 
-	*dccid = dcc->id;
-	dcc->cb = callback;
-	dcc->dccmode = LIBIRC_DCC_CHAT;
+	dcc->file_confirm_offset = position;
+	dcc->file_write_offset = position;
+	dccid = dcc->id;
+	passive = dcc->flags & DCCFL_PASSIVE;
+	libirc_mutex_unlock (&dcc->mutex);
 
-	return 0;
+	if ( passive && libirc_dcc_send_offer (session, dccid) )
+		irc_dcc_destroy (session, dccid);
 }
 
 
-int irc_dcc_msg	(irc_session_t * session, irc_dcc_t dccid, const char * text)
+/*
+ * Handles the reply to our passive offer, and connects to the peer.
+ */
+static void libirc_dcc_passive_reply (irc_session_t * session, const char * origin, int dccmode, const struct sockaddr_storage * addr, unsigned long token)
 {
-	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid, 1);
+	irc_dcc_session_t * dcc;
+	char nick[128];
+	int err;
 
-	if ( !dcc )
-		return 1;
+	irc_target_get_nick (origin, nick, sizeof(nick));
 
-	if ( dcc->dccmode != LIBIRC_DCC_CHAT )
-	{
-		session->lasterror = LIBIRC_ERR_INVAL;
-		libirc_mutex_unlock (&session->mutex_dcc);
-		return 1;
-	}
+	if ( (dcc = libirc_find_dcc_session (session, (irc_dcc_t) token)) == 0 )
+		return;
 
-	if ( (strlen(text) + 2) >= (sizeof(dcc->outgoing_buf) - dcc->outgoing_offset) )
+	if ( dcc->state != LIBIRC_STATE_PASSIVE
+	|| dcc->dccmode != dccmode
+	|| strncasecmp (dcc->nick, nick, sizeof(dcc->nick)) != 0 )
 	{
-		session->lasterror = LIBIRC_ERR_NOMEM;
-		libirc_mutex_unlock (&session->mutex_dcc);
-		return 1;
+		libirc_mutex_unlock (&dcc->mutex);
+		return;
 	}
 
-	libirc_mutex_lock (&dcc->mutex_outbuf);
+	memcpy (&dcc->remote_addr, addr, sizeof(dcc->remote_addr));
+	time (&dcc->timeout);
 
-	strcpy (dcc->outgoing_buf + dcc->outgoing_offset, text);
-	dcc->outgoing_offset += strlen (text);
-	dcc->outgoing_buf[dcc->outgoing_offset++] = 0x0D;
-	dcc->outgoing_buf[dcc->outgoing_offset++] = 0x0A;
+	if ( (err = libirc_dcc_connect (dcc)) != 0 )
+	{
+		libirc_mutex_unlock (&dcc->mutex);
+		(*dcc->cb)(session, dcc->id, err, dcc->ctx, 0, 0);
+		libirc_mutex_lock (&dcc->mutex);
 
-	libirc_mutex_unlock (&dcc->mutex_outbuf);
-	libirc_mutex_unlock (&session->mutex_dcc);
+		libirc_dcc_destroy_nolock (dcc);
+	}
 
-	return 0;
+	libirc_mutex_unlock (&dcc->mutex);
 }
 
 
 static void libirc_dcc_request (irc_session_t * session, const char * nick, const char * req)
 {
-	char filenamebuf[256];
-	unsigned long ip, size;
+	char filenamebuf[256], addrbuf[64], addrtext[64];
+	struct sockaddr_storage addr;
+	unsigned long token = 0;
+	irc_dcc_size_t size;
 	unsigned short port;
+	irc_dcc_t dccid;
+	int fields, turbo = 0;
 
-	if ( sscanf (req, "DCC CHAT chat %lu %hu", &ip, &port) == 2 )
+	if ( (fields = sscanf (req, "DCC CHAT chat %63s %hu %lu", addrbuf, &port, &token)) >= 2 )
 	{
+		if ( libirc_dcc_parse_addr (addrbuf, port, &addr) || (port == 0 && fields < 3) )
+			return;
+
+		// The peer listens for our passive offer
+		if ( port != 0 && fields == 3 )
+		{
+			libirc_dcc_passive_reply (session, nick, LIBIRC_DCC_CHAT, &addr, token);
+			return;
+		}
+
 		if ( session->callbacks.event_dcc_chat_req )
 		{
 			irc_dcc_session_t * dcc;
 
-			int err = libirc_new_dcc_session (session, ip, port, LIBIRC_DCC_CHAT, 0, &dcc);
+			int err = libirc_new_dcc_session (session, &addr, LIBIRC_DCC_CHAT, 0, &dcc);
 			if ( err )
 			{
 				session->lasterror = err;
 				return;
 			}
 
+			// A passive offer: the peer waits for us to listen
+			if ( port == 0 )
+			{
+				dcc->flags |= DCCFL_PASSIVE;
+				dcc->token = token;
+			}
+
+			irc_target_get_nick (nick, dcc->nick, sizeof(dcc->nick));
+			dccid = dcc->id;
+			libirc_dcc_addr_text (&dcc->remote_addr, addrtext, sizeof(addrtext));
+			libirc_mutex_unlock (&dcc->mutex);
+
 			(*session->callbacks.event_dcc_chat_req) (session, 
 						nick, 
-						inet_ntoa (dcc->remote_addr.sin_addr),
-						dcc->id);
+						addrtext,
+						dccid);
 		}
 
 		return;
 	}
-	else if ( sscanf (req, "DCC SEND %s %lu %hu %lu", filenamebuf, &ip, &port, &size) == 4 )
+	else if ( (fields = sscanf (req, "DCC SEND %255s %63s %hu %llu %lu", filenamebuf, addrbuf, &port, &size, &token)) >= 4
+	|| (turbo = (fields = sscanf (req, "DCC TSEND %255s %63s %hu %llu %lu", filenamebuf, addrbuf, &port, &size, &token)) >= 4) )
 	{
+		if ( libirc_dcc_parse_addr (addrbuf, port, &addr) || (port == 0 && fields < 5) )
+			return;
+
+		// The peer listens for our passive offer
+		if ( port != 0 && fields == 5 )
+		{
+			libirc_dcc_passive_reply (session, nick, LIBIRC_DCC_SENDFILE, &addr, token);
+			return;
+		}
+
 		if ( session->callbacks.event_dcc_send_req )
 		{
 			irc_dcc_session_t * dcc;
 
-			int err = libirc_new_dcc_session (session, ip, port, LIBIRC_DCC_RECVFILE, 0, &dcc);
+			int err = libirc_new_dcc_session (session, &addr, LIBIRC_DCC_RECVFILE, 0, &dcc);
 			if ( err )
 			{
 				session->lasterror = err;
 				return;
 			}
 
+			// TSEND receivers never acknowledge the received data
+			if ( turbo )
+				dcc->flags |= DCCFL_TURBO;
+
+			// A passive offer: the peer waits for us to listen
+			if ( port == 0 )
+			{
+				dcc->flags |= DCCFL_PASSIVE;
+				dcc->token = token;
+			}
+
+			// Set before the callback, which may call irc_dcc_resume()
+			dcc->file_size = size;
+			dcc->port = port;
+			irc_target_get_nick (nick, dcc->nick, sizeof(dcc->nick));
+			strcpy (dcc->filename, filenamebuf);
+
+			dccid = dcc->id;
+			libirc_dcc_addr_text (&dcc->remote_addr, addrtext, sizeof(addrtext));
+			libirc_mutex_unlock (&dcc->mutex);
+
 			(*session->callbacks.event_dcc_send_req) (session, 
 						nick, 
-						inet_ntoa (dcc->remote_addr.sin_addr),
+						addrtext,
 						filenamebuf,
 						size,
-						dcc->id);
-
-			dcc->received_file_size = size;
+						dccid);
 		}
 
 		return;
 	}
+	else if ( sscanf (req, "DCC RESUME %255s %hu %llu %lu", filenamebuf, &port, &size, &token) >= 3 )
+	{
+		libirc_dcc_resume_request (session, nick, filenamebuf, port, size, token);
+		return;
+	}
+	else if ( sscanf (req, "DCC ACCEPT %255s %hu %llu %lu", filenamebuf, &port, &size, &token) >= 3 )
+	{
+		libirc_dcc_resume_accepted (session, nick, port, size, token);
+		return;
+	}
 #if defined (ENABLE_DEBUG)
 	fprintf (stderr, "BUG: Unhandled DCC message: %s\n", req);
 	abort();
@@ -771,7 +2323,8 @@ static void libirc_dcc_request (irc_session_t * session, const char * nick, cons
 
 int	irc_dcc_accept (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback)
 {
-	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid, 1);
+	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid);
+	int err, passive;
 
 	if ( !dcc )
 		return 1;
@@ -779,31 +2332,160 @@ int	irc_dcc_accept (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dc
 	if ( dcc->state != LIBIRC_STATE_INIT )
 	{
 		session->lasterror = LIBIRC_ERR_STATE;
-		libirc_mutex_unlock (&session->mutex_dcc);
+		libirc_mutex_unlock (&dcc->mutex);
 		return 1;
 	}
 
 	dcc->cb = callback;
 	dcc->ctx = ctx;
 
-	// Initiate the connect
-    if ( socket_connect (&dcc->sock, (struct sockaddr *) &dcc->remote_addr, sizeof(dcc->remote_addr)) )
+	// Initiate the connect, or listen for a passive offer
+	if ( (err = libirc_dcc_start_accepted (session, dcc)) != 0 )
 	{
-		libirc_dcc_destroy_nolock (session, dccid);
-		libirc_mutex_unlock (&session->mutex_dcc);
-		session->lasterror = LIBIRC_ERR_CONNECT;
+		libirc_dcc_destroy_nolock (dcc);
+		libirc_mutex_unlock (&dcc->mutex);
+		session->lasterror = err;
+		return 1;
+	}
+
+	passive = dcc->flags & DCCFL_PASSIVE;
+	libirc_mutex_unlock (&dcc->mutex);
+
+	// Tell the peer where to connect
+	if ( passive && libirc_dcc_send_offer (session, dccid) )
+	{
+		irc_dcc_destroy (session, dccid);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+int	irc_dcc_resume (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback, irc_dcc_size_t position)
+{
+	char cmdbuf[384], nick[128];
+	irc_dcc_session_t * dcc;
+
+	if ( position == 0 )
+		return irc_dcc_accept (session, dccid, ctx, callback);
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return 1;
+
+	if ( dcc->state != LIBIRC_STATE_INIT || dcc->dccmode != LIBIRC_DCC_RECVFILE )
+	{
+		session->lasterror = LIBIRC_ERR_STATE;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	if ( position > dcc->file_size )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	dcc->cb = callback;
+	dcc->ctx = ctx;
+
+	// Connect when the sender confirms the position with DCC ACCEPT
+	dcc->file_confirm_offset = position;
+	dcc->state = LIBIRC_STATE_RESUMING;
+	time (&dcc->timeout);
+
+	if ( dcc->flags & DCCFL_PASSIVE )
+		snprintf (cmdbuf, sizeof(cmdbuf), "DCC RESUME %s 0 %llu %lu", dcc->filename, position, dcc->token);
+	else
+		snprintf (cmdbuf, sizeof(cmdbuf), "DCC RESUME %s %u %llu", dcc->filename, dcc->port, position);
+	strcpy (nick, dcc->nick);
+	libirc_mutex_unlock (&dcc->mutex);
+
+	if ( irc_cmd_ctcp_request (session, nick, cmdbuf) )
+	{
+		// The session could be destroyed meanwhile
+		if ( (dcc = libirc_find_dcc_session (session, dccid)) != 0 )
+		{
+			libirc_dcc_destroy_nolock (dcc);
+			libirc_mutex_unlock (&dcc->mutex);
+		}
+
 		return 1;
 	}
 
-	dcc->state = LIBIRC_STATE_CONNECTING;
-	libirc_mutex_unlock (&session->mutex_dcc);
 	return 0;
 }
 
 
+int	irc_dcc_accept_to_file (irc_session_t * session, irc_dcc_t dccid, void * ctx, irc_dcc_callback_t callback, const char * path, unsigned int flags)
+{
+	irc_dcc_session_t * dcc;
+	irc_dcc_size_t position = 0;
+	struct stat st;
+	int fd, err = 0;
+
+	if ( !path || !callback )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return 1;
+
+	if ( dcc->state != LIBIRC_STATE_INIT || dcc->dccmode != LIBIRC_DCC_RECVFILE )
+	{
+		session->lasterror = LIBIRC_ERR_STATE;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	if ( (fd = open (path, O_WRONLY | O_CREAT | O_BINARY | ((flags & LIBIRC_DCC_FILE_RESUME) ? 0 : O_TRUNC), 0644)) < 0 )
+	{
+		session->lasterror = LIBIRC_ERR_OPENFILE;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	// Continue from the end of the existing file
+	if ( flags & LIBIRC_DCC_FILE_RESUME )
+	{
+		if ( fstat (fd, &st) )
+			err = LIBIRC_ERR_OPENFILE;
+		else
+			position = (irc_dcc_size_t) st.st_size < dcc->file_size ? (irc_dcc_size_t) st.st_size : dcc->file_size;
+	}
+
+	if ( !err 
+	&& (flags & LIBIRC_DCC_FILE_PREALLOCATE)
+	&& libirc_file_preallocate (fd, dcc->file_size) )
+		err = LIBIRC_ERR_WRITE;
+
+	if ( err )
+	{
+		close (fd);
+		session->lasterror = err;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	dcc->file_fd = fd;
+	dcc->file_write_offset = position;
+	dcc->flags |= DCCFL_TO_FILE;
+
+	if ( session->options & LIBIRC_OPTION_DCC_ASYNC_IO )
+		dcc->flags |= DCCFL_ASYNC_IO;
+
+	libirc_mutex_unlock (&dcc->mutex);
+
+	return irc_dcc_resume (session, dccid, ctx, callback, position);
+}
+
+
 int	irc_dcc_decline (irc_session_t * session, irc_dcc_t dccid)
 {
-	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid, 1);
+	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid);
 
 	if ( !dcc )
 		return 1;
@@ -811,25 +2493,23 @@ int	irc_dcc_decline (irc_session_t * session, irc_dcc_t dccid)
 	if ( dcc->state != LIBIRC_STATE_INIT )
 	{
 		session->lasterror = LIBIRC_ERR_STATE;
-		libirc_mutex_unlock (&session->mutex_dcc);
+		libirc_mutex_unlock (&dcc->mutex);
 		return 1;
 	}
 
-	libirc_dcc_destroy_nolock (session, dccid);
-	libirc_mutex_unlock (&session->mutex_dcc);
+	libirc_dcc_destroy_nolock (dcc);
+	libirc_mutex_unlock (&dcc->mutex);
 	return 0;
 }
 
 
 int	irc_dcc_sendfile (irc_session_t * session, void * ctx, const char * nick, const char * filename, irc_dcc_callback_t callback, irc_dcc_t * dccid)
 {
-	struct sockaddr_in saddr;
-	socklen_t len = sizeof(saddr);
-	char cmdbuf[128], notbuf[128];
 	irc_dcc_session_t * dcc;
 	const char * p;
-	int err;
-	long filesize;
+	int err, queued;
+	irc_dcc_size_t filesize;
+	struct stat st;
 
 	if ( !session || !dccid || !filename || !callback )
 	{
@@ -843,35 +2523,48 @@ int	irc_dcc_sendfile (irc_session_t * session, void * ctx, const char * nick, co
 		return 1;
 	}
 
-	if ( (err = libirc_new_dcc_session (session, 0, 0, LIBIRC_DCC_SENDFILE, ctx, &dcc)) != 0 )
+	if ( (err = libirc_new_dcc_session (session, 0, LIBIRC_DCC_SENDFILE, ctx, &dcc)) != 0 )
 	{
 		session->lasterror = err;
 		return 1;
 	}
 
-	if ( (dcc->dccsend_file_fp = fopen (filename, "rb")) == 0 )
+	dcc->file = libirc_dcc_open_file (session, filename, &dcc->file_fd, &st);
+
+	if ( dcc->file_fd < 0 )
 	{
-		libirc_remove_dcc_session (session, dcc, 1);
+		libirc_mutex_unlock (&dcc->mutex);
+		libirc_remove_dcc_session (session, dcc);
 		session->lasterror = LIBIRC_ERR_OPENFILE;
 		return 1;
 	}
 
 	/* Get file length */
-	if ( fseek (dcc->dccsend_file_fp, 0, SEEK_END)
-	|| (filesize = ftell (dcc->dccsend_file_fp)) == -1
-	|| fseek (dcc->dccsend_file_fp, 0, SEEK_SET) )
+	if ( !dcc->file && fstat (dcc->file_fd, &st) )
 	{
-		libirc_remove_dcc_session (session, dcc, 1);
+		libirc_mutex_unlock (&dcc->mutex);
+		libirc_remove_dcc_session (session, dcc);
 		session->lasterror = LIBIRC_ERR_NODCCSEND;
 		return 1;
 	}
 
-	if ( getsockname (dcc->sock, (struct sockaddr*) &saddr, &len) < 0 )
-	{
-		libirc_remove_dcc_session (session, dcc, 1);
-		session->lasterror = LIBIRC_ERR_SOCKET;
-		return 1;
-	}
+	filesize = st.st_size;
+	dcc->file_size = filesize;
+
+	// There is nothing to wait for when sending an empty file
+	if ( filesize == 0 )
+		dcc->flags |= DCCFL_SEND_EOF;
+
+	// sendfile() blocks while reading the disk, so it is not used when 
+	// the file must be read without blocking the event loop
+	if ( session->options & LIBIRC_OPTION_DCC_ASYNC_IO )
+		dcc->flags |= DCCFL_ASYNC_IO;
+#if defined (LIBIRC_HAVE_SENDFILE)
+	// Regular files are sent directly from the page cache, unless the 
+	// data must pass through the digests
+	else if ( S_ISREG (st.st_mode) && (dcc->flags & (DCCFL_CRC32 | DCCFL_SHA256)) == 0 )
+		dcc->flags |= DCCFL_ZEROCOPY;
+#endif
 
 	// Remove path from the filename
 	if ( (p = strrchr (filename, '\\')) == 0
@@ -880,18 +2573,176 @@ int	irc_dcc_sendfile (irc_session_t * session, void * ctx, const char * nick, co
 	else
 		p++; // skip directory slash
 
-	sprintf (notbuf, "DCC Send %s (%s)", p, inet_ntoa (saddr.sin_addr));
-	sprintf (cmdbuf, "DCC SEND %s %lu %u %ld", p, (unsigned long) ntohl (saddr.sin_addr.s_addr), ntohs (saddr.sin_port), filesize);
+	// With TSEND the receiver does not send the acknowledges back
+	if ( session->options & LIBIRC_OPTION_DCC_TSEND )
+		dcc->flags |= DCCFL_TURBO;
+
+	// Remember whom and what is offered, for DCC RESUME and the queue
+	irc_target_get_nick (nick, dcc->nick, sizeof(dcc->nick));
+	strncpy (dcc->filename, p, sizeof(dcc->filename) - 1);
 
-	if ( irc_cmd_notice (session, nick, notbuf)
-	|| irc_cmd_ctcp_request (session, nick, cmdbuf) )
+	// With the send slots limited, the offer waits for a free slot
+	libirc_mutex_lock (&session->mutex_dcc_limits);
+
+	if ( session->dcc_max_sends || session->dcc_max_sends_per_nick )
 	{
-		libirc_remove_dcc_session (session, dcc, 1);
-		return 1;
+		dcc->state = LIBIRC_STATE_QUEUED;
+		libirc_dcc_queue_changed (session);
 	}
 
+	libirc_mutex_unlock (&session->mutex_dcc_limits);
+
 	*dccid = dcc->id;
 	dcc->cb = callback;
+	queued = dcc->state == LIBIRC_STATE_QUEUED;
+	libirc_mutex_unlock (&dcc->mutex);
+
+	if ( !queued && libirc_dcc_send_offer (session, *dccid) )
+	{
+		libirc_remove_dcc_session (session, dcc);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+void irc_dcc_set_buffer_size (irc_session_t * session, unsigned int size)
+{
+	if ( size < LIBIRC_DCC_BUFFER_SIZE )
+		size = LIBIRC_DCC_BUFFER_SIZE;
+
+	// The pooled buffers have the old size, so they are not usable anymore
+	libirc_mutex_lock (&session->mutex_dcc_pool);
+	libirc_dcc_buffer_pool_free_nolock (session);
+	session->dcc_buffer_size = size;
+	libirc_mutex_unlock (&session->mutex_dcc_pool);
+}
+
+
+void irc_dcc_set_send_slots (irc_session_t * session, unsigned int total, unsigned int per_nick)
+{
+	libirc_mutex_lock (&session->mutex_dcc_limits);
+	session->dcc_max_sends = total;
+	session->dcc_max_sends_per_nick = per_nick;
+
+	// The waiting transfers are started once the limits allow
+	libirc_dcc_queue_changed (session);
+	libirc_mutex_unlock (&session->mutex_dcc_limits);
+}
+
+
+int irc_dcc_set_priority (irc_session_t * session, irc_dcc_t dccid, int priority)
+{
+	irc_dcc_session_t * dcc = libirc_find_dcc_session (session, dccid);
+
+	if ( !dcc )
+		return 1;
+
+	if ( dcc->dccmode != LIBIRC_DCC_SENDFILE )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		libirc_mutex_unlock (&dcc->mutex);
+		return 1;
+	}
+
+	dcc->priority = priority;
+	libirc_mutex_unlock (&dcc->mutex);
+	return 0;
+}
+
+
+int irc_dcc_set_rate_limit (irc_session_t * session, irc_dcc_t dccid, unsigned int rate)
+{
+	irc_dcc_session_t * dcc;
+
+	if ( dccid == 0 )
+	{
+		libirc_mutex_lock (&session->mutex_dcc_limits);
+		libirc_dcc_bucket_set (&session->dcc_rate_limit, rate);
+		libirc_mutex_unlock (&session->mutex_dcc_limits);
+		return 0;
+	}
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return 1;
+
+	libirc_dcc_bucket_set (&dcc->rate_limit, rate);
+	libirc_mutex_unlock (&dcc->mutex);
+	return 0;
+}
+
+
+int irc_dcc_get_stats (irc_session_t * session, irc_dcc_t dccid, irc_dcc_stats_t * stats)
+{
+	irc_dcc_session_t * dcc;
+
+	if ( !stats )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return 1;
 
+	memset (stats, 0, sizeof(irc_dcc_stats_t));
+
+	if ( dcc->dccmode != LIBIRC_DCC_CHAT )
+	{
+		stats->size = dcc->file_size;
+		stats->transferred = libirc_dcc_transferred (dcc);
+		stats->rate = dcc->stats_rate;
+		stats->queue_position = dcc->queue_position;
+
+		if ( stats->rate > 0 && stats->size > stats->transferred )
+			stats->eta = (unsigned int) ((stats->size - stats->transferred + stats->rate - 1) / stats->rate);
+	}
+
+	libirc_mutex_unlock (&dcc->mutex);
+	return 0;
+}
+
+
+int irc_dcc_get_digest (irc_session_t * session, irc_dcc_t dccid, irc_dcc_digest_t * digest)
+{
+	irc_dcc_session_t * dcc;
+
+	if ( !digest )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	if ( (dcc = libirc_find_dcc_session (session, dccid)) == 0 )
+		return 1;
+
+	memset (digest, 0, sizeof(irc_dcc_digest_t));
+	digest->offset = dcc->digest_length ? dcc->digest_offset : libirc_dcc_transferred (dcc);
+	digest->length = dcc->digest_length;
+
+	if ( dcc->flags & DCCFL_CRC32 )
+	{
+		digest->flags |= LIBIRC_OPTION_DCC_CRC32;
+		digest->crc32 = dcc->crc32 ^ 0xFFFFFFFF;
+	}
+
+	if ( dcc->flags & DCCFL_SHA256 )
+	{
+		digest->flags |= LIBIRC_OPTION_DCC_SHA256;
+		libirc_sha256_result (&dcc->sha256, digest->sha256);
+	}
+
+	libirc_mutex_unlock (&dcc->mutex);
 	return 0;
 }
+
+
+void irc_dcc_set_send_window (irc_session_t * session, unsigned int window)
+{
+	// The window must hold at least a single buffer, otherwise nothing is sent
+	if ( window < LIBIRC_DCC_BUFFER_SIZE )
+		window = LIBIRC_DCC_BUFFER_SIZE;
+
+	session->dcc_send_window = window;
+}
@@ -16,14 +16,79 @@
 #define INCLUDE_IRC_DCC_H
 
 
+// DCC flags
+#define DCCFL_TURBO						(0x00000001)	// TSEND: the receiver does not acknowledge
+#define DCCFL_SEND_EOF					(0x00000002)	// the whole file has been read
+#define DCCFL_ACK_PENDING				(0x00000004)	// an acknowledge waits for the output buffer
+#define DCCFL_ZEROCOPY					(0x00000008)	// the file is sent directly with sendfile()
+#define DCCFL_ACK64						(0x00000010)	// the receiver sends 64-bit acknowledges
+#define DCCFL_ACK_DETECTED				(0x00000020)	// the acknowledge size is already known
+#define DCCFL_TO_FILE					(0x00000040)	// the received file is written by the library
+#define DCCFL_CHAT_CR					(0x00000080)	// the last chat line ended with CR, skip the LF
+#define DCCFL_ASYNC_IO					(0x00000100)	// the file is read or written by the I/O thread
+#define DCCFL_PASSIVE					(0x00000200)	// the offer has port 0, the receiver listens
+#define DCCFL_CRC32						(0x00000400)	// the CRC32 of the file data is computed
+#define DCCFL_SHA256					(0x00000800)	// the SHA-256 of the file data is computed
+
+// DCC I/O job states
+#define LIBIRC_DCC_IO_IDLE				0
+#define LIBIRC_DCC_IO_BUSY				1	// queued or running
+#define LIBIRC_DCC_IO_DONE				2	// finished, the result is not taken yet
+
+
+/*
+ * A file read or write passed to the I/O thread, so a slow disk does not 
+ * stall the event loop. Every DCC session has at most one job in flight.
+ */
+typedef struct irc_dcc_io_s
+{
+	struct irc_dcc_io_s	* next;
+	int				state;
+	int				write;		/* write the buffer instead of reading into it */
+	int				orphaned;	/* the DCC session is gone, free the job when done */
+	int				fd;
+	struct irc_dcc_file_s * file;	/* the shared file of fd, released with an orphaned job */
+	char		*	buf;
+	unsigned int	size;		/* buffer size */
+	unsigned int	length;		/* amount to read or write */
+	irc_dcc_size_t	offset;
+	int				result;		/* amount read or written, or -1 on error */
+} irc_dcc_io_t;
+
+
+/*
+ * A file offered by DCC SEND. The concurrent transfers of the same file 
+ * share a single descriptor, which only uses the positional reads, so the
+ * file is opened once and its pages are cached once.
+ */
+typedef struct irc_dcc_file_s
+{
+	struct irc_dcc_file_s	* next;
+	int					fd;
+	unsigned int		refs;
+	unsigned long long	dev;
+	unsigned long long	ino;
+} irc_dcc_file_t;
+
+
+/*
+ * A token bucket for the DCC send rate caps. The tokens accumulate at the
+ * specified rate for up to a second, and every sent byte takes one.
+ */
+typedef struct
+{
+	unsigned int		rate;		/* bytes per second, 0 if unlimited */
+	unsigned int		tokens;
+	unsigned long long	stamp;		/* last refill time, ms */
+} irc_dcc_bucket_t;
+
+
 /*
  * This structure keeps the state of a single DCC connection.
  */
 struct irc_dcc_session_s
 {
-	irc_dcc_session_t	*	next;
-
-	irc_dcc_t		id;
+	irc_dcc_t		id;				/*!< Slot generation and slot index */
 	void		*	ctx;
 	socket_t		sock;		/*!< DCC socket */
 	int				dccmode;	/*!< Boolean value to differ chat vs send 
@@ -32,23 +97,80 @@ struct irc_dcc_session_s
 	                             stripped CRLFs. In file mode, the data
 	                             is sent as-is */
 	int				state;
+	int				flags;
 	time_t			timeout;
 
-	FILE		*	dccsend_file_fp;
-	unsigned int	received_file_size;
-	unsigned int	file_confirm_offset;
+	int				file_fd;				/*!< The file being sent or received, or -1 */
+	irc_dcc_size_t	file_write_offset;		/*!< The file position of incoming_buf */
+	irc_dcc_size_t	file_size;				/*!< Size of the file being sent or received */
+	irc_dcc_size_t	file_confirm_offset;	/*!< Acknowledged (send) or received (recv) amount */
+	irc_dcc_size_t	file_sent_offset;		/*!< Amount of data passed to the socket (send) */
+	irc_dcc_size_t	file_read_offset;		/*!< Amount of data read from the file (send) */
+	irc_dcc_size_t	file_prefetch_offset;	/*!< End of the range asked to read ahead (send) */
+	irc_dcc_file_t *	file;				/*!< The shared file being sent, if any */
+	irc_dcc_io_t *	io;						/*!< The asynchronous file I/O, if used */
+
+	int				priority;				/*!< Send queue priority, higher goes first */
+	unsigned int	queue_seq;				/*!< Send queue order within the priority */
+	unsigned int	queue_position;			/*!< Last reported send queue position */
+	irc_dcc_bucket_t	rate_limit;			/*!< Send rate cap of this transfer */
+
+	unsigned long long	stats_time;			/*!< Time of the last rate sample, ms */
+	irc_dcc_size_t	stats_bytes;			/*!< Amount transferred at stats_time */
+	unsigned int	stats_rate;				/*!< Smoothed transfer rate, bytes per second */
+	unsigned int	send_window;			/*!< Max amount of unacknowledged data in flight */
+
+	irc_dcc_size_t	digest_offset;			/*!< File offset of the first hashed byte */
+	irc_dcc_size_t	digest_length;			/*!< Amount of the file data hashed */
+	unsigned int	crc32;					/*!< Running CRC32, inverted */
+	libirc_sha256_t	sha256;					/*!< Running SHA-256 */
 
-	struct sockaddr_in	remote_addr;
+	struct sockaddr_storage	remote_addr;	/*!< The peer address from the offer */
+	unsigned short	port;					/*!< The port in the DCC SEND offer */
+	unsigned long	token;					/*!< The passive offer token */
+	char			nick[128];				/*!< The peer nick, for DCC RESUME */
+	char			filename[256];			/*!< The offered file name, for DCC RESUME */
 
-	char 			incoming_buf[LIBIRC_DCC_BUFFER_SIZE];
+	unsigned int	buffer_size;			/*!< Size of the file data buffers */
+
+	char 		*	incoming_buf;			/*!< Allocated when first needed */
+	unsigned int	incoming_size;
 	unsigned int	incoming_offset;
 
-	char 			outgoing_buf[LIBIRC_DCC_BUFFER_SIZE];
+	char 		*	outgoing_buf;			/*!< Allocated when first needed */
+	unsigned int	outgoing_size;
 	unsigned int	outgoing_offset;
-	port_mutex_t	mutex_outbuf;
+
+	port_mutex_t	mutex;			/*!< Protects everything in this session */
 
 	irc_dcc_callback_t		cb;
 };
 
 
+/*
+ * An entry of the DCC session table. The generation changes every time
+ * the slot is freed, so the ids of the destroyed sessions never match the
+ * new ones in the same slot.
+ */
+typedef struct
+{
+	irc_dcc_session_t *	dcc;
+	unsigned int		generation;
+	unsigned int		next_free;	/* next free slot index plus 1, or 0 */
+} irc_dcc_slot_t;
+
+
+/*
+ * A DCC SEND in the scheduler: a queued one waiting for a slot, or an
+ * active one taking a slot.
+ */
+typedef struct
+{
+	irc_dcc_t			id;
+	int					priority;
+	unsigned int		seq;
+	char				nick[128];
+} irc_dcc_queue_entry_t;
+
+
 #endif /* INCLUDE_IRC_DCC_H */
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ */
+
+/*
+ * Asynchronous DCC file I/O. The DCC sessions with LIBIRC_OPTION_DCC_ASYNC_IO
+ * pass their file reads and writes to a single I/O thread per IRC session,
+ * which is started when first needed. When a job is done, the thread wakes
+ * up the event loop through a pipe, and the loop takes the result the next
+ * time it adds the descriptors. So the loop only sees the ready buffers, and
+ * a slow disk cannot delay the IRC traffic.
+ *
+ * Without the thread support the jobs are simply done in place.
+ *
+ * The files offered by DCC SEND, shared by the transfers, are kept here
+ * too, as the I/O thread closes the files of the orphaned jobs.
+ */
+
+/*
+ * Opens the file to send. If it is already being sent, the descriptor of 
+ * the other transfers is shared; the files are matched by the device and 
+ * inode, so different paths to the same file match too. Returns the shared
+ * file with a reference taken, or 0 if the file has no identity to match 
+ * (as on Windows), and the descriptor is the caller's own.
+ */
+static irc_dcc_file_t * libirc_dcc_open_file (irc_session_t * session, const char * filename, int * fd, struct stat * st)
+{
+	irc_dcc_file_t * file;
+
+	if ( (*fd = open (filename, O_RDONLY | O_BINARY)) < 0 )
+		return 0;
+
+	if ( fstat (*fd, st) || st->st_ino == 0 )
+		return 0;
+
+	libirc_mutex_lock (&session->mutex_dcc_files);
+
+	for ( file = session->dcc_files; file; file = file->next )
+	{
+		if ( file->dev == (unsigned long long) st->st_dev
+		&& file->ino == (unsigned long long) st->st_ino )
+			break;
+	}
+
+	if ( file )
+	{
+		close (*fd);
+		*fd = file->fd;
+		file->refs++;
+	}
+	else if ( (file = malloc (sizeof(irc_dcc_file_t))) != 0 )
+	{
+		file->fd = *fd;
+		file->refs = 1;
+		file->dev = st->st_dev;
+		file->ino = st->st_ino;
+		file->next = session->dcc_files;
+		session->dcc_files = file;
+
+		libirc_file_advise_sequential (*fd);
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc_files);
+	return file;
+}
+
+
+/*
+ * Drops the reference to the shared file, and closes it after the last one.
+ */
+static void libirc_dcc_close_file (irc_session_t * session, irc_dcc_file_t * file)
+{
+	irc_dcc_file_t ** prev;
+
+	libirc_mutex_lock (&session->mutex_dcc_files);
+
+	if ( --file->refs == 0 )
+	{
+		for ( prev = &session->dcc_files; *prev != file; prev = &(*prev)->next )
+			;
+
+		*prev = file->next;
+		close (file->fd);
+		free (file);
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc_files);
+}
+
+
+static void libirc_dcc_io_run (irc_dcc_io_t * io)
+{
+	if ( io->write )
+		io->result = libirc_file_write_at (io->fd, io->buf, io->length, io->offset) ? -1 : (int) io->length;
+	else
+		io->result = libirc_file_read_at (io->fd, io->buf, io->length, io->offset);
+}
+
+
+#if defined (LIBIRC_HAVE_DCC_IO_THREAD)
+/*
+ * Frees an orphaned job, and closes its file: the reference to the shared
+ * file, or the descriptor of its own.
+ */
+static void libirc_dcc_io_free (irc_session_t * session, irc_dcc_io_t * io)
+{
+	if ( io->file )
+		libirc_dcc_close_file (session, io->file);
+	else if ( io->fd >= 0 )
+		close (io->fd);
+
+	if ( io->buf )
+		free (io->buf);
+
+	free (io);
+}
+
+
+static void * libirc_dcc_io_thread (void * arg)
+{
+	irc_session_t * session = (irc_session_t *) arg;
+	irc_dcc_io_t * io;
+
+	libirc_mutex_lock (&session->mutex_dcc_io);
+
+	while ( 1 )
+	{
+		while ( !session->dcc_io_queue && !session->dcc_io_stop )
+			pthread_cond_wait (&session->dcc_io_cond, &session->mutex_dcc_io);
+
+		// The queued jobs are finished even when stopping
+		if ( (io = session->dcc_io_queue) == 0 )
+			break;
+
+		if ( (session->dcc_io_queue = io->next) == 0 )
+			session->dcc_io_queue_tail = 0;
+
+		libirc_mutex_unlock (&session->mutex_dcc_io);
+		libirc_dcc_io_run (io);
+		libirc_mutex_lock (&session->mutex_dcc_io);
+
+		if ( io->orphaned )
+		{
+			libirc_mutex_unlock (&session->mutex_dcc_io);
+			libirc_dcc_io_free (session, io);
+			libirc_mutex_lock (&session->mutex_dcc_io);
+		}
+		else
+		{
+			io->state = LIBIRC_DCC_IO_DONE;
+
+			// If the pipe is full (EAGAIN), the loop is going to wake up anyway
+			while ( write (session->dcc_io_pipe[1], "", 1) < 0 && errno == EINTR )
+				;
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc_io);
+	return 0;
+}
+
+
+/*
+ * Starts the I/O thread. Must be called with the queue locked.
+ */
+static int libirc_dcc_io_start (irc_session_t * session)
+{
+	if ( pipe (session->dcc_io_pipe) )
+		return LIBIRC_ERR_NOMEM;
+
+	fcntl (session->dcc_io_pipe[0], F_SETFL, fcntl (session->dcc_io_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl (session->dcc_io_pipe[1], F_SETFL, fcntl (session->dcc_io_pipe[1], F_GETFL) | O_NONBLOCK);
+
+	if ( pthread_cond_init (&session->dcc_io_cond, 0) )
+	{
+		close (session->dcc_io_pipe[0]);
+		close (session->dcc_io_pipe[1]);
+		return LIBIRC_ERR_NOMEM;
+	}
+
+	if ( pthread_create (&session->dcc_io_thread, 0, libirc_dcc_io_thread, session) )
+	{
+		pthread_cond_destroy (&session->dcc_io_cond);
+		close (session->dcc_io_pipe[0]);
+		close (session->dcc_io_pipe[1]);
+		return LIBIRC_ERR_NOMEM;
+	}
+
+	session->dcc_io_started = 1;
+	return 0;
+}
+#endif
+
+
+/*
+ * Queues the job for the I/O thread. The job and its buffer must not be
+ * touched until libirc_dcc_io_state() reports it done.
+ */
+static int libirc_dcc_io_submit (irc_session_t * session, irc_dcc_io_t * io)
+{
+#if defined (LIBIRC_HAVE_DCC_IO_THREAD)
+	libirc_mutex_lock (&session->mutex_dcc_io);
+
+	if ( !session->dcc_io_started )
+	{
+		int err = libirc_dcc_io_start (session);
+
+		if ( err )
+		{
+			libirc_mutex_unlock (&session->mutex_dcc_io);
+			return err;
+		}
+	}
+
+	io->next = 0;
+	io->state = LIBIRC_DCC_IO_BUSY;
+
+	if ( session->dcc_io_queue_tail )
+		session->dcc_io_queue_tail->next = io;
+	else
+		session->dcc_io_queue = io;
+
+	session->dcc_io_queue_tail = io;
+
+	pthread_cond_signal (&session->dcc_io_cond);
+	libirc_mutex_unlock (&session->mutex_dcc_io);
+#else
+	libirc_dcc_io_run (io);
+	io->state = LIBIRC_DCC_IO_DONE;
+#endif
+
+	return 0;
+}
+
+
+static int libirc_dcc_io_state (irc_session_t * session, irc_dcc_io_t * io)
+{
+	int state;
+
+	libirc_mutex_lock (&session->mutex_dcc_io);
+	state = io->state;
+	libirc_mutex_unlock (&session->mutex_dcc_io);
+
+	return state;
+}
+
+
+/*
+ * Detaches the job in flight from the DCC session being removed. It cannot
+ * be cancelled, so the job takes over its descriptor, or the reference to
+ * the shared file if any, and is freed by the I/O thread when done; the 
+ * event loop does not wait for it. The descriptor the job uses stays open
+ * until then. Returns 0 if the job is not in flight, and could be freed 
+ * right away.
+ */
+static int libirc_dcc_io_orphan (irc_session_t * session, irc_dcc_io_t * io, irc_dcc_file_t * file)
+{
+	int orphaned = 0;
+
+	libirc_mutex_lock (&session->mutex_dcc_io);
+
+	if ( io->state == LIBIRC_DCC_IO_BUSY )
+	{
+		io->orphaned = orphaned = 1;
+		io->file = file;
+	}
+
+	libirc_mutex_unlock (&session->mutex_dcc_io);
+	return orphaned;
+}
+
+
+/*
+ * Stops the I/O thread after it finishes all the queued jobs.
+ */
+static void libirc_dcc_io_stop (irc_session_t * session)
+{
+#if defined (LIBIRC_HAVE_DCC_IO_THREAD)
+	if ( !session->dcc_io_started )
+		return;
+
+	libirc_mutex_lock (&session->mutex_dcc_io);
+	session->dcc_io_stop = 1;
+	pthread_cond_signal (&session->dcc_io_cond);
+	libirc_mutex_unlock (&session->mutex_dcc_io);
+
+	pthread_join (session->dcc_io_thread, 0);
+	pthread_cond_destroy (&session->dcc_io_cond);
+
+	close (session->dcc_io_pipe[0]);
+	close (session->dcc_io_pipe[1]);
+	session->dcc_io_started = 0;
+#endif
+}
+
+
+static void libirc_dcc_io_add_descriptors (irc_session_t * session, fd_set *in_set, int * maxfd)
+{
+#if defined (LIBIRC_HAVE_DCC_IO_THREAD)
+	if ( session->dcc_io_started )
+		libirc_add_to_set (session->dcc_io_pipe[0], in_set, maxfd);
+#endif
+}
+
+
+static void libirc_dcc_io_process_descriptors (irc_session_t * session, fd_set *in_set)
+{
+#if defined (LIBIRC_HAVE_DCC_IO_THREAD)
+	char buf[64];
+
+	// Only wakes up the loop; the results are taken while adding descriptors
+	if ( session->dcc_io_started && FD_ISSET (session->dcc_io_pipe[0], in_set) )
+	{
+		while ( read (session->dcc_io_pipe[0], buf, sizeof(buf)) > 0 )
+			;
+	}
+#endif
+}
@@ -0,0 +1,39 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_DIGEST_H
+#define INCLUDE_IRC_DIGEST_H
+
+
+#define LIBIRC_SHA256_SIZE			32
+
+
+/*
+ * A running SHA-256 digest. With OpenSSL its implementation is used, which
+ * takes advantage of the CPU SHA extensions; otherwise the digest is 
+ * computed by the library itself.
+ */
+typedef struct
+{
+#if defined (ENABLE_SSL)
+	EVP_MD_CTX		*	ctx;
+#else
+	unsigned int		state[8];
+	unsigned long long	length;			/* amount hashed, bytes */
+	unsigned char		block[64];		/* the incomplete block */
+#endif
+} libirc_sha256_t;
+
+
+#endif /* INCLUDE_IRC_DIGEST_H */
@@ -35,6 +35,7 @@ static const char * libirc_strerror[LIBIRC_ERR_MAX] =
 	"SSL initialization failed",
 	"SSL connection failed",
 	"SSL certificate verify failed",
+	"SASL authentication failed",
 };
 
 
@@ -0,0 +1,399 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * Applies the CASEMAPPING. Our nick and the tracked names are folded again
+ * if it changes, which only happens if the server sends RPL_ISUPPORT after
+ * we joined the channels.
+ */
+static void libirc_set_casemapping (irc_session_t * session, const char * casemapping)
+{
+	unsigned char upper;
+	size_t i;
+
+	if ( !strcmp (casemapping, "ascii") )
+		upper = 'Z';
+	else if ( !strcmp (casemapping, "strict-rfc1459") )
+		upper = ']';
+	else
+		upper = '^';
+
+	if ( upper == session->isupport.casemap_upper )
+		return;
+
+	session->isupport.casemap_upper = upper;
+
+	for ( i = 0; session->nick && i < session->nick_length; i++ )
+		session->nick_folded[i] = libirc_casefold (session, session->nick[i]);
+
+	libirc_state_rehash (session);
+	libirc_monitor_rehash (session);
+}
+
+
+/*
+ * Forgets the server features, and restores the defaults. Called when the
+ * session is created, connected and destroyed.
+ */
+static void libirc_isupport_reset (irc_session_t * session)
+{
+	irc_isupport_t * isupport = &session->isupport;
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	while ( isupport->tokens )
+	{
+		irc_isupport_token_t * token = isupport->tokens;
+		isupport->tokens = token->next;
+		free (token);
+	}
+
+	isupport->limits[LIBIRC_LIMIT_LINELEN] = 512;
+	isupport->limits[LIBIRC_LIMIT_NICKLEN] = 9;
+	isupport->limits[LIBIRC_LIMIT_MODES] = 3;
+	isupport->limits[LIBIRC_LIMIT_MAXTARGETS] = 1;
+	isupport->limits[LIBIRC_LIMIT_MONITOR] = -1;
+	isupport->targmax_count = 0;
+	isupport->casemap_upper = '^';
+	strcpy (isupport->chantypes, "#&+!");
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+
+	libirc_mutex_lock (&session->mutex_state);
+	libirc_state_init (session);
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+/*
+ * Decodes the \xHH escapes of the token value in place.
+ */
+static void libirc_isupport_unescape (char * value)
+{
+	char * out = value;
+
+	for ( ; *value; value++ )
+	{
+		if ( value[0] == '\\' && value[1] == 'x' && isxdigit ((unsigned char) value[2]) && isxdigit ((unsigned char) value[3]) )
+		{
+			char hex[3] = { value[2], value[3], '\0' };
+
+			*out++ = (char) strtol (hex, 0, 16);
+			value += 3;
+		}
+		else
+			*out++ = *value;
+	}
+
+	*out = '\0';
+}
+
+
+/*
+ * A limit value; no value means there is no limit.
+ */
+static int libirc_isupport_number (const char * value)
+{
+	return value && *value ? atoi (value) : 0;
+}
+
+
+static void libirc_isupport_prefix (irc_session_t * session, const char * value)
+{
+	irc_state_t * tracker = &session->tracker;
+	const char * end;
+	size_t count;
+
+	// PREFIX=(ov)@+, or an empty value if there are no prefixes
+	if ( value[0] != '(' || (end = strchr (value, ')')) == 0 )
+	{
+		tracker->prefix_modes[0] = tracker->prefix_symbols[0] = '\0';
+		return;
+	}
+
+	count = end - value - 1;
+
+	if ( count > strlen (end + 1) )
+		count = strlen (end + 1);
+
+	if ( count > sizeof(tracker->prefix_modes) - 1 )
+		count = sizeof(tracker->prefix_modes) - 1;
+
+	memcpy (tracker->prefix_modes, value + 1, count);
+	tracker->prefix_modes[count] = '\0';
+	memcpy (tracker->prefix_symbols, end + 1, count);
+	tracker->prefix_symbols[count] = '\0';
+}
+
+
+static void libirc_isupport_chanmodes (irc_session_t * session, const char * value)
+{
+	irc_state_t * tracker = &session->tracker;
+	const char * lists[3] = { "", "", "" };
+	size_t lengths[3] = { 0, 0, 0 };
+	unsigned int i;
+
+	// CHANMODES=A,B,C,D: the lists and the modes always with a parameter go
+	// together, then the modes with a parameter only when set
+	for ( i = 0; i < 3; i++ )
+	{
+		lists[i] = value;
+		lengths[i] = strcspn (value, ",");
+
+		if ( value[lengths[i]] != ',' )
+			break;
+
+		value += lengths[i] + 1;
+	}
+
+	if ( lengths[0] + lengths[1] > sizeof(tracker->chanmodes_always) - 1 )
+		lengths[0] = lengths[1] = 0;
+
+	if ( lengths[2] > sizeof(tracker->chanmodes_set) - 1 )
+		lengths[2] = 0;
+
+	memcpy (tracker->chanmodes_always, lists[0], lengths[0]);
+	memcpy (tracker->chanmodes_always + lengths[0], lists[1], lengths[1]);
+	tracker->chanmodes_always[lengths[0] + lengths[1]] = '\0';
+	memcpy (tracker->chanmodes_set, lists[2], lengths[2]);
+	tracker->chanmodes_set[lengths[2]] = '\0';
+}
+
+
+static void libirc_isupport_targmax (irc_session_t * session, const char * value)
+{
+	irc_isupport_t * isupport = &session->isupport;
+
+	// TARGMAX=PRIVMSG:4,NOTICE:4,JOIN:
+	for ( isupport->targmax_count = 0; *value && isupport->targmax_count < LIBIRC_ISUPPORT_MAX_TARGMAX; )
+	{
+		irc_isupport_targmax_t * entry = isupport->targmax + isupport->targmax_count;
+		size_t len = strcspn (value, ":,");
+
+		if ( value[len] == ':' && len < sizeof(entry->command) )
+		{
+			memcpy (entry->command, value, len);
+			entry->command[len] = '\0';
+			entry->max = libirc_isupport_number (value + len + 1);
+			isupport->targmax_count++;
+		}
+
+		value += strcspn (value, ",");
+
+		if ( *value == ',' )
+			value++;
+	}
+}
+
+
+/*
+ * Applies a token to the typed features. The value is 0 if the server
+ * negated the token, which restores the default.
+ */
+static void libirc_isupport_apply (irc_session_t * session, const char * name, const char * value)
+{
+	irc_isupport_t * isupport = &session->isupport;
+
+	if ( !strcmp (name, "CASEMAPPING") )
+		libirc_set_casemapping (session, value ? value : "rfc1459");
+	else if ( !strcmp (name, "CHANTYPES") )
+	{
+		const char * chantypes = value ? value : "#&+!";
+		size_t len = strlen (chantypes);
+
+		if ( len > sizeof(isupport->chantypes) - 1 )
+			len = sizeof(isupport->chantypes) - 1;
+
+		memcpy (isupport->chantypes, chantypes, len);
+		isupport->chantypes[len] = '\0';
+	}
+	else if ( !strcmp (name, "PREFIX") || !strcmp (name, "CHANMODES") )
+	{
+		libirc_mutex_lock (&session->mutex_state);
+
+		if ( name[0] == 'P' )
+			libirc_isupport_prefix (session, value ? value : "(ov)@+");
+		else
+			libirc_isupport_chanmodes (session, value ? value : "b,k,l,");
+
+		libirc_mutex_unlock (&session->mutex_state);
+	}
+	else if ( !strcmp (name, "TARGMAX") )
+	{
+		libirc_mutex_lock (&session->mutex_isupport);
+		libirc_isupport_targmax (session, value ? value : "");
+		libirc_mutex_unlock (&session->mutex_isupport);
+	}
+	else if ( !strcmp (name, "LINELEN") )
+		isupport->limits[LIBIRC_LIMIT_LINELEN] = value && atoi (value) >= 512 ? atoi (value) : 512;
+	else if ( !strcmp (name, "NICKLEN") )
+		isupport->limits[LIBIRC_LIMIT_NICKLEN] = value ? libirc_isupport_number (value) : 9;
+	else if ( !strcmp (name, "MODES") )
+		isupport->limits[LIBIRC_LIMIT_MODES] = value ? libirc_isupport_number (value) : 3;
+	else if ( !strcmp (name, "MAXTARGETS") )
+		isupport->limits[LIBIRC_LIMIT_MAXTARGETS] = value ? libirc_isupport_number (value) : 1;
+	else if ( !strcmp (name, "MONITOR") )
+		isupport->limits[LIBIRC_LIMIT_MONITOR] = value ? libirc_isupport_number (value) : -1;
+}
+
+
+/*
+ * RPL_ISUPPORT: our nick, the tokens, and the "are supported" text. The
+ * server could send it again later to change or negate the tokens.
+ */
+static void libirc_isupport_parse (irc_session_t * session, const char ** params, unsigned int count)
+{
+	unsigned int i;
+
+	for ( i = 1; i + 1 < count; i++ )
+	{
+		const char * param = params[i];
+		size_t namelen = strcspn (param + (param[0] == '-'), "=") + (param[0] == '-');
+		irc_isupport_token_t ** t, * token = 0;
+
+		if ( namelen == 0 || (param[0] == '-' && namelen == 1) )
+			continue;
+
+		if ( param[0] != '-' )
+		{
+			if ( (token = malloc (offsetof(irc_isupport_token_t, name) + strlen (param) + 1)) == 0 )
+				continue;
+
+			strcpy (token->name, param);
+
+			if ( token->name[namelen] == '=' )
+			{
+				token->name[namelen] = '\0';
+				token->value = token->name + namelen + 1;
+				libirc_isupport_unescape (token->value);
+			}
+			else
+				token->value = token->name + namelen;
+		}
+
+		// The token replaces the old one with the same name, if any
+		libirc_mutex_lock (&session->mutex_isupport);
+
+		for ( t = &session->isupport.tokens; *t; t = &(*t)->next )
+		{
+			const char * name = token ? token->name : param + 1;
+
+			if ( !strcmp ((*t)->name, name) )
+			{
+				irc_isupport_token_t * old = *t;
+				*t = old->next;
+				free (old);
+				break;
+			}
+		}
+
+		if ( token )
+		{
+			token->next = session->isupport.tokens;
+			session->isupport.tokens = token;
+		}
+
+		libirc_mutex_unlock (&session->mutex_isupport);
+
+		if ( token )
+			libirc_isupport_apply (session, token->name, token->value);
+		else
+			libirc_isupport_apply (session, param + 1, 0);
+	}
+}
+
+
+int irc_server_limit (irc_session_t * session, unsigned int limit)
+{
+	if ( limit >= LIBIRC_LIMIT_MAX )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return -1;
+	}
+
+	return session->isupport.limits[limit];
+}
+
+
+int irc_server_targmax (irc_session_t * session, const char * command)
+{
+	int max = -1;
+	unsigned int i;
+
+	if ( !command )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return -1;
+	}
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	for ( i = 0; i < session->isupport.targmax_count; i++ )
+		if ( !strcasecmp (session->isupport.targmax[i].command, command) )
+		{
+			max = session->isupport.targmax[i].max;
+			break;
+		}
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+
+	// Not listed: the messages follow MAXTARGETS, MONITOR is only limited
+	// by its list, and the rest take one target
+	if ( max < 0 && !strcasecmp (command, "MONITOR") )
+		max = 0;
+	else if ( max < 0 )
+		max = !strcasecmp (command, "PRIVMSG") || !strcasecmp (command, "NOTICE")
+			? session->isupport.limits[LIBIRC_LIMIT_MAXTARGETS] : 1;
+
+	return max;
+}
+
+
+int irc_server_feature (irc_session_t * session, const char * name, char * value, size_t size)
+{
+	irc_isupport_token_t * token;
+
+	if ( !name )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	for ( token = session->isupport.tokens; token; token = token->next )
+		if ( !strcmp (token->name, name) )
+			break;
+
+	if ( token && value && size > 0 )
+	{
+		size_t len = strlen (token->value);
+
+		if ( len > size - 1 )
+			len = size - 1;
+
+		memcpy (value, token->value, len);
+		value[len] = '\0';
+	}
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+
+	if ( !token )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,60 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_ISUPPORT_H
+#define INCLUDE_IRC_ISUPPORT_H
+
+
+#define LIBIRC_ISUPPORT_MAX_TARGMAX		16
+
+
+/*
+ * An RPL_ISUPPORT token as the server sent it, with the value unescaped.
+ * The tokens are kept for irc_server_feature().
+ */
+typedef struct irc_isupport_token_s
+{
+	struct irc_isupport_token_s	* next;
+	char				  *	value;		/* points after the '=' in name, or to "" */
+	char					name[1];
+} irc_isupport_token_t;
+
+
+typedef struct
+{
+	char			command[16];
+	int				max;			/* 0 if no limit */
+} irc_isupport_targmax_t;
+
+
+/*
+ * The server features of RPL_ISUPPORT, parsed into the types the library
+ * uses, with the defaults of RFC 1459 until the server sends them. The 
+ * prefixes and the channel modes go to the state tracker.
+ */
+typedef struct
+{
+	irc_isupport_token_t *	tokens;
+
+	int				limits[LIBIRC_LIMIT_MAX];	/* by the LIBIRC_LIMIT_* index */
+	irc_isupport_targmax_t	targmax[LIBIRC_ISUPPORT_MAX_TARGMAX];
+	unsigned int	targmax_count;
+	int				has_targmax;
+
+	unsigned char	casemap_upper;		/* the last letter folded by the CASEMAPPING */
+	char			chantypes[16];		/* the channel name prefixes */
+} irc_isupport_t;
+
+
+#endif /* INCLUDE_IRC_ISUPPORT_H */
@@ -23,6 +23,17 @@
 #include "utils.c"
 #include "errors.c"
 #include "colors.c"
+#include "state.c"
+#include "monitor.c"
+#include "replies.c"
+#include "isupport.c"
+#include "digest.c"
+#include "sasl.c"
+#include "caps.c"
+#include "queries.c"
+#include "batch.c"
+#include "netsplit.c"
+#include "dccio.c"
 #include "dcc.c"
 #include "ssl.c"
 
@@ -70,14 +81,24 @@ irc_session_t * irc_create_session (irc_callbacks_t	* callbacks)
 	session->sock = -1;
 
 	if ( libirc_mutex_init (&session->mutex_session)
-	|| libirc_mutex_init (&session->mutex_dcc) )
+	|| libirc_mutex_init (&session->mutex_dcc)
+	|| libirc_mutex_init (&session->mutex_dcc_pool)
+	|| libirc_mutex_init (&session->mutex_dcc_files)
+	|| libirc_mutex_init (&session->mutex_dcc_io)
+	|| libirc_mutex_init (&session->mutex_dcc_limits)
+	|| libirc_mutex_init (&session->mutex_state)
+	|| libirc_mutex_init (&session->mutex_isupport)
+	|| libirc_mutex_init (&session->mutex_monitor)
+	|| libirc_mutex_init (&session->mutex_query) )
 	{
 		free (session);
 		return 0;
 	}
 
-	session->dcc_last_id = 1;
 	session->dcc_timeout = 60;
+	session->dcc_send_window = LIBIRC_DCC_SEND_WINDOW;
+	session->dcc_buffer_size = LIBIRC_DCC_FILE_BUFFER_SIZE;
+	libirc_isupport_reset (session);
 
 	memcpy (&session->callbacks, callbacks, sizeof(irc_callbacks_t));
 
@@ -107,12 +128,16 @@ static void free_ircsession_strings (irc_session_t * session)
 	session->realname = 0;
 	session->username = 0;
 	session->nick = 0;
+	session->nick_folded = 0;
+	session->nick_length = 0;
 	session->server = 0;
 	session->server_password = 0;
 }
 
 void irc_destroy_session (irc_session_t * session)
 {
+	unsigned int i;
+
 	free_ircsession_strings( session );
 
 	// The CTCP VERSION must be freed only now
@@ -129,16 +154,52 @@ void irc_destroy_session (irc_session_t * session)
 #if defined (ENABLE_SSL)
 	if ( session->ssl )
 		SSL_free( session->ssl );
+
+	free (session->ssl_cert);
+	free (session->ssl_key);
 #endif
 	
 	/* 
 	 * delete DCC data 
-	 * libirc_remove_dcc_session removes the DCC session from the list.
+	 * libirc_remove_dcc_session removes the DCC session from the table.
 	 */
-	while ( session->dcc_sessions )
-		libirc_remove_dcc_session (session, session->dcc_sessions, 0);
+	for ( i = 0; i < session->dcc_slots_count; i++ )
+	{
+		if ( session->dcc_slots[i].dcc )
+			libirc_remove_dcc_session (session, session->dcc_slots[i].dcc);
+	}
+
+	if ( session->dcc_slots )
+		free (session->dcc_slots);
+
+	free (session->dcc_schedule_queue);
+	free (session->dcc_schedule_active);
+
+	// The jobs of the removed sessions are finished by the I/O thread
+	libirc_dcc_io_stop (session);
+	libirc_dcc_buffer_pool_free (session);
 
 	libirc_mutex_destroy (&session->mutex_dcc);
+	libirc_mutex_destroy (&session->mutex_dcc_pool);
+	libirc_mutex_destroy (&session->mutex_dcc_files);
+	libirc_mutex_destroy (&session->mutex_dcc_io);
+	libirc_mutex_destroy (&session->mutex_dcc_limits);
+
+	libirc_isupport_reset (session);
+	libirc_cap_reset (session);
+	libirc_sasl_forget (&session->sasl);
+	free (session->cap_wanted);
+	libirc_mutex_destroy (&session->mutex_isupport);
+	libirc_state_free (session);
+	libirc_mutex_destroy (&session->mutex_state);
+	libirc_monitor_free (session);
+	libirc_mutex_destroy (&session->mutex_monitor);
+	libirc_query_abort (session, LIBIRC_ERR_CLOSED);
+	libirc_mutex_destroy (&session->mutex_query);
+	libirc_batch_clear (session);
+	libirc_netsplit_clear (session);
+	libirc_reply_clear (session);
+	free (session->reply_spare);
 
 	free (session);
     
@@ -175,6 +236,14 @@ int irc_connect (irc_session_t * session,
 
 	// Free the strings if defined; may be the case when the session is reused after the connection fails
 	free_ircsession_strings( session );
+	libirc_state_clear (session);
+	libirc_isupport_reset (session);
+	libirc_cap_reset (session);
+	libirc_monitor_reset (session);
+	libirc_reply_clear (session);
+	libirc_query_abort (session, LIBIRC_ERR_CLOSED);
+	libirc_batch_clear (session);
+	libirc_netsplit_clear (session);
 
 	// Handle the server # prefix (SSL)
 	if ( server[0] == SSL_PREFIX )
@@ -197,7 +266,7 @@ int irc_connect (irc_session_t * session,
 	if ( realname )
 		session->realname = strdup (realname);
 
-	session->nick = strdup (nick);
+	libirc_set_nick (session, nick);
 	session->server = strdup (server);
 
 	// If port number is zero and server contains the port, parse it
@@ -306,6 +375,14 @@ int irc_connect6 (irc_session_t * session,
 
 	// Free the strings if defined; may be the case when the session is reused after the connection fails
 	free_ircsession_strings( session );
+	libirc_state_clear (session);
+	libirc_isupport_reset (session);
+	libirc_cap_reset (session);
+	libirc_monitor_reset (session);
+	libirc_reply_clear (session);
+	libirc_query_abort (session, LIBIRC_ERR_CLOSED);
+	libirc_batch_clear (session);
+	libirc_netsplit_clear (session);
 
 	// Handle the server # prefix (SSL)
 	if ( server[0] == SSL_PREFIX )
@@ -328,7 +405,7 @@ int irc_connect6 (irc_session_t * session,
 	if ( realname )
 		session->realname = strdup (realname);
 
-	session->nick = strdup (nick);
+	libirc_set_nick (session, nick);
 	session->server = strdup (server);
 
 	// If port number is zero and server contains the port, parse it
@@ -523,9 +600,10 @@ int irc_add_select_descriptors (irc_session_t * session, fd_set *in_set, fd_set
 
 static void libirc_process_incoming_data (irc_session_t * session, size_t process_length)
 {
-	#define MAX_PARAMS_ALLOWED 10
-	char buf[2*512], *p, *s;
+	#define MAX_PARAMS_ALLOWED 15
+	char buf[LIBIRC_LINE_SIZE], *p, *s;
 	const char * command = 0, *prefix = 0, *params[MAX_PARAMS_ALLOWED+1];
+	const char * userhost = 0, * tags = 0;
 	int code = 0, paramindex = 0;
     char *buf_end = buf + process_length;
 
@@ -551,25 +629,41 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 	 *                   NUL or CR or LF>
  	 */
 
+	// Parse the IRCv3 message tags, which are kept for irc_message_tag()
+	if ( p[0] == '@' )
+	{
+		tags = p + 1;
+
+		while ( *p && *p != ' ')
+			p++;
+
+		if ( *p )
+			*p++ = '\0';
+	}
+
 	// Parse <prefix>
-	if ( buf[0] == ':' )
+	if ( p[0] == ':' )
 	{
+		// we skip the leading colon
+		prefix = s = p + 1;
+
 		while ( *p && *p != ' ')
 			p++;
 
 		*p++ = '\0';
 
-		// we use buf+1 to skip the leading colon
-		prefix = buf + 1;
-
 		// If LIBIRC_OPTION_STRIPNICKS is set, we should 'clean up' nick 
 		// right here
 		if ( session->options & LIBIRC_OPTION_STRIPNICKS )
 		{
-			for ( s = buf + 1; *s; s++ )
+			for ( ; *s; s++ )
 			{
 				if ( *s == '@' || *s == '!' )
 				{
+					// The tracker still needs the user@host
+					if ( *s == '!' )
+						userhost = s + 1;
+
 					*s = '\0';
 					break;
 				}
@@ -626,19 +720,52 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 	}
 
 	// and dump
+	session->message_tags = tags;
+
+	// The messages of a batch are delivered together when it ends
+	if ( tags && libirc_batch_message (session, code, command, prefix, userhost, params, paramindex) )
+	{
+		session->message_tags = 0;
+		return;
+	}
+
 	if ( code )
 	{
 		// We use SESSIONFL_MOTD_RECEIVED flag to check whether it is the first
 		// RPL_ENDOFMOTD or ERR_NOMOTD after the connection.
+		// The registration is complete, whatever happened to the negotiation
+		if ( code == 1 )
+			session->flags &= ~SESSIONFL_CAP_NEGOTIATING;
+
+		// The server tells the nick it knows us by, which may be truncated
+		if ( code == 1 && paramindex > 0 && (!session->nick || strcmp (params[0], session->nick)) )
+			libirc_set_nick (session, params[0]);
+
+		if ( code == 5 )
+			libirc_isupport_parse (session, params, paramindex);
+
+		// The SASL result lets the negotiation end
+		if ( code >= 902 && code <= 907 && libirc_sasl_numeric (session, code) )
+			libirc_cap_end (session);
+
 		if ( (code == 1 || code == 376 || code == 422) && !(session->flags & SESSIONFL_MOTD_RECEIVED ) )
 		{
 			session->flags |= SESSIONFL_MOTD_RECEIVED;
 
+			// The application learns here that it is not authenticated
+			if ( session->sasl.mechanism && session->sasl.state != SASL_SUCCEEDED )
+				session->lasterror = LIBIRC_ERR_AUTH;
+
 			if ( session->callbacks.event_connect )
 				(*session->callbacks.event_connect) (session, "CONNECT", prefix, params, paramindex);
 		}
 
-		if ( session->callbacks.event_numeric )
+		libirc_state_numeric (session, code, params, paramindex);
+		libirc_monitor_numeric (session, code, params, paramindex);
+
+		if ( !libirc_query_numeric (session, code, params, paramindex)
+		&& !libirc_reply_numeric (session, code, params, paramindex)
+		&& session->callbacks.event_numeric )
 			(*session->callbacks.event_numeric) (session, code, prefix, params, paramindex);
 	}
 	else
@@ -648,37 +775,44 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 			/*
 			 * If we're changed our nick, we should save it.
              */
-			char nickbuf[256];
+			if ( prefix && paramindex > 0 && libirc_is_me_n (session, prefix, strcspn (prefix, "!@")) )
+				libirc_set_nick (session, params[0]);
 
-			irc_target_get_nick (prefix, nickbuf, sizeof(nickbuf));
-
-			if ( !strncmp (nickbuf, session->nick, strlen(session->nick)) && paramindex > 0 )
-			{
-				free (session->nick);
-				session->nick = strdup (params[0]);
-			}
+			libirc_state_nick (session, prefix, params, paramindex);
 
 			if ( session->callbacks.event_nick )
 				(*session->callbacks.event_nick) (session, command, prefix, params, paramindex);
 		}
 		else if ( !strncmp (command, "QUIT", buf_end - command) )
 		{
-			if ( session->callbacks.event_quit )
-				(*session->callbacks.event_quit) (session, command, prefix, params, paramindex);
+			// The QUITs of a netsplit are delivered together once they stop
+			if ( !libirc_netsplit_quit (session, prefix, params, paramindex) )
+			{
+				if ( session->callbacks.event_quit )
+					(*session->callbacks.event_quit) (session, command, prefix, params, paramindex);
+
+				libirc_state_quit (session, prefix);
+			}
 		}
 		else if ( !strncmp (command, "JOIN", buf_end - command) )
 		{
-			if ( session->callbacks.event_join )
+			int rejoined = libirc_netsplit_join (session, prefix, params, paramindex);
+
+			libirc_state_join (session, prefix, userhost, params, paramindex);
+
+			if ( !rejoined && session->callbacks.event_join )
 				(*session->callbacks.event_join) (session, command, prefix, params, paramindex);
 		}
 		else if ( !strncmp (command, "PART", buf_end - command) )
 		{
 			if ( session->callbacks.event_part )
 				(*session->callbacks.event_part) (session, command, prefix, params, paramindex);
+
+			libirc_state_part (session, prefix, params, paramindex);
 		}
 		else if ( !strncmp (command, "MODE", buf_end - command) )
 		{
-			if ( paramindex > 0 && !strncmp (params[0], session->nick, strlen(session->nick)) )
+			if ( paramindex > 0 && !libirc_is_channel (session, params[0]) && libirc_is_me (session, params[0]) )
 			{
 				params[0] = params[1];
 				paramindex = 1;
@@ -688,6 +822,8 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 			}
 			else
 			{
+				libirc_state_mode (session, params, paramindex);
+
 				if ( session->callbacks.event_mode )
 					(*session->callbacks.event_mode) (session, command, prefix, params, paramindex);
 			}
@@ -701,6 +837,8 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 		{
 			if ( session->callbacks.event_kick )
 				(*session->callbacks.event_kick) (session, command, prefix, params, paramindex);
+
+			libirc_state_kick (session, params, paramindex);
 		}
 		else if ( !strncmp (command, "PRIVMSG", buf_end - command) )
 		{
@@ -742,7 +880,7 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 							(*session->callbacks.event_ctcp_req) (session, "CTCP", prefix, params, paramindex);
 					}
 				}
-				else if ( !strncasecmp (params[0], session->nick, strlen(session->nick) ) )
+				else if ( !libirc_is_channel (session, params[0]) && libirc_is_me (session, params[0]) )
 				{
 					if ( session->callbacks.event_privmsg )
 						(*session->callbacks.event_privmsg) (session, "PRIVMSG", prefix, params, paramindex);
@@ -779,7 +917,7 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 				if ( session->callbacks.event_ctcp_rep )
 					(*session->callbacks.event_ctcp_rep) (session, "CTCP", prefix, params, paramindex);
 			}
-			else if ( !strncasecmp (params[0], session->nick, strlen(session->nick) ) )
+			else if ( !libirc_is_channel (session, params[0]) && libirc_is_me (session, params[0]) )
 			{
 				if ( session->callbacks.event_notice )
 					(*session->callbacks.event_notice) (session, command, prefix, params, paramindex);
@@ -799,16 +937,28 @@ static void libirc_process_incoming_data (irc_session_t * session, size_t proces
 		}
 	 	else
 	 	{
+			// Not events of their own, but the library follows them
+			if ( !strncmp (command, "CHGHOST", buf_end - command) )
+				libirc_state_chghost (session, prefix, params, paramindex);
+			else if ( !strncmp (command, "CAP", buf_end - command) )
+				libirc_cap_process (session, params, paramindex);
+			else if ( !strncmp (command, "AUTHENTICATE", buf_end - command) )
+				libirc_sasl_authenticate (session, params, paramindex);
+
 			/*
 			 * The "unknown" event is triggered upon receipt of any number of 
 			 * unclassifiable miscellaneous messages, which aren't handled by 
 			 * the library.
 			 */
 
-			if ( session->callbacks.event_unknown )
+			if ( !libirc_query_command (session, command, params, paramindex)
+			&& !libirc_batch_command (session, command, params, paramindex)
+			&& session->callbacks.event_unknown )
 				(*session->callbacks.event_unknown) (session, command, prefix, params, paramindex);
 		}
 	}
+
+	session->message_tags = 0;
 }
 
 
@@ -849,10 +999,12 @@ int irc_process_select_descriptors (irc_session_t * session, fd_set *in_set, fd_
 			return 1;
 		}
 
-		if (saddr.ss_family == AF_INET)
+		if (laddr.ss_family == AF_INET)
 			memcpy (&session->local_addr, &((struct sockaddr_in *)&laddr)->sin_addr, sizeof(struct in_addr));
+#if defined (ENABLE_IPV6)
 		else
-			memcpy (&session->local_addr, &((struct sockaddr_in6 *)&laddr)->sin6_addr, sizeof(struct in6_addr));
+			memcpy (&session->local_addr6, &((struct sockaddr_in6 *)&laddr)->sin6_addr, sizeof(struct in6_addr));
+#endif
 
 #if defined (ENABLE_DEBUG)
 		if ( IS_DEBUG_ENABLED(session) )
@@ -865,7 +1017,10 @@ int irc_process_select_descriptors (irc_session_t * session, fd_set *in_set, fd_
     	if ( gethostname (hname, sizeof(hname)) < 0 )
     		strcpy (hname, "unknown");
 
-		// Prepare the data, which should be sent to the server
+		// Prepare the data, which should be sent to the server. The
+		// capabilities are negotiated first, which holds the registration
+		libirc_cap_start (session);
+
 		if ( session->server_password )
 		{
 			snprintf (buf, sizeof(buf), "PASS %s", session->server_password);
@@ -895,6 +1050,11 @@ int irc_process_select_descriptors (irc_session_t * session, fd_set *in_set, fd_
 		return 1;
 	}
 
+	// Poll the presence of the nicks the server does not follow
+	libirc_monitor_timer (session);
+	libirc_query_timer (session);
+	libirc_netsplit_timer (session);
+
 	// Hey, we've got something to read!
 	if ( FD_ISSET (session->sock, in_set) )
 	{
@@ -1240,6 +1400,62 @@ void irc_option_reset (irc_session_t * session, unsigned int option)
 }
 
 
+int irc_sasl_set (irc_session_t * session, int mechanism, const char * user, const char * password)
+{
+	char * u = 0, * pw = 0;
+
+	if ( mechanism < 0 || mechanism > LIBIRC_SASL_SCRAM_SHA_256
+	|| (mechanism != LIBIRC_SASL_EXTERNAL && mechanism != 0 && (!user || !password)) )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	if ( mechanism
+	&& ((user && (u = strdup (user)) == 0) || (password && (pw = strdup (password)) == 0)) )
+	{
+		free (u);
+		session->lasterror = LIBIRC_ERR_NOMEM;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_isupport);
+	libirc_sasl_forget (&session->sasl);
+	session->sasl.mechanism = mechanism;
+	session->sasl.user = u;
+	session->sasl.password = pw;
+	libirc_mutex_unlock (&session->mutex_isupport);
+
+	// The authentication needs the capability, which starts the negotiation
+	return mechanism ? irc_cap_request (session, "sasl") : 0;
+}
+
+
+int irc_ssl_set_client_cert (irc_session_t * session, const char * certfile, const char * keyfile)
+{
+#if defined (ENABLE_SSL)
+	char * cert = 0, * key = 0;
+
+	if ( (certfile && (cert = strdup (certfile)) == 0)
+	|| (keyfile && (key = strdup (keyfile)) == 0) )
+	{
+		free (cert);
+		session->lasterror = LIBIRC_ERR_NOMEM;
+		return 1;
+	}
+
+	free (session->ssl_cert);
+	free (session->ssl_key);
+	session->ssl_cert = cert;
+	session->ssl_key = key;
+	return 0;
+#else
+	session->lasterror = LIBIRC_ERR_SSL_NOT_SUPPORTED;
+	return 1;
+#endif
+}
+
+
 int irc_cmd_channel_mode (irc_session_t * session, const char * channel, const char * mode)
 {
 	if ( !channel )
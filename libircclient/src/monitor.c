@@ -0,0 +1,718 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * The presence of the nicks the application follows. The server reports
+ * the changes itself with MONITOR, or WATCH on the older servers; without
+ * either the nicks are polled with ISON, less often when nothing changes.
+ */
+
+#define LIBIRC_ISON_INTERVAL			30
+#define LIBIRC_ISON_MIN_INTERVAL		10
+#define LIBIRC_ISON_MAX_INTERVAL		120
+#define LIBIRC_ISON_TIMEOUT				120
+
+
+static irc_monitor_nick_t * libirc_monitor_find (irc_session_t * session, const char * nick, size_t length)
+{
+	irc_hash_table_t * table = &session->monitor.nicks;
+	unsigned int hash = libirc_state_hash (session, nick, length, 1);
+	irc_hash_entry_t * e;
+
+	for ( e = table->size ? table->buckets[hash & (table->size - 1)] : 0; e; e = e->next )
+	{
+		irc_monitor_nick_t * m = (irc_monitor_nick_t *) e;
+
+		if ( e->hash == hash && libirc_state_equal (session, m->nick, nick, length) )
+			return m;
+	}
+
+	return 0;
+}
+
+
+static void libirc_monitor_line_init (irc_session_t * session, irc_monitor_line_t * line, const char * command, char sep, int max)
+{
+	int linelen = irc_server_limit (session, LIBIRC_LIMIT_LINELEN);
+
+	line->start = line->used = strlen (command);
+	memcpy (line->buf, command, line->used);
+	line->budget = (linelen > 0 && linelen < (int) sizeof(line->buf) ? linelen : sizeof(line->buf)) - 2;
+	line->sep = sep;
+	line->count = 0;
+	line->max = max > 0 ? max : 0;
+	line->lines = 0;
+	line->poll = 0;
+}
+
+
+static void libirc_monitor_line_flush (irc_session_t * session, irc_monitor_line_t * line)
+{
+	if ( line->count == 0 )
+		return;
+
+	line->buf[line->used] = '\0';
+
+	if ( line->poll )
+		irc_send_raw (session, "@label=ison%u.%u %s", line->poll, line->lines + 1, line->buf);
+	else
+		irc_send_raw (session, "%s", line->buf);
+
+	line->used = line->start;
+	line->count = 0;
+	line->lines++;
+}
+
+
+/*
+ * Adds the nick, prefixed with the sign if any. Returns the number of the
+ * line it goes to, starting from 1.
+ */
+static unsigned int libirc_monitor_line_add (irc_session_t * session, irc_monitor_line_t * line, const char * sign, const char * nick)
+{
+	size_t length = strlen (sign) + strlen (nick) + (line->count ? 1 : 0);
+
+	if ( line->count && (line->used + length > line->budget || (line->max && line->count >= line->max)) )
+	{
+		libirc_monitor_line_flush (session, line);
+		length--;
+	}
+
+	// A nick longer than the line could not be sent anyway
+	if ( line->used + length <= line->budget )
+	{
+		if ( line->count )
+			line->buf[line->used++] = line->sep;
+
+		line->used += sprintf (line->buf + line->used, "%s%s", sign, nick);
+		line->count++;
+	}
+
+	return line->lines + 1;
+}
+
+
+/*
+ * Asks the server to follow the nicks it does not follow yet, as many as
+ * its list takes. Called with mutex_monitor locked.
+ */
+static void libirc_monitor_send_pending (irc_session_t * session)
+{
+	irc_monitor_t * monitor = &session->monitor;
+	irc_monitor_line_t line;
+	char value[32];
+	int limit = 0;
+	unsigned int i;
+
+	if ( monitor->full )
+		return;
+
+	if ( monitor->method == MONITOR_MONITOR )
+	{
+		limit = irc_server_limit (session, LIBIRC_LIMIT_MONITOR);
+		libirc_monitor_line_init (session, &line, "MONITOR + ", ',', irc_server_targmax (session, "MONITOR"));
+	}
+	else if ( monitor->method == MONITOR_WATCH )
+	{
+		if ( irc_server_feature (session, "WATCH", value, sizeof(value)) == 0 )
+			limit = atoi (value);
+
+		libirc_monitor_line_init (session, &line, "WATCH ", ' ', 0);
+	}
+	else
+		return;
+
+	for ( i = 0; i < monitor->nicks.size; i++ )
+	{
+		irc_hash_entry_t * e;
+
+		for ( e = monitor->nicks.buckets[i]; e; e = e->next )
+		{
+			irc_monitor_nick_t * m = (irc_monitor_nick_t *) e;
+
+			if ( m->listed )
+				continue;
+
+			if ( limit > 0 && monitor->listed >= (unsigned int) limit )
+				break;
+
+			libirc_monitor_line_add (session, &line, monitor->method == MONITOR_WATCH ? "+" : "", m->nick);
+			m->listed = 1;
+			monitor->listed++;
+		}
+	}
+
+	libirc_monitor_line_flush (session, &line);
+}
+
+
+/*
+ * Sets the presence of the nick, and reports it if it changed. The origin
+ * is the nick, maybe with the user@host. With a batch, only the nick polled
+ * in that ISON line is changed. Returns nonzero if it changed.
+ */
+static int libirc_monitor_update (irc_session_t * session, const char * origin, int online, unsigned int batch)
+{
+	size_t length = strcspn (origin, "!@");
+	irc_monitor_nick_t * m;
+	int changed = 0;
+	char nick[256];
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	if ( (m = libirc_monitor_find (session, origin, length)) != 0 && (batch == 0 || m->batch == batch) )
+	{
+		changed = m->online != online;
+		m->online = online;
+		m->batch = 0;
+	}
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+
+	if ( changed && session->callbacks.event_presence )
+	{
+		if ( session->options & LIBIRC_OPTION_STRIPNICKS )
+		{
+			if ( length >= sizeof(nick) )
+				length = sizeof(nick) - 1;
+
+			memcpy (nick, origin, length);
+			nick[length] = '\0';
+			origin = nick;
+		}
+
+		(*session->callbacks.event_presence) (session, online ? "ONLINE" : "OFFLINE", origin, 0, 0);
+	}
+
+	return changed;
+}
+
+
+/*
+ * Chooses how to follow the presence once the registration is complete,
+ * and the server features are known.
+ */
+static void libirc_monitor_start (irc_session_t * session)
+{
+	irc_monitor_t * monitor = &session->monitor;
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	if ( irc_server_limit (session, LIBIRC_LIMIT_MONITOR) >= 0 )
+		monitor->method = MONITOR_MONITOR;
+	else if ( irc_server_feature (session, "WATCH", 0, 0) == 0 )
+		monitor->method = MONITOR_WATCH;
+	else
+		monitor->method = MONITOR_ISON;
+
+	libirc_monitor_send_pending (session);
+	monitor->next_poll = time (0);
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+}
+
+
+/*
+ * The nicks the server did not take into its full list; they are polled.
+ */
+static void libirc_monitor_unlist (irc_session_t * session, const char * nicks, char sep)
+{
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	while ( *nicks )
+	{
+		size_t length = strcspn (nicks, sep == ',' ? "," : " ");
+		irc_monitor_nick_t * m = libirc_monitor_find (session, nicks, length);
+
+		if ( m && m->listed )
+		{
+			m->listed = 0;
+			session->monitor.listed--;
+		}
+
+		nicks += length;
+
+		if ( *nicks )
+			nicks++;
+	}
+
+	session->monitor.full = 1;
+	libirc_mutex_unlock (&session->mutex_monitor);
+}
+
+
+/*
+ * Checks whether all the nicks of the RPL_ISON reply were polled in the
+ * ISON line. Called with mutex_monitor locked.
+ */
+static int libirc_monitor_ison_match (irc_session_t * session, const char * reply, unsigned int batch)
+{
+	while ( *reply )
+	{
+		size_t length = strcspn (reply, " ");
+		irc_monitor_nick_t * m = libirc_monitor_find (session, reply, length);
+
+		if ( length > 0 && (!m || m->batch != batch) )
+			return 0;
+
+		reply += length;
+
+		while ( *reply == ' ' )
+			reply++;
+	}
+
+	return 1;
+}
+
+
+/*
+ * RPL_ISON: the nicks of a line of the poll which are online. The others 
+ * of that line are offline. The application could still send its own ISON,
+ * so with labeled-response the line is told by the label. Otherwise the 
+ * server answers in order, and a reply with a nick not in the next line 
+ * is not ours; an empty one cannot be told apart, and is taken.
+ */
+static void libirc_monitor_ison (irc_session_t * session, const char * reply)
+{
+	irc_monitor_t * monitor = &session->monitor;
+	char offline[MONITOR_LINE_SIZE + 1], label[32];
+	const char * p;
+	unsigned int batch, poll, i;
+	size_t used = 0;
+	int changed = 0;
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	if ( monitor->ison_label )
+	{
+		if ( libirc_message_tag (session->message_tags, "label", label, sizeof(label))
+		|| sscanf (label, "ison%u.%u", &poll, &batch) != 2
+		|| poll != monitor->ison_label || batch == 0 || batch > monitor->ison_sent )
+			batch = 0;
+	}
+	else
+		batch = monitor->ison_replied + 1;
+
+	if ( monitor->ison_replied >= monitor->ison_sent || batch == 0
+	|| !libirc_monitor_ison_match (session, reply, batch) )
+	{
+		libirc_mutex_unlock (&session->mutex_monitor);
+		return;
+	}
+
+	monitor->ison_replied++;
+	libirc_mutex_unlock (&session->mutex_monitor);
+
+	for ( p = reply; *p; )
+	{
+		char nick[256];
+		size_t length = strcspn (p, " ");
+
+		if ( length > 0 && length < sizeof(nick) )
+		{
+			memcpy (nick, p, length);
+			nick[length] = '\0';
+			changed |= libirc_monitor_update (session, nick, 1, batch);
+		}
+
+		p += length;
+
+		while ( *p == ' ' )
+			p++;
+	}
+
+	// The rest of the line is offline; a line holds them all
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	for ( i = 0; i < monitor->nicks.size; i++ )
+	{
+		irc_hash_entry_t * e;
+
+		for ( e = monitor->nicks.buckets[i]; e; e = e->next )
+		{
+			irc_monitor_nick_t * m = (irc_monitor_nick_t *) e;
+			size_t length = strlen (m->nick);
+
+			if ( m->batch == batch && used + length + 1 < sizeof(offline) )
+			{
+				memcpy (offline + used, m->nick, length + 1);
+				used += length + 1;
+			}
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+
+	for ( p = offline; p < offline + used; p += strlen (p) + 1 )
+		changed |= libirc_monitor_update (session, p, 0, batch);
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	monitor->ison_changed |= changed;
+
+	// The poll is over: poll sooner if the presence changes, and later
+	// if not, but not more than a line per 2 seconds on average
+	if ( monitor->ison_replied == monitor->ison_sent )
+	{
+		unsigned int min = monitor->ison_sent * 2 > LIBIRC_ISON_MIN_INTERVAL ? monitor->ison_sent * 2 : LIBIRC_ISON_MIN_INTERVAL;
+		unsigned int max = min > LIBIRC_ISON_MAX_INTERVAL ? min : LIBIRC_ISON_MAX_INTERVAL;
+
+		monitor->interval = monitor->ison_changed ? monitor->interval / 2 : monitor->interval * 3 / 2;
+
+		if ( monitor->interval < min )
+			monitor->interval = min;
+
+		if ( monitor->interval > max )
+			monitor->interval = max;
+
+		monitor->next_poll = time (0) + monitor->interval;
+	}
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+}
+
+
+/*
+ * Polls the nicks not in the server list, when it is time to. Called from
+ * the event loop.
+ */
+static void libirc_monitor_timer (irc_session_t * session)
+{
+	irc_monitor_t * monitor = &session->monitor;
+	irc_monitor_line_t line;
+	time_t now = time (0);
+	unsigned int i;
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	// A poll the server did not answer is given up
+	if ( monitor->method == MONITOR_NONE || now < monitor->next_poll
+	|| (monitor->ison_replied < monitor->ison_sent && now < monitor->poll_started + LIBIRC_ISON_TIMEOUT) )
+	{
+		libirc_mutex_unlock (&session->mutex_monitor);
+		return;
+	}
+
+	libirc_monitor_line_init (session, &line, "ISON ", ' ', 0);
+
+	// The labels tell the replies to the poll from the replies to the ISONs
+	// of the application
+	if ( irc_cap_enabled (session, "labeled-response") )
+	{
+		if ( ++monitor->ison_polls == 0 )
+			monitor->ison_polls = 1;
+
+		line.poll = monitor->ison_polls;
+	}
+
+	for ( i = 0; i < monitor->nicks.size; i++ )
+	{
+		irc_hash_entry_t * e;
+
+		for ( e = monitor->nicks.buckets[i]; e; e = e->next )
+		{
+			irc_monitor_nick_t * m = (irc_monitor_nick_t *) e;
+
+			m->batch = m->listed ? 0 : libirc_monitor_line_add (session, &line, "", m->nick);
+		}
+	}
+
+	libirc_monitor_line_flush (session, &line);
+
+	monitor->ison_sent = line.lines;
+	monitor->ison_replied = 0;
+	monitor->ison_changed = 0;
+	monitor->ison_label = line.poll;
+	monitor->poll_started = now;
+	monitor->next_poll = now + monitor->interval;
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+}
+
+
+static void libirc_monitor_numeric (irc_session_t * session, unsigned int code, const char ** params, unsigned int count)
+{
+	int method = session->monitor.method;
+
+	switch ( code )
+	{
+	case 376:	// RPL_ENDOFMOTD
+	case 422:	// ERR_NOMOTD
+		if ( method == MONITOR_NONE )
+			libirc_monitor_start (session);
+		break;
+
+	case 730:	// RPL_MONONLINE: nick!user@host,...
+	case 731:	// RPL_MONOFFLINE: nick,...
+		if ( method == MONITOR_MONITOR && count > 1 )
+		{
+			char target[512];
+			const char * p;
+
+			for ( p = params[1]; *p; )
+			{
+				size_t length = strcspn (p, ",");
+
+				if ( length > 0 && length < sizeof(target) )
+				{
+					memcpy (target, p, length);
+					target[length] = '\0';
+					libirc_monitor_update (session, target, code == 730, 0);
+				}
+
+				p += length;
+
+				if ( *p )
+					p++;
+			}
+		}
+		break;
+
+	case 734:	// ERR_MONLISTFULL: limit, nicks
+		if ( method == MONITOR_MONITOR && count > 2 )
+			libirc_monitor_unlist (session, params[2], ',');
+		break;
+
+	case 600:	// RPL_LOGON: nick, user, host
+	case 601:	// RPL_LOGOFF
+	case 604:	// RPL_NOWON
+	case 605:	// RPL_NOWOFF
+		if ( method == MONITOR_WATCH && count > 3 )
+		{
+			char origin[512];
+			int online = code == 600 || code == 604;
+
+			if ( online )
+				snprintf (origin, sizeof(origin), "%s!%s@%s", params[1], params[2], params[3]);
+			else
+				snprintf (origin, sizeof(origin), "%s", params[1]);
+
+			libirc_monitor_update (session, origin, online, 0);
+		}
+		break;
+
+	case 512:	// ERR_TOOMANYWATCH: nick
+		if ( method == MONITOR_WATCH && count > 1 )
+			libirc_monitor_unlist (session, params[1], ' ');
+		break;
+
+	case 303:	// RPL_ISON
+		if ( method != MONITOR_NONE && count > 1 )
+			libirc_monitor_ison (session, params[1]);
+		break;
+	}
+}
+
+
+/*
+ * Forgets the presence when the session is connected; the nicks stay.
+ */
+static void libirc_monitor_reset (irc_session_t * session)
+{
+	irc_monitor_t * monitor = &session->monitor;
+	unsigned int i;
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	for ( i = 0; i < monitor->nicks.size; i++ )
+	{
+		irc_hash_entry_t * e;
+
+		for ( e = monitor->nicks.buckets[i]; e; e = e->next )
+		{
+			irc_monitor_nick_t * m = (irc_monitor_nick_t *) e;
+
+			m->online = -1;
+			m->listed = 0;
+			m->batch = 0;
+		}
+	}
+
+	monitor->method = MONITOR_NONE;
+	monitor->listed = 0;
+	monitor->full = 0;
+	monitor->next_poll = 0;
+	monitor->poll_started = 0;
+	monitor->interval = LIBIRC_ISON_INTERVAL;
+	monitor->ison_sent = 0;
+	monitor->ison_replied = 0;
+	monitor->ison_changed = 0;
+	monitor->ison_label = 0;
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+}
+
+
+static void libirc_monitor_free (irc_session_t * session)
+{
+	irc_hash_table_t * table = &session->monitor.nicks;
+	unsigned int i;
+
+	for ( i = 0; i < table->size; i++ )
+	{
+		irc_hash_entry_t * e, * next;
+
+		for ( e = table->buckets[i]; e; e = next )
+		{
+			next = e->next;
+			free (e);
+		}
+	}
+
+	free (table->buckets);
+	memset (table, 0, sizeof(*table));
+}
+
+
+/*
+ * Hashes the nicks again when the CASEMAPPING changes.
+ */
+static void libirc_monitor_rehash (irc_session_t * session)
+{
+	libirc_mutex_lock (&session->mutex_monitor);
+	libirc_hash_rekey (session, &session->monitor.nicks, offsetof(irc_monitor_nick_t, nick));
+	libirc_mutex_unlock (&session->mutex_monitor);
+}
+
+
+int irc_monitor_add (irc_session_t * session, const char * nicks)
+{
+	const char * p;
+	int rc = 0;
+
+	if ( !nicks )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	for ( p = nicks; *p && rc == 0; )
+	{
+		size_t length = strcspn (p, ", ");
+
+		if ( length && !libirc_monitor_find (session, p, length) )
+		{
+			irc_monitor_nick_t * m = malloc (offsetof(irc_monitor_nick_t, nick) + length + 1);
+
+			if ( m )
+			{
+				memset (m, 0, offsetof(irc_monitor_nick_t, nick));
+				m->online = -1;
+				memcpy (m->nick, p, length);
+				m->nick[length] = '\0';
+				m->entry.hash = libirc_state_hash (session, p, length, 1);
+
+				if ( libirc_hash_insert (&session->monitor.nicks, &m->entry) )
+				{
+					free (m);
+					m = 0;
+				}
+			}
+
+			if ( !m )
+				rc = LIBIRC_ERR_NOMEM;
+		}
+
+		p += length;
+
+		while ( *p == ',' || *p == ' ' )
+			p++;
+	}
+
+	// The new nicks are polled soon, as more could be added in a moment
+	if ( session->monitor.method == MONITOR_ISON )
+		session->monitor.next_poll = time (0) + 1;
+	else
+		libirc_monitor_send_pending (session);
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+
+	if ( rc )
+		session->lasterror = rc;
+
+	return rc ? 1 : 0;
+}
+
+
+int irc_monitor_remove (irc_session_t * session, const char * nicks)
+{
+	irc_monitor_t * monitor = &session->monitor;
+	irc_monitor_line_t line;
+	const char * p;
+
+	if ( !nicks )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	if ( monitor->method == MONITOR_WATCH )
+		libirc_monitor_line_init (session, &line, "WATCH ", ' ', 0);
+	else
+		libirc_monitor_line_init (session, &line, "MONITOR - ", ',', irc_server_targmax (session, "MONITOR"));
+
+	for ( p = nicks; *p; )
+	{
+		size_t length = strcspn (p, ", ");
+		irc_monitor_nick_t * m = length ? libirc_monitor_find (session, p, length) : 0;
+
+		if ( m )
+		{
+			if ( m->listed )
+			{
+				libirc_monitor_line_add (session, &line, monitor->method == MONITOR_WATCH ? "-" : "", m->nick);
+				monitor->listed--;
+			}
+
+			libirc_hash_remove (&monitor->nicks, &m->entry);
+			free (m);
+		}
+
+		p += length;
+
+		while ( *p == ',' || *p == ' ' )
+			p++;
+	}
+
+	libirc_monitor_line_flush (session, &line);
+
+	// The freed places of the server list take the polled nicks
+	monitor->full = 0;
+	libirc_monitor_send_pending (session);
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+	return 0;
+}
+
+
+int irc_monitor_is_online (irc_session_t * session, const char * nick)
+{
+	irc_monitor_nick_t * m;
+	int online = -1;
+
+	if ( !nick )
+		return -1;
+
+	libirc_mutex_lock (&session->mutex_monitor);
+
+	if ( (m = libirc_monitor_find (session, nick, strlen (nick))) != 0 )
+		online = m->online;
+
+	libirc_mutex_unlock (&session->mutex_monitor);
+	return online;
+}
@@ -0,0 +1,78 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_MONITOR_H
+#define INCLUDE_IRC_MONITOR_H
+
+
+// The ways the presence is followed, as the server supports
+#define MONITOR_NONE			0		/* not registered yet */
+#define MONITOR_MONITOR			1
+#define MONITOR_WATCH			2
+#define MONITOR_ISON			3
+
+#define MONITOR_LINE_SIZE		512
+
+
+/*
+ * A nick the application follows, keyed by the case-folded nick. The nicks
+ * the server list does not take are polled with ISON.
+ */
+typedef struct
+{
+	irc_hash_entry_t	entry;
+	int					online;		/* 1 or 0, or -1 if not known yet */
+	int					listed;		/* in the MONITOR or WATCH list of the server */
+	unsigned int		batch;		/* the ISON line of the poll it is in, or 0 */
+	char				nick[1];
+} irc_monitor_nick_t;
+
+
+/*
+ * A command with a list of the nicks, sent when the next nick does not fit
+ * the line or the targets the server takes.
+ */
+typedef struct
+{
+	char				buf[MONITOR_LINE_SIZE];
+	size_t				used;
+	size_t				start;		/* the length of the command */
+	size_t				budget;		/* the longest line, without CR LF */
+	char				sep;
+	unsigned int		count;		/* the nicks in this line */
+	unsigned int		max;		/* the most nicks per line, or 0 */
+	unsigned int		lines;		/* the lines sent */
+	unsigned int		poll;		/* the ISON poll labeling the lines, or 0 */
+} irc_monitor_line_t;
+
+
+typedef struct
+{
+	irc_hash_table_t	nicks;
+	int					method;		/* MONITOR_* */
+	unsigned int		listed;		/* the nicks in the server list */
+	int					full;		/* the server list takes no more */
+
+	time_t				next_poll;	/* ISON */
+	time_t				poll_started;
+	unsigned int		interval;	/* seconds between the polls */
+	unsigned int		ison_sent;	/* the lines of the current poll */
+	unsigned int		ison_replied;
+	int					ison_changed;	/* a presence changed in the current poll */
+	unsigned int		ison_label;		/* the label of the current poll, or 0 */
+	unsigned int		ison_polls;
+} irc_monitor_t;
+
+
+#endif /* INCLUDE_IRC_MONITOR_H */
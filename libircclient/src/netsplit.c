@@ -0,0 +1,328 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * The netsplit storms, coalesced with LIBIRC_OPTION_DETECT_NETSPLITS. The
+ * servers quit the split users with the names of the two servers as the
+ * reason, which a user could not send, as the servers prefix the user
+ * reasons. The QUITs are delivered as one NETSPLIT event once they stop,
+ * and the tracker drops the users at once. The JOINs of the users coming
+ * back are delivered as NETJOIN events, but the tracker follows them as
+ * they come, so the modes the servers set after them are not lost.
+ */
+
+#define LIBIRC_NETSPLIT_ACTIVE(s)	(((s)->options & LIBIRC_OPTION_DETECT_NETSPLITS) && (s)->callbacks.event_netsplit)
+
+
+static int libirc_netsplit_server (const char * name, size_t length)
+{
+	size_t i;
+	int dot = 0;
+
+	if ( length == 0 || name[0] == '.' || name[length - 1] == '.' )
+		return 0;
+
+	for ( i = 0; i < length; i++ )
+	{
+		if ( !isalnum ((unsigned char) name[i]) && !strchr ("-_.*", name[i]) )
+			return 0;
+
+		dot |= name[i] == '.';
+	}
+
+	return dot;
+}
+
+
+/*
+ * Checks whether the QUIT reason is two server names, like
+ * "irc.example.net hub.example.net" or "*.net *.split".
+ */
+static int libirc_netsplit_reason (const char * reason)
+{
+	size_t first = strcspn (reason, " ");
+
+	return reason[first] == ' '
+		&& libirc_netsplit_server (reason, first)
+		&& libirc_netsplit_server (reason + first + 1, strlen (reason + first + 1));
+}
+
+
+static irc_netsplit_nick_t * libirc_netsplit_find (irc_session_t * session, const char * nick, size_t length)
+{
+	irc_hash_table_t * table = &session->netsplit_nicks;
+	unsigned int hash = libirc_state_hash (session, nick, length, 1);
+	irc_hash_entry_t * e;
+
+	for ( e = table->size ? table->buckets[hash & (table->size - 1)] : 0; e; e = e->next )
+		if ( e->hash == hash && libirc_state_equal (session, ((irc_netsplit_nick_t *) e)->nick, nick, length) )
+			return (irc_netsplit_nick_t *) e;
+
+	return 0;
+}
+
+
+/*
+ * Forgets the nicks of the split, or only the ones which came back.
+ */
+static void libirc_netsplit_forget (irc_session_t * session, irc_netsplit_t * split, int joined)
+{
+	irc_hash_table_t * table = &session->netsplit_nicks;
+	unsigned int i;
+
+	for ( i = 0; i < table->size; i++ )
+	{
+		irc_hash_entry_t ** e = table->buckets + i;
+
+		while ( *e )
+		{
+			irc_netsplit_nick_t * n = (irc_netsplit_nick_t *) *e;
+
+			if ( n->split == split && (!joined || n->joined) )
+			{
+				*e = n->entry.next;
+				table->count--;
+			}
+			else
+				e = &(*e)->next;
+		}
+	}
+}
+
+
+static void libirc_netsplit_free (irc_session_t * session, irc_netsplit_t * split)
+{
+	libirc_reply_release (session, &split->store);
+	free (split->users);
+	free (split);
+}
+
+
+static void libirc_netsplit_clear (irc_session_t * session)
+{
+	while ( session->netsplits )
+	{
+		irc_netsplit_t * split = session->netsplits;
+
+		session->netsplits = split->next;
+		libirc_netsplit_free (session, split);
+	}
+
+	// The nicks were in the arenas
+	free (session->netsplit_nicks.buckets);
+	memset (&session->netsplit_nicks, 0, sizeof(irc_hash_table_t));
+}
+
+
+/*
+ * Adds a QUIT or JOIN to be delivered. Returns nonzero if out of memory,
+ * and the message is then dispatched as usual.
+ */
+static int libirc_netsplit_add (irc_session_t * session, irc_netsplit_t * split, const char * origin, const char * channel)
+{
+	irc_netsplit_user_t * user;
+	char * copy;
+
+	if ( split->count == split->size )
+	{
+		unsigned int size = split->size ? split->size * 2 : 64;
+		irc_netsplit_user_t * users = realloc (split->users, size * sizeof(irc_netsplit_user_t));
+
+		if ( !users )
+			return 1;
+
+		split->users = users;
+		split->size = size;
+	}
+
+	user = split->users + split->count;
+	user->channel = 0;
+
+	if ( (copy = libirc_reply_alloc (session, &split->store, strlen (origin) + 1)) == 0 )
+		return 1;
+
+	strcpy (copy, origin);
+	user->origin = copy;
+
+	if ( channel )
+	{
+		if ( (copy = libirc_reply_alloc (session, &split->store, strlen (channel) + 1)) == 0 )
+			return 1;
+
+		strcpy (copy, channel);
+		user->channel = copy;
+	}
+
+	split->count++;
+	split->last = time (0);
+	return 0;
+}
+
+
+/*
+ * Delivers the QUITs of the split, which the tracker then applies at once.
+ * Its users are expected back from now on.
+ */
+static void libirc_netsplit_deliver (irc_session_t * session, irc_netsplit_t * split)
+{
+	const char ** origins;
+	unsigned int i;
+
+	split->split = time (0);
+
+	if ( split->count == 0 )
+		return;
+
+	origins = malloc (split->count * sizeof(char *));
+
+	if ( session->callbacks.event_netsplit )
+		(*session->callbacks.event_netsplit) (session, "NETSPLIT", split->servers, split->users, split->count);
+
+	if ( origins )
+	{
+		for ( i = 0; i < split->count; i++ )
+			origins[i] = split->users[i].origin;
+
+		libirc_state_quit_many (session, origins, split->count);
+		free (origins);
+	}
+	else
+	{
+		for ( i = 0; i < split->count; i++ )
+			libirc_state_quit (session, split->users[i].origin);
+	}
+
+	split->count = 0;
+}
+
+
+/*
+ * Holds the QUIT of a netsplit. Returns nonzero if so, and the QUIT is not
+ * dispatched.
+ */
+static int libirc_netsplit_quit (irc_session_t * session, const char * origin, const char ** params, unsigned int count)
+{
+	irc_netsplit_t * split;
+	irc_netsplit_nick_t * n;
+	size_t nicklen;
+
+	if ( !LIBIRC_NETSPLIT_ACTIVE(session) || !origin || count < 1 || !libirc_netsplit_reason (params[0]) )
+		return 0;
+
+	for ( split = session->netsplits; split; split = split->next )
+		if ( split->split == 0 && !strcmp (split->servers, params[0]) )
+			break;
+
+	if ( !split )
+	{
+		char * servers;
+
+		if ( (split = calloc (1, sizeof(irc_netsplit_t))) == 0 )
+			return 0;
+
+		if ( (servers = libirc_reply_alloc (session, &split->store, strlen (params[0]) + 1)) == 0 )
+		{
+			libirc_netsplit_free (session, split);
+			return 0;
+		}
+
+		strcpy (servers, params[0]);
+		split->servers = servers;
+		split->last = time (0);
+		split->next = session->netsplits;
+		session->netsplits = split;
+	}
+
+	nicklen = strcspn (origin, "!");
+
+	// The nick is expected back from the latest split only
+	if ( (n = libirc_netsplit_find (session, origin, nicklen)) != 0 )
+		libirc_hash_remove (&session->netsplit_nicks, &n->entry);
+
+	if ( libirc_netsplit_add (session, split, origin, 0) )
+		return 0;
+
+	if ( (n = libirc_reply_alloc (session, &split->store, offsetof(irc_netsplit_nick_t, nick) + nicklen + 1)) != 0 )
+	{
+		n->entry.hash = libirc_state_hash (session, origin, nicklen, 1);
+		n->split = split;
+		n->joined = 0;
+		memcpy (n->nick, origin, nicklen);
+		n->nick[nicklen] = '\0';
+		libirc_hash_insert (&session->netsplit_nicks, &n->entry);
+	}
+
+	return 1;
+}
+
+
+/*
+ * Holds the JOIN of a user back from a netsplit. Called before the tracker
+ * follows the JOIN. Returns nonzero if the JOIN event is not dispatched.
+ */
+static int libirc_netsplit_join (irc_session_t * session, const char * origin, const char ** params, unsigned int count)
+{
+	irc_netsplit_nick_t * n;
+
+	if ( !origin || count < 1 || session->netsplit_nicks.count == 0
+	|| (n = libirc_netsplit_find (session, origin, strcspn (origin, "!"))) == 0 )
+		return 0;
+
+	// Back before the QUITs stopped, so they are delivered first
+	if ( n->split->split == 0 )
+		libirc_netsplit_deliver (session, n->split);
+
+	if ( !LIBIRC_NETSPLIT_ACTIVE(session) || libirc_netsplit_add (session, n->split, origin, params[0]) )
+		return 0;
+
+	n->joined = 1;
+	return 1;
+}
+
+
+static void libirc_netsplit_timer (irc_session_t * session)
+{
+	irc_netsplit_t ** link = &session->netsplits;
+	time_t now;
+
+	if ( !*link )
+		return;
+
+	now = time (0);
+
+	while ( *link )
+	{
+		irc_netsplit_t * split = *link;
+
+		if ( split->split == 0 && now - split->last >= LIBIRC_NETSPLIT_QUIET )
+			libirc_netsplit_deliver (session, split);
+		else if ( split->count > 0 && now - split->last >= LIBIRC_NETSPLIT_QUIET )
+		{
+			if ( session->callbacks.event_netsplit )
+				(*session->callbacks.event_netsplit) (session, "NETJOIN", split->servers, split->users, split->count);
+
+			split->count = 0;
+			libirc_netsplit_forget (session, split, 1);
+		}
+		else if ( split->count == 0 && now - split->last >= LIBIRC_NETSPLIT_MEMORY )
+		{
+			libirc_netsplit_forget (session, split, 0);
+			*link = split->next;
+			libirc_netsplit_free (session, split);
+			continue;
+		}
+
+		link = &split->next;
+	}
+}
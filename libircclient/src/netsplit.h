@@ -0,0 +1,53 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_NETSPLIT_H
+#define INCLUDE_IRC_NETSPLIT_H
+
+
+#define LIBIRC_NETSPLIT_QUIET		2		/* the seconds without a QUIT or JOIN which end a storm */
+#define LIBIRC_NETSPLIT_MEMORY		900		/* how long the split users are expected back */
+
+
+/*
+ * A netsplit: the QUITs until they stop, then the JOINs of the users who
+ * come back, until the split is forgotten. The strings, and the nicks
+ * below, are kept in the arena of the store.
+ */
+typedef struct irc_netsplit_s
+{
+	struct irc_netsplit_s *	next;
+	const char			  *	servers;
+	time_t					last;		/* the last QUIT or JOIN */
+	time_t					split;		/* when the split was delivered, 0 while the QUITs come */
+	irc_netsplit_user_t	  *	users;		/* the QUITs or JOINs not delivered yet */
+	unsigned int			count;
+	unsigned int			size;
+	irc_reply_t				store;
+} irc_netsplit_t;
+
+
+/*
+ * A split user expected back, keyed by the case-folded nick.
+ */
+typedef struct
+{
+	irc_hash_entry_t		entry;
+	irc_netsplit_t		  *	split;
+	int						joined;		/* rejoined, so forgotten after the NETJOIN */
+	char					nick[1];
+} irc_netsplit_nick_t;
+
+
+#endif /* INCLUDE_IRC_NETSPLIT_H */
@@ -20,15 +20,28 @@
 #define LIBIRC_VERSION_LOW			9
 
 #define LIBIRC_BUFFER_SIZE			1024
+#define LIBIRC_LINE_SIZE			(8192 + 512)	// the message tags and the message
 #define LIBIRC_DCC_BUFFER_SIZE		1024
+#define LIBIRC_DCC_SEND_WINDOW		(64 * 1024)
+#define LIBIRC_DCC_SENDFILE_CHUNK	(256 * 1024)
+#define LIBIRC_DCC_FILE_BUFFER_SIZE	(256 * 1024)
+#define LIBIRC_DCC_CHAT_MAX_LINE	(64 * 1024)
+#define LIBIRC_DCC_CHAT_MAX_QUEUE	(1024 * 1024)
+#define LIBIRC_DCC_BUFFER_POOL_MAX	4
+#define LIBIRC_DCC_PREFETCH_SIZE	(1024 * 1024)
+#define LIBIRC_DCC_SLOT_BITS		16
+#define LIBIRC_DCC_SLOT_MASK		((1 << LIBIRC_DCC_SLOT_BITS) - 1)
+#define LIBIRC_DCC_INITIAL_SLOTS	16
 
 #define LIBIRC_STATE_INIT			0
 #define LIBIRC_STATE_LISTENING		1
 #define LIBIRC_STATE_CONNECTING		2
 #define LIBIRC_STATE_CONNECTED		3
 #define LIBIRC_STATE_DISCONNECTED	4
-#define LIBIRC_STATE_CONFIRM_SIZE	5	// Used only by DCC send to confirm the amount of sent data
 #define LIBIRC_STATE_REMOVED		10	// this state is used only in DCC
+#define LIBIRC_STATE_RESUMING		11	// this state is used only in DCC
+#define LIBIRC_STATE_QUEUED			12	// this state is used only in DCC
+#define LIBIRC_STATE_PASSIVE		13	// this state is used only in DCC
 
 
 #define SSL_PREFIX					'#'
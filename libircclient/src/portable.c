@@ -13,12 +13,18 @@
  */
 
 #if !defined (_WIN32)
+	// DCC transfers may exceed 4GB even on 32-bit systems
+	#if !defined (_FILE_OFFSET_BITS)
+		#define _FILE_OFFSET_BITS	64
+	#endif
+
 	#include "config.h"
 	#include <stdio.h>
 	#include <stdarg.h>
 	#include <unistd.h>
 	#include <string.h>
 	#include <stdlib.h>
+	#include <stddef.h>
 	#include <sys/stat.h>
 	#include <sys/types.h>
 	#include <sys/socket.h>
@@ -29,11 +35,22 @@
 	#include <errno.h>
 	#include <ctype.h>
 	#include <time.h>
+	#include <sys/time.h>
+
+	#if defined (__linux__)
+		#include <sys/sendfile.h>
+		#define LIBIRC_HAVE_SENDFILE
+		#define LIBIRC_HAVE_FALLOCATE
+		#define LIBIRC_HAVE_FADVISE
+	#endif
 
 	#if defined (ENABLE_THREADS)
 		#include <pthread.h>
 		typedef pthread_mutex_t		port_mutex_t;
 
+		// DCC file I/O could be done by a separate thread
+		#define LIBIRC_HAVE_DCC_IO_THREAD
+
 		#if !defined (PTHREAD_MUTEX_RECURSIVE) && defined (PTHREAD_MUTEX_RECURSIVE_NP)
 			#define PTHREAD_MUTEX_RECURSIVE		PTHREAD_MUTEX_RECURSIVE_NP
 		#endif
@@ -47,7 +64,10 @@
 	#include <stdarg.h>
 	#include <string.h>
 	#include <stdlib.h>
+	#include <stddef.h>
 	#include <sys/stat.h>
+	#include <io.h>
+	#include <fcntl.h>
 
 	#if defined (ENABLE_THREADS)
 		typedef CRITICAL_SECTION	port_mutex_t;
@@ -57,6 +77,10 @@
 	#define snprintf			_snprintf
 	#define vsnprintf			_vsnprintf
 	#define strncasecmp			_strnicmp
+
+	// 64-bit file sizes
+	#define stat				_stati64
+	#define fstat				_fstati64
 #endif
 
 
@@ -64,6 +88,24 @@
 	#include <openssl/ssl.h>
 	#include <openssl/err.h>
 	#include <openssl/rand.h>
+	#include <openssl/evp.h>
+#endif
+
+
+// The vector instructions used to find the mIRC format codes
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define LIBIRC_HAVE_SSE2
+#elif defined (__aarch64__) && defined (__ARM_NEON)
+	#include <arm_neon.h>
+	#define LIBIRC_HAVE_NEON
+#endif
+
+
+// The ARMv8 CRC32 instructions use the same polynomial as the DCC digest
+#if defined (__ARM_FEATURE_CRC32)
+	#include <arm_acle.h>
+	#define LIBIRC_HAVE_CRC32_INSN
 #endif
 
 
@@ -128,6 +170,134 @@ static inline void libirc_mutex_unlock (port_mutex_t * mutex)
 #endif
 
 
+#if !defined (O_BINARY)
+	#define O_BINARY	0
+#endif
+
+
+/*
+ * Reads the file data at the specified offset without moving the file 
+ * position, so several readers could share a single descriptor.
+ */
+static int libirc_file_read_at (int fd, void * buf, unsigned int length, unsigned long long offset)
+{
+#if defined (_WIN32)
+	if ( _lseeki64 (fd, offset, SEEK_SET) < 0 )
+		return -1;
+
+	return _read (fd, buf, length);
+#else
+	int count;
+
+	while ( (count = pread (fd, buf, length, (off_t) offset)) < 0 && errno == EINTR )
+		;
+
+	return count;
+#endif
+}
+
+
+/*
+ * Writes the whole buffer to the file at the specified offset. 
+ * Returns 0 on success.
+ */
+static int libirc_file_write_at (int fd, const void * buf, unsigned int length, unsigned long long offset)
+{
+	const char * ptr = (const char *) buf;
+
+#if defined (_WIN32)
+	if ( _lseeki64 (fd, offset, SEEK_SET) < 0 )
+		return -1;
+#endif
+
+	while ( length > 0 )
+	{
+#if defined (_WIN32)
+		int count = _write (fd, ptr, length);
+#else
+		int count = pwrite (fd, ptr, length, (off_t) offset);
+
+		if ( count < 0 && errno == EINTR )
+			continue;
+#endif
+		if ( count <= 0 )
+			return -1;
+
+		ptr += count;
+		offset += count;
+		length -= count;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Reserves the disk space for the file. Returns 0 on success, or if the
+ * preallocation is not supported by the platform or the file system.
+ */
+static int libirc_file_preallocate (int fd, unsigned long long size)
+{
+#if defined (LIBIRC_HAVE_FALLOCATE)
+	int err = posix_fallocate (fd, 0, (off_t) size);
+
+	if ( err && err != EOPNOTSUPP && err != EINVAL )
+		return -1;
+#endif
+
+	return 0;
+}
+
+
+/*
+ * Hints the kernel that the file is read sequentially, so it reads ahead
+ * more aggressively.
+ */
+static void libirc_file_advise_sequential (int fd)
+{
+#if defined (LIBIRC_HAVE_FADVISE)
+	posix_fadvise (fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+
+/*
+ * Asks the kernel to start reading the file range into the page cache in
+ * the background, so the following reads do not wait for the disk.
+ */
+static void libirc_file_prefetch (int fd, unsigned long long offset, unsigned long long length)
+{
+#if defined (LIBIRC_HAVE_FADVISE)
+	posix_fadvise (fd, (off_t) offset, (off_t) length, POSIX_FADV_WILLNEED);
+#endif
+}
+
+
+/*
+ * Returns the time in milliseconds since some unspecified point, which is
+ * only good for measuring the intervals.
+ */
+static unsigned long long libirc_time_ms (void)
+{
+#if defined (_WIN32)
+	return GetTickCount64 ();
+#elif defined (CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if ( clock_gettime (CLOCK_MONOTONIC, &ts) == 0 )
+		return (unsigned long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+#if !defined (_WIN32)
+	{
+		struct timeval tv;
+
+		gettimeofday (&tv, 0);
+		return (unsigned long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	}
+#endif
+}
+
+
 /*
  * Stub for WIN32 dll to initialize winsock API
  */
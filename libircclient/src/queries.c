@@ -0,0 +1,454 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * The queries with a completion callback. Their replies are collected like
+ * the aggregated ones, and are not passed to event_numeric. The server
+ * answers the queries in order, so without labeled-response a line belongs
+ * to the oldest query it could answer.
+ */
+
+#define LIBIRC_QUERY_LINE			0x00
+#define LIBIRC_QUERY_END			0x01	/* the last line of the reply */
+#define LIBIRC_QUERY_KEYED			0x02	/* params[1] is the target */
+#define LIBIRC_QUERY_SELF			0x04	/* the reply to MODE of our nick */
+
+
+typedef struct
+{
+	unsigned int	type;
+	unsigned int	code;
+	unsigned int	flags;
+} irc_query_numeric_t;
+
+
+static const irc_query_numeric_t libirc_query_numerics[] =
+{
+	{ LIBIRC_QUERY_WHOIS,	311,	LIBIRC_QUERY_KEYED },	// RPL_WHOISUSER
+	{ LIBIRC_QUERY_WHOIS,	312,	LIBIRC_QUERY_KEYED },	// RPL_WHOISSERVER
+	{ LIBIRC_QUERY_WHOIS,	313,	LIBIRC_QUERY_KEYED },	// RPL_WHOISOPERATOR
+	{ LIBIRC_QUERY_WHOIS,	317,	LIBIRC_QUERY_KEYED },	// RPL_WHOISIDLE
+	{ LIBIRC_QUERY_WHOIS,	319,	LIBIRC_QUERY_KEYED },	// RPL_WHOISCHANNELS
+	{ LIBIRC_QUERY_WHOIS,	301,	LIBIRC_QUERY_KEYED },	// RPL_AWAY
+	{ LIBIRC_QUERY_WHOIS,	276,	LIBIRC_QUERY_KEYED },	// RPL_WHOISCERTFP
+	{ LIBIRC_QUERY_WHOIS,	307,	LIBIRC_QUERY_KEYED },	// RPL_WHOISREGNICK
+	{ LIBIRC_QUERY_WHOIS,	310,	LIBIRC_QUERY_KEYED },	// RPL_WHOISHELPOP
+	{ LIBIRC_QUERY_WHOIS,	320,	LIBIRC_QUERY_KEYED },	// RPL_WHOISSPECIAL
+	{ LIBIRC_QUERY_WHOIS,	330,	LIBIRC_QUERY_KEYED },	// RPL_WHOISACCOUNT
+	{ LIBIRC_QUERY_WHOIS,	335,	LIBIRC_QUERY_KEYED },	// RPL_WHOISBOT
+	{ LIBIRC_QUERY_WHOIS,	338,	LIBIRC_QUERY_KEYED },	// RPL_WHOISACTUALLY
+	{ LIBIRC_QUERY_WHOIS,	378,	LIBIRC_QUERY_KEYED },	// RPL_WHOISHOST
+	{ LIBIRC_QUERY_WHOIS,	379,	LIBIRC_QUERY_KEYED },	// RPL_WHOISMODES
+	{ LIBIRC_QUERY_WHOIS,	671,	LIBIRC_QUERY_KEYED },	// RPL_WHOISSECURE
+	{ LIBIRC_QUERY_WHOIS,	401,	LIBIRC_QUERY_KEYED },	// ERR_NOSUCHNICK, RPL_ENDOFWHOIS follows
+	{ LIBIRC_QUERY_WHOIS,	318,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// RPL_ENDOFWHOIS
+	{ LIBIRC_QUERY_WHOIS,	402,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// ERR_NOSUCHSERVER
+
+	{ LIBIRC_QUERY_WHO,		352,	LIBIRC_QUERY_LINE },	// RPL_WHOREPLY
+	{ LIBIRC_QUERY_WHO,		354,	LIBIRC_QUERY_LINE },	// RPL_WHOSPCRPL
+	{ LIBIRC_QUERY_WHO,		315,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// RPL_ENDOFWHO
+
+	{ LIBIRC_QUERY_MODE,	324,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// RPL_CHANNELMODEIS
+	{ LIBIRC_QUERY_MODE,	221,	LIBIRC_QUERY_SELF | LIBIRC_QUERY_END },		// RPL_UMODEIS
+	{ LIBIRC_QUERY_MODE,	401,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// ERR_NOSUCHNICK
+	{ LIBIRC_QUERY_MODE,	403,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// ERR_NOSUCHCHANNEL
+	{ LIBIRC_QUERY_MODE,	442,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// ERR_NOTONCHANNEL
+	{ LIBIRC_QUERY_MODE,	477,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// ERR_NOCHANMODES
+	{ LIBIRC_QUERY_MODE,	482,	LIBIRC_QUERY_KEYED | LIBIRC_QUERY_END },	// ERR_CHANOPRIVSNEEDED
+	{ LIBIRC_QUERY_MODE,	502,	LIBIRC_QUERY_SELF | LIBIRC_QUERY_END },		// ERR_USERSDONTMATCH
+};
+
+
+static void libirc_query_unlink (irc_session_t * session, irc_query_entry_t * query)
+{
+	irc_query_entry_t ** link;
+
+	for ( link = &session->queries; *link; link = &(*link)->next )
+	{
+		if ( *link == query )
+		{
+			*link = query->next;
+			break;
+		}
+	}
+}
+
+
+/*
+ * Calls the callback of the unlinked query, unless it was cancelled, and
+ * frees the query.
+ */
+static void libirc_query_finish (irc_session_t * session, irc_query_entry_t * query, int status)
+{
+	if ( query->callback )
+		(*query->callback) (session, query->id, status, query->ctx, query->reply.lines, query->reply.count);
+
+	libirc_reply_release (session, &query->reply);
+	free (query);
+}
+
+
+/*
+ * Finds the labeled query by its label, or by the reference of the batch
+ * its reply comes in. Called with mutex_query locked.
+ */
+static irc_query_entry_t * libirc_query_labeled (irc_session_t * session, const char * label, const char * batch)
+{
+	irc_query_entry_t * query;
+
+	for ( query = session->queries; query; query = query->next )
+	{
+		if ( !query->labeled )
+			continue;
+
+		if ( label ? query->id == (irc_query_t) strtoul (label, 0, 10) : !strcmp (query->batch, batch) )
+			return query;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Finds the oldest query of the type the line could answer. Cancelled 
+ * queries still take their lines. Called with mutex_query locked.
+ */
+static irc_query_entry_t * libirc_query_oldest (irc_session_t * session, unsigned int type, const char * key, int self)
+{
+	irc_query_entry_t * query;
+
+	for ( query = session->queries; query; query = query->next )
+	{
+		if ( query->labeled || query->type != type )
+			continue;
+
+		if ( key && !libirc_state_equal (session, query->target, key, strlen (key)) )
+			continue;
+
+		if ( self && libirc_is_channel (session, query->target) )
+			continue;
+
+		return query;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Returns nonzero if the numeric is a part of a query reply, and so is not
+ * passed to event_numeric.
+ */
+static int libirc_query_numeric (irc_session_t * session, unsigned int code, const char ** params, unsigned int count)
+{
+	irc_query_entry_t * query = 0, * done = 0;
+	char value[64];
+	int end = 0;
+
+	libirc_mutex_lock (&session->mutex_query);
+
+	// RPL_CREATIONTIME follows the RPL_CHANNELMODEIS which ended the query
+	if ( session->query_mode_channel[0] )
+	{
+		int creation = code == 329 && count > 1
+			&& libirc_state_equal (session, session->query_mode_channel, params[1], strlen (params[1]));
+
+		session->query_mode_channel[0] = '\0';
+
+		if ( creation )
+		{
+			libirc_mutex_unlock (&session->mutex_query);
+			return 1;
+		}
+	}
+
+	if ( !session->queries )
+	{
+		libirc_mutex_unlock (&session->mutex_query);
+		return 0;
+	}
+
+	// A labeled reply of a single line, or a line of the labeled batch
+	if ( libirc_message_tag (session->message_tags, "label", value, sizeof(value)) == 0 )
+	{
+		query = libirc_query_labeled (session, value, 0);
+		end = 1;
+	}
+	else if ( libirc_message_tag (session->message_tags, "batch", value, sizeof(value)) == 0 )
+		query = libirc_query_labeled (session, 0, value);
+
+	if ( !query && !end )
+	{
+		unsigned int i;
+
+		for ( i = 0; !query && i < sizeof(libirc_query_numerics) / sizeof(libirc_query_numerics[0]); i++ )
+		{
+			const irc_query_numeric_t * n = libirc_query_numerics + i;
+
+			if ( n->code != code || ((n->flags & LIBIRC_QUERY_KEYED) && count < 2) )
+				continue;
+
+			query = libirc_query_oldest (session, n->type, 
+					(n->flags & LIBIRC_QUERY_KEYED) ? params[1] : 0, n->flags & LIBIRC_QUERY_SELF);
+			end = n->flags & LIBIRC_QUERY_END;
+		}
+
+		// A labeled reply of 324 and 329 comes in a batch, an unlabeled 
+		// one leaves the 329 to consume
+		if ( query && code == 324 )
+			snprintf (session->query_mode_channel, sizeof(session->query_mode_channel), "%s", params[1]);
+	}
+
+	if ( query )
+	{
+		// Out of memory, the line is lost but the reply still completes
+		libirc_reply_append (session, &query->reply, code, params, count);
+
+		if ( end )
+		{
+			libirc_query_unlink (session, query);
+			done = query;
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_query);
+
+	if ( done )
+		libirc_query_finish (session, done, 0);
+
+	return query != 0;
+}
+
+
+/*
+ * Follows the BATCH of a labeled reply, and the ACK of a query with no
+ * reply. Returns nonzero if the message is not to be dispatched.
+ */
+static int libirc_query_command (irc_session_t * session, const char * command, const char ** params, unsigned int count)
+{
+	irc_query_entry_t * query, * done = 0;
+	int batch = !strcmp (command, "BATCH"), consumed = 0;
+	char value[64];
+
+	libirc_mutex_lock (&session->mutex_query);
+
+	if ( libirc_message_tag (session->message_tags, "label", value, sizeof(value)) == 0
+	&& (query = libirc_query_labeled (session, value, 0)) != 0 )
+	{
+		if ( batch && count > 0 && params[0][0] == '+' )
+			snprintf (query->batch, sizeof(query->batch), "%s", params[0] + 1);
+		else
+		{
+			libirc_query_unlink (session, query);
+			done = query;
+		}
+
+		consumed = batch || !strcmp (command, "ACK");
+	}
+	else if ( batch && count > 0 && params[0][0] == '-' && params[0][1] != '\0'
+	&& (query = libirc_query_labeled (session, 0, params[0] + 1)) != 0 )
+	{
+		libirc_query_unlink (session, query);
+		done = query;
+		consumed = 1;
+	}
+
+	libirc_mutex_unlock (&session->mutex_query);
+
+	if ( done )
+		libirc_query_finish (session, done, 0);
+
+	return consumed;
+}
+
+
+/*
+ * Ends the queries which got no reply in time, so they do not take the
+ * lines of the next ones.
+ */
+static void libirc_query_timer (irc_session_t * session)
+{
+	irc_query_entry_t * query, * next, * expired = 0, ** tail = &expired;
+	time_t now = time (0);
+
+	libirc_mutex_lock (&session->mutex_query);
+
+	for ( query = session->queries; query; query = next )
+	{
+		next = query->next;
+
+		if ( now - query->started >= LIBIRC_QUERY_TIMEOUT )
+		{
+			libirc_query_unlink (session, query);
+			query->next = 0;
+			*tail = query;
+			tail = &query->next;
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_query);
+
+	for ( ; expired; expired = next )
+	{
+		next = expired->next;
+		libirc_query_finish (session, expired, LIBIRC_ERR_TIMEOUT);
+	}
+}
+
+
+/*
+ * Ends all the queries with the error, when the connection they were sent
+ * over is gone.
+ */
+static void libirc_query_abort (irc_session_t * session, int status)
+{
+	irc_query_entry_t * queries, * next;
+
+	libirc_mutex_lock (&session->mutex_query);
+	queries = session->queries;
+	session->queries = 0;
+	session->query_mode_channel[0] = '\0';
+	libirc_mutex_unlock (&session->mutex_query);
+
+	for ( ; queries; queries = next )
+	{
+		next = queries->next;
+		libirc_query_finish (session, queries, status);
+	}
+}
+
+
+static int libirc_query_send (irc_session_t * session, unsigned int type, const char * target, irc_query_callback_t callback, void * ctx, irc_query_t * id)
+{
+	irc_query_entry_t * query, ** link;
+	char label[32] = "";
+	size_t length;
+	irc_query_t qid;
+	int rc;
+
+	// A query with several targets could not be matched
+	if ( !target || !callback || !*target || strpbrk (target, " ,") )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	length = strlen (target);
+
+	if ( (query = calloc (1, sizeof(irc_query_entry_t) + length)) == 0 )
+	{
+		session->lasterror = LIBIRC_ERR_NOMEM;
+		return 1;
+	}
+
+	memcpy (query->target, target, length + 1);
+	query->type = type;
+	query->callback = callback;
+	query->ctx = ctx;
+	query->started = time (0);
+
+	// The labels are used once the server could send the reply in a batch
+	query->labeled = irc_cap_enabled (session, "labeled-response") && irc_cap_enabled (session, "batch");
+
+	// The query is linked before it is sent, so the reply finds it
+	libirc_mutex_lock (&session->mutex_query);
+
+	if ( ++session->query_last_id == 0 )
+		session->query_last_id++;
+
+	qid = query->id = session->query_last_id;
+
+	for ( link = &session->queries; *link; link = &(*link)->next )
+		;
+
+	*link = query;
+
+	libirc_mutex_unlock (&session->mutex_query);
+
+	if ( query->labeled )
+		sprintf (label, "@label=%u ", qid);
+
+	switch (type)
+	{
+	case LIBIRC_QUERY_WHOIS:
+		rc = irc_send_raw (session, "%sWHOIS %s %s", label, target, target);
+		break;
+
+	case LIBIRC_QUERY_WHO:
+		rc = irc_send_raw (session, "%sWHO %s", label, target);
+		break;
+
+	default:
+		rc = irc_send_raw (session, "%sMODE %s", label, target);
+		break;
+	}
+
+	if ( rc )
+	{
+		libirc_mutex_lock (&session->mutex_query);
+		libirc_query_unlink (session, query);
+		libirc_mutex_unlock (&session->mutex_query);
+
+		free (query);
+		return 1;
+	}
+
+	if ( id )
+		*id = qid;
+
+	return 0;
+}
+
+
+int irc_query_whois (irc_session_t * session, const char * nick, irc_query_callback_t callback, void * ctx, irc_query_t * query)
+{
+	return libirc_query_send (session, LIBIRC_QUERY_WHOIS, nick, callback, ctx, query);
+}
+
+
+int irc_query_who (irc_session_t * session, const char * mask, irc_query_callback_t callback, void * ctx, irc_query_t * query)
+{
+	return libirc_query_send (session, LIBIRC_QUERY_WHO, mask, callback, ctx, query);
+}
+
+
+int irc_query_mode (irc_session_t * session, const char * target, irc_query_callback_t callback, void * ctx, irc_query_t * query)
+{
+	return libirc_query_send (session, LIBIRC_QUERY_MODE, target, callback, ctx, query);
+}
+
+
+int irc_query_cancel (irc_session_t * session, irc_query_t id)
+{
+	irc_query_entry_t * query;
+
+	libirc_mutex_lock (&session->mutex_query);
+
+	for ( query = session->queries; query && query->id != id; query = query->next )
+		;
+
+	// The reply is still awaited, so it is not taken for another query's
+	if ( query )
+		query->callback = 0;
+
+	libirc_mutex_unlock (&session->mutex_query);
+
+	if ( !query )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,46 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_QUERIES_H
+#define INCLUDE_IRC_QUERIES_H
+
+
+#define LIBIRC_QUERY_WHOIS			1
+#define LIBIRC_QUERY_WHO			2
+#define LIBIRC_QUERY_MODE			3
+
+#define LIBIRC_QUERY_TIMEOUT		60
+
+
+/*
+ * A query waiting for its reply. With labeled-response the reply is found
+ * by the label, which is the query id; otherwise by the numerics and the
+ * target, the oldest query first.
+ */
+typedef struct irc_query_entry_s
+{
+	struct irc_query_entry_s *	next;
+	irc_query_t				id;
+	unsigned int			type;
+	int						labeled;
+	char					batch[64];	/* the labeled-response batch */
+	irc_query_callback_t	callback;	/* 0 if the query is cancelled */
+	void				  *	ctx;
+	time_t					started;
+	irc_reply_t				reply;		/* the lines, in the arena */
+	char					target[1];
+} irc_query_entry_t;
+
+
+#endif /* INCLUDE_IRC_QUERIES_H */
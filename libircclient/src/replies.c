@@ -0,0 +1,276 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * The multi-line replies, collected with LIBIRC_OPTION_AGGREGATE_REPLIES
+ * until the numeric which ends them, and delivered as one event. The lines
+ * of a reply are copied into an arena of large chunks, so a long LIST
+ * costs a few allocations instead of one per line.
+ */
+
+typedef struct
+{
+	unsigned int	line;
+	unsigned int	end;
+	unsigned int	key;	/* the param with the channel, or 0 */
+} irc_reply_kind_t;
+
+
+static const irc_reply_kind_t libirc_reply_kinds[] =
+{
+	{ 353, 366, 2 },	// RPL_NAMREPLY, RPL_ENDOFNAMES
+	{ 352, 315, 0 },	// RPL_WHOREPLY, RPL_ENDOFWHO
+	{ 354, 315, 0 },	// RPL_WHOSPCRPL, RPL_ENDOFWHO
+	{ 322, 323, 0 },	// RPL_LIST, RPL_LISTEND
+	{ 367, 368, 1 },	// RPL_BANLIST, RPL_ENDOFBANLIST
+	{ 348, 349, 1 },	// RPL_EXCEPTLIST, RPL_ENDOFEXCEPTLIST
+	{ 346, 347, 1 },	// RPL_INVITELIST, RPL_ENDOFINVITELIST
+};
+
+
+#define LIBIRC_REPLY_ALIGN(size)	(((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+
+static void * libirc_reply_alloc (irc_session_t * session, irc_reply_t * reply, size_t size)
+{
+	irc_arena_chunk_t * chunk = reply->arena;
+
+	size = LIBIRC_REPLY_ALIGN (size);
+
+	// A line is never longer than the chunk, as the server limits it
+	if ( size > LIBIRC_REPLY_CHUNK )
+		return 0;
+
+	if ( !chunk || chunk->used + size > LIBIRC_REPLY_CHUNK )
+	{
+		if ( session->reply_spare )
+		{
+			chunk = session->reply_spare;
+			session->reply_spare = 0;
+		}
+		else if ( (chunk = malloc (sizeof(irc_arena_chunk_t) + LIBIRC_REPLY_CHUNK)) == 0 )
+			return 0;
+
+		chunk->used = 0;
+		chunk->next = reply->arena;
+		reply->arena = chunk;
+	}
+
+	chunk->used += size;
+	return chunk->data + chunk->used - size;
+}
+
+
+static void libirc_reply_release (irc_session_t * session, irc_reply_t * reply)
+{
+	irc_arena_chunk_t * chunk, * next;
+
+	// One chunk is kept for the next reply
+	for ( chunk = reply->arena; chunk; chunk = next )
+	{
+		next = chunk->next;
+
+		if ( !session->reply_spare )
+			session->reply_spare = chunk;
+		else
+			free (chunk);
+	}
+
+	free (reply->lines);
+	reply->arena = 0;
+	reply->lines = 0;
+	reply->count = reply->size = 0;
+}
+
+
+static void libirc_reply_free (irc_session_t * session, irc_reply_t * reply)
+{
+	libirc_reply_release (session, reply);
+	free (reply);
+}
+
+
+static void libirc_reply_clear (irc_session_t * session)
+{
+	while ( session->replies )
+	{
+		irc_reply_t * reply = session->replies;
+
+		session->replies = reply->next;
+		libirc_reply_free (session, reply);
+	}
+}
+
+
+static irc_reply_t * libirc_reply_find (irc_session_t * session, unsigned int code, unsigned int end, const char * key)
+{
+	irc_reply_t * reply;
+
+	for ( reply = session->replies; reply; reply = reply->next )
+	{
+		if ( code ? reply->code != code : reply->end != end )
+			continue;
+
+		if ( !reply->key || (key && libirc_state_equal (session, reply->key, key, strlen (key))) )
+			return reply;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Copies the line, without our nick, into the arena of the reply. Returns
+ * nonzero if out of memory.
+ */
+static int libirc_reply_append (irc_session_t * session, irc_reply_t * reply, unsigned int code, const char ** params, unsigned int count)
+{
+	irc_reply_line_t * line;
+	const char ** copy;
+	size_t size = 0;
+	unsigned int i;
+	char * p;
+
+	if ( reply->count == reply->size )
+	{
+		unsigned int size = reply->size ? reply->size * 2 : 64;
+		irc_reply_line_t * lines = realloc (reply->lines, size * sizeof(irc_reply_line_t));
+
+		if ( !lines )
+			return 1;
+
+		reply->lines = lines;
+		reply->size = size;
+	}
+
+	if ( count == 0 )
+		count = 1;
+
+	// The pointers and the strings share one block
+	for ( i = 1; i < count; i++ )
+		size += strlen (params[i]) + 1;
+
+	if ( (copy = libirc_reply_alloc (session, reply, (count - 1) * sizeof(char*) + size)) == 0 )
+		return 1;
+
+	p = (char *) (copy + count - 1);
+
+	for ( i = 1; i < count; i++ )
+	{
+		size = strlen (params[i]) + 1;
+		memcpy (p, params[i], size);
+		copy[i - 1] = p;
+		p += size;
+	}
+
+	line = reply->lines + reply->count++;
+	line->code = code;
+	line->params = copy;
+	line->count = count - 1;
+	return 0;
+}
+
+
+/*
+ * Adds the line to the reply it belongs to. Returns nonzero if out of
+ * memory, and the line is then passed as a numeric.
+ */
+static int libirc_reply_add (irc_session_t * session, const irc_reply_kind_t * kind, const char ** params, unsigned int count)
+{
+	const char * key = kind->key ? params[kind->key] : 0;
+	irc_reply_t * reply = libirc_reply_find (session, kind->line, 0, key);
+	char * p;
+
+	if ( !reply )
+	{
+		if ( (reply = calloc (1, sizeof(irc_reply_t))) == 0 )
+			return 1;
+
+		reply->code = kind->line;
+		reply->end = kind->end;
+
+		if ( key && (p = libirc_reply_alloc (session, reply, strlen (key) + 1)) != 0 )
+		{
+			strcpy (p, key);
+			reply->key = p;
+		}
+
+		if ( key && !reply->key )
+		{
+			libirc_reply_free (session, reply);
+			return 1;
+		}
+
+		reply->next = session->replies;
+		session->replies = reply;
+	}
+
+	return libirc_reply_append (session, reply, kind->line, params, count);
+}
+
+
+static void libirc_reply_end (irc_session_t * session, const irc_reply_kind_t * kind, const char ** params, unsigned int count)
+{
+	// The key goes before the text, and RPL_LISTEND has none
+	const char * key = count > 2 ? params[1] : "";
+	irc_reply_t * reply = libirc_reply_find (session, 0, kind->end, kind->key ? key : 0), ** link;
+
+	// The reply could have no lines at all
+	if ( !reply )
+	{
+		(*session->callbacks.event_reply) (session, kind->line, key, 0, 0);
+		return;
+	}
+
+	for ( link = &session->replies; *link != reply; link = &(*link)->next )
+		;
+
+	*link = reply->next;
+
+	(*session->callbacks.event_reply) (session, reply->code, key, reply->lines, reply->count);
+	libirc_reply_free (session, reply);
+}
+
+
+/*
+ * Returns nonzero if the numeric is a part of a reply being collected, and
+ * so is not passed to event_numeric.
+ */
+static int libirc_reply_numeric (irc_session_t * session, unsigned int code, const char ** params, unsigned int count)
+{
+	unsigned int i;
+
+	if ( !(session->options & LIBIRC_OPTION_AGGREGATE_REPLIES) || !session->callbacks.event_reply )
+		return 0;
+
+	// RPL_LISTSTART carries nothing
+	if ( code == 321 )
+		return 1;
+
+	for ( i = 0; i < sizeof(libirc_reply_kinds) / sizeof(libirc_reply_kinds[0]); i++ )
+	{
+		const irc_reply_kind_t * kind = libirc_reply_kinds + i;
+
+		if ( code == kind->line && count > kind->key )
+			return libirc_reply_add (session, kind, params, count) == 0;
+
+		if ( code == kind->end )
+		{
+			libirc_reply_end (session, kind, params, count);
+			return 1;
+		}
+	}
+
+	return 0;
+}
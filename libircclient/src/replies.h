@@ -0,0 +1,51 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_REPLIES_H
+#define INCLUDE_IRC_REPLIES_H
+
+
+#define LIBIRC_REPLY_CHUNK			65536
+
+
+/*
+ * A block of the arena the lines of a reply are kept in. The whole arena
+ * is freed at once when the reply is delivered.
+ */
+typedef struct irc_arena_chunk_s
+{
+	struct irc_arena_chunk_s *	next;
+	size_t				used;
+	char				data[1];
+} irc_arena_chunk_t;
+
+
+/*
+ * A reply being collected, keyed by the channel. WHO and LIST are not
+ * keyed, as the servers answer them one at a time.
+ */
+typedef struct irc_reply_s
+{
+	struct irc_reply_s *	next;
+	unsigned int		code;		/* the numeric of the lines */
+	unsigned int		end;		/* the numeric which ends them */
+	const char		  *	key;		/* the channel, in the arena, or 0 */
+	irc_reply_line_t  *	lines;
+	unsigned int		count;
+	unsigned int		size;
+	irc_arena_chunk_t *	arena;
+} irc_reply_t;
+
+
+#endif /* INCLUDE_IRC_REPLIES_H */
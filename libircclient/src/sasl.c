@@ -0,0 +1,621 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+/*
+ * The SASL authentication with the PLAIN, EXTERNAL and SCRAM-SHA-256 
+ * mechanisms, started when the server acknowledges the "sasl" capability.
+ * The capability negotiation, and so the registration, waits until the
+ * server tells the result.
+ */
+
+#define LIBIRC_SASL_CHUNK				400		/* the longest AUTHENTICATE data */
+#define LIBIRC_SASL_MAX_INCOMING		8192
+#define LIBIRC_SCRAM_MAX_ITERATIONS		1000000
+
+
+static const char * libirc_sasl_names[] = { 0, "PLAIN", "EXTERNAL", "SCRAM-SHA-256" };
+
+static const char libirc_base64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+/*
+ * Encodes into out, which needs (length + 2) / 3 * 4 + 1 bytes. Returns the
+ * length of the result.
+ */
+static size_t libirc_base64_encode (char * out, const unsigned char * in, size_t length)
+{
+	char * start = out;
+	size_t i;
+
+	for ( i = 0; i + 2 < length; i += 3 )
+	{
+		unsigned int v = (in[i] << 16) | (in[i+1] << 8) | in[i+2];
+
+		*out++ = libirc_base64_chars[v >> 18];
+		*out++ = libirc_base64_chars[(v >> 12) & 0x3F];
+		*out++ = libirc_base64_chars[(v >> 6) & 0x3F];
+		*out++ = libirc_base64_chars[v & 0x3F];
+	}
+
+	if ( i < length )
+	{
+		unsigned int v = (in[i] << 16) | (i + 1 < length ? in[i+1] << 8 : 0);
+
+		*out++ = libirc_base64_chars[v >> 18];
+		*out++ = libirc_base64_chars[(v >> 12) & 0x3F];
+		*out++ = i + 1 < length ? libirc_base64_chars[(v >> 6) & 0x3F] : '=';
+		*out++ = '=';
+	}
+
+	*out = '\0';
+	return out - start;
+}
+
+
+/*
+ * Decodes into out, which needs length * 3 / 4 + 1 bytes, and terminates
+ * it, as most of the payloads are text. Returns the length, or -1.
+ */
+static int libirc_base64_decode (unsigned char * out, const char * in, size_t length)
+{
+	unsigned int v = 0, bits = 0;
+	int used = 0;
+	size_t i;
+
+	for ( i = 0; i < length && in[i] != '='; i++ )
+	{
+		const char * c;
+
+		if ( in[i] == '\0' || (c = strchr (libirc_base64_chars, in[i])) == 0 )
+			return -1;
+
+		v = (v << 6) | (unsigned int) (c - libirc_base64_chars);
+		bits += 6;
+
+		if ( bits >= 8 )
+		{
+			bits -= 8;
+			out[used++] = (unsigned char) (v >> bits);
+		}
+	}
+
+	out[used] = '\0';
+	return used;
+}
+
+
+static int libirc_hmac_sha256 (const unsigned char * key, size_t keylen, const void * data, size_t length, unsigned char * digest)
+{
+	unsigned char pad[64], inner[LIBIRC_SHA256_SIZE];
+	libirc_sha256_t sha;
+	unsigned int i;
+
+	// The keys longer than the block are hashed first
+	if ( keylen > sizeof(pad) )
+	{
+		if ( libirc_sha256_init (&sha) )
+			return 1;
+
+		libirc_sha256_update (&sha, key, keylen);
+		libirc_sha256_result (&sha, inner);
+		libirc_sha256_free (&sha);
+
+		key = inner;
+		keylen = sizeof(inner);
+	}
+
+	memset (pad, 0, sizeof(pad));
+	memcpy (pad, key, keylen);
+
+	for ( i = 0; i < sizeof(pad); i++ )
+		pad[i] ^= 0x36;
+
+	if ( libirc_sha256_init (&sha) )
+		return 1;
+
+	libirc_sha256_update (&sha, pad, sizeof(pad));
+	libirc_sha256_update (&sha, data, length);
+	libirc_sha256_result (&sha, inner);
+	libirc_sha256_free (&sha);
+
+	for ( i = 0; i < sizeof(pad); i++ )
+		pad[i] ^= 0x36 ^ 0x5C;
+
+	if ( libirc_sha256_init (&sha) )
+		return 1;
+
+	libirc_sha256_update (&sha, pad, sizeof(pad));
+	libirc_sha256_update (&sha, inner, sizeof(inner));
+	libirc_sha256_result (&sha, digest);
+	libirc_sha256_free (&sha);
+	return 0;
+}
+
+
+/*
+ * The SCRAM Hi() function, which is PBKDF2 with HMAC-SHA-256 and a single
+ * output block.
+ */
+static int libirc_scram_hi (const char * password, const unsigned char * salt, size_t saltlen, unsigned long iterations, unsigned char * result)
+{
+	unsigned char u[LIBIRC_SHA256_SIZE], * first = malloc (saltlen + 4);
+	size_t pwlen = strlen (password);
+	unsigned long i;
+	unsigned int j;
+	int rc;
+
+	if ( !first )
+		return 1;
+
+	// U1 is computed over the salt and the block number 1
+	memcpy (first, salt, saltlen);
+	first[saltlen] = first[saltlen + 1] = first[saltlen + 2] = 0;
+	first[saltlen + 3] = 1;
+
+	rc = libirc_hmac_sha256 ((const unsigned char *) password, pwlen, first, saltlen + 4, u);
+	memcpy (result, u, sizeof(u));
+
+	for ( i = 1; rc == 0 && i < iterations; i++ )
+	{
+		rc = libirc_hmac_sha256 ((const unsigned char *) password, pwlen, u, sizeof(u), u);
+
+		for ( j = 0; j < sizeof(u); j++ )
+			result[j] ^= u[j];
+	}
+
+	free (first);
+	return rc;
+}
+
+
+/*
+ * Fills the buffer for the SCRAM nonce, which needs to be unpredictable.
+ */
+static void libirc_sasl_random (unsigned char * buf, size_t length)
+{
+	unsigned int seed;
+	size_t i;
+
+#if defined (ENABLE_SSL)
+	if ( RAND_bytes (buf, (int) length) == 1 )
+		return;
+#elif !defined (_WIN32)
+	FILE * fp = fopen ("/dev/urandom", "rb");
+
+	if ( fp )
+	{
+		size_t got = fread (buf, 1, length, fp);
+
+		fclose (fp);
+
+		if ( got == length )
+			return;
+	}
+#endif
+
+	// Not as good, but keeps the nonce unique at least
+	seed = (unsigned int) time (0) ^ (unsigned int) clock () ^ (unsigned int) (size_t) buf;
+
+	for ( i = 0; i < length; i++ )
+	{
+		seed = seed * 1103515245 + 12345;
+		buf[i] = (unsigned char) (seed >> 16);
+	}
+}
+
+
+/*
+ * Sends the payload base64-encoded, split in the 400 byte lines. A shorter
+ * line ends it, so an empty one, "+", follows a multiple of 400 bytes.
+ */
+static int libirc_sasl_send (irc_session_t * session, const void * payload, size_t length)
+{
+	char * encoded, * p;
+	size_t left;
+	int rc = 0;
+
+	if ( length == 0 )
+		return irc_send_raw (session, "AUTHENTICATE +");
+
+	if ( (encoded = malloc ((length + 2) / 3 * 4 + 1)) == 0 )
+		return 1;
+
+	left = libirc_base64_encode (encoded, payload, length);
+
+	for ( p = encoded; rc == 0 && left > 0; )
+	{
+		size_t chunk = left > LIBIRC_SASL_CHUNK ? LIBIRC_SASL_CHUNK : left;
+
+		rc = irc_send_raw (session, "AUTHENTICATE %.*s", (int) chunk, p);
+		p += chunk;
+		left -= chunk;
+	}
+
+	if ( rc == 0 && (p - encoded) % LIBIRC_SASL_CHUNK == 0 )
+		rc = irc_send_raw (session, "AUTHENTICATE +");
+
+	free (encoded);
+	return rc;
+}
+
+
+/*
+ * SCRAM: sends the client-first-message, which is the GS2 header "n,,"
+ * (no channel binding) and the bare message n=user,r=nonce.
+ */
+static int libirc_scram_first (irc_session_t * session)
+{
+	irc_sasl_t * sasl = &session->sasl;
+	unsigned char random[18];
+	char nonce[25], * p;
+	const char * u;
+
+	libirc_sasl_random (random, sizeof(random));
+	sasl->nonce_length = libirc_base64_encode (nonce, random, sizeof(random));
+
+	// The ',' and '=' in the user name are escaped, which triples them
+	if ( (p = sasl->client_first = malloc (strlen (sasl->user) * 3 + sasl->nonce_length + 16)) == 0 )
+		return 1;
+
+	p += sprintf (p, "n,,n=");
+
+	for ( u = sasl->user; *u; u++ )
+	{
+		if ( *u == ',' )
+			p += sprintf (p, "=2C");
+		else if ( *u == '=' )
+			p += sprintf (p, "=3D");
+		else
+			*p++ = *u;
+	}
+
+	p += sprintf (p, ",r=%s", nonce);
+	return libirc_sasl_send (session, sasl->client_first, p - sasl->client_first);
+}
+
+
+/*
+ * SCRAM: answers the server-first-message, r=nonce,s=salt,i=iterations,
+ * with the proof we know the password. The signature the server should
+ * answer with is kept to check it.
+ */
+static int libirc_scram_final (irc_session_t * session, const char * server_first)
+{
+	irc_sasl_t * sasl = &session->sasl;
+	const char * nonce = 0, * salt = 0, * p, * mine, * bare = sasl->client_first + 3;
+	size_t noncelen = 0, saltlen = 0, finallen;
+	unsigned long iterations = 0;
+	unsigned char salted[LIBIRC_SHA256_SIZE], client_key[LIBIRC_SHA256_SIZE];
+	unsigned char stored_key[LIBIRC_SHA256_SIZE], server_key[LIBIRC_SHA256_SIZE];
+	unsigned char signature[LIBIRC_SHA256_SIZE];
+	unsigned char * saltbuf;
+	char * final, * auth;
+	libirc_sha256_t sha;
+	int rc = 1, i;
+
+	for ( p = server_first; *p; )
+	{
+		size_t field = strcspn (p, ",");
+
+		if ( field > 2 && p[1] == '=' )
+		{
+			if ( p[0] == 'r' )
+			{
+				nonce = p + 2;
+				noncelen = field - 2;
+			}
+			else if ( p[0] == 's' )
+			{
+				salt = p + 2;
+				saltlen = field - 2;
+			}
+			else if ( p[0] == 'i' )
+				iterations = strtoul (p + 2, 0, 10);
+		}
+
+		p += field;
+
+		if ( *p == ',' )
+			p++;
+	}
+
+	// The server nonce must start with ours
+	mine = sasl->client_first + strlen (sasl->client_first) - sasl->nonce_length;
+
+	if ( !nonce || !salt || iterations == 0 || iterations > LIBIRC_SCRAM_MAX_ITERATIONS
+	|| noncelen <= sasl->nonce_length || strncmp (nonce, mine, sasl->nonce_length) )
+		return 1;
+
+	saltbuf = malloc (saltlen * 3 / 4 + 1);
+	final = malloc (noncelen + 64);
+	auth = malloc (strlen (bare) + strlen (server_first) + noncelen + 16);
+
+	if ( saltbuf && final && auth
+	&& (i = libirc_base64_decode (saltbuf, salt, saltlen)) > 0
+	&& libirc_scram_hi (sasl->password, saltbuf, i, iterations, salted) == 0
+	&& libirc_hmac_sha256 (salted, sizeof(salted), "Client Key", 10, client_key) == 0
+	&& libirc_hmac_sha256 (salted, sizeof(salted), "Server Key", 10, server_key) == 0
+	&& libirc_sha256_init (&sha) == 0 )
+	{
+		libirc_sha256_update (&sha, client_key, sizeof(client_key));
+		libirc_sha256_result (&sha, stored_key);
+		libirc_sha256_free (&sha);
+
+		// The client-final-message-without-proof; "biws" is the encoded "n,,"
+		finallen = sprintf (final, "c=biws,r=%.*s", (int) noncelen, nonce);
+
+		// The AuthMessage is signed by both sides
+		sprintf (auth, "%s,%s,%s", bare, server_first, final);
+
+		if ( libirc_hmac_sha256 (stored_key, sizeof(stored_key), auth, strlen (auth), signature) == 0
+		&& libirc_hmac_sha256 (server_key, sizeof(server_key), auth, strlen (auth), sasl->server_signature) == 0 )
+		{
+			// ClientProof is ClientKey XOR ClientSignature
+			for ( i = 0; i < LIBIRC_SHA256_SIZE; i++ )
+				signature[i] ^= client_key[i];
+
+			finallen += sprintf (final + finallen, ",p=");
+			finallen += libirc_base64_encode (final + finallen, signature, sizeof(signature));
+
+			rc = libirc_sasl_send (session, final, finallen);
+		}
+	}
+
+	memset (salted, 0, sizeof(salted));
+	memset (client_key, 0, sizeof(client_key));
+
+	free (saltbuf);
+	free (final);
+	free (auth);
+	return rc;
+}
+
+
+/*
+ * SCRAM: checks the server-final-message, v=signature, which proves the
+ * server knows the password too, and ends the exchange.
+ */
+static int libirc_scram_verify (irc_session_t * session, const char * server_final)
+{
+	char expected[LIBIRC_SHA256_SIZE * 2];
+	size_t length = libirc_base64_encode (expected, session->sasl.server_signature, LIBIRC_SHA256_SIZE);
+
+	if ( strncmp (server_final, "v=", 2)
+	|| strcspn (server_final + 2, ",") != length
+	|| strncmp (server_final + 2, expected, length) )
+		return 1;
+
+	return libirc_sasl_send (session, 0, 0);
+}
+
+
+/*
+ * Answers the server data, decoded. Nonzero aborts the authentication.
+ */
+static int libirc_sasl_step (irc_session_t * session, const char * data)
+{
+	irc_sasl_t * sasl = &session->sasl;
+	int step = sasl->step++;
+
+	switch ( sasl->mechanism )
+	{
+	case LIBIRC_SASL_PLAIN:
+		// authzid NUL authcid NUL password, the authzid left empty
+		if ( step == 0 )
+		{
+			size_t userlen = strlen (sasl->user), pwlen = strlen (sasl->password);
+			char * payload = malloc (userlen + pwlen + 2);
+			int rc;
+
+			if ( !payload )
+				return 1;
+
+			payload[0] = '\0';
+			memcpy (payload + 1, sasl->user, userlen + 1);
+			memcpy (payload + userlen + 2, sasl->password, pwlen);
+
+			rc = libirc_sasl_send (session, payload, userlen + pwlen + 2);
+
+			memset (payload, 0, userlen + pwlen + 2);
+			free (payload);
+			return rc;
+		}
+		break;
+
+	case LIBIRC_SASL_EXTERNAL:
+		// The client certificate tells who we are; the user is the authzid
+		if ( step == 0 )
+			return libirc_sasl_send (session, sasl->user, sasl->user ? strlen (sasl->user) : 0);
+		break;
+
+	case LIBIRC_SASL_SCRAM_SHA_256:
+		if ( step == 0 )
+			return libirc_scram_first (session);
+
+		if ( step == 1 )
+			return libirc_scram_final (session, data);
+
+		if ( step == 2 )
+			return libirc_scram_verify (session, data);
+		break;
+	}
+
+	// The server wants more than the mechanism has
+	return 1;
+}
+
+
+static void libirc_sasl_abort (irc_session_t * session)
+{
+	session->sasl.aborted = 1;
+	irc_send_raw (session, "AUTHENTICATE *");
+}
+
+
+/*
+ * Forgets the authentication of the previous connection; the credentials
+ * stay for the next. Called with mutex_isupport locked.
+ */
+static void libirc_sasl_reset (irc_sasl_t * sasl)
+{
+	free (sasl->incoming);
+	free (sasl->client_first);
+
+	sasl->incoming = 0;
+	sasl->incoming_length = 0;
+	sasl->client_first = 0;
+	sasl->nonce_length = 0;
+	sasl->state = SASL_IDLE;
+	sasl->step = 0;
+	sasl->aborted = 0;
+	memset (sasl->server_signature, 0, sizeof(sasl->server_signature));
+}
+
+
+static void libirc_sasl_forget (irc_sasl_t * sasl)
+{
+	libirc_sasl_reset (sasl);
+
+	if ( sasl->password )
+	{
+		memset (sasl->password, 0, strlen (sasl->password));
+		free (sasl->password);
+	}
+
+	free (sasl->user);
+
+	sasl->user = 0;
+	sasl->password = 0;
+	sasl->mechanism = 0;
+}
+
+
+/*
+ * Starts the authentication once the server acknowledged the capability.
+ * The mechanisms are the value of the capability, like "PLAIN,EXTERNAL",
+ * if the server listed them. Called with mutex_isupport locked.
+ */
+static void libirc_sasl_start (irc_session_t * session, const char * mechanisms)
+{
+	irc_sasl_t * sasl = &session->sasl;
+	const char * name = libirc_sasl_names[sasl->mechanism];
+
+	if ( !sasl->mechanism || sasl->state != SASL_IDLE )
+		return;
+
+	sasl->state = SASL_FAILED;
+
+	if ( mechanisms )
+	{
+		size_t length = strlen (name);
+
+		while ( *mechanisms && *mechanisms != ' ' )
+		{
+			size_t entry = strcspn (mechanisms, ", ");
+
+			if ( entry == length && !strncmp (mechanisms, name, length) )
+				break;
+
+			mechanisms += entry;
+
+			if ( *mechanisms == ',' )
+				mechanisms++;
+		}
+
+		if ( !*mechanisms || *mechanisms == ' ' )
+			return;
+	}
+
+	if ( irc_send_raw (session, "AUTHENTICATE %s", name) == 0 )
+		sasl->state = SASL_IN_PROGRESS;
+}
+
+
+/*
+ * AUTHENTICATE: the server data, base64-encoded. A 400 byte line means
+ * more follow, and "+" is empty.
+ */
+static void libirc_sasl_authenticate (irc_session_t * session, const char ** params, unsigned int count)
+{
+	irc_sasl_t * sasl = &session->sasl;
+	unsigned char * data = 0;
+	size_t length;
+	char * grown;
+
+	if ( count < 1 )
+		return;
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	if ( sasl->state != SASL_IN_PROGRESS || sasl->aborted )
+	{
+		libirc_mutex_unlock (&session->mutex_isupport);
+		return;
+	}
+
+	length = strcmp (params[0], "+") ? strlen (params[0]) : 0;
+
+	if ( sasl->incoming_length + length > LIBIRC_SASL_MAX_INCOMING
+	|| (grown = realloc (sasl->incoming, sasl->incoming_length + length + 1)) == 0 )
+	{
+		libirc_sasl_abort (session);
+		libirc_mutex_unlock (&session->mutex_isupport);
+		return;
+	}
+
+	memcpy (grown + sasl->incoming_length, params[0], length);
+	sasl->incoming = grown;
+	sasl->incoming_length += length;
+
+	if ( length < LIBIRC_SASL_CHUNK )
+	{
+		if ( (data = malloc (sasl->incoming_length * 3 / 4 + 1)) == 0
+		|| libirc_base64_decode (data, sasl->incoming, sasl->incoming_length) < 0
+		|| libirc_sasl_step (session, (const char *) data) )
+			libirc_sasl_abort (session);
+
+		free (data);
+		free (sasl->incoming);
+		sasl->incoming = 0;
+		sasl->incoming_length = 0;
+	}
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+}
+
+
+/*
+ * The SASL result numerics. Returns nonzero when the authentication is
+ * over, so the negotiation could end.
+ */
+static int libirc_sasl_numeric (irc_session_t * session, int code)
+{
+	irc_sasl_t * sasl = &session->sasl;
+	int done = 1;
+
+	libirc_mutex_lock (&session->mutex_isupport);
+
+	if ( sasl->state != SASL_IN_PROGRESS )
+		done = 0;
+	else if ( code == 903 || code == 907 )	// RPL_SASLSUCCESS, ERR_SASLALREADY
+		sasl->state = sasl->aborted ? SASL_FAILED : SASL_SUCCEEDED;
+	else if ( code == 902 || code == 904 || code == 905 || code == 906 )
+		sasl->state = SASL_FAILED;
+	else
+		done = 0;
+
+	libirc_mutex_unlock (&session->mutex_isupport);
+	return done;
+}
@@ -0,0 +1,49 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_SASL_H
+#define INCLUDE_IRC_SASL_H
+
+
+// The SASL authentication states
+#define SASL_IDLE				0
+#define SASL_IN_PROGRESS		1
+#define SASL_SUCCEEDED			2
+#define SASL_FAILED				3
+
+
+/*
+ * The SASL authentication of a session, done during the capability
+ * negotiation, before the registration completes.
+ */
+typedef struct
+{
+	int				mechanism;		/* LIBIRC_SASL_*, or 0 if not used */
+	char		  *	user;
+	char		  *	password;
+
+	int				state;			/* SASL_* */
+	int				step;			/* the exchanges done in this authentication */
+	int				aborted;		/* we sent AUTHENTICATE *, waiting for the reply */
+
+	char		  *	incoming;		/* the server data split over several lines */
+	size_t			incoming_length;
+
+	char		  *	client_first;	/* SCRAM: the client-first-message, "n,," and the bare one */
+	size_t			nonce_length;	/* SCRAM: the length of our nonce in it */
+	unsigned char	server_signature[LIBIRC_SHA256_SIZE];
+} irc_sasl_t;
+
+
+#endif /* INCLUDE_IRC_SASL_H */
@@ -18,7 +18,16 @@
 
 
 #include "params.h"
+#include "digest.h"
 #include "dcc.h"
+#include "state.h"
+#include "isupport.h"
+#include "sasl.h"
+#include "monitor.h"
+#include "replies.h"
+#include "queries.h"
+#include "batch.h"
+#include "netsplit.h"
 #include "libirc_events.h"
 
 
@@ -28,6 +37,8 @@
 #define SESSIONFL_SSL_WRITE_WANTS_READ	(0x00000004)
 #define SESSIONFL_SSL_READ_WANTS_WRITE	(0x00000008)
 #define SESSIONFL_USES_IPV6				(0x00000010)
+#define SESSIONFL_CAP_NEGOTIATING		(0x00000020)
+#define SESSIONFL_CAP_LISTED			(0x00000040)
 
 
 
@@ -35,11 +46,13 @@ struct irc_session_s
 {
 	void		*	ctx;
 	int				dcc_timeout;
+	unsigned int	dcc_send_window;
+	unsigned int	dcc_buffer_size;
 
 	int				options;
 	int				lasterror;
 
-	char 			incoming_buf[LIBIRC_BUFFER_SIZE];
+	char 			incoming_buf[LIBIRC_LINE_SIZE];
 	unsigned int	incoming_offset;
 
 	char 			outgoing_buf[LIBIRC_BUFFER_SIZE];
@@ -55,6 +68,8 @@ struct irc_session_s
 	char 		  *	realname;
 	char		  * username;
 	char		  *	nick;
+	char		  *	nick_folded;		/* our nick in the CASEMAPPING lower case, in the nick block */
+	size_t			nick_length;
 	char		  * ctcp_version;
 
 #if defined( ENABLE_IPV6 )
@@ -62,14 +77,72 @@ struct irc_session_s
 #endif
 
 	struct in_addr	local_addr;
-	irc_dcc_t		dcc_last_id;
-	irc_dcc_session_t * dcc_sessions;
-	port_mutex_t	mutex_dcc;
+	irc_dcc_slot_t *	dcc_slots;		/* DCC sessions, indexed by the low bits of id */
+	unsigned int	dcc_slots_count;
+	unsigned int	dcc_free_slot;		/* first free slot index plus 1, or 0 */
+	port_mutex_t	mutex_dcc;			/* protects the slots; taken before any DCC lock */
+	char		  *	dcc_buffer_pool;	/* free file buffers, chained through their first bytes */
+	unsigned int	dcc_buffer_pool_count;
+	port_mutex_t	mutex_dcc_pool;		/* protects the pool; taken after any DCC lock */
+	irc_dcc_file_t *	dcc_files;		/* files being sent, shared by the transfers */
+	port_mutex_t	mutex_dcc_files;	/* protects the files; taken after any DCC lock */
+
+	unsigned int	dcc_max_sends;		/* concurrent DCC SEND limits, 0 if unlimited */
+	unsigned int	dcc_max_sends_per_nick;
+	unsigned int	dcc_queue_seq;		/* order of the queued DCC SENDs */
+	unsigned int	dcc_queue_changes;	/* nonzero until the scheduler finds the queue empty */
+	irc_dcc_bucket_t	dcc_rate_limit;	/* total DCC send rate cap */
+	port_mutex_t	mutex_dcc_limits;	/* protects the above; taken after any DCC lock */
+	irc_dcc_queue_entry_t *	dcc_schedule_queue;		/* scheduler arrays, grown with the slots */
+	irc_dcc_queue_entry_t *	dcc_schedule_active;
+	unsigned int	dcc_schedule_size;
+
+	irc_dcc_io_t  *	dcc_io_queue;		/* file I/O jobs for the I/O thread */
+	irc_dcc_io_t  *	dcc_io_queue_tail;
+	port_mutex_t	mutex_dcc_io;		/* protects the queue and the job states */
+#if defined (LIBIRC_HAVE_DCC_IO_THREAD)
+	pthread_t		dcc_io_thread;
+	pthread_cond_t	dcc_io_cond;
+	int				dcc_io_pipe[2];		/* wakes up the event loop when a job is done */
+	int				dcc_io_started;
+	int				dcc_io_stop;
+#endif
+
+	irc_state_t		tracker;			/* channels and users, with LIBIRC_OPTION_TRACK_STATE */
+	port_mutex_t	mutex_state;		/* protects the tracker */
+
+	irc_isupport_t	isupport;			/* the server features */
+	port_mutex_t	mutex_isupport;		/* protects the feature tokens, the capabilities and SASL */
+
+	char		  *	cap_wanted;			/* the capabilities the application wants */
+	char		  *	cap_available;		/* the ones the server has, with the values */
+	char		  *	cap_enabled;
+	unsigned int	cap_pending;		/* CAP REQ not answered yet */
+	const char	  *	message_tags;		/* the tags of the message being dispatched */
+	irc_sasl_t		sasl;
+
+	irc_monitor_t	monitor;			/* the nicks whose presence is followed */
+	port_mutex_t	mutex_monitor;
+
+	irc_reply_t	  *	replies;			/* the replies being collected, event loop only */
+	irc_arena_chunk_t * reply_spare;
+
+	irc_query_entry_t * queries;		/* the queries waiting for the replies, oldest first */
+	char			query_mode_channel[128];	/* the channel of the MODE query 324 just ended */
+	irc_query_t		query_last_id;
+	port_mutex_t	mutex_query;
+
+	irc_batch_t	  *	batches;			/* the batches being collected, event loop only */
+
+	irc_netsplit_t *	netsplits;			/* the splits being delivered or remembered, event loop only */
+	irc_hash_table_t	netsplit_nicks;		/* the split users expected back */
 
 	irc_callbacks_t	callbacks;
 
 #if defined (ENABLE_SSL)
 	SSL 		 *	ssl;
+	char		  *	ssl_cert;			/* the client certificate and key files, PEM */
+	char		  *	ssl_key;
 #endif
 
 	
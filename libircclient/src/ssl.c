@@ -204,6 +204,13 @@ static int ssl_init( irc_session_t * session )
 	if ( !session->ssl )
 		return LIBIRC_ERR_SSL_INIT_FAILED;
 
+	// The client certificate identifies us, like for SASL EXTERNAL
+	if ( session->ssl_cert
+	&& (SSL_use_certificate_file( session->ssl, session->ssl_cert, SSL_FILETYPE_PEM ) != 1
+		|| SSL_use_PrivateKey_file( session->ssl, session->ssl_key ? session->ssl_key : session->ssl_cert, SSL_FILETYPE_PEM ) != 1
+		|| SSL_check_private_key( session->ssl ) != 1) )
+		return LIBIRC_ERR_SSL_INIT_FAILED;
+
 	// Let OpenSSL use our socket
 	if ( SSL_set_fd( session->ssl, session->sock) != 1 )
 		return LIBIRC_ERR_SSL_INIT_FAILED;
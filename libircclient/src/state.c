@@ -0,0 +1,1063 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#define LIBIRC_STATE_TRACKED(s)		((s)->options & LIBIRC_OPTION_TRACK_STATE)
+
+
+static unsigned int libirc_state_hash (irc_session_t * session, const char * name, size_t length, int fold)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	// FNV-1a
+	for ( i = 0; i < length; i++ )
+		hash = (hash ^ (fold ? libirc_casefold (session, name[i]) : (unsigned char) name[i])) * 16777619u;
+
+	return hash;
+}
+
+
+/*
+ * Compares the stored 0-terminated name with the name of the specified
+ * length, ignoring the case.
+ */
+static int libirc_state_equal (irc_session_t * session, const char * stored, const char * name, size_t length)
+{
+	size_t i;
+
+	for ( i = 0; i < length; i++ )
+		if ( libirc_casefold (session, stored[i]) != libirc_casefold (session, name[i]) )
+			return 0;
+
+	return stored[length] == '\0';
+}
+
+
+static int libirc_hash_insert (irc_hash_table_t * table, irc_hash_entry_t * entry)
+{
+	unsigned int index;
+
+	if ( table->count >= table->size )
+	{
+		unsigned int size = table->size ? table->size * 2 : 16, i;
+		irc_hash_entry_t ** buckets = calloc (size, sizeof(irc_hash_entry_t *));
+
+		// Without the memory the old table just gets longer chains
+		if ( !buckets && !table->size )
+			return 1;
+
+		if ( buckets )
+		{
+			for ( i = 0; i < table->size; i++ )
+			{
+				irc_hash_entry_t * e = table->buckets[i], * next;
+
+				for ( ; e; e = next )
+				{
+					next = e->next;
+					e->next = buckets[e->hash & (size - 1)];
+					buckets[e->hash & (size - 1)] = e;
+				}
+			}
+
+			free (table->buckets);
+			table->buckets = buckets;
+			table->size = size;
+		}
+	}
+
+	index = entry->hash & (table->size - 1);
+	entry->next = table->buckets[index];
+	table->buckets[index] = entry;
+	table->count++;
+	return 0;
+}
+
+
+static void libirc_hash_remove (irc_hash_table_t * table, irc_hash_entry_t * entry)
+{
+	irc_hash_entry_t ** e = table->buckets + (entry->hash & (table->size - 1));
+
+	while ( *e && *e != entry )
+		e = &(*e)->next;
+
+	if ( *e )
+	{
+		*e = entry->next;
+		table->count--;
+	}
+}
+
+
+static irc_state_string_t * libirc_state_intern (irc_session_t * session, const char * str, size_t length)
+{
+	irc_hash_table_t * table = &session->tracker.hosts;
+	unsigned int hash = libirc_state_hash (session, str, length, 0);
+	irc_state_string_t * s;
+	irc_hash_entry_t * e;
+
+	for ( e = table->size ? table->buckets[hash & (table->size - 1)] : 0; e; e = e->next )
+	{
+		s = (irc_state_string_t *) e;
+
+		if ( e->hash == hash && !strncmp (s->str, str, length) && s->str[length] == '\0' )
+		{
+			s->refs++;
+			return s;
+		}
+	}
+
+	if ( (s = malloc (offsetof(irc_state_string_t, str) + length + 1)) == 0 )
+		return 0;
+
+	s->entry.hash = hash;
+	s->refs = 1;
+	memcpy (s->str, str, length);
+	s->str[length] = '\0';
+
+	if ( libirc_hash_insert (table, &s->entry) )
+	{
+		free (s);
+		return 0;
+	}
+
+	return s;
+}
+
+
+static void libirc_state_release (irc_session_t * session, irc_state_string_t * s)
+{
+	if ( s && --s->refs == 0 )
+	{
+		libirc_hash_remove (&session->tracker.hosts, &s->entry);
+		free (s);
+	}
+}
+
+
+static irc_state_user_t * libirc_state_find_user (irc_session_t * session, const char * nick, size_t length)
+{
+	irc_hash_table_t * table = &session->tracker.users;
+	unsigned int hash = libirc_state_hash (session, nick, length, 1);
+	irc_hash_entry_t * e;
+
+	for ( e = table->size ? table->buckets[hash & (table->size - 1)] : 0; e; e = e->next )
+		if ( e->hash == hash && libirc_state_equal (session, ((irc_state_user_t *) e)->nick, nick, length) )
+			return (irc_state_user_t *) e;
+
+	return 0;
+}
+
+
+/*
+ * Finds the user, or creates it in no channels. A new user must be added
+ * to a channel, or freed by libirc_state_unused().
+ */
+static irc_state_user_t * libirc_state_add_user (irc_session_t * session, const char * nick, size_t length)
+{
+	irc_state_user_t * user = libirc_state_find_user (session, nick, length);
+
+	if ( user )
+		return user;
+
+	if ( (user = malloc (offsetof(irc_state_user_t, nick) + length + 1)) == 0 )
+		return 0;
+
+	user->entry.hash = libirc_state_hash (session, nick, length, 1);
+	user->channels = 0;
+	user->quitting = 0;
+	user->host = 0;
+	memcpy (user->nick, nick, length);
+	user->nick[length] = '\0';
+
+	if ( libirc_hash_insert (&session->tracker.users, &user->entry) )
+	{
+		free (user);
+		return 0;
+	}
+
+	return user;
+}
+
+
+static void libirc_state_unused (irc_session_t * session, irc_state_user_t * user)
+{
+	if ( user->channels == 0 )
+	{
+		libirc_hash_remove (&session->tracker.users, &user->entry);
+		libirc_state_release (session, user->host);
+		free (user);
+	}
+}
+
+
+static void libirc_state_set_host (irc_session_t * session, irc_state_user_t * user, const char * host, size_t length)
+{
+	irc_state_string_t * s;
+
+	if ( length == 0
+	|| (user->host && !strncmp (user->host->str, host, length) && user->host->str[length] == '\0') )
+		return;
+
+	// Without the memory the old host is kept
+	if ( (s = libirc_state_intern (session, host, length)) == 0 )
+		return;
+
+	libirc_state_release (session, user->host);
+	user->host = s;
+}
+
+
+static irc_state_channel_t * libirc_state_find_channel (irc_session_t * session, const char * name, size_t length)
+{
+	irc_hash_table_t * table = &session->tracker.channels;
+	unsigned int hash = libirc_state_hash (session, name, length, 1);
+	irc_hash_entry_t * e;
+
+	for ( e = table->size ? table->buckets[hash & (table->size - 1)] : 0; e; e = e->next )
+		if ( e->hash == hash && libirc_state_equal (session, ((irc_state_channel_t *) e)->name, name, length) )
+			return (irc_state_channel_t *) e;
+
+	return 0;
+}
+
+
+static irc_state_channel_t * libirc_state_add_channel (irc_session_t * session, const char * name, size_t length)
+{
+	irc_state_channel_t * ch = malloc (offsetof(irc_state_channel_t, name) + length + 1);
+
+	if ( !ch )
+		return 0;
+
+	memset (ch, 0, offsetof(irc_state_channel_t, name));
+	ch->entry.hash = libirc_state_hash (session, name, length, 1);
+	memcpy (ch->name, name, length);
+	ch->name[length] = '\0';
+
+	if ( libirc_hash_insert (&session->tracker.channels, &ch->entry) )
+	{
+		free (ch);
+		return 0;
+	}
+
+	return ch;
+}
+
+
+static inline unsigned int libirc_state_slot (const irc_state_channel_t * ch, const irc_state_user_t * user)
+{
+	return ((unsigned int) ((size_t) user >> 4) * 2654435761u) & (ch->size - 1);
+}
+
+
+static irc_state_member_t * libirc_state_find_member (const irc_state_channel_t * ch, const irc_state_user_t * user)
+{
+	unsigned int i;
+
+	if ( ch->size == 0 )
+		return 0;
+
+	for ( i = libirc_state_slot (ch, user); ch->members[i].user; i = (i + 1) & (ch->size - 1) )
+		if ( ch->members[i].user == user )
+			return ch->members + i;
+
+	return 0;
+}
+
+
+/*
+ * Adds the member to the channel table, which is kept at most 3/4 full.
+ * The user reference is not counted here.
+ */
+static irc_state_member_t * libirc_state_insert_member (irc_state_channel_t * ch, irc_state_user_t * user, unsigned int modes)
+{
+	unsigned int i;
+
+	if ( (ch->count + 1) * 4 > ch->size * 3 )
+	{
+		irc_state_member_t * old = ch->members;
+		unsigned int oldsize = ch->size, size = ch->size ? ch->size * 2 : 8;
+
+		if ( (ch->members = calloc (size, sizeof(irc_state_member_t))) == 0 )
+		{
+			ch->members = old;
+			return 0;
+		}
+
+		ch->size = size;
+
+		for ( i = 0; i < oldsize; i++ )
+		{
+			unsigned int j;
+
+			if ( !old[i].user )
+				continue;
+
+			for ( j = libirc_state_slot (ch, old[i].user); ch->members[j].user; j = (j + 1) & (size - 1) )
+				;
+
+			ch->members[j] = old[i];
+		}
+
+		free (old);
+	}
+
+	for ( i = libirc_state_slot (ch, user); ch->members[i].user; i = (i + 1) & (ch->size - 1) )
+		;
+
+	ch->members[i].user = user;
+	ch->members[i].modes = modes;
+	ch->count++;
+	return ch->members + i;
+}
+
+
+/*
+ * Removes the member from the channel table. The following members of the
+ * same probe sequence are shifted back, so no deleted marks are needed.
+ */
+static void libirc_state_delete_member (irc_state_channel_t * ch, irc_state_member_t * member)
+{
+	unsigned int mask = ch->size - 1, i = member - ch->members, j = i;
+
+	for ( ;; )
+	{
+		unsigned int k;
+
+		j = (j + 1) & mask;
+
+		if ( !ch->members[j].user )
+			break;
+
+		// The member stays if its home slot is cyclically within (i, j]
+		k = libirc_state_slot (ch, ch->members[j].user);
+
+		if ( i <= j ? (i < k && k <= j) : (i < k || k <= j) )
+			continue;
+
+		ch->members[i] = ch->members[j];
+		i = j;
+	}
+
+	ch->members[i].user = 0;
+	ch->members[i].modes = 0;
+	ch->count--;
+}
+
+
+static void libirc_state_join_member (irc_session_t * session, irc_state_channel_t * ch, irc_state_user_t * user, unsigned int modes)
+{
+	irc_state_member_t * member = libirc_state_find_member (ch, user);
+
+	if ( member )
+		member->modes = modes;
+	else if ( libirc_state_insert_member (ch, user, modes) )
+		user->channels++;
+}
+
+
+static void libirc_state_part_member (irc_session_t * session, irc_state_channel_t * ch, irc_state_user_t * user)
+{
+	irc_state_member_t * member = libirc_state_find_member (ch, user);
+
+	if ( member )
+	{
+		libirc_state_delete_member (ch, member);
+		user->channels--;
+		libirc_state_unused (session, user);
+	}
+}
+
+
+static void libirc_state_free_channel (irc_session_t * session, irc_state_channel_t * ch)
+{
+	unsigned int i;
+
+	for ( i = 0; i < ch->size; i++ )
+	{
+		irc_state_user_t * user = ch->members[i].user;
+
+		if ( user )
+		{
+			user->channels--;
+			libirc_state_unused (session, user);
+		}
+	}
+
+	libirc_hash_remove (&session->tracker.channels, &ch->entry);
+	free (ch->members);
+	free (ch);
+}
+
+
+static unsigned int libirc_state_mode_bit (char mode)
+{
+	switch (mode)
+	{
+	case 'q':	return LIBIRC_MEMBER_OWNER;
+	case 'a':	return LIBIRC_MEMBER_ADMIN;
+	case 'o':	return LIBIRC_MEMBER_OP;
+	case 'h':	return LIBIRC_MEMBER_HALFOP;
+	case 'v':	return LIBIRC_MEMBER_VOICE;
+	}
+
+	return 0;
+}
+
+
+static void libirc_state_init (irc_session_t * session)
+{
+	strcpy (session->tracker.prefix_modes, "qaohv");
+	strcpy (session->tracker.prefix_symbols, "~&@%+");
+	strcpy (session->tracker.chanmodes_always, "beIk");
+	strcpy (session->tracker.chanmodes_set, "l");
+}
+
+
+static void libirc_hash_rekey (irc_session_t * session, irc_hash_table_t * table, size_t keyoffset)
+{
+	irc_hash_entry_t * list = 0, * e, * next;
+	unsigned int i;
+
+	for ( i = 0; i < table->size; i++ )
+	{
+		for ( e = table->buckets[i]; e; e = next )
+		{
+			next = e->next;
+			e->next = list;
+			list = e;
+		}
+
+		table->buckets[i] = 0;
+	}
+
+	// The table does not grow, so the inserts do not fail
+	table->count = 0;
+
+	for ( e = list; e; e = next )
+	{
+		const char * key = (const char *) e + keyoffset;
+
+		next = e->next;
+		e->hash = libirc_state_hash (session, key, strlen (key), 1);
+		libirc_hash_insert (table, e);
+	}
+}
+
+
+/*
+ * Hashes the channels and users again when the CASEMAPPING changes. The
+ * names which become equal stay as they are; only one of them is found.
+ */
+static void libirc_state_rehash (irc_session_t * session)
+{
+	libirc_mutex_lock (&session->mutex_state);
+	libirc_hash_rekey (session, &session->tracker.channels, offsetof(irc_state_channel_t, name));
+	libirc_hash_rekey (session, &session->tracker.users, offsetof(irc_state_user_t, nick));
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+/*
+ * Forgets all the channels and users, when the session is reconnected or
+ * destroyed. The channels hold the users, and the users hold the hosts.
+ */
+static void libirc_state_clear (irc_session_t * session)
+{
+	unsigned int i;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	for ( i = 0; i < session->tracker.channels.size; i++ )
+		while ( session->tracker.channels.buckets[i] )
+			libirc_state_free_channel (session, (irc_state_channel_t *) session->tracker.channels.buckets[i]);
+
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+static void libirc_state_free (irc_session_t * session)
+{
+	libirc_state_clear (session);
+
+	free (session->tracker.channels.buckets);
+	free (session->tracker.users.buckets);
+	free (session->tracker.hosts.buckets);
+	memset (&session->tracker.channels, 0, sizeof(irc_hash_table_t));
+	memset (&session->tracker.users, 0, sizeof(irc_hash_table_t));
+	memset (&session->tracker.hosts, 0, sizeof(irc_hash_table_t));
+}
+
+
+/*
+ * JOIN: our own join starts tracking the channel, the other joins add the
+ * members. Called before the event, so the event sees the new member. The
+ * userhost is the part cut from the origin by LIBIRC_OPTION_STRIPNICKS.
+ */
+static void libirc_state_join (irc_session_t * session, const char * origin, const char * userhost, const char ** params, unsigned int count)
+{
+	irc_state_channel_t * ch;
+	irc_state_user_t * user;
+	size_t nicklen, namelen;
+
+	if ( !LIBIRC_STATE_TRACKED(session) || !origin || count < 1 )
+		return;
+
+	nicklen = strcspn (origin, "!");
+	namelen = strlen (params[0]);
+
+	if ( origin[nicklen] == '!' )
+		userhost = origin + nicklen + 1;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( libirc_is_me_n (session, origin, nicklen) )
+	{
+		// A channel we thought we were in is started over
+		if ( (ch = libirc_state_find_channel (session, params[0], namelen)) != 0 )
+			libirc_state_free_channel (session, ch);
+
+		ch = libirc_state_add_channel (session, params[0], namelen);
+	}
+	else
+		ch = libirc_state_find_channel (session, params[0], namelen);
+
+	if ( ch && (user = libirc_state_add_user (session, origin, nicklen)) != 0 )
+	{
+		if ( userhost )
+			libirc_state_set_host (session, user, userhost, strlen (userhost));
+
+		if ( !libirc_state_find_member (ch, user) )
+			libirc_state_join_member (session, ch, user, 0);
+
+		libirc_state_unused (session, user);
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+/*
+ * PART and KICK: the member leaves the channel, and our own leave stops
+ * tracking it. Called after the event, so the event still sees the member.
+ */
+static void libirc_state_leave (irc_session_t * session, const char * channel, const char * nick, size_t nicklen)
+{
+	irc_state_channel_t * ch;
+	irc_state_user_t * user;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (ch = libirc_state_find_channel (session, channel, strlen (channel))) != 0 )
+	{
+		if ( libirc_is_me_n (session, nick, nicklen) )
+			libirc_state_free_channel (session, ch);
+		else if ( (user = libirc_state_find_user (session, nick, nicklen)) != 0 )
+			libirc_state_part_member (session, ch, user);
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+static void libirc_state_part (irc_session_t * session, const char * origin, const char ** params, unsigned int count)
+{
+	if ( LIBIRC_STATE_TRACKED(session) && origin && count > 0 )
+		libirc_state_leave (session, params[0], origin, strcspn (origin, "!"));
+}
+
+
+static void libirc_state_kick (irc_session_t * session, const char ** params, unsigned int count)
+{
+	if ( LIBIRC_STATE_TRACKED(session) && count > 1 )
+		libirc_state_leave (session, params[0], params[1], strlen (params[1]));
+}
+
+
+/*
+ * QUIT: the user leaves all the channels. Called after the event.
+ */
+static void libirc_state_quit (irc_session_t * session, const char * origin)
+{
+	irc_state_user_t * user;
+	unsigned int i, left;
+
+	if ( !LIBIRC_STATE_TRACKED(session) || !origin )
+		return;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (user = libirc_state_find_user (session, origin, strcspn (origin, "!"))) != 0 )
+	{
+		// The user is freed when it leaves the last channel
+		left = user->channels;
+
+		for ( i = 0; i < session->tracker.channels.size && left > 0; i++ )
+		{
+			irc_hash_entry_t * e, * next;
+
+			for ( e = session->tracker.channels.buckets[i]; e && left > 0; e = next )
+			{
+				irc_state_channel_t * ch = (irc_state_channel_t *) e;
+				irc_state_member_t * member = libirc_state_find_member (ch, user);
+
+				next = e->next;
+
+				if ( member )
+				{
+					left--;
+					libirc_state_part_member (session, ch, user);
+				}
+			}
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+/*
+ * QUIT of many users at once, as in a netsplit: every channel is walked
+ * once for all of them, instead of once for each.
+ */
+static void libirc_state_quit_many (irc_session_t * session, const char ** origins, unsigned int count)
+{
+	irc_state_user_t ** users;
+	unsigned int i, j, marked = 0;
+
+	if ( !LIBIRC_STATE_TRACKED(session) || count == 0 )
+		return;
+
+	// Without the memory the users leave one by one
+	if ( (users = malloc (count * sizeof(irc_state_user_t *))) == 0 )
+	{
+		for ( i = 0; i < count; i++ )
+			libirc_state_quit (session, origins[i]);
+
+		return;
+	}
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	for ( i = 0; i < count; i++ )
+	{
+		irc_state_user_t * user = libirc_state_find_user (session, origins[i], strcspn (origins[i], "!"));
+
+		if ( user && !user->quitting )
+		{
+			user->quitting = 1;
+			users[marked++] = user;
+		}
+	}
+
+	for ( i = 0; marked > 0 && i < session->tracker.channels.size; i++ )
+	{
+		irc_hash_entry_t * e;
+
+		for ( e = session->tracker.channels.buckets[i]; e; e = e->next )
+		{
+			irc_state_channel_t * ch = (irc_state_channel_t *) e;
+
+			// The member shifted back into the deleted slot is checked next
+			for ( j = 0; j < ch->size; )
+			{
+				irc_state_user_t * user = ch->members[j].user;
+
+				if ( user && user->quitting )
+				{
+					libirc_state_delete_member (ch, ch->members + j);
+					user->channels--;
+				}
+				else
+					j++;
+			}
+		}
+	}
+
+	for ( i = 0; i < marked; i++ )
+	{
+		users[i]->quitting = 0;
+		libirc_state_unused (session, users[i]);
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+	free (users);
+}
+
+
+/*
+ * NICK: the user gets a new nick, and so a new entry, which replaces the
+ * old one in all its channels. Called before the event.
+ */
+static void libirc_state_nick (irc_session_t * session, const char * origin, const char ** params, unsigned int count)
+{
+	irc_state_user_t * user, * renamed;
+	size_t oldlen, newlen;
+	unsigned int i;
+
+	if ( !LIBIRC_STATE_TRACKED(session) || !origin || count < 1 )
+		return;
+
+	oldlen = strcspn (origin, "!");
+	newlen = strlen (params[0]);
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (user = libirc_state_find_user (session, origin, oldlen)) == 0 )
+		goto unlock;
+
+	// Only the case changes, so the key stays the same
+	if ( newlen == oldlen && libirc_state_equal (session, user->nick, params[0], newlen) )
+	{
+		memcpy (user->nick, params[0], newlen);
+		goto unlock;
+	}
+
+	// A stale user with the new nick is dropped from all the channels
+	if ( (renamed = libirc_state_find_user (session, params[0], newlen)) != 0 )
+	{
+		renamed->channels++;
+
+		for ( i = 0; i < session->tracker.channels.size; i++ )
+		{
+			irc_hash_entry_t * e;
+
+			for ( e = session->tracker.channels.buckets[i]; e; e = e->next )
+				libirc_state_part_member (session, (irc_state_channel_t *) e, renamed);
+		}
+
+		renamed->channels--;
+		libirc_state_unused (session, renamed);
+	}
+
+	if ( (renamed = malloc (offsetof(irc_state_user_t, nick) + newlen + 1)) == 0 )
+		goto unlock;
+
+	memcpy (renamed, user, offsetof(irc_state_user_t, nick));
+	renamed->entry.hash = libirc_state_hash (session, params[0], newlen, 1);
+	memcpy (renamed->nick, params[0], newlen);
+	renamed->nick[newlen] = '\0';
+
+	// The tables do not grow here, as an entry is removed before adding
+	for ( i = 0; i < session->tracker.channels.size; i++ )
+	{
+		irc_hash_entry_t * e;
+
+		for ( e = session->tracker.channels.buckets[i]; e; e = e->next )
+		{
+			irc_state_channel_t * ch = (irc_state_channel_t *) e;
+			irc_state_member_t * member = libirc_state_find_member (ch, user);
+
+			if ( member )
+			{
+				unsigned int modes = member->modes;
+
+				libirc_state_delete_member (ch, member);
+				libirc_state_insert_member (ch, renamed, modes);
+			}
+		}
+	}
+
+	libirc_hash_remove (&session->tracker.users, &user->entry);
+	libirc_hash_insert (&session->tracker.users, &renamed->entry);
+	free (user);
+
+unlock:
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+/*
+ * MODE on a tracked channel: the prefix modes change the member modes, and
+ * the parameters of the other modes are skipped.
+ */
+static void libirc_state_mode (irc_session_t * session, const char ** params, unsigned int count)
+{
+	irc_state_channel_t * ch;
+	const char * m;
+	unsigned int arg = 2;
+	int set = 1;
+
+	if ( !LIBIRC_STATE_TRACKED(session) || count < 2 )
+		return;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (ch = libirc_state_find_channel (session, params[0], strlen (params[0]))) != 0 )
+	{
+		for ( m = params[1]; *m; m++ )
+		{
+			if ( *m == '+' || *m == '-' )
+				set = *m == '+';
+			else if ( strchr (session->tracker.prefix_modes, *m) )
+			{
+				irc_state_user_t * user;
+				irc_state_member_t * member;
+
+				if ( arg >= count )
+					break;
+
+				user = libirc_state_find_user (session, params[arg], strlen (params[arg]));
+				arg++;
+
+				if ( user && (member = libirc_state_find_member (ch, user)) != 0 )
+				{
+					if ( set )
+						member->modes |= libirc_state_mode_bit (*m);
+					else
+						member->modes &= ~libirc_state_mode_bit (*m);
+				}
+			}
+			else if ( strchr (session->tracker.chanmodes_always, *m)
+			|| (set && strchr (session->tracker.chanmodes_set, *m)) )
+				arg++;
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+/*
+ * RPL_NAMREPLY: the members already in the channel when we join, with the
+ * prefixes of their modes (all of them with multi-prefix), and the hosts
+ * with userhost-in-names.
+ */
+static void libirc_state_names (irc_session_t * session, const char ** params, unsigned int count)
+{
+	irc_state_channel_t * ch;
+	const char * p;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (ch = libirc_state_find_channel (session, params[count-2], strlen (params[count-2]))) == 0 )
+		goto unlock;
+
+	for ( p = params[count-1]; *p; )
+	{
+		irc_state_user_t * user;
+		const char * symbol;
+		unsigned int modes = 0;
+		size_t nicklen;
+
+		if ( *p == ' ' )
+		{
+			p++;
+			continue;
+		}
+
+		while ( *p && (symbol = strchr (session->tracker.prefix_symbols, *p)) != 0 )
+		{
+			modes |= libirc_state_mode_bit (session->tracker.prefix_modes[symbol - session->tracker.prefix_symbols]);
+			p++;
+		}
+
+		nicklen = strcspn (p, "! ");
+
+		if ( nicklen > 0 && (user = libirc_state_add_user (session, p, nicklen)) != 0 )
+		{
+			if ( p[nicklen] == '!' )
+				libirc_state_set_host (session, user, p + nicklen + 1, strcspn (p + nicklen + 1, " "));
+
+			libirc_state_join_member (session, ch, user, modes);
+			libirc_state_unused (session, user);
+		}
+
+		p += strcspn (p, " ");
+	}
+
+unlock:
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+static void libirc_state_host (irc_session_t * session, const char * nick, const char * username, const char * host)
+{
+	irc_state_user_t * user;
+	char buf[512];
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (user = libirc_state_find_user (session, nick, strlen (nick))) != 0 )
+	{
+		snprintf (buf, sizeof(buf), "%s@%s", username, host);
+		libirc_state_set_host (session, user, buf, strlen (buf));
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+}
+
+
+/*
+ * The numeric replies: RPL_NAMREPLY (353), and RPL_WHOREPLY (352) for the
+ * hosts.
+ */
+static void libirc_state_numeric (irc_session_t * session, unsigned int code, const char ** params, unsigned int count)
+{
+	if ( !LIBIRC_STATE_TRACKED(session) )
+		return;
+
+	if ( code == 353 && count >= 3 )
+		libirc_state_names (session, params, count);
+	else if ( code == 352 && count >= 6 )
+		libirc_state_host (session, params[5], params[2], params[3]);
+}
+
+
+/*
+ * CHGHOST: the user or the host of the user changes.
+ */
+static void libirc_state_chghost (irc_session_t * session, const char * origin, const char ** params, unsigned int count)
+{
+	char nick[256];
+
+	if ( !LIBIRC_STATE_TRACKED(session) || !origin || count < 2 )
+		return;
+
+	irc_target_get_nick (origin, nick, sizeof(nick));
+	libirc_state_host (session, nick, params[0], params[1]);
+}
+
+
+int irc_state_is_member (irc_session_t * session, const char * channel, const char * nick, unsigned int * modes)
+{
+	irc_state_channel_t * ch;
+	irc_state_user_t * user;
+	irc_state_member_t * member = 0;
+
+	if ( !channel || !nick )
+		return 0;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (ch = libirc_state_find_channel (session, channel, strlen (channel))) != 0
+	&& (user = libirc_state_find_user (session, nick, strlen (nick))) != 0
+	&& (member = libirc_state_find_member (ch, user)) != 0
+	&& modes )
+		*modes = member->modes;
+
+	libirc_mutex_unlock (&session->mutex_state);
+	return member ? 1 : 0;
+}
+
+
+int irc_state_member_count (irc_session_t * session, const char * channel)
+{
+	irc_state_channel_t * ch;
+	int count = -1;
+
+	if ( !channel )
+		return -1;
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (ch = libirc_state_find_channel (session, channel, strlen (channel))) != 0 )
+		count = ch->count;
+
+	libirc_mutex_unlock (&session->mutex_state);
+	return count;
+}
+
+
+int irc_state_get_host (irc_session_t * session, const char * nick, char * host, size_t size)
+{
+	irc_state_user_t * user;
+	int rc = 1;
+
+	if ( !nick || !host || size == 0 )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (user = libirc_state_find_user (session, nick, strlen (nick))) != 0 && user->host )
+	{
+		size_t len = strlen (user->host->str);
+
+		if ( len > size - 1 )
+			len = size - 1;
+
+		memcpy (host, user->host->str, len);
+		host[len] = '\0';
+		rc = 0;
+	}
+	else
+		session->lasterror = LIBIRC_ERR_INVAL;
+
+	libirc_mutex_unlock (&session->mutex_state);
+	return rc;
+}
+
+
+int irc_state_members (irc_session_t * session, const char * channel, irc_state_member_callback_t callback, void * ctx)
+{
+	irc_state_channel_t * ch;
+	unsigned int i;
+
+	if ( !channel || !callback )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	if ( (ch = libirc_state_find_channel (session, channel, strlen (channel))) == 0 )
+	{
+		libirc_mutex_unlock (&session->mutex_state);
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	for ( i = 0; i < ch->size; i++ )
+	{
+		irc_state_user_t * user = ch->members[i].user;
+
+		if ( user )
+			(*callback) (session, ch->name, user->nick, user->host ? user->host->str : 0, ch->members[i].modes, ctx);
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+	return 0;
+}
+
+
+int irc_state_channels (irc_session_t * session, irc_state_channel_callback_t callback, void * ctx)
+{
+	unsigned int i;
+
+	if ( !callback )
+	{
+		session->lasterror = LIBIRC_ERR_INVAL;
+		return 1;
+	}
+
+	libirc_mutex_lock (&session->mutex_state);
+
+	for ( i = 0; i < session->tracker.channels.size; i++ )
+	{
+		irc_hash_entry_t * e;
+
+		for ( e = session->tracker.channels.buckets[i]; e; e = e->next )
+		{
+			irc_state_channel_t * ch = (irc_state_channel_t *) e;
+			(*callback) (session, ch->name, ch->count, ctx);
+		}
+	}
+
+	libirc_mutex_unlock (&session->mutex_state);
+	return 0;
+}
@@ -0,0 +1,105 @@
+/* 
+ * Copyright (C) 2004-2012 George Yunaev gyunaev@ulduzsoft.com
+ *
+ * This library is free software; you can redistribute it and/or modify it 
+ * under the terms of the GNU Lesser General Public License as published by 
+ * the Free Software Foundation; either version 3 of the License, or (at your 
+ * option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT 
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or 
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public 
+ * License for more details.
+ */
+
+#ifndef INCLUDE_IRC_STATE_H
+#define INCLUDE_IRC_STATE_H
+
+
+/*
+ * An entry of the chained hash tables. The entries are embedded as the
+ * first member of the channels, users and strings.
+ */
+typedef struct irc_hash_entry_s
+{
+	struct irc_hash_entry_s	* next;
+	unsigned int			hash;
+} irc_hash_entry_t;
+
+
+typedef struct
+{
+	irc_hash_entry_t ** buckets;
+	unsigned int		size;		/* power of two, or 0 */
+	unsigned int		count;
+} irc_hash_table_t;
+
+
+/*
+ * An interned string, shared by all its users. The hosts are kept this way,
+ * as the clones and the users of the same network share them.
+ */
+typedef struct
+{
+	irc_hash_entry_t	entry;
+	unsigned int		refs;
+	char				str[1];
+} irc_state_string_t;
+
+
+/*
+ * A user seen in the tracked channels, keyed by the case-folded nick. The
+ * user is freed when it leaves the last tracked channel.
+ */
+typedef struct
+{
+	irc_hash_entry_t	entry;
+	unsigned int		channels;	/* number of the tracked channels it is in */
+	unsigned int		quitting;	/* marked by libirc_state_quit_many() */
+	irc_state_string_t *	host;	/* user@host, or 0 if not known yet */
+	char				nick[1];
+} irc_state_user_t;
+
+
+/*
+ * A channel member: a slot of the open addressing table of the channel,
+ * keyed by the user pointer, so the nick changes do not move the members.
+ */
+typedef struct
+{
+	irc_state_user_t *	user;		/* 0 if the slot is free */
+	unsigned int		modes;		/* LIBIRC_MEMBER_* bits */
+} irc_state_member_t;
+
+
+/*
+ * A channel we are in, keyed by the case-folded name.
+ */
+typedef struct
+{
+	irc_hash_entry_t	entry;
+	irc_state_member_t *	members;
+	unsigned int		size;		/* power of two, or 0 */
+	unsigned int		count;
+	char				name[1];
+} irc_state_channel_t;
+
+
+/*
+ * The channel and user state tracker of a session. The prefix modes and
+ * the channel modes with parameters are the defaults of the most servers.
+ */
+typedef struct
+{
+	irc_hash_table_t	channels;
+	irc_hash_table_t	users;
+	irc_hash_table_t	hosts;
+
+	char				prefix_modes[16];		/* the modes of the nick prefixes, like "ov" */
+	char				prefix_symbols[16];		/* the prefixes themselves, like "@+" */
+	char				chanmodes_always[64];	/* the channel modes always with a parameter */
+	char				chanmodes_set[32];		/* the ones with a parameter only when set */
+} irc_state_t;
+
+
+#endif /* INCLUDE_IRC_STATE_H */
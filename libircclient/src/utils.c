@@ -59,24 +59,157 @@ static int libirc_findcrlf_offset(const char *buf, int offset, const int length)
 	return offset;
 }
 
-static int libirc_findcrorlf (char * buf, int length)
+/*
+ * Returns the length of the first line in the buffer, which is terminated
+ * by either CR or LF, or the buffer length if there is no terminator.
+ */
+static unsigned int libirc_find_eol (const char * buf, unsigned int length)
 {
-	int offset = 0;
+	unsigned int offset = 0;
+
 	for ( ; offset < length; offset++ ) 
 	{
 		if ( buf[offset] == 0x0D || buf[offset] == 0x0A )
+			break;
+	}
+
+	return offset;
+}
+
+
+/*
+ * Folds the case as the server CASEMAPPING does: the letters from 'A' up to
+ * casemap_upper are folded, which is 'Z' for ascii, ']' for strict-rfc1459
+ * and '^' for rfc1459, where []\~ are the upper case of {}|^.
+ */
+static inline unsigned char libirc_casefold (irc_session_t * session, unsigned char c)
+{
+	return c >= 'A' && c <= session->isupport.casemap_upper ? c + 32 : c;
+}
+
+
+/*
+ * Stores our nick together with its case-folded copy, in a single block.
+ */
+static int libirc_set_nick (irc_session_t * session, const char * nick)
+{
+	size_t length = strlen (nick), i;
+	char * buf = malloc (length * 2 + 2);
+
+	if ( !buf )
+		return 1;
+
+	memcpy (buf, nick, length + 1);
+
+	for ( i = 0; i <= length; i++ )
+		buf[length + 1 + i] = libirc_casefold (session, nick[i]);
+
+	if ( session->nick )
+		free (session->nick);
+
+	session->nick = buf;
+	session->nick_folded = buf + length + 1;
+	session->nick_length = length;
+	return 0;
+}
+
+
+/*
+ * Checks whether the nick of the specified length is ours.
+ */
+static int libirc_is_me_n (irc_session_t * session, const char * nick, size_t length)
+{
+	size_t i;
+
+	if ( !session->nick || length != session->nick_length )
+		return 0;
+
+	for ( i = 0; i < length; i++ )
+		if ( (char) libirc_casefold (session, nick[i]) != session->nick_folded[i] )
+			return 0;
+
+	return 1;
+}
+
+
+/*
+ * Same for a 0-terminated nick or message target, without measuring it.
+ */
+static int libirc_is_me (irc_session_t * session, const char * target)
+{
+	size_t i;
+
+	if ( !session->nick )
+		return 0;
+
+	// A shorter target fails on its terminator
+	for ( i = 0; i < session->nick_length; i++ )
+		if ( (char) libirc_casefold (session, target[i]) != session->nick_folded[i] )
+			return 0;
+
+	return target[i] == '\0';
+}
+
+
+/*
+ * Checks whether the message target is a channel by its first character.
+ */
+static int libirc_is_channel (irc_session_t * session, const char * target)
+{
+	return target[0] != '\0' && strchr (session->isupport.chantypes, target[0]) != 0;
+}
+
+
+/*
+ * Finds the tag in the tags of a message, and unescapes its value. Returns
+ * nonzero if there is no such tag.
+ */
+static int libirc_message_tag (const char * tag, const char * key, char * value, size_t size)
+{
+	size_t keylen = strlen (key);
+
+	// key=value;key;key=value, with the values escaped
+	while ( tag && *tag )
+	{
+		size_t length = strcspn (tag, "=;");
+
+		if ( length == keylen && !strncmp (tag, key, keylen) )
 		{
-			buf[offset++] = '\0';
+			const char * v = tag[length] == '=' ? tag + length + 1 : tag + length;
+			size_t used = 0;
 
-			if ( offset < (length - 1) 
-			&& (buf[offset] == 0x0D || buf[offset] == 0x0A) )
-				offset++;
+			for ( ; value && *v && *v != ';' && used + 1 < size; v++ )
+			{
+				if ( *v == '\\' && v[1] )
+				{
+					v++;
 
-			return offset;
+					switch (*v)
+					{
+					case ':':	value[used++] = ';'; break;
+					case 's':	value[used++] = ' '; break;
+					case 'r':	value[used++] = '\r'; break;
+					case 'n':	value[used++] = '\n'; break;
+					default:	value[used++] = *v; break;
+					}
+				}
+				else if ( *v != '\\' )
+					value[used++] = *v;
+			}
+
+			if ( value && size > 0 )
+				value[used] = '\0';
+
+			return 0;
 		}
+
+		tag += strcspn (tag, ";");
+
+		if ( *tag == ';' )
+			tag++;
 	}
 
-	return 0;
+	return 1;
 }
 
 